@@ -384,6 +384,7 @@ void cleanup_tap_devices(void)
                 rtdev->hard_start_xmit = tap_device[i].orig_xmit;
                 if (rtdev->features & NETIF_F_LLTX)
                     rtdev->start_xmit = tap_device[i].orig_xmit;
+                clear_bit(PRIV_FLAG_CAPTURED, &rtdev->priv_flags);
                 RTNET_MOD_DEC_USE_COUNT_EX(rtdev->rt_owner);
                 mutex_unlock(&rtdev->nrt_lock);
 
@@ -497,6 +498,9 @@ int __init rtcap_init(void)
             if (rtdev->features & NETIF_F_LLTX)
                 rtdev->start_xmit = rtdev->hard_start_xmit;
 
+            /* capture single frames, no large sends */
+            set_bit(PRIV_FLAG_CAPTURED, &rtdev->priv_flags);
+
             tap_device[i].present |= XMIT_HOOK;
             RTNET_MOD_INC_USE_COUNT_EX(rtdev->rt_owner);
 
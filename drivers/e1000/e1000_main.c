@@ -764,7 +764,7 @@ static int e1000_probe(struct pci_dev *pdev,
 	netdev->stop = &e1000_close;
 	netdev->hard_start_xmit = &e1000_xmit_frame;
 	// netdev->get_stats = &e1000_get_stats;
-	// netdev->set_multicast_list = &e1000_set_multi;
+	netdev->set_multicast_list = &e1000_set_multi;
 	// netdev->set_mac_address = &e1000_set_mac;
 	// netdev->change_mtu = &e1000_change_mtu;
 	// netdev->do_ioctl = &e1000_ioctl;
@@ -2050,7 +2050,9 @@ e1000_set_multi(struct rtnet_device *netdev)
 {
 	struct e1000_adapter *adapter = netdev->priv;
 	struct e1000_hw *hw = &adapter->hw;
+	struct rtdev_mc_list *mc_ptr;
 	uint32_t rctl;
+	uint32_t hash_value;
 	int i, rar_entries = E1000_RAR_ENTRIES;
 	int mta_reg_count = (hw->mac_type == e1000_ich8lan) ?
 				E1000_NUM_MTA_REGISTERS_ICH8LAN :
@@ -2089,11 +2091,18 @@ e1000_set_multi(struct rtnet_device *netdev)
 	 * -- with 82571 controllers only 0-13 entries are filled here
 	 */
 
+	mc_ptr = netdev->mc_list;
+
 	for (i = 1; i < rar_entries; i++) {
-		E1000_WRITE_REG_ARRAY(hw, RA, i << 1, 0);
-		E1000_WRITE_FLUSH(hw);
-		E1000_WRITE_REG_ARRAY(hw, RA, (i << 1) + 1, 0);
-		E1000_WRITE_FLUSH(hw);
+		if (mc_ptr) {
+			e1000_rar_set(hw, mc_ptr->dmi_addr, i);
+			mc_ptr = mc_ptr->next;
+		} else {
+			E1000_WRITE_REG_ARRAY(hw, RA, i << 1, 0);
+			E1000_WRITE_FLUSH(hw);
+			E1000_WRITE_REG_ARRAY(hw, RA, (i << 1) + 1, 0);
+			E1000_WRITE_FLUSH(hw);
+		}
 	}
 
 	/* clear the old settings from the multicast hash table */
@@ -2103,6 +2112,13 @@ e1000_set_multi(struct rtnet_device *netdev)
 		E1000_WRITE_FLUSH(hw);
 	}
 
+	/* load any remaining addresses into the hash table */
+
+	for (; mc_ptr; mc_ptr = mc_ptr->next) {
+		hash_value = e1000_hash_mc_addr(hw, mc_ptr->dmi_addr);
+		e1000_mta_set(hw, hash_value);
+	}
+
 	if (hw->mac_type == e1000_82542_rev2_0)
 		e1000_leave_82542_rst(adapter);
 }
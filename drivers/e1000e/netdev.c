@@ -2179,7 +2179,10 @@ static void e1000_set_multi(struct rtnet_device *netdev)
 {
 	struct e1000_adapter *adapter = netdev->priv;
 	struct e1000_hw *hw = &adapter->hw;
+	struct rtdev_mc_list *mc_ptr;
+	u8  *mta_list;
 	u32 rctl;
+	int i;
 
 	/* Check for Promiscuous and All Multicast modes */
 
@@ -2202,7 +2205,31 @@ static void e1000_set_multi(struct rtnet_device *netdev)
 
 	ew32(RCTL, rctl);
 
-	e1000_update_mc_addr_list(hw, NULL, 0);
+	if (netdev->mc_count) {
+		mta_list = kmalloc(netdev->mc_count * 6, GFP_ATOMIC);
+		if (!mta_list)
+			return;
+
+		/* prepare a packed array of only addresses. */
+		mc_ptr = netdev->mc_list;
+
+		for (i = 0; i < netdev->mc_count; i++) {
+			if (!mc_ptr)
+				break;
+			memcpy(mta_list + (i * ETH_ALEN), mc_ptr->dmi_addr,
+			       ETH_ALEN);
+			mc_ptr = mc_ptr->next;
+		}
+
+		e1000_update_mc_addr_list(hw, mta_list, i);
+		kfree(mta_list);
+	} else {
+		/*
+		 * if we're called from probe, we might not have
+		 * anything to do here, so clear out the list
+		 */
+		e1000_update_mc_addr_list(hw, NULL, 0);
+	}
 
 	if (netdev->features & NETIF_F_HW_VLAN_CTAG_RX)
 		e1000e_vlan_strip_enable(adapter);
@@ -3267,30 +3294,111 @@ link_up:
 #define E1000_MAX_PER_TXD	8192
 #define E1000_MAX_TXD_PWR	12
 
-static int e1000_tx_map(struct e1000_adapter *adapter,
-			struct rtskb *skb, unsigned int first)
+/*
+ * large sends are TCP over IPv4 rtskb chains, the first rtskb holds all
+ * headers, the stack left the TCP pseudo header sum without the length
+ */
+static int e1000_tso(struct e1000_adapter *adapter, struct rtskb *skb)
 {
 	struct e1000_ring *tx_ring = adapter->tx_ring;
+	struct e1000_context_desc *context_desc;
 	struct e1000_buffer *buffer_info;
-	unsigned int offset = 0, size, i;
+	struct iphdr *iph = skb->nh.iph;
+	unsigned int i;
+	u32 cmd_length = 0;
+	u16 ipcse, tucse, mss;
+	u8 ipcss, ipcso, tucss, tucso, hdr_len;
+
+	hdr_len = skb->h.raw - skb->data + (skb->h.th->doff << 2);
+	mss = skb->gso_size;
+
+	/* the device fills in length and checksum of each frame */
+	iph->tot_len = 0;
+	iph->check = 0;
+	cmd_length = E1000_TXD_CMD_IP;
+	ipcse = skb->h.raw - skb->data - 1;
+	ipcss = skb->nh.raw - skb->data;
+	ipcso = (u8 *)&iph->check - skb->data;
+	tucss = skb->h.raw - skb->data;
+	tucso = (u8 *)&skb->h.th->check - skb->data;
+	tucse = 0;
+
+	cmd_length |= (E1000_TXD_CMD_DEXT | E1000_TXD_CMD_TSE |
+		       E1000_TXD_CMD_TCP |
+		       (rtskb_chain_data_len(skb) - hdr_len));
 
 	i = tx_ring->next_to_use;
-
+	context_desc = E1000_CONTEXT_DESC(*tx_ring, i);
 	buffer_info = &tx_ring->buffer_info[i];
-	size = skb->len;
 
-	buffer_info->length = size;
+	context_desc->lower_setup.ip_fields.ipcss  = ipcss;
+	context_desc->lower_setup.ip_fields.ipcso  = ipcso;
+	context_desc->lower_setup.ip_fields.ipcse  = cpu_to_le16(ipcse);
+	context_desc->upper_setup.tcp_fields.tucss = tucss;
+	context_desc->upper_setup.tcp_fields.tucso = tucso;
+	context_desc->upper_setup.tcp_fields.tucse = cpu_to_le16(tucse);
+	context_desc->tcp_seg_setup.fields.mss     = cpu_to_le16(mss);
+	context_desc->tcp_seg_setup.fields.hdr_len = hdr_len;
+	context_desc->cmd_and_length = cpu_to_le32(cmd_length);
+
 	buffer_info->time_stamp = jiffies;
 	buffer_info->next_to_watch = i;
-	buffer_info->dma = rtskb_data_dma_addr(skb, offset);
-	buffer_info->mapped_as_page = false;
+
+	i++;
+	if (i == tx_ring->count)
+		i = 0;
+	tx_ring->next_to_use = i;
+
+	return 1;
+}
+
+static int e1000_tx_map(struct e1000_adapter *adapter,
+			struct rtskb *skb, unsigned int first)
+{
+	struct e1000_ring *tx_ring = adapter->tx_ring;
+	struct e1000_buffer *buffer_info;
+	struct rtskb *frag = skb;
+	unsigned int offset = 0, size, i, count = 0;
+	unsigned int bytecount = 0, segs = 1, hdr_len;
+
+	i = tx_ring->next_to_use;
+
+	/* one descriptor per rtskb, large sends are chains */
+	while (1) {
+		buffer_info = &tx_ring->buffer_info[i];
+		size = frag->len;
+
+		buffer_info->length = size;
+		buffer_info->time_stamp = jiffies;
+		buffer_info->next_to_watch = i;
+		buffer_info->dma = rtskb_data_dma_addr(frag, offset);
+		buffer_info->mapped_as_page = false;
+
+		bytecount += size;
+		count++;
+
+		if (frag == skb->chain_end)
+			break;
+		frag = frag->next;
+
+		i++;
+		if (i == tx_ring->count)
+			i = 0;
+	}
+
+	if (skb->gso_size) {
+		/* multiply data chunks by size of headers */
+		hdr_len = skb->h.raw - skb->data + (skb->h.th->doff << 2);
+		segs = DIV_ROUND_UP(bytecount - hdr_len, skb->gso_size);
+		bytecount += (segs - 1) * hdr_len;
+	}
 
 	tx_ring->buffer_info[i].skb = skb;
-	tx_ring->buffer_info[i].segs = 1;
-	tx_ring->buffer_info[i].bytecount = size;
+	tx_ring->buffer_info[i].segs = segs;
+	tx_ring->buffer_info[i].bytecount = bytecount;
 	tx_ring->buffer_info[first].next_to_watch = i;
 
-	return 1;
+	return count;
 }
 
 static void e1000_tx_queue(struct e1000_adapter *adapter,
@@ -3302,6 +3410,15 @@ static void e1000_tx_queue(struct e1000_adapter *adapter,
 	u32 txd_upper = 0, txd_lower = E1000_TXD_CMD_IFCS;
 	unsigned int i;
 
+	if (tx_flags & E1000_TX_FLAGS_TSO) {
+		txd_lower |= E1000_TXD_CMD_DEXT | E1000_TXD_DTYP_D |
+			     E1000_TXD_CMD_TSE;
+		txd_upper |= E1000_TXD_POPTS_TXSM << 8;
+
+		if (tx_flags & E1000_TX_FLAGS_IPV4)
+			txd_upper |= E1000_TXD_POPTS_IXSM << 8;
+	}
+
 	if (tx_flags & E1000_TX_FLAGS_CSUM) {
 		txd_lower |= E1000_TXD_CMD_DEXT | E1000_TXD_DTYP_D;
 		txd_upper |= E1000_TXD_POPTS_TXSM << 8;
@@ -3391,6 +3508,7 @@ static int e1000_xmit_frame(struct rtskb *skb, struct rtnet_device *netdev)
 	rtdm_lockctx_t context;
 	unsigned int first;
 	unsigned int tx_flags = 0;
+	struct rtskb *frag;
 	int count = 0;
 
 	if (test_bit(__E1000_DOWN, &adapter->state)) {
@@ -3403,17 +3521,29 @@ static int e1000_xmit_frame(struct rtskb *skb, struct rtnet_device *netdev)
 		return NETDEV_TX_OK;
 	}
 
+	/* one descriptor per rtskb of the chain */
+	for (frag = skb; frag != skb->chain_end; frag = frag->next)
+		count++;
 	count++;
 
-	count += skb->len;
-
 	if (adapter->hw.mac.tx_pkt_filtering)
 		e1000_transfer_dhcp_info(adapter, skb);
 
 	rtdm_lock_get_irqsave(&tx_ring->lock, context);
 
+	/* + 1 context descriptor, + 1 gap to keep tail from touching head */
+	if (e1000_desc_unused(tx_ring) < count + 2) {
+		rtdm_lock_put_irqrestore(&tx_ring->lock, context);
+		return NETDEV_TX_BUSY;
+	}
+
 	first = tx_ring->next_to_use;
 
+	if (skb->gso_size) {
+		tx_flags |= E1000_TX_FLAGS_TSO | E1000_TX_FLAGS_IPV4;
+		e1000_tso(adapter, skb);
+	}
+
 	if (skb->xmit_stamp)
 		*skb->xmit_stamp =
 			cpu_to_be64(rtdm_clock_read() + *skb->xmit_stamp);
@@ -4057,6 +4187,7 @@ static int e1000_probe(struct pci_dev *pdev,
 	netdev->open = e1000_open;
 	netdev->stop = e1000_close;
 	netdev->hard_start_xmit = e1000_xmit_frame;
+	netdev->set_multicast_list = e1000_set_multi;
         //netdev->get_stats = e1000_get_stats;
 	netdev->map_rtskb = e1000_map_rtskb;
 	netdev->unmap_rtskb = e1000_unmap_rtskb;
@@ -52,11 +52,6 @@
 #include <rtnet_port.h>
 
 // RTNET redefines
-#ifdef  NETIF_F_TSO
-#undef  NETIF_F_TSO
-#define NETIF_F_TSO 0
-#endif
-
 #ifdef  NETIF_F_TSO6
 #undef  NETIF_F_TSO6
 #define NETIF_F_TSO6 0
@@ -1218,9 +1213,9 @@ static int igb_probe(struct pci_dev *pdev,
 	netdev->get_stats = igb_get_stats;
 	netdev->map_rtskb = igb_map_rtskb;
 	netdev->unmap_rtskb = igb_unmap_rtskb;
+	netdev->set_multicast_list = igb_set_multi;
 #if 0
 	netdev->do_ioctl = igb_ioctl;
-	netdev->set_multicast_list = igb_set_multi;
 	netdev->set_mac_address = igb_set_mac;
 	netdev->change_mtu = igb_change_mtu;
 
@@ -1288,11 +1283,8 @@ static int igb_probe(struct pci_dev *pdev,
 			"PHY reset is blocked due to SOL/IDER session.\n");
 
 	netdev->features = NETIF_F_SG | NETIF_F_HW_CSUM;
-	// no TSO support for now
-	/*
+	/* large TCP sends over IPv4 as rtskb chains, no TSO6 */
 	netdev->features |= NETIF_F_TSO;
-	netdev->features |= NETIF_F_TSO6;
-	*/
 
 #ifdef CONFIG_IGB_LRO
 	netdev->features |= NETIF_F_LRO;
@@ -2358,7 +2350,10 @@ static void igb_set_multi(struct rtnet_device *netdev)
 	struct igb_adapter *adapter = netdev->priv;
 	struct e1000_hw *hw = &adapter->hw;
 	struct e1000_mac_info *mac = &hw->mac;
+	struct rtdev_mc_list *mc_ptr;
+	u8  *mta_list;
 	u32 rctl;
+	int i;
 
 	/* Check for Promiscuous and All Multicast modes */
 
@@ -2377,8 +2372,28 @@ static void igb_set_multi(struct rtnet_device *netdev)
 	}
 	wr32(E1000_RCTL, rctl);
 
-	/* nothing to program, so clear mc list */
-	igb_update_mc_addr_list_82575(hw, NULL, 0, 1, mac->rar_entry_count);
+	if (!netdev->mc_count) {
+		/* nothing to program, so clear mc list */
+		igb_update_mc_addr_list_82575(hw, NULL, 0, 1,
+					      mac->rar_entry_count);
+		return;
+	}
+
+	mta_list = kzalloc(netdev->mc_count * 6, GFP_ATOMIC);
+	if (!mta_list)
+		return;
+
+	/* The shared function expects a packed array of only addresses. */
+	mc_ptr = netdev->mc_list;
+
+	for (i = 0; i < netdev->mc_count; i++) {
+		if (!mc_ptr)
+			break;
+		memcpy(mta_list + (i*ETH_ALEN), mc_ptr->dmi_addr, ETH_ALEN);
+		mc_ptr = mc_ptr->next;
+	}
+	igb_update_mc_addr_list_82575(hw, mta_list, i, 1, mac->rar_entry_count);
+	kfree(mta_list);
 }
 
 /* Need to wait a few seconds after link up to get diagnostic information from
@@ -2755,44 +2770,27 @@ set_itr_now:
 #define IGB_TX_FLAGS_VLAN_MASK	0xffff0000
 #define IGB_TX_FLAGS_VLAN_SHIFT	16
 
-#if NETIF_F_TSO
+/* headers of a large send are all in the first rtskb of the chain */
 static inline int igb_tso_adv(struct igb_adapter *adapter,
 			      struct igb_ring *tx_ring,
 			      struct rtskb *skb, u32 tx_flags, u8 *hdr_len)
 {
 	struct e1000_adv_tx_context_desc *context_desc;
 	unsigned int i;
-	int err;
 	struct igb_buffer *buffer_info;
+	struct iphdr *iph = skb->nh.iph;
 	u32 info = 0, tu_cmd = 0;
 	u32 mss_l4len_idx, l4len;
 	*hdr_len = 0;
 
-	if (skb_header_cloned(skb)) {
-		err = pskb_expand_head(skb, 0, 0, GFP_ATOMIC);
-		if (err)
-			return err;
-	}
-
-	l4len = tcp_hdrlen(skb);
+	l4len = skb->h.th->doff << 2;
 	*hdr_len += l4len;
 
-	if (skb->protocol == htons(ETH_P_IP)) {
-		struct iphdr *iph = ip_hdr(skb);
-		iph->tot_len = 0;
-		iph->check = 0;
-		tcp_hdr(skb)->check = ~csum_tcpudp_magic(iph->saddr,
-							 iph->daddr, 0,
-							 IPPROTO_TCP,
-							 0);
-#if NETIF_F_TSO6
-	} else if (skb_shinfo(skb)->gso_type == SKB_GSO_TCPV6) {
-		ipv6_hdr(skb)->payload_len = 0;
-		tcp_hdr(skb)->check = ~csum_ipv6_magic(&ipv6_hdr(skb)->saddr,
-						       &ipv6_hdr(skb)->daddr,
-						       0, IPPROTO_TCP, 0);
-	}
-#endif
+	/* the device fills in the IP length and checksum of each frame, the
+	 * stack left the TCP pseudo header sum without the length */
+	iph->tot_len = 0;
+	iph->check = 0;
+
 	i = tx_ring->next_to_use;
 
 	buffer_info = &tx_ring->buffer_info[i];
@@ -2800,23 +2798,21 @@ static inline int igb_tso_adv(struct igb_adapter *adapter,
 	/* VLAN MACLEN IPLEN */
 	if (tx_flags & IGB_TX_FLAGS_VLAN)
 		info |= (tx_flags & IGB_TX_FLAGS_VLAN_MASK);
-	info |= (skb_network_offset(skb) << E1000_ADVTXD_MACLEN_SHIFT);
-	*hdr_len += skb_network_offset(skb);
-	info |= skb_network_header_len(skb);
-	*hdr_len += skb_network_header_len(skb);
+	info |= ((skb->nh.raw - skb->data) << E1000_ADVTXD_MACLEN_SHIFT);
+	*hdr_len += skb->nh.raw - skb->data;
+	info |= iph->ihl << 2;
+	*hdr_len += iph->ihl << 2;
 	context_desc->vlan_macip_lens = cpu_to_le32(info);
 
 	/* ADV DTYP TUCMD MKRLOC/ISCSIHEDLEN */
 	tu_cmd |= (E1000_TXD_CMD_DEXT | E1000_ADVTXD_DTYP_CTXT);
-
-	if (skb->protocol == htons(ETH_P_IP))
-		tu_cmd |= E1000_ADVTXD_TUCMD_IPV4;
+	tu_cmd |= E1000_ADVTXD_TUCMD_IPV4;
 	tu_cmd |= E1000_ADVTXD_TUCMD_L4T_TCP;
 
 	context_desc->type_tucmd_mlhl = cpu_to_le32(tu_cmd);
 
 	/* MSS L4LEN IDX */
-	mss_l4len_idx = (skb_shinfo(skb)->gso_size << E1000_ADVTXD_MSS_SHIFT);
+	mss_l4len_idx = (skb->gso_size << E1000_ADVTXD_MSS_SHIFT);
 	mss_l4len_idx |= (l4len << E1000_ADVTXD_L4LEN_SHIFT);
 
 	/* Context index must be unique per ring. */
@@ -2837,7 +2833,6 @@ static inline int igb_tso_adv(struct igb_adapter *adapter,
 
 	return true;
 }
-#endif
 
 static inline bool igb_tx_csum_adv(struct igb_adapter *adapter,
 					struct igb_ring *tx_ring,
@@ -2853,7 +2848,8 @@ static int igb_tx_map_adv(struct igb_adapter *adapter, struct igb_ring *tx_ring,
 			  struct rtskb *skb, unsigned int first)
 {
 	struct igb_buffer *buffer_info;
-	unsigned int len = skb->len;
+	struct rtskb *frag = skb;
+	unsigned int len;
 	unsigned int count = 0, i;
 #ifdef IGB_FRAMES_SUPPORT
 	unsigned int f;
@@ -2861,17 +2857,25 @@ static int igb_tx_map_adv(struct igb_adapter *adapter, struct igb_ring *tx_ring,
 
 	i = tx_ring->next_to_use;
 
-	buffer_info = &tx_ring->buffer_info[i];
-	BUG_ON(len >= IGB_MAX_DATA_PER_TXD);
-	buffer_info->length = len;
-	/* set time_stamp *before* dma to help avoid a possible race */
-	buffer_info->time_stamp = jiffies;
-	buffer_info->next_to_watch = i;
-	buffer_info->dma = rtskb_data_dma_addr(skb, 0);
-	count++;
-	i++;
-	if (i == tx_ring->count)
-		i = 0;
+	/* one descriptor per rtskb, large sends are chains */
+	while (1) {
+		len = frag->len;
+		buffer_info = &tx_ring->buffer_info[i];
+		BUG_ON(len >= IGB_MAX_DATA_PER_TXD);
+		buffer_info->length = len;
+		/* set time_stamp *before* dma to help avoid a possible race */
+		buffer_info->time_stamp = jiffies;
+		buffer_info->next_to_watch = i;
+		buffer_info->dma = rtskb_data_dma_addr(frag, 0);
+		count++;
+		i++;
+		if (i == tx_ring->count)
+			i = 0;
+
+		if (frag == skb->chain_end)
+			break;
+		frag = frag->next;
+	}
 
 	/* No frames in RTNet on driver level */
 #ifdef IGB_FRAMES_SUPPORT
@@ -3014,15 +3018,16 @@ static int igb_xmit_frame_ring_adv(struct rtskb *skb,
 	struct igb_adapter *adapter = netdev->priv;
 	unsigned int first;
 	unsigned int tx_flags = 0;
-	unsigned int len = skb->len;
+	unsigned int len = rtskb_chain_data_len(skb);
+	unsigned int nr_bufs = 1;
+	struct rtskb *frag;
 	u8 hdr_len = 0;
 	rtdm_lockctx_t context;
 	int count;
-
-#if NETIF_F_TSO
 	int tso = 0;
-#endif
-	// len -= skb->data_len;
+
+	for (frag = skb; frag != skb->chain_end; frag = frag->next)
+		nr_bufs++;
 
 	if (test_bit(__IGB_DOWN, &adapter->state)) {
 		kfree_rtskb(skb);
@@ -3036,15 +3041,12 @@ static int igb_xmit_frame_ring_adv(struct rtskb *skb,
 
 	rtdm_lock_get_irqsave(&tx_ring->lock, context);
 
-	/* need: 1 descriptor per page,
+	/* need: 1 descriptor per rtskb of the chain,
 	 *       + 2 desc gap to keep tail from touching head,
-	 *       + 1 desc for skb->data,
 	 *       + 1 desc for context descriptor,
+	 *       + 1 spare,
 	 * otherwise try next time */
-
-	// fragmentation is done in IP stack
-	// if (igb_maybe_stop_tx(netdev, tx_ring, skb_shinfo(skb)->nr_frags + 4)) {
-	if (igb_maybe_stop_tx(netdev, tx_ring, MAX_SKB_FRAGS + 4)) {
+	if (igb_maybe_stop_tx(netdev, tx_ring, nr_bufs + 4)) {
 		/* this is a hard error */
 	        rtdm_lock_put_irqrestore(&tx_ring->lock, context);
 		return NETDEV_TX_BUSY;
@@ -3059,20 +3061,15 @@ static int igb_xmit_frame_ring_adv(struct rtskb *skb,
 	if (skb->xmit_stamp)
 	    *skb->xmit_stamp = cpu_to_be64(rtdm_clock_read() + *skb->xmit_stamp);
 
-#if NETIF_F_TSO
-	tso = skb_is_gso(skb) ? igb_tso_adv(adapter, tx_ring, skb, tx_flags,
-					      &hdr_len) : 0;
-
-	if (tso < 0) {
-		kfree_rtskb(skb);
-		rtdm_lock_put_irqrestore(&tx_ring->lock, context);
-		return NETDEV_TX_OK;
+	/* large sends are TCP over IPv4 only */
+	if (skb->gso_size) {
+		tx_flags |= IGB_TX_FLAGS_IPV4;
+		tso = igb_tso_adv(adapter, tx_ring, skb, tx_flags, &hdr_len);
 	}
 
 	if (tso)
 		tx_flags |= IGB_TX_FLAGS_TSO;
 	else
-#endif
 	    if (igb_tx_csum_adv(adapter, tx_ring, skb, tx_flags))
 			if (skb->ip_summed == CHECKSUM_PARTIAL)
 				tx_flags |= IGB_TX_FLAGS_CSUM;
@@ -3775,18 +3772,20 @@ static bool igb_clean_tx_irq(struct igb_ring *tx_ring)
 			skb = buffer_info->skb;
 
 			if (skb) {
-#if NETIF_F_TSO
-				unsigned int segs, bytecount;
-				/* gso_segs is currently only valid for tcp */
-				segs = skb_shinfo(skb)->gso_segs ?: 1;
+				unsigned int segs = 1, bytecount;
+				unsigned int hdr = 0;
+
+				bytecount = rtskb_chain_data_len(skb);
+				if (skb->gso_size) {
+					/* the first rtskb holds all headers */
+					hdr = skb->h.raw - skb->data +
+					      (skb->h.th->doff << 2);
+					segs = DIV_ROUND_UP(bytecount - hdr,
+							    skb->gso_size);
+				}
 				/* multiply data chunks by size of headers */
-				bytecount = ((segs - 1) * skb_headlen(skb)) +
-					    skb->len;
 				total_packets += segs;
-				total_bytes += bytecount;
-#else
-				total_packets++;
-				total_bytes += skb->len;
+				total_bytes += bytecount + (segs - 1) * hdr;
 			}
 
 			igb_unmap_and_free_tx_resource(adapter, buffer_info);
@@ -3867,7 +3866,6 @@ static bool igb_clean_tx_irq(struct igb_ring *tx_ring)
 	tx_ring->tx_stats.packets += total_packets;
 	adapter->net_stats.tx_bytes += total_bytes;
 	adapter->net_stats.tx_packets += total_packets;
-#endif
 	return (count < tx_ring->count);
 }
 
@@ -71,6 +71,19 @@ static int rt_loopback_close (struct rtnet_device *rtdev)
  */
 static int rt_loopback_xmit(struct rtskb *rtskb, struct rtnet_device *rtdev)
 {
+    struct rtskb *copy;
+
+
+    /* the sender may keep a reference for retransmission, but the
+       reception path below consumes and modifies the rtskb */
+    if (rtskb_shared(rtskb)) {
+        copy = rtskb_clone(rtskb, rtskb->pool);
+        kfree_rtskb(rtskb);
+        if (copy == NULL)
+            return 0; /* lost like on the wire */
+        rtskb = copy;
+    }
+
     /* write transmission stamp - in case any protocol ever gets the idea to
        ask the lookback device for this service... */
     if (rtskb->xmit_stamp)
@@ -80,6 +93,9 @@ static int rt_loopback_xmit(struct rtskb *rtskb, struct rtnet_device *rtdev)
     /* make sure that critical fields are re-intialised */
     rtskb->chain_end = rtskb;
 
+    /* the "reception" happens right now */
+    rtskb->time_stamp = rtdm_clock_read();
+
     /* parse the Ethernet header as usual */
     rtskb->protocol = rt_eth_type_trans(rtskb, rtdev);
 
@@ -0,0 +1,367 @@
+/***
+ *
+ *  examples/xenomai/posix/loopback-bench.c
+ *
+ *  Multi-sender UDP benchmark over rt_loopback - a number of real-time
+ *  threads blast datagrams at a single receiver, reporting the per-sender
+ *  transmit cost and checking every received payload. With payloads beyond
+ *  the MTU, this also verifies that concurrently generated IP IDs do not
+ *  confuse the reassembly. Option -x disables UDP checksums (SO_NO_CHECK),
+ *  which takes effect if the device is marked trusted
+ *  ("rtifconfig rtlo up 127.0.0.1 nocsum").
+ *
+ *  RTnet - real-time networking example
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <arpa/inet.h>
+#include <limits.h>
+
+#include <rtnet.h>
+
+#define RCV_PORT                37000
+#define MAX_SENDERS             32
+#define MAX_PAYLOAD             8192
+#define DEFAULT_ADD_BUFFERS     30
+
+char *dest_ip_s = "127.0.0.1";
+unsigned int senders = 4;
+unsigned int count = 10000;
+unsigned int payload = 64;
+int add_rtskbs = DEFAULT_ADD_BUFFERS;
+int no_check = 0;
+
+struct sockaddr_in dest_addr;
+pthread_barrier_t start_barrier;
+
+struct sender_stats {
+    pthread_t       thread;
+    int             sock;
+    unsigned int    sent;
+    unsigned int    errors;
+    long long       total, max;
+
+    unsigned int    received;
+    unsigned int    corrupted;
+};
+
+static struct sender_stats sender[MAX_SENDERS];
+
+struct bench_header {
+    uint32_t        sender;
+    uint32_t        seq;
+};
+
+
+static inline long long timespec_ns(const struct timespec *ts)
+{
+    return ts->tv_sec * 1000000000LL + ts->tv_nsec;
+}
+
+
+/* payload pattern, unique per sender and sequence number */
+static void fill_payload(unsigned char *buf, uint32_t nr, uint32_t seq)
+{
+    struct bench_header *hdr = (struct bench_header *)buf;
+    unsigned int        i;
+
+    hdr->sender = nr;
+    hdr->seq    = seq;
+    for (i = sizeof(*hdr); i < payload; i++)
+        buf[i] = (unsigned char)(nr * 31 + seq + i);
+}
+
+
+void *transmitter(void *arg)
+{
+    struct sender_stats *stats = arg;
+    uint32_t            nr = stats - &sender[0];
+    struct sched_param  param = { .sched_priority = 80 };
+    unsigned char       buf[MAX_PAYLOAD];
+    struct timespec     start, end;
+    long long           delta;
+    uint32_t            seq;
+
+
+    pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+
+    pthread_barrier_wait(&start_barrier);
+
+    for (seq = 0; seq < count; seq++) {
+        fill_payload(buf, nr, seq);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (sendto(stats->sock, buf, payload, 0,
+                   (struct sockaddr *)&dest_addr,
+                   sizeof(struct sockaddr_in)) < 0) {
+            if (errno == EBADF)
+                break;
+            stats->errors++;
+            continue;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        delta = timespec_ns(&end) - timespec_ns(&start);
+        stats->total += delta;
+        if (delta > stats->max)
+            stats->max = delta;
+        stats->sent++;
+    }
+
+    return NULL;
+}
+
+
+void *receiver(void *arg)
+{
+    int                 sock = *(int *)arg;
+    struct sched_param  param = { .sched_priority = 82 };
+    unsigned char       buf[MAX_PAYLOAD];
+    unsigned char       ref[MAX_PAYLOAD];
+    struct bench_header *hdr = (struct bench_header *)buf;
+    int                 ret;
+
+
+    pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+
+    while (1) {
+        ret = recv(sock, buf, sizeof(buf), 0);
+        if (ret < 0) {
+            if (errno == ETIMEDOUT)
+                continue;
+            return NULL;
+        }
+
+        if ((ret < (int)sizeof(*hdr)) || (hdr->sender >= senders))
+            continue;
+
+        fill_payload(ref, hdr->sender, hdr->seq);
+        if ((ret != (int)payload) || (memcmp(buf, ref, payload) != 0))
+            sender[hdr->sender].corrupted++;
+        else
+            sender[hdr->sender].received++;
+    }
+}
+
+
+void catch_signal(int sig)
+{
+}
+
+
+int main(int argc, char *argv[])
+{
+    struct sockaddr_in local_addr;
+    pthread_attr_t thattr;
+    pthread_t recv_thread;
+    struct timespec start, end;
+    int64_t timeout = 100000000; /* 100 ms */
+    unsigned int total_sent = 0, total_received = 0;
+    unsigned int i;
+    int sock;
+    int ret;
+
+
+    while (1) {
+        switch (getopt(argc, argv, "d:n:c:s:b:x")) {
+            case 'd':
+                dest_ip_s = optarg;
+                break;
+
+            case 'n':
+                senders = atoi(optarg);
+                break;
+
+            case 'c':
+                count = atoi(optarg);
+                break;
+
+            case 's':
+                payload = atoi(optarg);
+                break;
+
+            case 'b':
+                add_rtskbs = atoi(optarg);
+                break;
+
+            case 'x':
+                no_check = 1;
+                break;
+
+            case -1:
+                goto end_of_opt;
+
+            default:
+                printf("usage: %s [-d <dest_ip>] [-n <senders>] "
+                       "[-c <datagrams_per_sender>] [-s <payload_bytes>] "
+                       "[-b <add_buffers>] [-x]\n", argv[0]);
+                return 0;
+        }
+    }
+ end_of_opt:
+
+    if ((senders == 0) || (senders > MAX_SENDERS)) {
+        printf("number of senders must be between 1 and %d\n", MAX_SENDERS);
+        return 1;
+    }
+    if ((payload < sizeof(struct bench_header)) || (payload > MAX_PAYLOAD)) {
+        printf("payload must be between %d and %d bytes\n",
+               (int)sizeof(struct bench_header), MAX_PAYLOAD);
+        return 1;
+    }
+
+    dest_addr.sin_family = AF_INET;
+    dest_addr.sin_port   = htons(RCV_PORT);
+    inet_aton(dest_ip_s, &dest_addr.sin_addr);
+
+    signal(SIGTERM, catch_signal);
+    signal(SIGINT, catch_signal);
+    signal(SIGHUP, catch_signal);
+    mlockall(MCL_CURRENT|MCL_FUTURE);
+
+    printf("destination ip address: %s\n", dest_ip_s);
+    printf("senders: %u, datagrams per sender: %u, payload: %u bytes%s\n",
+           senders, count, payload, no_check ? ", no checksums" : "");
+
+    /* create and bind the receiving rt-socket */
+    if ((sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0) {
+        perror("socket cannot be created");
+        return 1;
+    }
+
+    local_addr.sin_family      = AF_INET;
+    local_addr.sin_port        = htons(RCV_PORT);
+    local_addr.sin_addr.s_addr = INADDR_ANY;
+    if (bind(sock, (struct sockaddr *)&local_addr, sizeof(local_addr)) < 0) {
+        perror("cannot bind to local ip/port");
+        close(sock);
+        return 1;
+    }
+
+    ret = ioctl(sock, RTNET_RTIOC_EXTPOOL, &add_rtskbs);
+    if (ret != add_rtskbs)
+        perror("WARNING: ioctl(RTNET_RTIOC_EXTPOOL)");
+
+    ioctl(sock, RTNET_RTIOC_TIMEOUT, &timeout);
+
+    if (no_check &&
+        setsockopt(sock, SOL_SOCKET, SO_NO_CHECK, &no_check,
+                   sizeof(no_check)) < 0)
+        perror("WARNING: setsockopt(SO_NO_CHECK)");
+
+    /* one transmitting rt-socket per sender */
+    for (i = 0; i < senders; i++) {
+        if ((sender[i].sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0) {
+            perror("socket cannot be created");
+            while (i > 0)
+                close(sender[--i].sock);
+            close(sock);
+            return 1;
+        }
+
+        ret = ioctl(sender[i].sock, RTNET_RTIOC_EXTPOOL, &add_rtskbs);
+        if (ret != add_rtskbs)
+            perror("WARNING: ioctl(RTNET_RTIOC_EXTPOOL)");
+
+        if (no_check &&
+            setsockopt(sender[i].sock, SOL_SOCKET, SO_NO_CHECK, &no_check,
+                       sizeof(no_check)) < 0)
+            perror("WARNING: setsockopt(SO_NO_CHECK)");
+    }
+
+    pthread_barrier_init(&start_barrier, NULL, senders + 1);
+
+    pthread_attr_init(&thattr);
+    pthread_attr_setdetachstate(&thattr, PTHREAD_CREATE_JOINABLE);
+    pthread_attr_setstacksize(&thattr, PTHREAD_STACK_MIN + 2 * MAX_PAYLOAD);
+
+    ret = pthread_create(&recv_thread, &thattr, &receiver, &sock);
+    if (ret) {
+        errno = ret; perror("pthread_create(receiver) failed");
+        for (i = 0; i < senders; i++)
+            close(sender[i].sock);
+        close(sock);
+        return 1;
+    }
+
+    for (i = 0; i < senders; i++) {
+        ret = pthread_create(&sender[i].thread, &thattr, &transmitter,
+                             &sender[i]);
+        if (ret) {
+            errno = ret; perror("pthread_create(transmitter) failed");
+            /* process termination also releases the sockets */
+            exit(1);
+        }
+    }
+
+    pthread_barrier_wait(&start_barrier);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (i = 0; i < senders; i++)
+        pthread_join(sender[i].thread, NULL);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    /* give the receiver a chance to drain its queue */
+    usleep(200000);
+
+    printf("\nsender  sent      errors  avg xmit     max xmit     "
+           "received  corrupted\n");
+    for (i = 0; i < senders; i++) {
+        printf("%-6u  %-8u  %-6u  %9.3f us  %9.3f us  %-8u  %u\n", i,
+               sender[i].sent, sender[i].errors,
+               sender[i].sent ?
+                   (float)sender[i].total / sender[i].sent / 1000 : 0.0,
+               (float)sender[i].max / 1000,
+               sender[i].received, sender[i].corrupted);
+        total_sent     += sender[i].sent;
+        total_received += sender[i].received;
+    }
+
+    printf("\ntotal: %u sent, %u received in %.3f ms (%.0f datagrams/s)\n",
+           total_sent, total_received,
+           (float)(timespec_ns(&end) - timespec_ns(&start)) / 1000000,
+           total_sent * 1000000000.0 /
+               (timespec_ns(&end) - timespec_ns(&start)));
+
+    printf("shutting down\n");
+
+    for (i = 0; i < senders; i++)
+        close(sender[i].sock);
+
+    /* Note: The following loop is no longer required since Xenomai 2.4,
+     *       plain close works as well. */
+    while ((close(sock) < 0) && (errno == EAGAIN)) {
+        printf("socket busy - waiting...\n");
+        sleep(1);
+    }
+
+    pthread_kill(recv_thread, SIGHUP);
+    pthread_join(recv_thread, NULL);
+
+    return 0;
+}
@@ -0,0 +1,460 @@
+/***
+ *
+ *  examples/xenomai/posix/packet-ring-bench.c
+ *
+ *  Cyclic raw Ethernet benchmark - a real-time thread sends a burst of
+ *  frames per cycle over a packet socket and receives them back (e.g. via
+ *  rtlo), once through send/recv and once through the memory-mapped
+ *  transmit and receive rings (RTNET_RTIOC_TXRING/RXRING). Each mode runs
+ *  at 1, 2, 3 and 4 kHz. Reports the communication time per cycle, overruns
+ *  of the cycle period, lost frames and, for the rings, the one-way latency
+ *  derived from the time stamps in the frame headers.
+ *
+ *  RTnet - real-time networking example
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <netpacket/packet.h>
+#include <net/ethernet.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+
+#include <rtnet.h>
+
+#define BENCH_PROTO             0x1234
+#define MAX_FRAMES              64
+#define MAX_SIZE                1514
+#define MIN_SIZE                (ETH_HLEN + sizeof(uint32_t))
+#define MAX_RATE_KHZ            4
+#define DEFAULT_ADD_BUFFERS     30
+
+char *if_name = "rtlo";
+unsigned int cycles = 2000;
+unsigned int frames = 4;
+unsigned int size = 64;
+unsigned int ring_frames = 64;
+int add_rtskbs = DEFAULT_ADD_BUFFERS;
+
+struct bench {
+    int             sock;
+    int             ifindex;
+    void            *tx_ring, *rx_ring;     /* NULL: use send/recv */
+    unsigned int    tx_frame_size, rx_frame_size;
+    unsigned int    tx_index, rx_index;
+};
+
+struct bench_result {
+    unsigned int    cycles;
+    unsigned int    overruns;   /* cycles exceeding the period */
+    unsigned int    lost;
+    unsigned int    corrupted;
+    long long       total, max; /* communication time per cycle */
+    long long       latency;    /* sum of one-way latencies (rings) */
+    unsigned int    stamped;
+};
+
+
+static inline long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+static inline void timespec_add_ns(struct timespec *ts, long ns)
+{
+    ts->tv_nsec += ns;
+    while (ts->tv_nsec >= 1000000000) {
+        ts->tv_nsec -= 1000000000;
+        ts->tv_sec++;
+    }
+}
+
+
+/* broadcast Ethernet header, sequence number and a pattern derived from it */
+static void fill_frame(unsigned char *buf, uint32_t seq)
+{
+    struct ether_header *eth = (struct ether_header *)buf;
+    unsigned int        i;
+
+    memset(eth->ether_dhost, 0xFF, ETH_ALEN);
+    memset(eth->ether_shost, 0, ETH_ALEN);
+    eth->ether_type = htons(BENCH_PROTO);
+
+    memcpy(buf + ETH_HLEN, &seq, sizeof(seq));
+    for (i = MIN_SIZE; i < size; i++)
+        buf[i] = (unsigned char)(seq + i);
+}
+
+
+static int check_frame(const unsigned char *buf, unsigned int len,
+                       uint32_t seq)
+{
+    unsigned char ref[MAX_SIZE];
+
+    if (len != size)
+        return 0;
+
+    fill_frame(ref, seq);
+    return memcmp(buf + ETH_HLEN, ref + ETH_HLEN, size - ETH_HLEN) == 0;
+}
+
+
+static inline struct rtnet_ring_frame *ring_frame(void *ring,
+                                                  unsigned int frame_size,
+                                                  unsigned int index)
+{
+    return (struct rtnet_ring_frame *)((char *)ring + index * frame_size);
+}
+
+
+/* one cycle via send/recv, returns the number of frames received */
+static unsigned int cycle_copy(struct bench *b, struct bench_result *result,
+                               uint32_t seq)
+{
+    unsigned char   buf[MAX_SIZE];
+    unsigned int    i, received = 0;
+    int             ret;
+
+    for (i = 0; i < frames; i++) {
+        fill_frame(buf, seq + i);
+        if (send(b->sock, buf, size, 0) != (int)size)
+            perror("send");
+    }
+
+    for (i = 0; i < frames; i++) {
+        ret = recv(b->sock, buf, sizeof(buf), 0);
+        if (ret < 0)
+            break;
+        if (check_frame(buf, ret, seq + i))
+            received++;
+        else
+            result->corrupted++;
+    }
+
+    return received;
+}
+
+
+/* one cycle via the rings, returns the number of frames received */
+static unsigned int cycle_ring(struct bench *b, struct bench_result *result,
+                               uint32_t seq)
+{
+    struct rtnet_ring_frame *frame;
+    uint64_t                tx_stamp[MAX_FRAMES];
+    unsigned int            first = b->tx_index;
+    unsigned int            i, received = 0;
+
+    for (i = 0; i < frames; i++) {
+        frame = ring_frame(b->tx_ring, b->tx_frame_size, b->tx_index);
+
+        fill_frame((unsigned char *)frame + RTNET_RING_HDRLEN, seq + i);
+        frame->len      = size;
+        frame->data     = RTNET_RING_HDRLEN;
+        frame->addr_len = 0;            /* bound interface */
+
+        /* publish the frame contents before marking it */
+        __sync_synchronize();
+        frame->status = RTNET_RING_SEND;
+
+        if (++b->tx_index == ring_frames)
+            b->tx_index = 0;
+    }
+
+    /* a single call for the whole burst */
+    if (ioctl(b->sock, RTNET_RTIOC_TXRING_KICK) < 0)
+        perror("ioctl(RTNET_RTIOC_TXRING_KICK)");
+
+    for (i = 0; i < frames; i++) {
+        frame = ring_frame(b->tx_ring, b->tx_frame_size,
+                           (first + i) % ring_frames);
+        tx_stamp[i] = frame->stamp;
+    }
+
+    for (i = 0; i < frames; i++) {
+        frame = ring_frame(b->rx_ring, b->rx_frame_size, b->rx_index);
+
+        while (!(frame->status & RTNET_RING_USER))
+            if (ioctl(b->sock, RTNET_RTIOC_RXRING_WAIT, &b->rx_index) < 0)
+                return received;
+
+        /* read the frame only after having seen its status */
+        __sync_synchronize();
+
+        if (check_frame((unsigned char *)frame + frame->data, frame->snaplen,
+                        seq + i)) {
+            received++;
+            result->latency += frame->stamp - tx_stamp[i];
+            result->stamped++;
+        } else
+            result->corrupted++;
+
+        /* hand the frame back to the stack */
+        __sync_synchronize();
+        frame->status = RTNET_RING_KERNEL;
+
+        if (++b->rx_index == ring_frames)
+            b->rx_index = 0;
+    }
+
+    return received;
+}
+
+
+static int bench_open(struct bench *b, int use_rings)
+{
+    struct sockaddr_ll      addr;
+    struct rtnet_ring_req   req;
+    struct ifreq            ifr;
+    int64_t                 timeout = 100000000; /* 100 ms */
+
+
+    memset(b, 0, sizeof(*b));
+
+    if ((b->sock = socket(PF_PACKET, SOCK_RAW, htons(BENCH_PROTO))) < 0) {
+        perror("socket cannot be created");
+        return -1;
+    }
+
+    strncpy(ifr.ifr_name, if_name, IFNAMSIZ);
+    if (ioctl(b->sock, SIOCGIFINDEX, &ifr) < 0) {
+        perror("cannot get interface index");
+        goto err;
+    }
+    b->ifindex = ifr.ifr_ifindex;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sll_family   = AF_PACKET;
+    addr.sll_protocol = htons(BENCH_PROTO);
+    addr.sll_ifindex  = b->ifindex;
+    if (bind(b->sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("cannot bind to interface");
+        goto err;
+    }
+
+    if (ioctl(b->sock, RTNET_RTIOC_EXTPOOL, &add_rtskbs) != add_rtskbs)
+        perror("WARNING: ioctl(RTNET_RTIOC_EXTPOOL)");
+    ioctl(b->sock, RTNET_RTIOC_TIMEOUT, &timeout);
+
+    if (!use_rings)
+        return 0;
+
+    req.frame_size = RTNET_RING_ALIGN_LEN(RTNET_RING_HDRLEN + size);
+    req.frame_nr   = ring_frames;
+    if (ioctl(b->sock, RTNET_RTIOC_TXRING, &req) < 0) {
+        perror("ioctl(RTNET_RTIOC_TXRING)");
+        goto err;
+    }
+    b->tx_ring       = req.addr;
+    b->tx_frame_size = req.frame_size;
+
+    req.frame_size = RTNET_RING_ALIGN_LEN(RTNET_RING_HDRLEN +
+        RTNET_RING_ALIGN_LEN(sizeof(struct sockaddr_ll)) + size);
+    req.frame_nr   = ring_frames;
+    if (ioctl(b->sock, RTNET_RTIOC_RXRING, &req) < 0) {
+        perror("ioctl(RTNET_RTIOC_RXRING)");
+        goto err;
+    }
+    b->rx_ring       = req.addr;
+    b->rx_frame_size = req.frame_size;
+
+    return 0;
+
+ err:
+    if (b->tx_ring)
+        munmap(b->tx_ring, b->tx_frame_size * ring_frames);
+    close(b->sock);
+    return -1;
+}
+
+
+static void bench_close(struct bench *b)
+{
+    if (b->tx_ring)
+        munmap(b->tx_ring, b->tx_frame_size * ring_frames);
+    if (b->rx_ring)
+        munmap(b->rx_ring, b->rx_frame_size * ring_frames);
+
+    while ((close(b->sock) < 0) && (errno == EAGAIN)) {
+        printf("socket busy - waiting...\n");
+        sleep(1);
+    }
+}
+
+
+static void run_cycles(struct bench *b, unsigned int rate_khz,
+                       struct bench_result *result)
+{
+    struct timespec next;
+    long            period = 1000000 / rate_khz;
+    long long       start, delta;
+    uint32_t        seq = 0;
+    unsigned int    n, received;
+
+
+    memset(result, 0, sizeof(*result));
+
+    clock_gettime(CLOCK_MONOTONIC, &next);
+
+    for (n = 0; n < cycles; n++) {
+        timespec_add_ns(&next, period);
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+
+        start = now_ns();
+        if (b->tx_ring)
+            received = cycle_ring(b, result, seq);
+        else
+            received = cycle_copy(b, result, seq);
+        delta = now_ns() - start;
+
+        result->lost  += frames - received;
+        result->total += delta;
+        if (delta > result->max)
+            result->max = delta;
+        if (delta > period)
+            result->overruns++;
+        result->cycles++;
+
+        seq += frames;
+    }
+}
+
+
+static void print_result(const char *name, unsigned int rate_khz,
+                         struct bench_result *result)
+{
+    printf("%-6s  %u kHz  %9.3f us  %9.3f us  %-8u  %-8u  %-9u  ", name,
+           rate_khz, result->cycles ?
+               (float)result->total / result->cycles / 1000 : 0.0,
+           (float)result->max / 1000, result->overruns, result->lost,
+           result->corrupted);
+    if (result->stamped)
+        printf("%9.3f us\n",
+               (float)result->latency / result->stamped / 1000);
+    else
+        printf("%9s\n", "-");
+}
+
+
+void catch_signal(int sig)
+{
+}
+
+
+int main(int argc, char *argv[])
+{
+    struct sched_param  param = { .sched_priority = 80 };
+    struct bench_result results[2][MAX_RATE_KHZ];
+    struct bench        b;
+    unsigned int        rate;
+    int                 mode;
+
+
+    while (1) {
+        switch (getopt(argc, argv, "i:c:n:s:f:b:")) {
+            case 'i':
+                if_name = optarg;
+                break;
+
+            case 'c':
+                cycles = atoi(optarg);
+                break;
+
+            case 'n':
+                frames = atoi(optarg);
+                break;
+
+            case 's':
+                size = atoi(optarg);
+                break;
+
+            case 'f':
+                ring_frames = atoi(optarg);
+                break;
+
+            case 'b':
+                add_rtskbs = atoi(optarg);
+                break;
+
+            case -1:
+                goto end_of_opt;
+
+            default:
+                printf("usage: %s [-i <interface>] [-c <cycles>] "
+                       "[-n <frames_per_cycle>] [-s <frame_bytes>] "
+                       "[-f <ring_frames>] [-b <add_buffers>]\n", argv[0]);
+                return 0;
+        }
+    }
+ end_of_opt:
+
+    if ((size < MIN_SIZE) || (size > MAX_SIZE)) {
+        printf("frame size must be between %d and %d bytes\n",
+               (int)MIN_SIZE, MAX_SIZE);
+        return 1;
+    }
+    if ((frames == 0) || (frames > MAX_FRAMES) || (frames > ring_frames)) {
+        printf("frames per cycle must be between 1 and %d "
+               "(and not exceed the ring frames)\n", MAX_FRAMES);
+        return 1;
+    }
+
+    signal(SIGTERM, catch_signal);
+    signal(SIGINT, catch_signal);
+    signal(SIGHUP, catch_signal);
+    mlockall(MCL_CURRENT|MCL_FUTURE);
+
+    pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+
+    printf("interface: %s, cycles: %u, frames per cycle: %u, "
+           "frame size: %u bytes, ring frames: %u\n",
+           if_name, cycles, frames, size, ring_frames);
+
+    /* mode 0: send/recv, mode 1: rings */
+    for (mode = 0; mode < 2; mode++) {
+        if (bench_open(&b, mode) < 0)
+            return 1;
+
+        for (rate = 1; rate <= MAX_RATE_KHZ; rate++)
+            run_cycles(&b, rate, &results[mode][rate - 1]);
+
+        bench_close(&b);
+    }
+
+    printf("\nmode    rate   avg cycle    max cycle    overruns  lost      "
+           "corrupted  latency\n");
+    for (rate = 1; rate <= MAX_RATE_KHZ; rate++) {
+        print_result("copy", rate, &results[0][rate - 1]);
+        print_result("ring", rate, &results[1][rate - 1]);
+    }
+
+    return 0;
+}
@@ -0,0 +1,373 @@
+/***
+ *
+ *  examples/xenomai/posix/rttcp-bench.c
+ *
+ *  TCP throughput benchmark over rt_loopback - a real-time thread streams
+ *  a byte pattern over a TCP connection to a receiver which checks it,
+ *  reporting the throughput and the cost of each write. Small writes show
+ *  the effect of the write coalescing: option -N sets TCP_NODELAY, -C
+ *  corks the socket while writing (TCP_CORK) and -v splits every write
+ *  into the given number of io vectors passed to a single sendmsg().
+ *
+ *  RTnet - real-time networking example
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <arpa/inet.h>
+#include <limits.h>
+
+#include <rtnet.h>
+
+#define SRV_PORT                36020
+#define MAX_SIZE                8192
+#define MAX_IOVS                16
+#define DEFAULT_ADD_BUFFERS     30
+
+char *dest_ip_s = "127.0.0.1";
+unsigned int count = 10000;
+unsigned int size = 64;
+unsigned int iovs = 1;
+int nodelay = 0;
+int cork = 0;
+int add_rtskbs = DEFAULT_ADD_BUFFERS;
+
+struct sockaddr_in dest_addr;
+pthread_barrier_t start_barrier;
+
+struct send_stats {
+    unsigned int    writes;
+    long long       total, max;
+    long long       start, end;
+};
+
+struct recv_stats {
+    unsigned long long  bytes;
+    unsigned long long  corrupted;  /* offset of first mismatch + 1 */
+    long long           end;
+};
+
+static struct send_stats tx_stats;
+static struct recv_stats rx_stats;
+
+
+static inline long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+/* stream pattern, depends on the absolute stream offset only */
+static inline unsigned char pattern(unsigned long long offset)
+{
+    return (unsigned char)(offset ^ (offset >> 8) ^ (offset >> 16));
+}
+
+
+void *receiver(void *arg)
+{
+    int                 sock = *(int *)arg;
+    int                 conn;
+    struct sched_param  param = { .sched_priority = 82 };
+    struct sockaddr_in  local_addr, peer_addr;
+    socklen_t           len = sizeof(peer_addr);
+    unsigned char       buf[MAX_SIZE];
+    unsigned long long  expected = (unsigned long long)count * size;
+    int64_t             timeout = 1000000000; /* 1 s */
+    int                 i, ret;
+
+
+    pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+
+    local_addr.sin_family      = AF_INET;
+    local_addr.sin_port        = htons(SRV_PORT);
+    local_addr.sin_addr.s_addr = INADDR_ANY;
+    if (bind(sock, (struct sockaddr *)&local_addr, sizeof(local_addr)) < 0) {
+        perror("bind server socket");
+        pthread_barrier_wait(&start_barrier);
+        return NULL;
+    }
+    if (listen(sock, 1) < 0) {
+        perror("listen on server socket");
+        pthread_barrier_wait(&start_barrier);
+        return NULL;
+    }
+
+    pthread_barrier_wait(&start_barrier);
+
+    conn = accept(sock, (struct sockaddr *)&peer_addr, &len);
+    if (conn < 0) {
+        perror("accept connection");
+        return NULL;
+    }
+
+    if (ioctl(conn, RTNET_RTIOC_EXTPOOL, &add_rtskbs) != add_rtskbs)
+        perror("WARNING: ioctl(RTNET_RTIOC_EXTPOOL)");
+    ioctl(conn, RTNET_RTIOC_TIMEOUT, &timeout);
+
+    while (rx_stats.bytes < expected) {
+        ret = read(conn, buf, sizeof(buf));
+        if (ret <= 0)
+            break;
+
+        if (!rx_stats.corrupted)
+            for (i = 0; i < ret; i++)
+                if (buf[i] != pattern(rx_stats.bytes + i)) {
+                    rx_stats.corrupted = rx_stats.bytes + i + 1;
+                    break;
+                }
+        rx_stats.bytes += ret;
+    }
+    rx_stats.end = now_ns();
+
+    close(conn);
+
+    return NULL;
+}
+
+
+void *transmitter(void *arg)
+{
+    int                 sock = *(int *)arg;
+    struct sched_param  param = { .sched_priority = 80 };
+    unsigned char       buf[MAX_SIZE];
+    struct iovec        iov[MAX_IOVS];
+    struct msghdr       msg;
+    unsigned long long  offset = 0;
+    unsigned int        chunk = size / iovs;
+    unsigned int        n, i;
+    long long           start, delta;
+    int                 off = 0;
+    int                 ret;
+
+
+    pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+
+    if (nodelay &&
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &nodelay,
+                   sizeof(nodelay)) < 0)
+        perror("WARNING: setsockopt(TCP_NODELAY)");
+
+    if (connect(sock, (struct sockaddr *)&dest_addr,
+                sizeof(struct sockaddr_in)) < 0) {
+        perror("connect to server");
+        return NULL;
+    }
+
+    if (cork &&
+        setsockopt(sock, IPPROTO_TCP, TCP_CORK, &cork, sizeof(cork)) < 0)
+        perror("WARNING: setsockopt(TCP_CORK)");
+
+    /* the last vector takes the remainder of the write */
+    for (i = 0; i < iovs; i++) {
+        iov[i].iov_base = buf + i * chunk;
+        iov[i].iov_len  = (i < iovs - 1) ? chunk : size - i * chunk;
+    }
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov    = iov;
+    msg.msg_iovlen = iovs;
+
+    tx_stats.start = now_ns();
+
+    for (n = 0; n < count; n++) {
+        for (i = 0; i < size; i++)
+            buf[i] = pattern(offset + i);
+
+        start = now_ns();
+        if (iovs > 1)
+            ret = sendmsg(sock, &msg, 0);
+        else
+            ret = write(sock, buf, size);
+        delta = now_ns() - start;
+
+        /* short writes only happen on errors or timeouts */
+        if (ret != (int)size) {
+            perror("write to socket");
+            break;
+        }
+
+        tx_stats.total += delta;
+        if (delta > tx_stats.max)
+            tx_stats.max = delta;
+        tx_stats.writes++;
+        offset += size;
+    }
+
+    /* uncorking flushes the data held back */
+    if (cork)
+        setsockopt(sock, IPPROTO_TCP, TCP_CORK, &off, sizeof(off));
+
+    tx_stats.end = now_ns();
+
+    return NULL;
+}
+
+
+void catch_signal(int sig)
+{
+}
+
+
+int main(int argc, char *argv[])
+{
+    pthread_attr_t  thattr;
+    pthread_t       recv_thread, send_thread;
+    long long       duration;
+    int             srv_sock, cli_sock;
+    int             ret;
+
+
+    while (1) {
+        switch (getopt(argc, argv, "d:c:s:v:NCb:")) {
+            case 'd':
+                dest_ip_s = optarg;
+                break;
+
+            case 'c':
+                count = atoi(optarg);
+                break;
+
+            case 's':
+                size = atoi(optarg);
+                break;
+
+            case 'v':
+                iovs = atoi(optarg);
+                break;
+
+            case 'N':
+                nodelay = 1;
+                break;
+
+            case 'C':
+                cork = 1;
+                break;
+
+            case 'b':
+                add_rtskbs = atoi(optarg);
+                break;
+
+            case -1:
+                goto end_of_opt;
+
+            default:
+                printf("usage: %s [-d <dest_ip>] [-c <writes>] "
+                       "[-s <write_bytes>] [-v <io_vectors>] [-N] [-C] "
+                       "[-b <add_buffers>]\n", argv[0]);
+                return 0;
+        }
+    }
+ end_of_opt:
+
+    if ((size == 0) || (size > MAX_SIZE)) {
+        printf("write size must be between 1 and %d bytes\n", MAX_SIZE);
+        return 1;
+    }
+    if ((iovs == 0) || (iovs > MAX_IOVS) || (iovs > size)) {
+        printf("number of io vectors must be between 1 and %d "
+               "(and not exceed the write size)\n", MAX_IOVS);
+        return 1;
+    }
+
+    dest_addr.sin_family = AF_INET;
+    dest_addr.sin_port   = htons(SRV_PORT);
+    inet_aton(dest_ip_s, &dest_addr.sin_addr);
+
+    signal(SIGTERM, catch_signal);
+    signal(SIGINT, catch_signal);
+    signal(SIGHUP, catch_signal);
+    mlockall(MCL_CURRENT|MCL_FUTURE);
+
+    printf("destination ip address: %s\n", dest_ip_s);
+    printf("writes: %u, size: %u bytes, io vectors: %u%s%s\n",
+           count, size, iovs, nodelay ? ", nodelay" : "",
+           cork ? ", corked" : "");
+
+    if ((srv_sock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0) {
+        perror("socket cannot be created");
+        return 1;
+    }
+    if ((cli_sock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0) {
+        perror("socket cannot be created");
+        close(srv_sock);
+        return 1;
+    }
+
+    if (ioctl(srv_sock, RTNET_RTIOC_EXTPOOL, &add_rtskbs) != add_rtskbs)
+        perror("WARNING: ioctl(RTNET_RTIOC_EXTPOOL)");
+    if (ioctl(cli_sock, RTNET_RTIOC_EXTPOOL, &add_rtskbs) != add_rtskbs)
+        perror("WARNING: ioctl(RTNET_RTIOC_EXTPOOL)");
+
+    pthread_barrier_init(&start_barrier, NULL, 2);
+
+    pthread_attr_init(&thattr);
+    pthread_attr_setdetachstate(&thattr, PTHREAD_CREATE_JOINABLE);
+    pthread_attr_setstacksize(&thattr, PTHREAD_STACK_MIN + 2 * MAX_SIZE);
+
+    ret = pthread_create(&recv_thread, &thattr, &receiver, &srv_sock);
+    if (ret) {
+        errno = ret; perror("pthread_create(receiver) failed");
+        exit(1);
+    }
+
+    /* connect only when the server is listening */
+    pthread_barrier_wait(&start_barrier);
+
+    ret = pthread_create(&send_thread, &thattr, &transmitter, &cli_sock);
+    if (ret) {
+        errno = ret; perror("pthread_create(transmitter) failed");
+        /* process termination also releases the sockets */
+        exit(1);
+    }
+
+    pthread_join(send_thread, NULL);
+    /* the receiver terminates on the last byte or on a read timeout */
+    pthread_join(recv_thread, NULL);
+
+    pthread_barrier_destroy(&start_barrier);
+
+    duration = rx_stats.end - tx_stats.start;
+
+    printf("\nwrites    avg write    max write    received    throughput\n");
+    printf("%-8u  %9.3f us  %9.3f us  %-10llu  %.3f MB/s\n",
+           tx_stats.writes, tx_stats.writes ?
+               (float)tx_stats.total / tx_stats.writes / 1000 : 0.0,
+           (float)tx_stats.max / 1000, rx_stats.bytes,
+           (duration > 0) ? rx_stats.bytes * 1000.0 / duration : 0.0);
+    if (rx_stats.corrupted)
+        printf("stream corrupted at byte %llu\n", rx_stats.corrupted - 1);
+
+    close(cli_sock);
+    close(srv_sock);
+
+    return 0;
+}
@@ -0,0 +1,431 @@
+/***
+ *
+ *  examples/xenomai/posix/rttcp-recovery.c
+ *
+ *  TCP loss recovery benchmark - a real-time thread streams time-stamped
+ *  messages over a TCP connection (rt_loopback by default) to a receiver
+ *  which reports the delivery delay of each message. With error injection
+ *  enabled (--enable-tcp-error-injection), option -e sets the error_rate of
+ *  the rttcp module before the sockets are created, so the delay of the
+ *  messages following a lost segment shows how long the recovery took.
+ *  Option -a delays accept(), the first messages are then sent before the
+ *  connection is accepted and must still arrive complete and in order.
+ *
+ *  RTnet - real-time networking example
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <arpa/inet.h>
+#include <limits.h>
+
+#include <rtnet.h>
+
+#define SRV_PORT                36010
+#define MAX_SIZE                1024
+#define DEFAULT_ADD_BUFFERS     30
+
+#define ERROR_RATE_PARAM        "/sys/module/rttcp/parameters/error_rate"
+#define MULTI_ERROR_PARAM       "/sys/module/rttcp/parameters/multi_error"
+
+char *dest_ip_s = "127.0.0.1";
+unsigned int count = 10000;
+unsigned int size = 64;
+unsigned int cycle = 1000;          /* 1 ms */
+unsigned int threshold = 1000;      /* 1 ms */
+int error_rate = -1;
+int multi_error = -1;
+int add_rtskbs = DEFAULT_ADD_BUFFERS;
+unsigned int accept_delay = 0;      /* us */
+
+struct sockaddr_in dest_addr;
+pthread_barrier_t start_barrier;
+
+struct msg_header {
+    uint32_t        seq;
+    uint32_t        pad;
+    int64_t         stamp;          /* transmission time */
+};
+
+struct recovery_stats {
+    unsigned int    received;
+    unsigned int    reordered;
+    unsigned int    stalled;        /* delayed beyond threshold */
+    long long       total, min, max;
+    long long       stall_total;
+};
+
+static struct recovery_stats stats = { .min = LLONG_MAX };
+
+
+static inline long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+static int write_param(const char *path, int value, int *old_value)
+{
+    FILE *f;
+
+    if (old_value) {
+        f = fopen(path, "r");
+        if (!f || fscanf(f, "%d", old_value) != 1) {
+            if (f)
+                fclose(f);
+            return -1;
+        }
+        fclose(f);
+    }
+
+    f = fopen(path, "w");
+    if (!f)
+        return -1;
+    fprintf(f, "%d\n", value);
+    return fclose(f);
+}
+
+
+static int read_full(int sock, void *buf, size_t len)
+{
+    size_t  done = 0;
+    int     ret;
+
+    while (done < len) {
+        ret = read(sock, (char *)buf + done, len - done);
+        if (ret <= 0)
+            return ret;
+        done += ret;
+    }
+    return done;
+}
+
+
+static int write_full(int sock, const void *buf, size_t len)
+{
+    size_t  done = 0;
+    int     ret;
+
+    while (done < len) {
+        ret = write(sock, (const char *)buf + done, len - done);
+        if (ret <= 0)
+            return ret;
+        done += ret;
+    }
+    return done;
+}
+
+
+void *receiver(void *arg)
+{
+    int                 sock = *(int *)arg;
+    int                 conn;
+    struct sched_param  param = { .sched_priority = 82 };
+    struct sockaddr_in  local_addr, peer_addr;
+    socklen_t           len = sizeof(peer_addr);
+    unsigned char       buf[MAX_SIZE];
+    struct msg_header   *hdr = (struct msg_header *)buf;
+    uint32_t            expected = 0;
+    long long           delay;
+    int64_t             timeout = 1000000000; /* 1 s */
+
+
+    pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+
+    local_addr.sin_family      = AF_INET;
+    local_addr.sin_port        = htons(SRV_PORT);
+    local_addr.sin_addr.s_addr = INADDR_ANY;
+    if (bind(sock, (struct sockaddr *)&local_addr, sizeof(local_addr)) < 0) {
+        perror("bind server socket");
+        pthread_barrier_wait(&start_barrier);
+        return NULL;
+    }
+    if (listen(sock, 1) < 0) {
+        perror("listen on server socket");
+        pthread_barrier_wait(&start_barrier);
+        return NULL;
+    }
+
+    pthread_barrier_wait(&start_barrier);
+
+    /* let the transmitter send before the connection is accepted */
+    if (accept_delay > 0)
+        usleep(accept_delay);
+
+    conn = accept(sock, (struct sockaddr *)&peer_addr, &len);
+    if (conn < 0) {
+        perror("accept connection");
+        return NULL;
+    }
+
+    if (ioctl(conn, RTNET_RTIOC_EXTPOOL, &add_rtskbs) != add_rtskbs)
+        perror("WARNING: ioctl(RTNET_RTIOC_EXTPOOL)");
+    ioctl(conn, RTNET_RTIOC_TIMEOUT, &timeout);
+
+    while (stats.received < count) {
+        if (read_full(conn, buf, size) <= 0)
+            break;
+
+        delay = now_ns() - hdr->stamp;
+
+        stats.received++;
+        if (hdr->seq != expected)
+            stats.reordered++;
+        expected = hdr->seq + 1;
+
+        stats.total += delay;
+        if (delay < stats.min)
+            stats.min = delay;
+        if (delay > stats.max)
+            stats.max = delay;
+        if (delay > threshold * 1000LL) {
+            stats.stalled++;
+            stats.stall_total += delay;
+        }
+    }
+
+    close(conn);
+
+    return NULL;
+}
+
+
+void *transmitter(void *arg)
+{
+    int                 sock = *(int *)arg;
+    struct sched_param  param = { .sched_priority = 80 };
+    unsigned char       buf[MAX_SIZE];
+    struct msg_header   *hdr = (struct msg_header *)buf;
+    struct timespec     next;
+    uint32_t            seq;
+
+
+    pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+
+    if (connect(sock, (struct sockaddr *)&dest_addr,
+                sizeof(struct sockaddr_in)) < 0) {
+        perror("connect to server");
+        return NULL;
+    }
+
+    memset(buf, 0x5a, sizeof(buf));
+    clock_gettime(CLOCK_MONOTONIC, &next);
+
+    for (seq = 0; seq < count; seq++) {
+        next.tv_nsec += cycle * 1000;
+        while (next.tv_nsec >= 1000000000) {
+            next.tv_nsec -= 1000000000;
+            next.tv_sec++;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+
+        hdr->seq   = seq;
+        hdr->stamp = now_ns();
+        if (write_full(sock, buf, size) <= 0) {
+            perror("write to socket");
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+
+void catch_signal(int sig)
+{
+}
+
+
+int main(int argc, char *argv[])
+{
+    pthread_attr_t  thattr;
+    pthread_t       recv_thread, send_thread;
+    int             old_error_rate = 0, old_multi_error = 0;
+    int             srv_sock, cli_sock;
+    int             ret;
+
+
+    while (1) {
+        switch (getopt(argc, argv, "d:c:s:t:T:e:m:b:a:")) {
+            case 'd':
+                dest_ip_s = optarg;
+                break;
+
+            case 'c':
+                count = atoi(optarg);
+                break;
+
+            case 's':
+                size = atoi(optarg);
+                break;
+
+            case 't':
+                cycle = atoi(optarg);
+                break;
+
+            case 'T':
+                threshold = atoi(optarg);
+                break;
+
+            case 'e':
+                error_rate = atoi(optarg);
+                break;
+
+            case 'm':
+                multi_error = atoi(optarg);
+                break;
+
+            case 'b':
+                add_rtskbs = atoi(optarg);
+                break;
+
+            case 'a':
+                accept_delay = atoi(optarg);
+                break;
+
+            case -1:
+                goto end_of_opt;
+
+            default:
+                printf("usage: %s [-d <dest_ip>] [-c <messages>] "
+                       "[-s <message_bytes>] [-t <cycle_us>] "
+                       "[-T <stall_threshold_us>] [-e <error_rate>] "
+                       "[-m <multi_error>] [-b <add_buffers>] "
+                       "[-a <accept_delay_us>]\n", argv[0]);
+                return 0;
+        }
+    }
+ end_of_opt:
+
+    if ((size < sizeof(struct msg_header)) || (size > MAX_SIZE)) {
+        printf("message size must be between %d and %d bytes\n",
+               (int)sizeof(struct msg_header), MAX_SIZE);
+        return 1;
+    }
+
+    dest_addr.sin_family = AF_INET;
+    dest_addr.sin_port   = htons(SRV_PORT);
+    inet_aton(dest_ip_s, &dest_addr.sin_addr);
+
+    signal(SIGTERM, catch_signal);
+    signal(SIGINT, catch_signal);
+    signal(SIGHUP, catch_signal);
+    mlockall(MCL_CURRENT|MCL_FUTURE);
+
+    /* the error rate is applied to sockets on creation */
+    if (error_rate >= 0 &&
+        write_param(ERROR_RATE_PARAM, error_rate, &old_error_rate) < 0) {
+        perror("cannot set error_rate (TCP error injection enabled?)");
+        return 1;
+    }
+    if (multi_error >= 0 &&
+        write_param(MULTI_ERROR_PARAM, multi_error, &old_multi_error) < 0)
+        perror("WARNING: cannot set multi_error");
+
+    printf("destination ip address: %s\n", dest_ip_s);
+    printf("messages: %u, size: %u bytes, cycle: %u us, error rate: %d\n",
+           count, size, cycle, error_rate);
+    if (accept_delay > 0)
+        printf("accept delay: %u us\n", accept_delay);
+
+    if ((srv_sock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0) {
+        perror("socket cannot be created");
+        ret = 1;
+        goto restore;
+    }
+    if ((cli_sock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0) {
+        perror("socket cannot be created");
+        close(srv_sock);
+        ret = 1;
+        goto restore;
+    }
+
+    if (ioctl(srv_sock, RTNET_RTIOC_EXTPOOL, &add_rtskbs) != add_rtskbs)
+        perror("WARNING: ioctl(RTNET_RTIOC_EXTPOOL)");
+    if (ioctl(cli_sock, RTNET_RTIOC_EXTPOOL, &add_rtskbs) != add_rtskbs)
+        perror("WARNING: ioctl(RTNET_RTIOC_EXTPOOL)");
+
+    pthread_barrier_init(&start_barrier, NULL, 2);
+
+    pthread_attr_init(&thattr);
+    pthread_attr_setdetachstate(&thattr, PTHREAD_CREATE_JOINABLE);
+    pthread_attr_setstacksize(&thattr, PTHREAD_STACK_MIN + 2 * MAX_SIZE);
+
+    ret = pthread_create(&recv_thread, &thattr, &receiver, &srv_sock);
+    if (ret) {
+        errno = ret; perror("pthread_create(receiver) failed");
+        exit(1);
+    }
+
+    /* connect only when the server is listening */
+    pthread_barrier_wait(&start_barrier);
+
+    ret = pthread_create(&send_thread, &thattr, &transmitter, &cli_sock);
+    if (ret) {
+        errno = ret; perror("pthread_create(transmitter) failed");
+        /* process termination also releases the sockets */
+        exit(1);
+    }
+
+    pthread_join(send_thread, NULL);
+    /* the receiver terminates on the last message or on a read timeout */
+    pthread_join(recv_thread, NULL);
+
+    pthread_barrier_destroy(&start_barrier);
+
+    printf("\nreceived  reordered  avg delay    min delay    max delay    "
+           "stalled  avg stall\n");
+    if (stats.received)
+        printf("%-8u  %-9u  %9.3f us  %9.3f us  %9.3f us  %-7u  "
+               "%9.3f us\n", stats.received, stats.reordered,
+               (float)stats.total / stats.received / 1000,
+               (float)stats.min / 1000, (float)stats.max / 1000,
+               stats.stalled, stats.stalled ?
+                   (float)stats.stall_total / stats.stalled / 1000 : 0.0);
+    else
+        printf("%-8u  -\n", 0);
+
+    close(cli_sock);
+    close(srv_sock);
+
+    /* the stream has to be complete whatever was lost on the way */
+    if (stats.received != count || stats.reordered) {
+        printf("FAILED: messages lost or out of order\n");
+        ret = 1;
+    } else
+        ret = 0;
+
+ restore:
+    if (error_rate >= 0)
+        write_param(ERROR_RATE_PARAM, old_error_rate, NULL);
+    if (multi_error >= 0)
+        write_param(MULTI_ERROR_PARAM, old_multi_error, NULL);
+
+    return ret;
+}
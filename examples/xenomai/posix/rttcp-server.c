@@ -70,13 +70,12 @@ void* receiver(void* arg)
         return NULL;
     }
 
-    /* Backlog is ignored, current realization just transmit state to LISTEN */
     if (listen(sock, 1) < 0) {
         perror("listen on socket");
         return NULL;
     }
 
-    /* Warning, no new socket descriptor, only one connection */
+    /* the connection gets a new socket descriptor */
     sock = accept(sock, (struct sockaddr *)&connection->client_addr, &len);
     if (sock < 0) {
         perror("accept connection");
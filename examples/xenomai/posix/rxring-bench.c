@@ -0,0 +1,395 @@
+/***
+ *
+ *  examples/xenomai/posix/rxring-bench.c
+ *
+ *  UDP receive throughput benchmark - a real-time thread blasts datagrams
+ *  over rt_loopback, received first via plain recv and then via the
+ *  memory-mapped receive ring (RTNET_RTIOC_RXRING). Reports the receive
+ *  rate, the per-datagram cost on the receiver side and lost datagrams.
+ *
+ *  RTnet - real-time networking example
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <arpa/inet.h>
+#include <limits.h>
+
+#include <rtnet.h>
+
+#define RCV_PORT                37001
+#define MAX_PAYLOAD             8192
+#define DEFAULT_ADD_BUFFERS     30
+
+char *dest_ip_s = "127.0.0.1";
+unsigned int count = 100000;
+unsigned int payload = 64;
+unsigned int frame_nr = 256;
+int add_rtskbs = DEFAULT_ADD_BUFFERS;
+
+struct sockaddr_in dest_addr;
+pthread_barrier_t start_barrier;
+volatile int sender_done;
+
+struct bench_result {
+    unsigned int    sent;
+    unsigned int    received;
+    unsigned int    corrupted;
+    long long       first, last;    /* reception of first/last datagram */
+};
+
+struct receiver_args {
+    int                 sock;
+    void                *ring;      /* NULL: use recv */
+    unsigned int        frame_size;
+    struct bench_result *result;
+};
+
+
+static inline long long timespec_ns(const struct timespec *ts)
+{
+    return ts->tv_sec * 1000000000LL + ts->tv_nsec;
+}
+
+
+static inline long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return timespec_ns(&ts);
+}
+
+
+/* sequence number followed by a pattern derived from it */
+static void fill_payload(unsigned char *buf, uint32_t seq)
+{
+    unsigned int i;
+
+    memcpy(buf, &seq, sizeof(seq));
+    for (i = sizeof(seq); i < payload; i++)
+        buf[i] = (unsigned char)(seq + i);
+}
+
+
+static void check_payload(struct bench_result *result,
+                          const unsigned char *buf, unsigned int len)
+{
+    unsigned char   ref[MAX_PAYLOAD];
+    uint32_t        seq;
+
+    if (len != payload) {
+        result->corrupted++;
+        return;
+    }
+
+    memcpy(&seq, buf, sizeof(seq));
+    fill_payload(ref, seq);
+    if (memcmp(buf, ref, payload) != 0)
+        result->corrupted++;
+    else
+        result->received++;
+
+    if (result->first == 0)
+        result->first = now_ns();
+    result->last = now_ns();
+}
+
+
+void *transmitter(void *arg)
+{
+    struct bench_result *result = arg;
+    struct sched_param  param = { .sched_priority = 80 };
+    unsigned char       buf[MAX_PAYLOAD];
+    uint32_t            seq;
+    int                 sock;
+
+
+    pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+
+    if ((sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0) {
+        perror("socket cannot be created");
+        pthread_barrier_wait(&start_barrier);
+        sender_done = 1;
+        return NULL;
+    }
+    if (ioctl(sock, RTNET_RTIOC_EXTPOOL, &add_rtskbs) != add_rtskbs)
+        perror("WARNING: ioctl(RTNET_RTIOC_EXTPOOL)");
+
+    pthread_barrier_wait(&start_barrier);
+
+    for (seq = 0; seq < count; seq++) {
+        fill_payload(buf, seq);
+        if (sendto(sock, buf, payload, 0, (struct sockaddr *)&dest_addr,
+                   sizeof(struct sockaddr_in)) == (int)payload)
+            result->sent++;
+    }
+
+    close(sock);
+    sender_done = 1;
+
+    return NULL;
+}
+
+
+void *receiver(void *arg)
+{
+    struct receiver_args    *rx = arg;
+    struct sched_param      param = { .sched_priority = 82 };
+    unsigned char           buf[MAX_PAYLOAD];
+    struct rtnet_ring_frame *frame;
+    unsigned int            index = 0;
+    int                     ret;
+
+
+    pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+
+    pthread_barrier_wait(&start_barrier);
+
+    while (1) {
+        if (!rx->ring) {
+            ret = recv(rx->sock, buf, sizeof(buf), 0);
+            if (ret < 0) {
+                if ((errno == ETIMEDOUT) && !sender_done)
+                    continue;
+                return NULL;
+            }
+            check_payload(rx->result, buf, ret);
+            continue;
+        }
+
+        frame = (struct rtnet_ring_frame *)
+            ((char *)rx->ring + index * rx->frame_size);
+
+        if (!(frame->status & RTNET_RING_USER)) {
+            ret = ioctl(rx->sock, RTNET_RTIOC_RXRING_WAIT, &index);
+            if (ret < 0) {
+                if ((errno == ETIMEDOUT) && !sender_done)
+                    continue;
+                return NULL;
+            }
+            continue;
+        }
+
+        /* read the frame only after having seen its status */
+        __sync_synchronize();
+
+        check_payload(rx->result, (unsigned char *)frame + frame->data,
+                      frame->snaplen);
+
+        /* hand the frame back to the stack */
+        __sync_synchronize();
+        frame->status = RTNET_RING_KERNEL;
+
+        if (++index == frame_nr)
+            index = 0;
+    }
+}
+
+
+static int run_bench(int use_ring, struct bench_result *result)
+{
+    struct sockaddr_in      local_addr;
+    struct receiver_args    rx;
+    struct rtnet_ring_req   req;
+    pthread_attr_t          thattr;
+    pthread_t               recv_thread, send_thread;
+    int64_t                 timeout = 100000000; /* 100 ms */
+    int                     ret;
+
+
+    memset(result, 0, sizeof(*result));
+    memset(&rx, 0, sizeof(rx));
+    rx.result = result;
+    sender_done = 0;
+
+    if ((rx.sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0) {
+        perror("socket cannot be created");
+        return -1;
+    }
+
+    local_addr.sin_family      = AF_INET;
+    local_addr.sin_port        = htons(RCV_PORT);
+    local_addr.sin_addr.s_addr = INADDR_ANY;
+    if (bind(rx.sock, (struct sockaddr *)&local_addr,
+             sizeof(local_addr)) < 0) {
+        perror("cannot bind to local ip/port");
+        close(rx.sock);
+        return -1;
+    }
+
+    ret = ioctl(rx.sock, RTNET_RTIOC_EXTPOOL, &add_rtskbs);
+    if (ret != add_rtskbs)
+        perror("WARNING: ioctl(RTNET_RTIOC_EXTPOOL)");
+
+    ioctl(rx.sock, RTNET_RTIOC_TIMEOUT, &timeout);
+
+    if (use_ring) {
+        req.frame_size = RTNET_RING_ALIGN_LEN(RTNET_RING_HDRLEN +
+            RTNET_RING_ALIGN_LEN(sizeof(struct sockaddr_in)) + payload);
+        req.frame_nr   = frame_nr;
+        if (ioctl(rx.sock, RTNET_RTIOC_RXRING, &req) < 0) {
+            perror("ioctl(RTNET_RTIOC_RXRING)");
+            close(rx.sock);
+            return -1;
+        }
+        rx.ring       = req.addr;
+        rx.frame_size = req.frame_size;
+    }
+
+    pthread_barrier_init(&start_barrier, NULL, 3);
+
+    pthread_attr_init(&thattr);
+    pthread_attr_setdetachstate(&thattr, PTHREAD_CREATE_JOINABLE);
+    pthread_attr_setstacksize(&thattr, PTHREAD_STACK_MIN + 3 * MAX_PAYLOAD);
+
+    ret = pthread_create(&recv_thread, &thattr, &receiver, &rx);
+    if (ret) {
+        errno = ret; perror("pthread_create(receiver) failed");
+        exit(1);
+    }
+    ret = pthread_create(&send_thread, &thattr, &transmitter, result);
+    if (ret) {
+        errno = ret; perror("pthread_create(transmitter) failed");
+        /* process termination also releases the sockets */
+        exit(1);
+    }
+
+    pthread_barrier_wait(&start_barrier);
+
+    pthread_join(send_thread, NULL);
+    /* the receiver terminates on the first timeout after the sender */
+    pthread_join(recv_thread, NULL);
+
+    pthread_barrier_destroy(&start_barrier);
+
+    if (rx.ring)
+        munmap(rx.ring, req.frame_size * frame_nr);
+
+    while ((close(rx.sock) < 0) && (errno == EAGAIN)) {
+        printf("socket busy - waiting...\n");
+        sleep(1);
+    }
+
+    return 0;
+}
+
+
+static void print_result(const char *name, struct bench_result *result)
+{
+    long long elapsed = result->last - result->first;
+
+    printf("%-8s  %-8u  %-8u  %-8u  %-9u  ", name, result->sent,
+           result->received, result->sent - result->received -
+           result->corrupted, result->corrupted);
+    if ((result->received > 1) && (elapsed > 0))
+        printf("%9.0f  %9.3f us\n",
+               (result->received - 1) * 1000000000.0 / elapsed,
+               (float)elapsed / (result->received - 1) / 1000);
+    else
+        printf("%9s  %9s\n", "-", "-");
+}
+
+
+void catch_signal(int sig)
+{
+}
+
+
+int main(int argc, char *argv[])
+{
+    struct bench_result plain, ring;
+
+
+    while (1) {
+        switch (getopt(argc, argv, "d:c:s:f:b:")) {
+            case 'd':
+                dest_ip_s = optarg;
+                break;
+
+            case 'c':
+                count = atoi(optarg);
+                break;
+
+            case 's':
+                payload = atoi(optarg);
+                break;
+
+            case 'f':
+                frame_nr = atoi(optarg);
+                break;
+
+            case 'b':
+                add_rtskbs = atoi(optarg);
+                break;
+
+            case -1:
+                goto end_of_opt;
+
+            default:
+                printf("usage: %s [-d <dest_ip>] [-c <datagrams>] "
+                       "[-s <payload_bytes>] [-f <ring_frames>] "
+                       "[-b <add_buffers>]\n", argv[0]);
+                return 0;
+        }
+    }
+ end_of_opt:
+
+    if ((payload < sizeof(uint32_t)) || (payload > MAX_PAYLOAD)) {
+        printf("payload must be between %d and %d bytes\n",
+               (int)sizeof(uint32_t), MAX_PAYLOAD);
+        return 1;
+    }
+    if (frame_nr == 0) {
+        printf("the ring requires at least one frame\n");
+        return 1;
+    }
+
+    dest_addr.sin_family = AF_INET;
+    dest_addr.sin_port   = htons(RCV_PORT);
+    inet_aton(dest_ip_s, &dest_addr.sin_addr);
+
+    signal(SIGTERM, catch_signal);
+    signal(SIGINT, catch_signal);
+    signal(SIGHUP, catch_signal);
+    mlockall(MCL_CURRENT|MCL_FUTURE);
+
+    printf("destination ip address: %s\n", dest_ip_s);
+    printf("datagrams: %u, payload: %u bytes, ring frames: %u\n",
+           count, payload, frame_nr);
+
+    if (run_bench(0, &plain) < 0)
+        return 1;
+    if (run_bench(1, &ring) < 0)
+        return 1;
+
+    printf("\nmode      sent      received  lost      corrupted  "
+           "rate [1/s]  per datagram\n");
+    print_result("recv", &plain);
+    print_result("rxring", &ring);
+
+    return 0;
+}
@@ -47,7 +47,31 @@ static inline void rt_arp_solicit(struct rtnet_device *rtdev, u32 target)
                 NULL, NULL, NULL);
 }
 
-void __init rt_arp_init(void);
+/* statistics of the pending address resolution */
+struct rt_arp_stats {
+    unsigned int        pending;    /* currently unresolved destinations */
+    unsigned long       queued;     /* packets held back for resolution */
+    unsigned long       resolved;   /* destinations resolved with pending
+                                       packets or requests */
+    unsigned long       timeouts;   /* destinations given up */
+    unsigned long       overflows;  /* resolutions rejected, table full */
+    unsigned long       recycled;   /* unanswered destinations given up to
+                                       make room for new ones */
+    unsigned long       dropped_full; /* packets dropped, queue full */
+    unsigned long       dropped_unresolved; /* packets dropped on timeout or
+                                               device shutdown */
+};
+
+extern struct rt_arp_stats rt_arp_stats;
+
+int rt_arp_resolve(struct dest_route *rt_buf, u32 ip, u32 saddr);
+int rt_arp_queue(struct rtskb *skb, u32 ip);
+int rt_arp_queue_batch(struct rtskb_queue *batch, unsigned int count, u32 ip);
+void rt_arp_flush_pending(u32 ip, struct rtnet_device *rtdev,
+                          unsigned char *dev_addr);
+void rt_arp_purge_pending(struct rtnet_device *rtdev);
+
+int __init rt_arp_init(void);
 void rt_arp_release(void);
 
 
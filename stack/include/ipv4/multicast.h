@@ -0,0 +1,63 @@
+/***
+ *
+ *  include/ipv4/multicast.h - IPv4 multicast group membership
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#ifndef __RTNET_MULTICAST_H_
+#define __RTNET_MULTICAST_H_
+
+#include <linux/in.h>
+#include <linux/init.h>
+#include <linux/types.h>
+
+#include <rtdev.h>
+#include <rtnet_socket.h>
+
+
+static inline int rt_ip_is_multicast(u32 addr)
+{
+    return IN_MULTICAST(ntohl(addr));
+}
+
+/* RFC 1112: 01:00:5e followed by the lower 23 bits of the group */
+static inline void rt_ip_mc_map(u32 group, unsigned char *buf)
+{
+    u32 addr = ntohl(group);
+
+    buf[0] = 0x01;
+    buf[1] = 0x00;
+    buf[2] = 0x5e;
+    buf[5] = addr & 0xFF;
+    buf[4] = (addr >> 8) & 0xFF;
+    buf[3] = (addr >> 16) & 0x7F;
+}
+
+int rt_ip_mc_join(struct rtsocket *sock, u32 group, u32 ifaddr, int ifindex);
+int rt_ip_mc_leave(struct rtsocket *sock, u32 group, u32 ifaddr, int ifindex);
+void rt_ip_mc_drop_socket(struct rtsocket *sock);
+
+int rt_ip_mc_member(u32 group, int ifindex);
+int rt_ip_mc_socket_member(struct rtsocket *sock, u32 group, int ifindex);
+
+struct rtnet_device *rt_ip_mc_output_dev(u32 saddr);
+void rt_ip_mc_release_device(struct rtnet_device *rtdev);
+
+int __init rt_ip_mc_init(void);
+void rt_ip_mc_release(void);
+
+#endif  /* __RTNET_MULTICAST_H_ */
@@ -34,6 +34,8 @@
 struct dest_route {
     u32                 ip;
     unsigned char       dev_addr[MAX_ADDR_LEN];
+    u32                 pending_ip; /* unresolved next hop, dev_addr invalid
+                                       (only set by rt_ip_route_resolve) */
     struct rtnet_device *rtdev;
 };
 
@@ -49,12 +51,14 @@ int rt_ip_route_del_net(u32 addr, u32 mask);
 
 #ifdef CONFIG_RTNET_RTIPV4_ROUTER
 int rt_ip_route_forward(struct rtskb *rtskb, u32 daddr);
+void rt_ip_route_forward_flush(void);
 #endif /* CONFIG_RTNET_RTIPV4_ROUTER */
 
 int rt_ip_route_del_host(u32 addr, struct rtnet_device *rtdev);
 int rt_ip_route_get_host(u32 addr, char* if_name, unsigned char *dev_addr,
                          struct rtnet_device *rtdev);
 int rt_ip_route_output(struct dest_route *rt_buf, u32 daddr, u32 saddr);
+int rt_ip_route_resolve(struct dest_route *rt_buf, u32 daddr, u32 saddr);
 
 int __init rt_ip_routing_init(void);
 void rt_ip_routing_release(void);
@@ -26,7 +26,7 @@
 #include <ipv4/protocol.h>
 
 /* Maximum number of active tcp sockets, must be power of 2 */
-#define RT_TCP_SOCKETS      32
+#define RT_TCP_SOCKETS      256
 
 /*Maximum number of active tcp connections, must be power of 2 */
 #define RT_TCP_CONNECTIONS  64
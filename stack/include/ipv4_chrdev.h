@@ -37,6 +37,12 @@ struct ipv4_cmd {
             __u32       ip_addr;
         } solicit;
 
+        struct {
+            __u32       count;
+            __u32       __padding;
+            __u64       ip_addrs;   /* user pointer to count addresses */
+        } solicit_list;
+
         struct {
             __u8        dev_addr[DEV_ADDR_LEN];
             __u32       ip_addr;
@@ -100,5 +106,7 @@ struct ipv4_cmd {
 					      struct ipv4_cmd)
 #define IOC_RT_HOST_ROUTE_GET_DEV       _IOWR(RTNET_IOC_TYPE_IPV4, 8,   \
 					      struct ipv4_cmd)
+#define IOC_RT_HOST_ROUTE_SOLICIT_LIST  _IOW(RTNET_IOC_TYPE_IPV4, 9,    \
+                                             struct ipv4_cmd)
 
 #endif  /* __IPV4_H_ */
@@ -28,6 +28,10 @@
 
 #define MAX_RT_DEVICES                  8
 
+/* RTnet-specific interface flag: the attached segment is trusted, UDP
+ * sockets with SO_NO_CHECK may omit checksums on it */
+#define IFF_RT_NOCSUM                   0x40000000
+
 
 #ifdef __KERNEL__
 
@@ -41,11 +45,19 @@
 
 #define PRIV_FLAG_UP                    0
 #define PRIV_FLAG_ADDING_ROUTE          1
+#define PRIV_FLAG_CAPTURED              2   /* transmission hooked by RTcap */
 
 #ifndef NETIF_F_LLTX
 #define NETIF_F_LLTX                    4096
 #endif
 
+/* the driver accepts large TCP sends and segments them in hardware, see
+ * rtskb.h (same bit as the Linux TSO feature) */
+#define RTNETIF_F_TSO                   NETIF_F_TSO
+
+/* maximum IP datagram of a large send, including the headers */
+#define RTDEV_TSO_MAX_SIZE              65535
+
 
 enum rtnet_link_state {
 	__RTNET_LINK_STATE_XOFF = 0,
@@ -54,6 +66,16 @@ enum rtnet_link_state {
 	__RTNET_LINK_STATE_NOCARRIER,
 };
 
+/***
+ *  rtdev_mc_list - link layer multicast address, see struct dev_mc_list
+ */
+struct rtdev_mc_list {
+    struct rtdev_mc_list *next;
+    unsigned char       dmi_addr[MAX_ADDR_LEN];
+    unsigned char       dmi_addrlen;
+    int                 dmi_users;
+};
+
 /***
  *  rtnet_device
  */
@@ -103,6 +125,9 @@ struct rtnet_device {
     int                 promiscuity;
     int                 allmulti;
 
+    struct rtdev_mc_list *mc_list;  /* multicast filter, nrt_lock protected */
+    int                 mc_count;
+
     __u32               local_ip;   /* IP address in network order  */
     __u32               broadcast_ip; /* broadcast IP in network order */
 
@@ -143,6 +168,9 @@ struct rtnet_device {
     unsigned int        (*get_mtu)(struct rtnet_device *rtdev,
                                    unsigned int priority);
 
+    /* reprograms the hardware filter from mc_list (non-RT, nrt_lock held) */
+    void                (*set_multicast_list)(struct rtnet_device *rtdev);
+
     int                 (*do_ioctl)(struct rtnet_device *rtdev, 
 				    unsigned int request, void * cmd);
     struct net_device_stats *(*get_stats)(struct rtnet_device *rtdev);
@@ -208,7 +236,21 @@ static inline void rtdev_dereference(struct rtnet_device *rtdev)
     atomic_dec(&rtdev->refcount);
 }
 
+/***
+ *  rtdev_can_tso - check if large sends can be passed to a device
+ *  @rtdev: output device
+ *
+ *  RTmac disciplines schedule and RTcap records single frames, so do not use
+ *  large sends while one of them is attached.
+ */
+static inline int rtdev_can_tso(struct rtnet_device *rtdev)
+{
+    return (rtdev->features & RTNETIF_F_TSO) && rtdev->mac_disc == NULL &&
+        !test_bit(PRIV_FLAG_CAPTURED, &rtdev->priv_flags);
+}
+
 int rtdev_xmit(struct rtskb *skb);
+int rtdev_xmit_batch(struct rtskb_queue *batch);
 
 #ifdef CONFIG_RTNET_ADDON_PROXY
 int rtdev_xmit_proxy(struct rtskb *skb);
@@ -219,6 +261,9 @@ unsigned int rt_hard_mtu(struct rtnet_device *rtdev, unsigned int priority);
 int rtdev_open(struct rtnet_device *rtdev);
 int rtdev_close(struct rtnet_device *rtdev);
 
+int rtdev_mc_add(struct rtnet_device *rtdev, const unsigned char *addr);
+int rtdev_mc_del(struct rtnet_device *rtdev, const unsigned char *addr);
+
 int rtdev_map_rtskb(struct rtskb *skb);
 void rtdev_unmap_rtskb(struct rtskb *skb);
 
@@ -77,6 +77,20 @@ typedef int64_t                 nanosecs_rel_t;
  * Use RTNET_RTIOC_TIMEOUT with any negative timeout value instead. */
 #define RTNET_RTIOC_EXTPOOL     _IOW(RTIOC_TYPE_NETWORK, 0x14, unsigned int)
 #define RTNET_RTIOC_SHRPOOL     _IOW(RTIOC_TYPE_NETWORK, 0x15, unsigned int)
+#define RTNET_RTIOC_RECVMMSG    _IOWR(RTIOC_TYPE_NETWORK, 0x16, \
+                                      struct rtnet_mmsg_args)
+#define RTNET_RTIOC_SENDMMSG    _IOWR(RTIOC_TYPE_NETWORK, 0x17, \
+                                      struct rtnet_mmsg_args)
+#define RTNET_RTIOC_RXRING      _IOWR(RTIOC_TYPE_NETWORK, 0x18, \
+                                      struct rtnet_ring_req)
+#define RTNET_RTIOC_RXRING_WAIT _IOW(RTIOC_TYPE_NETWORK, 0x19, unsigned int)
+#define RTNET_RTIOC_RXLIMIT     _IOW(RTIOC_TYPE_NETWORK, 0x1a, \
+                                     struct rtnet_rx_limit)
+#define RTNET_RTIOC_SOCKSTATS   _IOR(RTIOC_TYPE_NETWORK, 0x1b, \
+                                     struct rtnet_sock_stats)
+#define RTNET_RTIOC_TXRING      _IOWR(RTIOC_TYPE_NETWORK, 0x1c, \
+                                      struct rtnet_ring_req)
+#define RTNET_RTIOC_TXRING_KICK _IO(RTIOC_TYPE_NETWORK, 0x1d)
 
 /* socket transmission priorities */
 #define SOCK_MAX_PRIO           0
@@ -93,6 +107,103 @@ typedef int64_t                 nanosecs_rel_t;
 /* argument construction for RTNET_RTIOC_XMITPARAMS */
 #define SOCK_XMIT_PARAMS(priority, channel) ((priority) | ((channel) << 16))
 
+/* batched datagram I/O of UDP sockets (recvmmsg/sendmmsg semantics):
+ * the IOCTLs return the number of processed messages, msg_len reports the
+ * bytes per message */
+#define RTNET_MMSG_IOV_MAX      8   /* maximum iovec length per message */
+
+struct rtnet_mmsghdr {
+    struct msghdr           msg_hdr;
+    unsigned int            msg_len;
+};
+
+struct rtnet_mmsg_args {
+    struct rtnet_mmsghdr    *msgvec;
+    unsigned int            vlen;
+    unsigned int            flags;      /* MSG_* for all messages */
+};
+
+/* memory-mapped receive ring (RTNET_RTIOC_RXRING): frame_nr frames of
+ * frame_size bytes each, every frame starting with a struct rtnet_ring_frame,
+ * followed by the source address and, at offset data, the payload. The stack
+ * fills frames in ascending order and hands them over by setting
+ * RTNET_RING_USER, the application returns them by resetting status to
+ * RTNET_RING_KERNEL. RTNET_RTIOC_RXRING_WAIT blocks (with the socket timeout)
+ * until the given frame has been handed over. */
+#define RTNET_RING_KERNEL       0x00        /* frame owned by the stack     */
+#define RTNET_RING_USER         0x01        /* frame holds a datagram       */
+#define RTNET_RING_TRUNC        0x02        /* datagram exceeded the frame  */
+
+/* memory-mapped transmit ring of packet sockets (RTNET_RTIOC_TXRING), same
+ * layout as the receive ring. The application fills frames in ascending
+ * order - len, data and optionally a struct sockaddr_ll destination of
+ * addr_len bytes behind the header (0: bound address) - and marks them
+ * RTNET_RING_SEND. RTNET_RTIOC_TXRING_KICK passes all consecutively marked
+ * frames to the device and returns their number. The stack hands each frame
+ * back as RTNET_RING_AVAILABLE, or RTNET_RING_ERROR if it was rejected, with
+ * stamp set to the time of the hand-over. With an RTmac discipline like TDMA,
+ * the kick only queues the frames, they go out in the next matching slot. */
+#define RTNET_RING_AVAILABLE    0x00        /* frame owned by the application */
+#define RTNET_RING_SEND         0x01        /* frame ready for transmission */
+#define RTNET_RING_SENDING      0x04        /* frame taken by the stack     */
+#define RTNET_RING_ERROR        0x08        /* frame could not be sent      */
+
+#define RTNET_RING_ALIGN        16
+#define RTNET_RING_ALIGN_LEN(x) (((x) + RTNET_RING_ALIGN - 1) & \
+                                 ~(RTNET_RING_ALIGN - 1))
+
+struct rtnet_ring_frame {
+    volatile uint32_t       status;
+    uint32_t                len;        /* original datagram length */
+    uint32_t                snaplen;    /* bytes stored in the frame */
+    uint16_t                data;       /* payload offset from frame start */
+    uint16_t                addr_len;   /* length of the source address */
+    uint64_t                stamp;      /* reception/transmission time (ns) */
+};
+
+#define RTNET_RING_HDRLEN       RTNET_RING_ALIGN_LEN(sizeof(struct rtnet_ring_frame))
+
+struct rtnet_ring_req {
+    unsigned int            frame_size; /* multiple of RTNET_RING_ALIGN */
+    unsigned int            frame_nr;
+    void                    *addr;      /* returned mapping of the ring */
+};
+
+/* receive queue limit (RTNET_RTIOC_RXLIMIT), a depth of 0 leaves the queue
+ * bounded by the socket pool only. Depth 1 together with
+ * RTNET_RXQ_DROP_OLDEST keeps just the latest datagram, e.g. for cyclic
+ * process data. */
+#define RTNET_RXQ_DROP_NEWEST   0           /* reject arriving datagrams */
+#define RTNET_RXQ_DROP_OLDEST   1           /* displace the oldest one   */
+
+struct rtnet_rx_limit {
+    unsigned int            depth;
+    unsigned int            policy;     /* RTNET_RXQ_* */
+};
+
+/* per-socket reception counters (RTNET_RTIOC_SOCKSTATS) */
+struct rtnet_sock_stats {
+    uint64_t                received;       /* delivered to the socket */
+    uint64_t                dropped_full;   /* lost due to the queue limit */
+    uint64_t                dropped_nobuf;  /* lost due to an empty pool */
+    uint32_t                queued;         /* currently waiting */
+};
+
+/* RTnet-specific TCP socket options (level IPPROTO_TCP), unsigned int values.
+ * The retransmission timeout is derived from the measured round-trip time
+ * and kept between RTNET_TCP_RTO_MIN and RTNET_TCP_RTO_MAX (microseconds);
+ * a connection is considered lost after RTNET_TCP_RETRIES unsuccessful
+ * retransmissions. RTNET_TCP_WINDOW sets the receive window in bytes, it
+ * has to be set before connect() or listen(). If RTNET_TCP_QUICKACK is
+ * non-zero, received data is acknowledged at once instead of delaying the
+ * ACK in the hope to send it along with a reply. The standard options
+ * TCP_NODELAY and TCP_CORK control the coalescing of written data. */
+#define RTNET_TCP_RTO_MIN       0x100
+#define RTNET_TCP_RTO_MAX       0x101
+#define RTNET_TCP_RETRIES       0x102
+#define RTNET_TCP_WINDOW        0x103
+#define RTNET_TCP_QUICKACK      0x104
+
 
 #ifdef __KERNEL__
 
@@ -45,22 +45,35 @@ struct rt_proc_call {
     atomic_t            ref_count;
     wait_queue_head_t   call_wq;
     rtpc_cleanup_proc   cleanup_handler;
+    nanosecs_abs_t      queued;     /* for the dispatch latency */
+    int                 pooled;     /* taken from the call pool */
     char                priv_data[0] __attribute__ ((aligned(8)));
 };
 
 #define CALL_PENDING    1000 /* result value for blocked calls */
 
+/* largest private data of a call served from the call pool, larger ones
+   are allocated on demand */
+#define RTPC_POOL_PRIV_SIZE 256
+
 
 int rtnet_rtpc_dispatch_call(rtpc_proc rt_proc, unsigned int timeout,
                              void *priv_data, size_t priv_data_size,
                              rtpc_copy_back_proc copy_back_handler,
                              rtpc_cleanup_proc cleanup_handler);
 
+int rtnet_rtpc_dispatch_calls(rtpc_proc rt_proc, unsigned int timeout,
+                              void *priv_data, size_t priv_data_size,
+                              unsigned int count,
+                              rtpc_copy_back_proc copy_back_handler,
+                              rtpc_cleanup_proc cleanup_handler);
+
 
 void rtnet_rtpc_complete_call(struct rt_proc_call *call, int result);
 void rtnet_rtpc_complete_call_nrt(struct rt_proc_call *call, int result);
 
 #define rtpc_dispatch_call                  rtnet_rtpc_dispatch_call
+#define rtpc_dispatch_calls                 rtnet_rtpc_dispatch_calls
 #define rtpc_complete_call                  rtnet_rtpc_complete_call
 #define rtpc_complete_call_nrt              rtnet_rtpc_complete_call_nrt
 
@@ -38,6 +38,19 @@
 #include <rtdm/rtdm_driver.h>
 
 
+/* memory-mapped ring, see RTNET_RTIOC_RXRING and RTNET_RTIOC_TXRING */
+struct rtsocket_ring {
+    void                    *buf;
+    size_t                  size;
+    unsigned int            frame_size;
+    unsigned int            frame_nr;
+    unsigned int            head;       /* next frame to fill or send */
+
+    rtdm_lock_t             lock;
+    rtdm_event_t            event;
+    atomic_t                refs;       /* socket + user mappings */
+};
+
 struct rtsocket {
     unsigned short          protocol;
 
@@ -46,11 +59,15 @@ struct rtsocket {
     struct mutex            pool_nrt_lock;
 
     struct rtskb_queue      incoming;
+    atomic_t                rx_queued;  /* datagrams in incoming */
+    unsigned int            rx_limit;   /* max. rx_queued, 0 for pool size */
+    unsigned int            rx_policy;  /* RTNET_RXQ_* */
 
     rtdm_lock_t             param_lock;
 
     unsigned int            priority;
     nanosecs_rel_t          timeout;    /* receive timeout, 0 for infinite */
+    unsigned int            options;    /* RT_SOCK_* (SOL_SOCKET options) */
 
     rtdm_sem_t              pending_sem;
 
@@ -58,6 +75,15 @@ struct rtsocket {
                                              void *arg);
     void                    *callback_arg;
 
+    struct rtsocket_ring    *rx_ring;   /* optional, replaces incoming */
+    struct rtsocket_ring    *tx_ring;   /* optional, packet sockets only */
+
+    struct {
+        unsigned long       received;
+        unsigned long       dropped_full;
+        unsigned long       dropped_nobuf;
+    } stats;                            /* protected by param_lock */
+
     union {
         /* IP specific */
         struct {
@@ -69,6 +95,11 @@ struct rtsocket {
             int             reg_index;  /* index in port registry */
             u8              tos;
             u8              state;
+            u16             ip_id;      /* ID of next unfragmented datagram */
+            u8              reuse;      /* RT_INET_REUSE* (SO_REUSE*) */
+            u8              no_check;   /* SO_NO_CHECK, UDP only */
+
+            unsigned int    frag_collectors; /* pending IP reassemblies */
         } inet;
 
         /* packet socket specific */
@@ -80,6 +111,15 @@ struct rtsocket {
 };
 
 
+/* generic socket options */
+#define RT_SOCK_TIMESTAMPNS         0x01
+
+
+/* address sharing options of inet sockets */
+#define RT_INET_REUSEADDR           0x01
+#define RT_INET_REUSEPORT           0x02
+
+
 static inline struct rtdm_dev_context *rt_socket_context(struct rtsocket *sock)
 {
     return container_of((void *)sock, struct rtdm_dev_context, dev_private);
@@ -90,6 +130,18 @@ static inline struct rtdm_dev_context *rt_socket_context(struct rtsocket *sock)
 #define rt_socket_dereference(sock) \
     atomic_dec(&(rt_socket_context(sock)->close_lock_count))
 
+/* account a packet lost because the socket pool ran empty */
+static inline void rt_socket_drop_nobuf(struct rtsocket *sock)
+{
+    rtdm_lockctx_t context;
+
+    rtdm_lock_get_irqsave(&sock->param_lock, context);
+    sock->stats.dropped_nobuf++;
+    rtdm_lock_put_irqrestore(&sock->param_lock, context);
+}
+
+extern unsigned int socket_rtskbs;    /* default size of socket pools */
+
 int rt_socket_init(struct rtdm_dev_context *context, unsigned short protocol);
 int rt_socket_cleanup(struct rtdm_dev_context *context);
 int rt_socket_common_ioctl(struct rtdm_dev_context *context,
@@ -98,6 +150,29 @@ int rt_socket_common_ioctl(struct rtdm_dev_context *context,
 int rt_socket_if_ioctl(struct rtdm_dev_context *context,
                        rtdm_user_info_t *user_info,
                        int request, void *arg);
+struct rtskb *rt_socket_queue_rx(struct rtsocket *sock, struct rtskb *skb);
+int rt_socket_common_setsockopt(struct rtsocket *sock, int optname,
+                                const void *optval, socklen_t optlen);
+int rt_socket_common_getsockopt(struct rtsocket *sock, int optname,
+                                void *optval, socklen_t *optlen);
+void rt_socket_recv_timestamp(struct rtsocket *sock,
+                              rtdm_user_info_t *user_info,
+                              struct msghdr *msg, nanosecs_abs_t stamp);
+int rt_socket_rxring_setup(struct rtdm_dev_context *context,
+                           rtdm_user_info_t *user_info,
+                           struct rtnet_ring_req *req);
+int rt_socket_rxring_wait(struct rtsocket *sock, unsigned int index);
+int rt_socket_rxring_put(struct rtsocket_ring *ring, struct rtskb *skb,
+                         unsigned int len, const void *addr,
+                         unsigned int addr_len);
+int rt_socket_txring_setup(struct rtdm_dev_context *context,
+                           rtdm_user_info_t *user_info,
+                           struct rtnet_ring_req *req);
+struct rtnet_ring_frame *rt_socket_txring_claim(struct rtsocket_ring *ring);
+void rt_socket_txring_complete(struct rtnet_ring_frame *frame, int err);
+struct rtsocket_ring *rt_socket_ring_get(struct rtsocket *sock,
+                                         struct rtsocket_ring **slot);
+void rt_socket_ring_put(struct rtsocket_ring *ring);
 #ifdef CONFIG_RTNET_SELECT_SUPPORT
 int rt_socket_select_bind(struct rtdm_dev_context *context,
                           rtdm_selector_t *selector,
@@ -1,6 +1,6 @@
 /***
  *
- *  ipv4/tcp/timerwheel.h - timerwheel interface for RTnet
+ *  include/rtnet_timerwheel.h - timerwheel interface for RTnet
  *
  *  Copyright (C) 2009 Vladimir Zapolskiy <vladimir.zapolskiy@siemens.com>
  *
@@ -19,11 +19,27 @@
  *
  */
 
-#ifndef __TIMERWHEEL_H_
-#define __TIMERWHEEL_H_
+#ifndef __RTNET_TIMERWHEEL_H_
+#define __RTNET_TIMERWHEEL_H_
 
+#include <linux/init.h>
 #include <linux/list.h>
-#include <rtnet.h>
+
+#include <rtnet_sys.h>
+
+/*
+  The timer wheel is a stack-wide service for coarse protocol timers
+  (retransmissions, delayed ACKs, keepalives). Handlers run in the context
+  of a single real-time task, expired timers are processed in batches.
+
+  One tick lasts 2^TIMERWHEEL_GRANULARITY ns (1.05 ms), timers can be set
+  up to TIMERWHEEL_HORIZON ticks (about 4.9 hours) ahead.
+*/
+#define TIMERWHEEL_GRANULARITY      20
+#define TIMERWHEEL_LEVEL_BITS       6
+#define TIMERWHEEL_LEVELS           4
+#define TIMERWHEEL_HORIZON          \
+    (1ULL << (TIMERWHEEL_LEVEL_BITS * TIMERWHEEL_LEVELS))
 
 #define TIMERWHEEL_TIMER_UNUSED    -1
 
@@ -33,7 +49,8 @@ struct timerwheel_timer {
     struct list_head            link;
     timerwheel_timer_handler    handler;
     void                        *data;
-    int                         slot;
+    int                         slot;     /* >= 0 while armed */
+    u64                         expires;  /* in wheel ticks */
     volatile int                refcount; /* only written by wheel task */
 };
 
@@ -55,9 +72,8 @@ int timerwheel_remove_timer(struct timerwheel_timer *timer);
 
 void timerwheel_remove_timer_sync(struct timerwheel_timer *timer);
 
-int timerwheel_init(nanosecs_rel_t timeout,
-                    unsigned int granularity);
+int __init timerwheel_init(void);
 
 void timerwheel_cleanup(void);
 
-#endif
+#endif /* __RTNET_TIMERWHEEL_H_ */
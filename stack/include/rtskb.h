@@ -134,6 +134,31 @@ disciplines when they add a rtskb to their internal transmission queue. In such
 a case, the RTSKB_CAP_RTMAC_STAMP bit is set in cap_flags to indicate that the
 cap_rtmac_stamp field now contains valid data.
 
+
+7. Shared rtskbs
+
+A protocol can keep a reference on an outgoing rtskb (rtskb_get()) in order
+to transmit the very same buffer again later, e.g. for retransmissions. Every
+kfree_rtskb() drops one reference, the rtskb returns to its pool with the last
+one. As long as a rtskb is shared (rtskb_shared()), it must neither be modified
+nor passed to rtdev_xmit() again, the driver may still be working on it.
+Consumers which turn outgoing rtskbs into incoming ones, like the loopback
+device, have to copy shared rtskbs first. A chain is shared as a whole via
+the reference count of its first rtskb.
+
+
+8. Large Sends
+
+A TCP segment exceeding the MTU can be passed to devices which segment it in
+hardware (RTNETIF_F_TSO, see rtdev_can_tso()). Such a large send is a chain:
+the first rtskb carries the link, IP, and TCP headers followed by payload,
+the further rtskbs carry payload only, from data to tail. Each rtskb of the
+chain becomes one DMA buffer. gso_size of the first rtskb is set to the
+payload per frame the device has to generate. The TCP checksum field holds
+the pseudo header sum without length, the device completes IP and TCP
+checksums of each frame. Devices without the feature never see large sends,
+rtdev_xmit() drops them, and the protocol segments in software instead.
+
  ***/
 
 
@@ -160,6 +185,8 @@ struct rtskb {
 
     struct rtskb_queue  *pool;      /* owning pool */
 
+    atomic_t            users;      /* references, see rtskb_get() */
+
     unsigned int        priority;   /* bit 0..15: prio, 16..31: user-defined */
 
     struct rtsocket     *sk;        /* assigned socket */
@@ -203,6 +230,8 @@ struct rtskb {
     unsigned char       ip_summed;
     unsigned int        csum;
 
+    unsigned short      gso_size;   /* payload per frame of a large send */
+
     unsigned char       *data;
     unsigned char       *tail;
     unsigned char       *end;
@@ -280,10 +309,65 @@ extern void rtskb_under_panic(struct rtskb *skb, int len, void *here);
 
 extern struct rtskb *alloc_rtskb(unsigned int size, struct rtskb_queue *pool);
 #define dev_alloc_rtskb(len, pool)  alloc_rtskb(len, pool)
+extern int alloc_rtskbs(unsigned int size, unsigned int count,
+                        struct rtskb_queue *pool, struct rtskb_queue *batch);
 
 extern void kfree_rtskb(struct rtskb *skb);
 #define dev_kfree_rtskb(a)  kfree_rtskb(a)
 
+/***
+ *  rtskb_get - take an additional reference on a rtskb
+ */
+static inline struct rtskb *rtskb_get(struct rtskb *skb)
+{
+    atomic_inc(&skb->users);
+    return skb;
+}
+
+/***
+ *  rtskb_chain_append - add a rtskb to the end of a chain
+ *  @head: first rtskb of the chain
+ *  @skb: single rtskb to append
+ */
+static inline void rtskb_chain_append(struct rtskb *head, struct rtskb *skb)
+{
+    head->chain_end->next = skb;
+    head->chain_end       = skb;
+#ifdef CONFIG_RTNET_CHECKED
+    head->chain_len++;
+#endif
+}
+
+/***
+ *  rtskb_chain_data_len - data length of all rtskbs of a chain
+ *  @head: first rtskb of the chain
+ */
+static inline unsigned int rtskb_chain_data_len(struct rtskb *head)
+{
+    struct rtskb *skb = head;
+    unsigned int len  = head->len;
+
+    while (skb != head->chain_end) {
+        skb  = skb->next;
+        len += skb->len;
+    }
+
+    return len;
+}
+
+/***
+ *  rtskb_shared - check if a rtskb is referenced more than once
+ */
+static inline int rtskb_shared(struct rtskb *skb)
+{
+#ifdef CONFIG_RTNET_ADDON_RTCAP
+    /* still queued for capturing */
+    if (skb->cap_flags & RTSKB_CAP_SHARED)
+        return 1;
+#endif
+    return atomic_read(&skb->users) != 1;
+}
+
 
 /***
  *  rtskb_queue_init - initialize the queue
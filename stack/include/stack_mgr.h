@@ -49,12 +49,19 @@ struct rtpacket_type {
     int                 (*handler)(struct rtskb *, struct rtpacket_type *);
     int                 (*err_handler)(struct rtskb *, struct rtnet_device *,
                                        struct rtpacket_type *);
+
+    /* optional, see rt_stack_request_flush() */
+    void                (*flush_handler)(struct rtpacket_type *);
+    int                 flush_pending;
+    struct rtpacket_type *flush_next;
 };
 
 
 int rtdev_add_pack(struct rtpacket_type *pt);
 int rtdev_remove_pack(struct rtpacket_type *pt);
 
+void rt_stack_request_flush(struct rtpacket_type *pt);
+
 void rt_stack_connect(struct rtnet_device *rtdev, struct rtnet_mgr *mgr);
 void rt_stack_disconnect(struct rtnet_device *rtdev);
 
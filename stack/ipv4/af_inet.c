@@ -24,6 +24,7 @@
  */
 
 #include <linux/module.h>
+#include <linux/slab.h>
 #include <asm/uaccess.h>
 
 #include <ipv4_chrdev.h>
@@ -32,12 +33,16 @@
 #include <ipv4/arp.h>
 #include <ipv4/icmp.h>
 #include <ipv4/ip_output.h>
+#include <ipv4/multicast.h>
 #include <ipv4/protocol.h>
 #include <ipv4/route.h>
 
 
 MODULE_LICENSE("GPL");
 
+/* upper limit of addresses per IOC_RT_HOST_ROUTE_SOLICIT_LIST */
+#define RT_ROUTE_SOLICIT_MAX    1024
+
 struct route_solicit_params {
     struct rtnet_device *rtdev;
     __u32               ip_addr;
@@ -79,6 +84,58 @@ static void cleanup_route_solicit(void *priv_data)
 
 
 
+/***
+ *  route_solicit_list - solicit a list of addresses in one batch (locked)
+ */
+static int route_solicit_list(struct rtnet_device *rtdev,
+                              struct ipv4_cmd *cmd)
+{
+    struct route_solicit_params *params;
+    __u32                       *ip_addrs;
+    unsigned int                count = cmd->args.solicit_list.count;
+    unsigned int                i;
+    int                         ret;
+
+
+    if ((count == 0) || (count > RT_ROUTE_SOLICIT_MAX))
+        return -EINVAL;
+
+    ip_addrs = kmalloc(count * sizeof(__u32), GFP_KERNEL);
+    if (ip_addrs == NULL)
+        return -ENOMEM;
+
+    if (copy_from_user(ip_addrs,
+            (void *)(unsigned long)cmd->args.solicit_list.ip_addrs,
+            count * sizeof(__u32)) != 0) {
+        ret = -EFAULT;
+        goto out;
+    }
+
+    params = kmalloc(count * sizeof(*params), GFP_KERNEL);
+    if (params == NULL) {
+        ret = -ENOMEM;
+        goto out;
+    }
+
+    for (i = 0; i < count; i++) {
+        params[i].ip_addr = ip_addrs[i];
+        params[i].rtdev   = rtdev;
+        rtdev_reference(rtdev);
+    }
+
+    ret = rtpc_dispatch_calls(route_solicit_handler, 0, params,
+                              sizeof(*params), count, NULL,
+                              cleanup_route_solicit);
+
+    kfree(params);
+
+  out:
+    kfree(ip_addrs);
+    return ret;
+}
+
+
+
 #ifdef CONFIG_RTNET_RTIPV4_ICMP
 static int ping_handler(struct rt_proc_call *call)
 {
@@ -159,6 +216,15 @@ static int ipv4_ioctl(struct rtnet_device *rtdev, unsigned int request,
             mutex_unlock(&rtdev->nrt_lock);
             break;
 
+        case IOC_RT_HOST_ROUTE_SOLICIT_LIST:
+            if (mutex_lock_interruptible(&rtdev->nrt_lock))
+                return -ERESTARTSYS;
+
+            ret = route_solicit_list(rtdev, &cmd);
+
+            mutex_unlock(&rtdev->nrt_lock);
+            break;
+
         case IOC_RT_HOST_ROUTE_DELETE:
         case IOC_RT_HOST_ROUTE_DELETE_DEV:
             ret = rt_ip_route_del_host(cmd.args.delhost.ip_addr, rtdev);
@@ -275,8 +341,16 @@ static void rt_ip_ifdown(struct rtnet_device *rtdev)
 
 
 
+static void rt_ip_unregister_device(struct rtnet_device *rtdev)
+{
+    rt_ip_route_del_all(rtdev);
+    rt_ip_mc_release_device(rtdev);
+}
+
+
+
 static struct rtdev_event_hook  rtdev_hook = {
-    .unregister_device = rt_ip_ifdown,
+    .unregister_device = rt_ip_unregister_device,
     .ifup =              rt_ip_ifup,
     .ifdown =            rt_ip_ifdown
 };
@@ -294,16 +368,6 @@ static int __init rt_ipv4_proto_init(void)
     int result;
 
 
-    /* Network-Layer */
-    rt_ip_init();
-    rt_arp_init();
-
-    /* Transport-Layer */
-    for (i=0; i<MAX_RT_INET_PROTOCOLS; i++)
-        rt_inet_protocols[i]=NULL;
-
-    rt_icmp_init();
-
 #ifdef CONFIG_PROC_FS
     ipv4_proc_root = proc_mkdir("ipv4", rtnet_proc_root);
     if (!ipv4_proc_root) {
@@ -312,27 +376,47 @@ static int __init rt_ipv4_proto_init(void)
     }
 #endif /* CONFIG_PROC_FS */
 
-    if ((result = rt_ip_routing_init()) < 0)
+    /* Network-Layer */
+    if ((result = rt_ip_init()) < 0)
+        goto err0;
+    if ((result = rt_arp_init()) < 0)
         goto err1;
-    if ((result = rtnet_register_ioctls(&ipv4_ioctls)) < 0)
+
+    /* Transport-Layer */
+    for (i=0; i<MAX_RT_INET_PROTOCOLS; i++)
+        rt_inet_protocols[i]=NULL;
+
+    rt_icmp_init();
+
+    if ((result = rt_ip_routing_init()) < 0)
         goto err2;
+    if ((result = rt_ip_mc_init()) < 0)
+        goto err3;
+    if ((result = rtnet_register_ioctls(&ipv4_ioctls)) < 0)
+        goto err4;
 
     rtdev_add_event_hook(&rtdev_hook);
 
     return 0;
 
-  err2:
+  err4:
+    rt_ip_mc_release();
+
+  err3:
     rt_ip_routing_release();
 
+  err2:
+    rt_icmp_release();
+    rt_arp_release();
+
   err1:
+    rt_ip_release();
+
+  err0:
 #ifdef CONFIG_PROC_FS
     remove_proc_entry("ipv4", rtnet_proc_root);
 #endif /* CONFIG_PROC_FS */
 
-    rt_icmp_release();
-    rt_arp_release();
-    rt_ip_release();
-
     return result;
 }
 
@@ -341,18 +425,22 @@ static void __exit rt_ipv4_proto_release(void)
 {
     rtdev_del_event_hook(&rtdev_hook);
     rtnet_unregister_ioctls(&ipv4_ioctls);
-    rt_ip_routing_release();
 
-#ifdef CONFIG_PROC_FS
-    remove_proc_entry("ipv4", rtnet_proc_root);
-#endif
+    /* stop reception first, the router still holds packets otherwise */
+    rt_ip_release();
+
+    rt_ip_mc_release();
+    rt_ip_routing_release();
 
     /* Transport-Layer */
     rt_icmp_release();
 
     /* Network-Layer */
     rt_arp_release();
-    rt_ip_release();
+
+#ifdef CONFIG_PROC_FS
+    remove_proc_entry("ipv4", rtnet_proc_root);
+#endif
 }
 
 
@@ -21,6 +21,8 @@
  *
  */
 
+#include <linux/moduleparam.h>
+
 #include <rtdev.h>
 #include <stack_mgr.h>
 #include <ipv4/arp.h>
@@ -29,6 +31,52 @@
 #include <ipv4/ip_input.h>
 #endif /* CONFIG_RTNET_ADDON_PROXY_ARP */
 
+
+/* Pending address resolutions
+ *
+ * Destinations without a host route are solicited via ARP, and outgoing
+ * packets are held back in a small per-destination queue until the reply
+ * installs the route. Both the number of destinations and the number of
+ * queued packets are bounded, unanswered requests are repeated a limited
+ * number of times before all waiting packets are dropped. When the table is
+ * full, the destination unanswered for the longest time is given up early,
+ * so that unreachable hosts cannot lock out resolvable ones. */
+#define RT_ARP_PENDING_ENTRIES  16
+
+struct rt_arp_pending {
+    u32                 ip;         /* 0 if unused */
+    struct rtnet_device *rtdev;
+    struct rtskb_queue  queue;
+    unsigned int        queue_len;
+    unsigned int        solicits;
+    int                 resend;
+    nanosecs_abs_t      next_solicit;
+};
+
+static unsigned int arp_queue_len = 4;
+module_param(arp_queue_len, uint, 0444);
+MODULE_PARM_DESC(arp_queue_len, "packets held back per unresolved "
+                 "destination (default: 4)");
+
+static unsigned int arp_solicits = 3;
+module_param(arp_solicits, uint, 0444);
+MODULE_PARM_DESC(arp_solicits, "ARP requests sent before an unresolved "
+                 "destination is given up (default: 3)");
+
+static unsigned int arp_solicit_interval = 100;
+module_param(arp_solicit_interval, uint, 0444);
+MODULE_PARM_DESC(arp_solicit_interval, "interval between ARP requests in ms "
+                 "(default: 100)");
+
+static struct rt_arp_pending    arp_pending[RT_ARP_PENDING_ENTRIES];
+static rtdm_lock_t              arp_pending_lock = RTDM_LOCK_UNLOCKED;
+static rtdm_timer_t             arp_timer;
+static int                      arp_timer_active;
+static rtdm_nrtsig_t            arp_signal;
+
+struct rt_arp_stats             rt_arp_stats;
+
+
 /***
  *  arp_send:   Create and send an arp packet. If (dest_hw == NULL),
  *              we create a broadcast message.
@@ -103,6 +151,470 @@ void rt_arp_send(int type, int ptype, u32 dest_ip, struct rtnet_device *rtdev,
 
 
 
+/***
+ *  rt_arp_on_link - checks if ip is located in the subnet of rtdev
+ *
+ *  The host part is derived from the trailing ones of the broadcast address.
+ */
+static inline int rt_arp_on_link(struct rtnet_device *rtdev, u32 ip)
+{
+    u32 bcast = ntohl(rtdev->broadcast_ip);
+    u32 host_mask = (bcast ^ (bcast + 1)) >> 1;
+
+
+    return (rtdev->broadcast_ip != 0) && (ip != rtdev->broadcast_ip) &&
+        (((ntohl(ip) ^ ntohl(rtdev->local_ip)) & ~host_mask) == 0);
+}
+
+
+
+/***
+ *  __rt_arp_find_pending - looks up a pending resolution
+ *
+ *  Note: must be called with arp_pending_lock held
+ */
+static inline struct rt_arp_pending *
+__rt_arp_find_pending(u32 ip, struct rtnet_device *rtdev)
+{
+    struct rt_arp_pending   *entry;
+
+
+    for (entry = arp_pending; entry < &arp_pending[RT_ARP_PENDING_ENTRIES];
+         entry++)
+        if ((entry->ip == ip) && (entry->rtdev == rtdev))
+            return entry;
+
+    return NULL;
+}
+
+
+
+/***
+ *  __rt_arp_release_pending - frees entry and hands out its queued packets
+ *
+ *  Note: must be called with arp_pending_lock held, the caller has to drop
+ *        the device reference of the entry.
+ */
+static inline void __rt_arp_release_pending(struct rt_arp_pending *entry,
+                                            struct rtskb_queue *packets)
+{
+    struct rtskb    *skb;
+
+
+    while ((skb = __rtskb_dequeue(&entry->queue)) != NULL)
+        __rtskb_queue_tail(packets, skb);
+
+    entry->ip    = 0;
+    entry->rtdev = NULL;
+    rt_arp_stats.pending--;
+}
+
+
+
+/***
+ *  __rt_arp_recycle_pending - gives up the oldest unanswered resolution
+ *
+ *  Only entries which already missed a reply are candidates, thus a burst of
+ *  new destinations cannot push out each other.
+ *  Note: must be called with arp_pending_lock held
+ */
+static struct rt_arp_pending *
+__rt_arp_recycle_pending(struct rtskb_queue *packets)
+{
+    struct rt_arp_pending   *entry;
+    struct rt_arp_pending   *oldest = NULL;
+
+
+    for (entry = arp_pending; entry < &arp_pending[RT_ARP_PENDING_ENTRIES];
+         entry++) {
+        if ((entry->ip == 0) || (entry->solicits < 2))
+            continue;
+
+        if ((oldest == NULL) || (entry->solicits > oldest->solicits) ||
+            ((entry->solicits == oldest->solicits) &&
+             (entry->next_solicit < oldest->next_solicit)))
+            oldest = entry;
+    }
+
+    if (oldest != NULL) {
+        rt_arp_stats.recycled++;
+        rt_arp_stats.dropped_unresolved += oldest->queue_len;
+
+        /* atomic_dec only, safe under the lock */
+        rtdev_dereference(oldest->rtdev);
+        __rt_arp_release_pending(oldest, packets);
+    }
+
+    return oldest;
+}
+
+
+
+/***
+ *  rt_arp_xmit - sends a held back IP packet to the resolved address
+ */
+static void rt_arp_xmit(struct rtskb *skb, unsigned char *dev_addr)
+{
+    struct rtnet_device *rtdev = skb->rtdev;
+
+
+    if (rtdev->hard_header &&
+        (rtdev->hard_header(skb, rtdev, ETH_P_IP, dev_addr, rtdev->dev_addr,
+                            skb->len) < 0)) {
+        kfree_rtskb(skb);
+        return;
+    }
+
+    rtdev_xmit(skb);
+}
+
+
+
+/***
+ *  rt_arp_resolve - starts or joins the resolution of an on-link address
+ *  @rt_buf:    route to fill in, receives a device reference on success
+ *  @ip:        address to resolve (next hop)
+ *  @saddr:     required local address or INADDR_ANY
+ */
+int rt_arp_resolve(struct dest_route *rt_buf, u32 ip, u32 saddr)
+{
+    struct rtnet_device     *rtdev = NULL;
+    struct rt_arp_pending   *entry;
+    struct rtskb_queue      packets;
+    struct rtskb            *skb;
+    rtdm_lockctx_t          context;
+    int                     solicit = 0;
+    int                     i;
+
+
+    for (i = 1; i <= MAX_RT_DEVICES; i++) {
+        if ((rtdev = rtdev_get_by_index(i)) == NULL)
+            continue;
+
+        if (((rtdev->flags & (IFF_UP | IFF_LOOPBACK | IFF_NOARP)) == IFF_UP)
+            && (rtdev->local_ip != 0) &&
+            ((saddr == INADDR_ANY) || (saddr == rtdev->local_ip)) &&
+            rt_arp_on_link(rtdev, ip))
+            break;
+
+        rtdev_dereference(rtdev);
+        rtdev = NULL;
+    }
+    if (rtdev == NULL)
+        return -EHOSTUNREACH;
+
+    rtskb_queue_init(&packets);
+
+    rtdm_lock_get_irqsave(&arp_pending_lock, context);
+
+    entry = __rt_arp_find_pending(ip, rtdev);
+    if (entry == NULL) {
+        entry = __rt_arp_find_pending(0, NULL);
+        if (entry == NULL)
+            entry = __rt_arp_recycle_pending(&packets);
+        if (entry == NULL) {
+            rt_arp_stats.overflows++;
+            rtdm_lock_put_irqrestore(&arp_pending_lock, context);
+
+            rtdev_dereference(rtdev);
+            return -EHOSTUNREACH;
+        }
+
+        entry->ip           = ip;
+        entry->rtdev        = rtdev;
+        entry->queue_len    = 0;
+        entry->solicits     = 1;
+        entry->resend       = 0;
+        entry->next_solicit = rtdm_clock_read() +
+            (nanosecs_abs_t)arp_solicit_interval * 1000000;
+        rtdev_reference(rtdev);     /* held by the entry */
+        rt_arp_stats.pending++;
+
+        if (!arp_timer_active) {
+            arp_timer_active = 1;
+            rtdm_timer_start(&arp_timer,
+                (nanosecs_rel_t)arp_solicit_interval * 1000000, 0,
+                RTDM_TIMERMODE_RELATIVE);
+        }
+        solicit = 1;
+    }
+
+    rtdm_lock_put_irqrestore(&arp_pending_lock, context);
+
+    while ((skb = __rtskb_dequeue(&packets)) != NULL)
+        kfree_rtskb(skb);
+
+    if (solicit)
+        rt_arp_solicit(rtdev, ip);
+
+    rt_buf->rtdev      = rtdev;
+    rt_buf->pending_ip = ip;
+
+    return 0;
+}
+
+
+
+/***
+ *  rt_arp_queue_batch - holds back the packets of one datagram until their
+ *                       next hop is resolved
+ *  @batch:     complete IP packets without device header, rtdev set
+ *  @count:     number of packets in @batch
+ *  @ip:        next hop (dest_route.pending_ip)
+ *
+ *  The packets are queued as one unit: if the pending queue has no room
+ *  for all of them, the whole datagram is dropped, as a part of it would
+ *  be useless to the receiver anyway.
+ *
+ *  Note: always consumes the rtskbs, just like rtdev_xmit.
+ */
+int rt_arp_queue_batch(struct rtskb_queue *batch, unsigned int count, u32 ip)
+{
+    struct rt_arp_pending   *entry;
+    struct rtskb            *skb;
+    struct rtnet_device     *rtdev;
+    rtdm_lockctx_t          context;
+    unsigned char           dev_addr[MAX_ADDR_LEN];
+    char                    if_name[IFNAMSIZ];
+    int                     ret;
+
+
+    if (rtskb_queue_empty(batch))
+        return 0;
+    rtdev = batch->first->rtdev;
+
+    rtdm_lock_get_irqsave(&arp_pending_lock, context);
+
+    entry = __rt_arp_find_pending(ip, rtdev);
+    if (entry != NULL) {
+        if (entry->queue_len + count <= arp_queue_len) {
+            while ((skb = __rtskb_dequeue(batch)) != NULL)
+                __rtskb_queue_tail(&entry->queue, skb);
+            entry->queue_len += count;
+            rt_arp_stats.queued += count;
+
+            rtdm_lock_put_irqrestore(&arp_pending_lock, context);
+            return 0;
+        }
+
+        rt_arp_stats.dropped_full += count;
+        rtdm_lock_put_irqrestore(&arp_pending_lock, context);
+
+        ret = -ENOBUFS;
+        goto drop;
+    }
+
+    rtdm_lock_put_irqrestore(&arp_pending_lock, context);
+
+    /* the resolution completed (or failed) since the route lookup */
+    if (rt_ip_route_get_host(ip, if_name, dev_addr, rtdev) == 0) {
+        while ((skb = __rtskb_dequeue(batch)) != NULL)
+            rt_arp_xmit(skb, dev_addr);
+        return 0;
+    }
+
+    rtdm_lock_get_irqsave(&arp_pending_lock, context);
+    rt_arp_stats.dropped_unresolved += count;
+    rtdm_lock_put_irqrestore(&arp_pending_lock, context);
+
+    ret = -EHOSTUNREACH;
+
+ drop:
+    while ((skb = __rtskb_dequeue(batch)) != NULL)
+        kfree_rtskb(skb);
+    return ret;
+}
+
+
+
+/***
+ *  rt_arp_queue - holds back an IP packet until its next hop is resolved
+ *  @skb:       complete IP packet without device header, skb->rtdev set
+ *  @ip:        next hop (dest_route.pending_ip)
+ *
+ *  Note: always consumes the rtskb, just like rtdev_xmit.
+ */
+int rt_arp_queue(struct rtskb *skb, u32 ip)
+{
+    struct rtskb_queue      batch;
+
+
+    rtskb_queue_init(&batch);
+    __rtskb_queue_tail(&batch, skb);
+
+    return rt_arp_queue_batch(&batch, 1, ip);
+}
+
+
+
+/***
+ *  rt_arp_flush_pending - sends held back packets to a resolved destination
+ */
+void rt_arp_flush_pending(u32 ip, struct rtnet_device *rtdev,
+                          unsigned char *dev_addr)
+{
+    struct rt_arp_pending   *entry;
+    struct rtskb_queue      packets;
+    struct rtskb            *skb;
+    rtdm_lockctx_t          context;
+
+
+    if (rt_arp_stats.pending == 0)
+        return;
+
+    rtskb_queue_init(&packets);
+
+    rtdm_lock_get_irqsave(&arp_pending_lock, context);
+
+    entry = __rt_arp_find_pending(ip, rtdev);
+    if (entry == NULL) {
+        rtdm_lock_put_irqrestore(&arp_pending_lock, context);
+        return;
+    }
+
+    __rt_arp_release_pending(entry, &packets);
+    rt_arp_stats.resolved++;
+
+    rtdm_lock_put_irqrestore(&arp_pending_lock, context);
+
+    while ((skb = __rtskb_dequeue(&packets)) != NULL)
+        rt_arp_xmit(skb, dev_addr);
+
+    rtdev_dereference(rtdev);
+}
+
+
+
+/***
+ *  rt_arp_purge_pending - drops all pending resolutions of a device
+ *  @rtdev:     device or NULL for all
+ */
+void rt_arp_purge_pending(struct rtnet_device *rtdev)
+{
+    struct rt_arp_pending   *entry;
+    struct rtnet_device     *entry_dev;
+    struct rtskb_queue      packets;
+    struct rtskb            *skb;
+    rtdm_lockctx_t          context;
+
+
+    rtskb_queue_init(&packets);
+
+    for (entry = arp_pending; entry < &arp_pending[RT_ARP_PENDING_ENTRIES];
+         entry++) {
+        rtdm_lock_get_irqsave(&arp_pending_lock, context);
+
+        entry_dev = entry->rtdev;
+        if ((entry->ip == 0) || (rtdev && (entry_dev != rtdev))) {
+            rtdm_lock_put_irqrestore(&arp_pending_lock, context);
+            continue;
+        }
+
+        rt_arp_stats.dropped_unresolved += entry->queue_len;
+        __rt_arp_release_pending(entry, &packets);
+
+        rtdm_lock_put_irqrestore(&arp_pending_lock, context);
+
+        while ((skb = __rtskb_dequeue(&packets)) != NULL)
+            kfree_rtskb(skb);
+
+        rtdev_dereference(entry_dev);
+    }
+}
+
+
+
+/***
+ *  rt_arp_timer_handler - repeats or gives up pending resolutions
+ */
+static void rt_arp_timer_handler(rtdm_timer_t *timer)
+{
+    struct rt_arp_pending   *entry;
+    struct rtskb_queue      packets;
+    struct rtskb            *skb;
+    nanosecs_abs_t          now = rtdm_clock_read();
+    nanosecs_rel_t          interval;
+    int                     signal = 0;
+    rtdm_lockctx_t          context;
+
+
+    interval = (nanosecs_rel_t)arp_solicit_interval * 1000000;
+    rtskb_queue_init(&packets);
+
+    rtdm_lock_get_irqsave(&arp_pending_lock, context);
+
+    for (entry = arp_pending; entry < &arp_pending[RT_ARP_PENDING_ENTRIES];
+         entry++) {
+        if ((entry->ip == 0) || (now < entry->next_solicit))
+            continue;
+
+        if (entry->solicits >= arp_solicits) {
+            rt_arp_stats.timeouts++;
+            rt_arp_stats.dropped_unresolved += entry->queue_len;
+
+            /* atomic_dec only, safe under the lock */
+            rtdev_dereference(entry->rtdev);
+            __rt_arp_release_pending(entry, &packets);
+        } else {
+            entry->solicits++;
+            entry->resend       = 1;
+            entry->next_solicit = now + interval;
+            signal = 1;
+        }
+    }
+
+    if (rt_arp_stats.pending > 0)
+        rtdm_timer_start_in_handler(&arp_timer, interval, 0,
+                                    RTDM_TIMERMODE_RELATIVE);
+    else
+        arp_timer_active = 0;
+
+    rtdm_lock_put_irqrestore(&arp_pending_lock, context);
+
+    /* ARP requests are sent from Linux context, we may be in IRQ context */
+    if (signal)
+        rtdm_nrtsig_pend(&arp_signal);
+
+    while ((skb = __rtskb_dequeue(&packets)) != NULL)
+        kfree_rtskb(skb);
+}
+
+
+
+/***
+ *  rt_arp_signal_handler - repeats ARP requests of pending resolutions
+ */
+static void rt_arp_signal_handler(rtdm_nrtsig_t nrtsig, void *arg)
+{
+    struct rt_arp_pending   *entry;
+    struct rtnet_device     *rtdev;
+    u32                     ip;
+    rtdm_lockctx_t          context;
+
+
+    for (entry = arp_pending; entry < &arp_pending[RT_ARP_PENDING_ENTRIES];
+         entry++) {
+        rtdm_lock_get_irqsave(&arp_pending_lock, context);
+
+        if ((entry->ip == 0) || !entry->resend) {
+            rtdm_lock_put_irqrestore(&arp_pending_lock, context);
+            continue;
+        }
+
+        entry->resend = 0;
+        ip    = entry->ip;
+        rtdev = entry->rtdev;
+        rtdev_reference(rtdev);
+
+        rtdm_lock_put_irqrestore(&arp_pending_lock, context);
+
+        rt_arp_solicit(rtdev, ip);
+        rtdev_dereference(rtdev);
+    }
+}
+
+
+
 /***
  *  arp_rcv:    Receive an arp request by the device layer.
  */
@@ -200,9 +712,29 @@ static struct rtpacket_type arp_packet_type = {
 /***
  *  rt_arp_init
  */
-void __init rt_arp_init(void)
+int __init rt_arp_init(void)
 {
+    int i;
+    int ret;
+
+
+    for (i = 0; i < RT_ARP_PENDING_ENTRIES; i++)
+        rtskb_queue_init(&arp_pending[i].queue);
+
+    ret = rtdm_nrtsig_init(&arp_signal, rt_arp_signal_handler, NULL);
+    if (ret < 0)
+        return ret;
+
+    ret = rtdm_timer_init(&arp_timer, rt_arp_timer_handler,
+                          "rtnet-arp");
+    if (ret < 0) {
+        rtdm_nrtsig_destroy(&arp_signal);
+        return ret;
+    }
+
     rtdev_add_pack(&arp_packet_type);
+
+    return 0;
 }
 
 
@@ -213,4 +745,9 @@ void __init rt_arp_init(void)
 void rt_arp_release(void)
 {
     rtdev_remove_pack(&arp_packet_type);
+
+    rtdm_timer_destroy(&arp_timer);
+    rtdm_nrtsig_destroy(&arp_signal);
+
+    rt_arp_purge_pending(NULL);
 }
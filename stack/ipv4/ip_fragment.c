@@ -20,7 +20,12 @@
  */
 
 
+#include <linux/jhash.h>
+#include <linux/log2.h>
 #include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
 #include <net/checksum.h>
 #include <net/ip.h>
 
@@ -31,6 +36,7 @@
 #include <linux/ip.h>
 #include <linux/in.h>
 
+#include <ipv4/af_inet.h>
 #include <ipv4/ip_fragment.h>
 
 #ifdef CONFIG_RTNET_ADDON_PROXY
@@ -38,168 +44,521 @@
 #endif /* CONFIG_RTNET_ADDON_PROXY */
 
 /*
- * This defined sets the number of incoming fragmented IP messages that
- * can be handled in parallel.
+ * Incoming fragmented IP messages are collected in a hash table keyed on
+ * (saddr, daddr, id, protocol). The number of collectors is bounded, so is
+ * the number of collectors a single socket may occupy. Every collector has
+ * to complete within frag_timeout, otherwise it is released by the expiry
+ * timer. Fragments may arrive in any order. As long as the first fragment,
+ * and thus the destination socket, is unknown, fragments are held at the
+ * expense of the global pool, then they are moved to the socket pool.
  */
-#define COLLECTOR_COUNT 10
+static unsigned int frag_collectors = 32;
+module_param(frag_collectors, uint, 0444);
+MODULE_PARM_DESC(frag_collectors, "maximum number of IP messages "
+                 "reassembled in parallel (default: 32)");
+
+static unsigned int frag_socket_quota = 8;
+module_param(frag_socket_quota, uint, 0444);
+MODULE_PARM_DESC(frag_socket_quota, "maximum number of reassemblies per "
+                 "socket, 0 for no limit (default: 8)");
+
+static unsigned int frag_timeout = 1000;
+module_param(frag_timeout, uint, 0444);
+MODULE_PARM_DESC(frag_timeout, "reassembly timeout in ms (default: 1000)");
 
 struct ip_collector
 {
-    int   in_use;
-    __u32 saddr;
-    __u32 daddr;
-    __u16 id;
-    __u8  protocol;
-
-    struct rtskb_queue frags;
-    struct rtsocket *sock;
-    unsigned int buf_size;
+    struct hlist_node   hash_link;
+    struct list_head    age_link;   /* expiry order or free list */
+
+    __u32               saddr;
+    __u32               daddr;
+    __u16               id;
+    __u8                protocol;
+    __u8                fallback;   /* forward fragments to the proxy */
+
+    struct rtsocket     *sock;      /* NULL until the first fragment arrives */
+    struct rtskb        *frags;     /* sorted by offset, linked via next */
+    struct rtskb        *last;
+    unsigned int        buf_size;   /* payload collected so far */
+    unsigned int        total_size; /* payload size, 0 until last fragment */
+    nanosecs_abs_t      deadline;
 };
 
-static struct ip_collector collector[COLLECTOR_COUNT];
+static struct ip_collector  *collector;
+static struct hlist_head    *collector_hash;
+static unsigned int         collector_hash_mask;
+static LIST_HEAD(collector_age_list);
+static LIST_HEAD(collector_free_list);
+static unsigned int         collectors_in_use;
+static rtdm_lock_t          collector_lock = RTDM_LOCK_UNLOCKED;
+static rtdm_timer_t         collector_timer;
+
+static struct {
+    unsigned long           reassembled;
+    unsigned long           timeouts;
+    unsigned long           overflows;  /* no collector available */
+    unsigned long           quota_drops;
+    unsigned long           dropped;    /* duplicates, no buffers */
+} frag_stats;
+
 
 
-static void alloc_collector(struct rtskb *skb, struct rtsocket *sock)
+static inline unsigned int frag_offset(struct rtskb *skb)
 {
-    int                 i;
-    rtdm_lockctx_t      context;
-    struct ip_collector *p_coll;
-    struct iphdr        *iph = skb->nh.iph;
+    return (ntohs(skb->nh.iph->frag_off) & IP_OFFSET) << 3;
+}
+
+
+
+static inline unsigned int collector_hashkey(struct iphdr *iph)
+{
+    return jhash_3words(iph->saddr, iph->daddr,
+                        ((u32)iph->id << 16) | iph->protocol, 0) &
+        collector_hash_mask;
+}
 
 
-    /*
-     * Find a free collector
-     *
-     * Note: We once used to clean up probably outdated chains, but the
-     * algorithm was not stable enough and could cause incorrect drops even
-     * under medium load. If we run in overload, we will loose data anyhow.
-     * What we should do in the future is to account collectors per socket or
-     * socket owner and set quotations.
-     * Garbage collection is now performed only on socket close.
-     */
-    for (i = 0; i < COLLECTOR_COUNT; i++) {
-        p_coll = &collector[i];
-        rtdm_lock_get_irqsave(&p_coll->frags.lock, context);
-
-        if (!p_coll->in_use) {
-            p_coll->in_use        = 1;
-            p_coll->buf_size      = skb->len;
-            p_coll->frags.first   = skb;
-            p_coll->frags.last    = skb;
-            p_coll->saddr         = iph->saddr;
-            p_coll->daddr         = iph->daddr;
-            p_coll->id            = iph->id;
-            p_coll->protocol      = iph->protocol;
-            p_coll->sock          = sock;
-
-            rtdm_lock_put_irqrestore(&p_coll->frags.lock, context);
-
-            return;
-        }
 
-        rtdm_lock_put_irqrestore(&p_coll->frags.lock, context);
+/*
+ * Releases all fragments of an incomplete message.
+ * They are not chained yet and may belong to different pools.
+ */
+static void free_fragments(struct rtskb *skb)
+{
+    struct rtskb *next_skb;
+
+
+    while (skb != NULL) {
+        next_skb       = skb->next;
+        skb->next      = NULL;
+        skb->chain_end = skb;
+        kfree_rtskb(skb);
+        skb = next_skb;
     }
+}
 
-    rtdm_printk("RTnet: IP fragmentation - no collector available\n");
-    kfree_rtskb(skb);
+
+
+/*
+ * Unhashes the collector and returns its fragments.
+ * Note: must be called with collector_lock held
+ */
+static struct rtskb *release_collector(struct ip_collector *p_coll)
+{
+    struct rtskb *frags = p_coll->frags;
+
+
+    hlist_del(&p_coll->hash_link);
+    list_move_tail(&p_coll->age_link, &collector_free_list);
+
+    if (p_coll->sock != NULL)
+        p_coll->sock->prot.inet.frag_collectors--;
+
+    p_coll->sock  = NULL;
+    p_coll->frags = NULL;
+    collectors_in_use--;
+
+    return frags;
 }
 
 
 
 /*
- * Return a pointer to the collector that holds the message which
- * fits to the iphdr of the passed rtskb.
- * */
-static struct rtskb *add_to_collector(struct rtskb *skb, unsigned int offset, int more_frags)
+ * Note: must be called with collector_lock held
+ */
+static struct ip_collector *find_collector(struct iphdr *iph,
+                                           unsigned int key)
 {
-    int                 i;
-    rtdm_lockctx_t      context;
     struct ip_collector *p_coll;
-    struct iphdr        *iph = skb->nh.iph;
-    struct rtskb        *first_skb;
-
+    struct hlist_node   *node;
 
-    /* Search in existing collectors */
-    for (i = 0; i < COLLECTOR_COUNT; i++)
-    {
-        p_coll = &collector[i];
-        rtdm_lock_get_irqsave(&p_coll->frags.lock, context);
 
-        if (p_coll->in_use  &&
-            (iph->saddr    == p_coll->saddr) &&
+    hlist_for_each(node, &collector_hash[key]) {
+        p_coll = hlist_entry(node, struct ip_collector, hash_link);
+        if ((iph->saddr    == p_coll->saddr) &&
             (iph->daddr    == p_coll->daddr) &&
             (iph->id       == p_coll->id) &&
             (iph->protocol == p_coll->protocol))
-        {
-            first_skb = p_coll->frags.first;
+            return p_coll;
+    }
+
+    return NULL;
+}
 
-            /* Acquire the rtskb at the expense of the protocol pool */
-            if (rtskb_acquire(skb, &p_coll->sock->skb_pool) != 0) {
-                /* We have to drop this fragment => clean up the whole chain */
-                p_coll->in_use = 0;
 
-                rtdm_lock_put_irqrestore(&p_coll->frags.lock, context);
 
+/*
+ * Note: must be called with collector_lock held
+ */
+static struct ip_collector *alloc_collector(struct iphdr *iph,
+                                            unsigned int key)
+{
+    struct ip_collector *p_coll;
+
+
+    if (list_empty(&collector_free_list)) {
+        frag_stats.overflows++;
 #ifdef FRAG_DBG
-                rtdm_printk("RTnet: Compensation pool empty - IP fragments "
-                            "dropped (saddr:%x, daddr:%x)\n",
-                            iph->saddr, iph->daddr);
+        rtdm_printk("RTnet: IP fragmentation - no collector available\n");
 #endif
+        return NULL;
+    }
+
+    p_coll = list_entry(collector_free_list.next, struct ip_collector,
+                        age_link);
+
+    p_coll->saddr      = iph->saddr;
+    p_coll->daddr      = iph->daddr;
+    p_coll->id         = iph->id;
+    p_coll->protocol   = iph->protocol;
+    p_coll->fallback   = 0;
+    p_coll->sock       = NULL;
+    p_coll->frags      = NULL;
+    p_coll->last       = NULL;
+    p_coll->buf_size   = 0;
+    p_coll->total_size = 0;
+    p_coll->deadline   = rtdm_clock_read() +
+        (nanosecs_abs_t)frag_timeout * 1000000;
+
+    hlist_add_head(&p_coll->hash_link, &collector_hash[key]);
+
+    /* deadlines grow monotonically, so the age list stays sorted */
+    list_move_tail(&p_coll->age_link, &collector_age_list);
+    if (collectors_in_use++ == 0)
+        rtdm_timer_start(&collector_timer, p_coll->deadline, 0,
+                         RTDM_TIMERMODE_ABSOLUTE);
+
+    return p_coll;
+}
+
+
+
+/*
+ * Assigns the collector to its destination socket, accounting the quota.
+ * Note: must be called with collector_lock held
+ */
+static int assign_collector(struct ip_collector *p_coll,
+                            struct rtsocket *sock)
+{
+    if ((frag_socket_quota > 0) &&
+        (sock->prot.inet.frag_collectors >= frag_socket_quota)) {
+        frag_stats.quota_drops++;
+        return -ENOBUFS;
+    }
+
+    sock->prot.inet.frag_collectors++;
+    p_coll->sock = sock;
+
+    return 0;
+}
 
-                kfree_rtskb(first_skb);
-                kfree_rtskb(skb);
-                return NULL;
-            }
 
-            /* Optimized version of __rtskb_queue_tail */
-            skb->next = NULL;
-            p_coll->frags.last->next = skb;
-            p_coll->frags.last = skb;
 
-            /* Extend the chain */
-            first_skb->chain_end = skb;
+/*
+ * Inserts the fragment according to its offset. Returns the complete,
+ * chained message or NULL. Duplicated or overlapping fragments are dropped.
+ * Note: must be called with collector_lock held
+ */
+static struct rtskb *insert_fragment(struct ip_collector *p_coll,
+                                     struct rtskb *skb, unsigned int offset,
+                                     int more_frags)
+{
+    struct rtskb    **pprev = &p_coll->frags;
+    struct rtskb    *prev = NULL;
+    struct rtskb    *next;
+    struct rtskb    *first_skb;
 #ifdef CONFIG_RTNET_CHECKED
-            first_skb->chain_len++;
+    unsigned int    count = 0;
 #endif
 
-            /* Sanity check: unordered fragments are not allowed! */
-            if (offset != p_coll->buf_size) {
-                /* We have to drop this fragment => clean up the whole chain */
-                p_coll->in_use = 0;
-                skb = first_skb;
 
-                rtdm_lock_put_irqrestore(&p_coll->frags.lock, context);
-                break; /* leave the for loop */
-            }
+    if (!more_frags) {
+        if (p_coll->total_size != 0) {
+            frag_stats.dropped++;
+            kfree_rtskb(skb);
+            return NULL;
+        }
+        p_coll->total_size = offset + skb->len;
+    }
 
-            p_coll->buf_size += skb->len;
+    /* fast path: in-order arrival */
+    if ((p_coll->last != NULL) &&
+        (offset >= frag_offset(p_coll->last) + p_coll->last->len)) {
+        pprev = &p_coll->last->next;
+        prev  = p_coll->last;
+    } else
+        while ((*pprev != NULL) && (frag_offset(*pprev) < offset)) {
+            prev  = *pprev;
+            pprev = &prev->next;
+        }
+    next = *pprev;
 
-            if (!more_frags) {
-                p_coll->in_use = 0;
+    if (((prev != NULL) && (frag_offset(prev) + prev->len > offset)) ||
+        ((next != NULL) && (offset + skb->len > frag_offset(next))) ||
+        ((p_coll->total_size != 0) &&
+         (offset + skb->len > p_coll->total_size))) {
+#ifdef FRAG_DBG
+        rtdm_printk("RTnet: overlapping IP fragment (saddr:%x, daddr:%x)"
+                    " - dropped\n", p_coll->saddr, p_coll->daddr);
+#endif
+        if (!more_frags)
+            p_coll->total_size = 0;
+        frag_stats.dropped++;
+        kfree_rtskb(skb);
+        return NULL;
+    }
 
-                rtdm_lock_put_irqrestore(&p_coll->frags.lock, context);
-                return first_skb;
-            } else {
-                rtdm_lock_put_irqrestore(&p_coll->frags.lock, context);
-                return NULL;
-            }
+    skb->next = next;
+    *pprev    = skb;
+    if (next == NULL)
+        p_coll->last = skb;
+    p_coll->buf_size += skb->len;
+
+    if ((p_coll->total_size == 0) || (p_coll->buf_size < p_coll->total_size) ||
+        (p_coll->sock == NULL))
+        return NULL;
+
+    /* complete: turn the fragment list into an rtskb chain */
+    first_skb = release_collector(p_coll);
+    first_skb->chain_end = p_coll->last;
+#ifdef CONFIG_RTNET_CHECKED
+    for (skb = first_skb; skb != NULL; skb = skb->next)
+        count++;
+    first_skb->chain_len = count;
+#endif
+    frag_stats.reassembled++;
+
+    return first_skb;
+}
+
+
+
+/*
+ * Expires collectors which did not complete in time.
+ */
+static void collector_timer_handler(rtdm_timer_t *timer)
+{
+    struct ip_collector *p_coll;
+    struct rtskb        *expired = NULL;
+    struct rtskb        *frags;
+    struct rtskb        *last;
+    nanosecs_abs_t      now = rtdm_clock_read();
+    rtdm_lockctx_t      context;
+
+
+    rtdm_lock_get_irqsave(&collector_lock, context);
+
+    while (!list_empty(&collector_age_list)) {
+        p_coll = list_entry(collector_age_list.next, struct ip_collector,
+                            age_link);
+        if (p_coll->deadline > now) {
+            rtdm_timer_start_in_handler(&collector_timer, p_coll->deadline,
+                                        0, RTDM_TIMERMODE_ABSOLUTE);
+            break;
         }
 
-        rtdm_lock_put_irqrestore(&p_coll->frags.lock, context);
+#ifdef FRAG_DBG
+        rtdm_printk("RTnet: IP reassembly timed out (saddr:%x, daddr:%x)\n",
+                    p_coll->saddr, p_coll->daddr);
+#endif
+        frag_stats.timeouts++;
+
+        last = p_coll->last;
+        if ((frags = release_collector(p_coll)) != NULL) {
+            last->next = expired;
+            expired    = frags;
+        }
+    }
+
+    rtdm_lock_put_irqrestore(&collector_lock, context);
+
+    free_fragments(expired);
+}
+
+
+
+#ifdef CONFIG_RTNET_ADDON_PROXY
+static void forward_fragments(struct rtskb *skb)
+{
+    struct rtskb *next_skb;
+
+
+    while (skb != NULL) {
+        next_skb       = skb->next;
+        skb->next      = NULL;
+        skb->chain_end = skb;
+        __rtskb_push(skb, skb->nh.iph->ihl*4);
+        rt_ip_fallback_handler(skb);
+        skb = next_skb;
     }
+}
+#endif /* CONFIG_RTNET_ADDON_PROXY */
+
+
+
+/*
+ * Handles the first fragment, the one which identifies the socket.
+ */
+static struct rtskb *add_first_fragment(struct rtskb *skb, int more_frags,
+                                        struct rtinet_protocol *ipprot)
+{
+    struct iphdr        *iph = skb->nh.iph;
+    struct ip_collector *p_coll;
+    struct rtsocket     *sock;
+    struct rtskb        *held;
+    struct rtskb        *result;
+    struct rtskb        *drop = NULL;
+    unsigned int        key = collector_hashkey(iph);
+    rtdm_lockctx_t      context;
+    int                 ret;
 
+
+    /* Get the destination socket */
+    if ((sock = ipprot->dest_socket(skb)) == NULL) {
 #ifdef CONFIG_RTNET_ADDON_PROXY
-    if (rt_ip_fallback_handler) {
-	    __rtskb_push(skb, iph->ihl*4);
-	    rt_ip_fallback_handler(skb);
-	    return NULL;
+        if (rt_ip_fallback_handler) {
+            /* forward what we already hold, and what is still to come */
+            rtdm_lock_get_irqsave(&collector_lock, context);
+            p_coll = find_collector(iph, key);
+            if (p_coll == NULL)
+                p_coll = alloc_collector(iph, key);
+            if (p_coll != NULL) {
+                p_coll->fallback = 1;
+                drop = p_coll->frags;
+                p_coll->frags = NULL;
+                p_coll->last  = NULL;
+            }
+            rtdm_lock_put_irqrestore(&collector_lock, context);
+
+            forward_fragments(drop);
+
+            __rtskb_push(skb, iph->ihl*4);
+            rt_ip_fallback_handler(skb);
+            return NULL;
+        }
+#endif
+        /* Drop the rtskb */
+        kfree_rtskb(skb);
+        return NULL;
+    }
+
+    /* Acquire the rtskb at the expense of the socket's pool */
+    ret = rtskb_acquire(skb, &sock->skb_pool);
+    if (ret != 0)
+        rt_socket_drop_nobuf(sock);
+
+    /* socket is now implicitely locked by the missing rtskb */
+    rt_socket_dereference(sock);
+
+    if (ret != 0) {
+        frag_stats.dropped++;
+        kfree_rtskb(skb);
+        return NULL;
     }
+
+    rtdm_lock_get_irqsave(&collector_lock, context);
+
+    p_coll = find_collector(iph, key);
+    if (p_coll == NULL) {
+        p_coll = alloc_collector(iph, key);
+        if (p_coll == NULL)
+            goto drop_skb;
+    } else if (p_coll->sock != NULL) {
+        /* duplicated first fragment */
+        frag_stats.dropped++;
+        goto drop_skb;
+    }
+
+    if (assign_collector(p_coll, sock) != 0)
+        goto drop_collector;
+
+    /* move fragments received out of order to the socket pool */
+    for (held = p_coll->frags; held != NULL; held = held->next)
+        if (rtskb_acquire(held, &sock->skb_pool) != 0) {
+#ifdef FRAG_DBG
+            rtdm_printk("RTnet: Compensation pool empty - IP fragments "
+                        "dropped (saddr:%x, daddr:%x)\n",
+                        iph->saddr, iph->daddr);
 #endif
+            frag_stats.dropped++;
+            rt_socket_drop_nobuf(sock);
+            goto drop_collector;
+        }
+
+    result = insert_fragment(p_coll, skb, 0, more_frags);
+
+    rtdm_lock_put_irqrestore(&collector_lock, context);
+
+    return result;
+
+  drop_collector:
+    drop = release_collector(p_coll);
+
+  drop_skb:
+    rtdm_lock_put_irqrestore(&collector_lock, context);
+
+    free_fragments(drop);
+    kfree_rtskb(skb);
+    return NULL;
+}
+
+
+
+/*
+ * Handles any subsequent fragment, possibly arriving before the first one.
+ */
+static struct rtskb *add_to_collector(struct rtskb *skb, unsigned int offset,
+                                      int more_frags)
+{
+    struct iphdr        *iph = skb->nh.iph;
+    struct ip_collector *p_coll;
+    struct rtskb_queue  *pool;
+    struct rtskb        *result;
+    unsigned int        key = collector_hashkey(iph);
+    rtdm_lockctx_t      context;
+
+
+    rtdm_lock_get_irqsave(&collector_lock, context);
 
+    p_coll = find_collector(iph, key);
+    if (p_coll == NULL) {
+        p_coll = alloc_collector(iph, key);
+        if (p_coll == NULL)
+            goto drop;
+    }
+
+#ifdef CONFIG_RTNET_ADDON_PROXY
+    if (p_coll->fallback) {
+        rtdm_lock_put_irqrestore(&collector_lock, context);
+
+        __rtskb_push(skb, iph->ihl*4);
+        rt_ip_fallback_handler(skb);
+        return NULL;
+    }
+#endif /* CONFIG_RTNET_ADDON_PROXY */
+
+    /* Acquire the rtskb at the expense of the socket pool or, as long as
+     * the socket is unknown, of the global pool */
+    pool = (p_coll->sock != NULL) ? &p_coll->sock->skb_pool : &global_pool;
+    if (rtskb_acquire(skb, pool) != 0) {
 #ifdef FRAG_DBG
-    rtdm_printk("RTnet: Unordered IP fragment (saddr:%x, daddr:%x)"
-                " - dropped\n", iph->saddr, iph->daddr);
+        rtdm_printk("RTnet: Compensation pool empty - IP fragments "
+                    "dropped (saddr:%x, daddr:%x)\n",
+                    iph->saddr, iph->daddr);
 #endif
+        frag_stats.dropped++;
+        goto drop;
+    }
+
+    result = insert_fragment(p_coll, skb, offset, more_frags);
+
+    rtdm_lock_put_irqrestore(&collector_lock, context);
+
+    return result;
+
+  drop:
+    rtdm_lock_put_irqrestore(&collector_lock, context);
 
     kfree_rtskb(skb);
     return NULL;
@@ -209,28 +568,28 @@ static struct rtskb *add_to_collector(struct rtskb *skb, unsigned int offset, in
 
 /*
  * Cleans up all collectors referring to the specified socket.
- * This is now the only kind of garbage collection we do.
  */
 void rt_ip_frag_invalidate_socket(struct rtsocket *sock)
 {
-    int                 i;
-    rtdm_lockctx_t      context;
     struct ip_collector *p_coll;
+    struct rtskb        *frags;
+    rtdm_lockctx_t      context;
+
 
+  start_over:
+    rtdm_lock_get_irqsave(&collector_lock, context);
 
-    for (i = 0; i < COLLECTOR_COUNT; i++)
-    {
-        p_coll = &collector[i];
-        rtdm_lock_get_irqsave(&p_coll->frags.lock, context);
+    list_for_each_entry(p_coll, &collector_age_list, age_link)
+        if (p_coll->sock == sock) {
+            frags = release_collector(p_coll);
 
-        if ((p_coll->in_use) && (p_coll->sock == sock))
-        {
-            p_coll->in_use = 0;
-            kfree_rtskb(p_coll->frags.first);
+            rtdm_lock_put_irqrestore(&collector_lock, context);
+
+            free_fragments(frags);
+            goto start_over;
         }
 
-        rtdm_lock_put_irqrestore(&p_coll->frags.lock, context);
-    }
+    rtdm_lock_put_irqrestore(&collector_lock, context);
 }
 EXPORT_SYMBOL(rt_ip_frag_invalidate_socket);
 
@@ -241,24 +600,24 @@ EXPORT_SYMBOL(rt_ip_frag_invalidate_socket);
  */
 static void cleanup_all_collectors(void)
 {
-    int                 i;
-    rtdm_lockctx_t      context;
     struct ip_collector *p_coll;
+    struct rtskb        *frags;
+    rtdm_lockctx_t      context;
 
 
-    for (i = 0; i < COLLECTOR_COUNT; i++)
-    {
-        p_coll = &collector[i];
-        rtdm_lock_get_irqsave(&p_coll->frags.lock, context);
+    rtdm_lock_get_irqsave(&collector_lock, context);
 
-        if (p_coll->in_use)
-        {
-            p_coll->in_use = 0;
-            kfree_rtskb(p_coll->frags.first);
-        }
+    while (!list_empty(&collector_age_list)) {
+        p_coll = list_entry(collector_age_list.next, struct ip_collector,
+                            age_link);
+        frags = release_collector(p_coll);
 
-        rtdm_lock_put_irqrestore(&p_coll->frags.lock, context);
+        rtdm_lock_put_irqrestore(&collector_lock, context);
+        free_fragments(frags);
+        rtdm_lock_get_irqsave(&collector_lock, context);
     }
+
+    rtdm_lock_put_irqrestore(&collector_lock, context);
 }
 
 
@@ -272,9 +631,7 @@ struct rtskb *rt_ip_defrag(struct rtskb *skb, struct rtinet_protocol *ipprot)
 {
     unsigned int    more_frags;
     unsigned int    offset;
-    struct rtsocket *sock;
     struct iphdr    *iph = skb->nh.iph;
-    int             ret;
 
 
     /* Parse the IP header */
@@ -285,62 +642,107 @@ struct rtskb *rt_ip_defrag(struct rtskb *skb, struct rtinet_protocol *ipprot)
 
     /* First fragment? */
     if (offset == 0)
-    {
-        /* Get the destination socket */
-        if ((sock = ipprot->dest_socket(skb)) == NULL) {
-#ifdef CONFIG_RTNET_ADDON_PROXY
-                if (rt_ip_fallback_handler) {
-                    __rtskb_push(skb, iph->ihl*4);
-                    rt_ip_fallback_handler(skb);
-                    return NULL;
-                }
-#endif
-            /* Drop the rtskb */
-            kfree_rtskb(skb);
-            return NULL;
-        }
+        return add_first_fragment(skb, more_frags, ipprot);
+    else
+        return add_to_collector(skb, offset, more_frags);
+}
 
-        /* Acquire the rtskb at the expense of the socket's pool */
-        ret = rtskb_acquire(skb, &sock->skb_pool);
 
-        /* socket is now implicitely locked by the missing rtskb */
-        rt_socket_dereference(sock);
 
-        if (ret != 0) {
-            /* Drop the rtskb */
-            kfree_rtskb(skb);
-        } else {
-            /* Allocates a new collector */
-            alloc_collector(skb, sock);
-        }
-        return NULL;
-    }
-    else
-    {
-        /* Add to an existing collector */
-        return add_to_collector(skb, offset, more_frags);
-    }
+#ifdef CONFIG_PROC_FS
+static int rtnet_ipv4_fragment_show(struct seq_file *p, void *data)
+{
+    seq_printf(p, "Collectors used/total:\t%u/%u\n"
+	       "Socket quota:\t\t%u\n"
+	       "Timeout:\t\t%u ms\n"
+	       "Reassembled:\t\t%lu\n"
+	       "Timeouts:\t\t%lu\n"
+	       "Overflows:\t\t%lu\n"
+	       "Quota drops:\t\t%lu\n"
+	       "Dropped fragments:\t%lu\n",
+	       collectors_in_use, frag_collectors, frag_socket_quota,
+	       frag_timeout, frag_stats.reassembled, frag_stats.timeouts,
+	       frag_stats.overflows, frag_stats.quota_drops,
+	       frag_stats.dropped);
+    return 0;
 }
 
+static int rtnet_ipv4_fragment_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, rtnet_ipv4_fragment_show, NULL);
+}
+
+static const struct file_operations rtnet_ipv4_fragment_fops = {
+    .open = rtnet_ipv4_fragment_open,
+    .read = seq_read,
+    .llseek = seq_lseek,
+    .release = single_release,
+};
+#endif /* CONFIG_PROC_FS */
+
 
 
 int __init rt_ip_fragment_init(void)
 {
-    int i;
+    unsigned int    hash_size;
+    unsigned int    i;
+    int             ret;
 
 
-    /* Probably not needed (static variable...) */
-    memset(collector, 0, sizeof(collector));
+    if (frag_collectors == 0)
+        frag_collectors = 1;
 
-    for (i = 0; i < COLLECTOR_COUNT; i++)
-        rtdm_lock_init(&collector[i].frags.lock);
+    hash_size = roundup_pow_of_two(frag_collectors);
+    collector_hash_mask = hash_size - 1;
+
+    collector = kzalloc(frag_collectors * sizeof(struct ip_collector),
+                        GFP_KERNEL);
+    collector_hash = kmalloc(hash_size * sizeof(struct hlist_head),
+                             GFP_KERNEL);
+    if (!collector || !collector_hash) {
+        ret = -ENOMEM;
+        goto err;
+    }
+
+    for (i = 0; i < hash_size; i++)
+        INIT_HLIST_HEAD(&collector_hash[i]);
+    for (i = 0; i < frag_collectors; i++)
+        list_add_tail(&collector[i].age_link, &collector_free_list);
+
+    ret = rtdm_timer_init(&collector_timer, collector_timer_handler,
+                          "rtnet-ipfrag");
+    if (ret < 0)
+        goto err;
+
+#ifdef CONFIG_PROC_FS
+    if (!proc_create("ip_fragment", S_IFREG | S_IRUGO, ipv4_proc_root,
+                     &rtnet_ipv4_fragment_fops)) {
+        rtdm_timer_destroy(&collector_timer);
+        ret = -ENOMEM;
+        goto err;
+    }
+#endif /* CONFIG_PROC_FS */
 
     return 0;
+
+  err:
+    /*ERRMSG*/printk("RTnet: unable to initialize IP fragment collectors\n");
+    kfree(collector_hash);
+    kfree(collector);
+    return ret;
 }
 
 
 
 void rt_ip_fragment_cleanup(void)
 {
+#ifdef CONFIG_PROC_FS
+    remove_proc_entry("ip_fragment", ipv4_proc_root);
+#endif /* CONFIG_PROC_FS */
+
+    rtdm_timer_destroy(&collector_timer);
     cleanup_all_collectors();
+
+    kfree(collector_hash);
+    kfree(collector);
 }
@@ -28,6 +28,7 @@
 #include <rtnet_socket.h>
 #include <stack_mgr.h>
 #include <ipv4/ip_fragment.h>
+#include <ipv4/multicast.h>
 #include <ipv4/protocol.h>
 #include <ipv4/route.h>
 
@@ -83,6 +84,8 @@ static inline void rt_ip_local_deliver(struct rtskb *skb)
 
             /* Acquire the rtskb at the expense of the protocol pool */
             err = rtskb_acquire(skb, &sock->skb_pool);
+            if (err)
+                rt_socket_drop_nobuf(sock);
 
             /* Socket is now implicitely locked by the rtskb */
             rt_socket_dereference(sock);
@@ -147,9 +150,23 @@ int rt_ip_rcv(struct rtskb *skb, struct rtpacket_type *pt)
 
     rtskb_trim(skb, len);
 
+    /* Multicast is filtered against the joined groups (the NIC filter is
+     * imperfect), only handed to UDP, and never forwarded. */
+    if (rt_ip_is_multicast(iph->daddr)) {
+        if ((iph->protocol != IPPROTO_UDP) ||
+            !rt_ip_mc_member(iph->daddr, skb->rtdev->ifindex))
+            goto drop;
+
+        rt_ip_local_deliver(skb);
+        return 0;
+    }
+
 #ifdef CONFIG_RTNET_RTIPV4_ROUTER
-    if (rt_ip_route_forward(skb, iph->daddr))
+    if (rt_ip_route_forward(skb, iph->daddr)) {
+        /* forwarded packets leave in batches at the end of the burst */
+        rt_stack_request_flush(pt);
         return 0;
+    }
 #endif /* CONFIG_RTNET_RTIPV4_ROUTER */
 
     rt_ip_local_deliver(skb);
@@ -27,31 +27,38 @@
 
 #include <rtnet_socket.h>
 #include <stack_mgr.h>
+#include <ipv4/arp.h>
 #include <ipv4/ip_fragment.h>
 #include <ipv4/ip_input.h>
 #include <ipv4/route.h>
 
 
-static rtdm_lock_t  rt_ip_id_lock  = RTDM_LOCK_UNLOCKED;
-static u16          rt_ip_id_count = 0;
+/* IDs of fragmented datagrams, shared by all senders. Unfragmented ones carry
+ * IP_DF and are never reassembled, so they draw from a per-socket counter. */
+static atomic_t     rt_ip_id_count = ATOMIC_INIT(0);
 
 /***
  *  Slow path for fragmented packets
+ *
+ *  All rtskbs are reserved up front and all fragments are built before the
+ *  first one is sent. Thus, the datagram is either transmitted completely or
+ *  not at all.
  */
 int rt_ip_build_xmit_slow(struct rtsocket *sk,
         int getfrag(const void *, char *, unsigned int, unsigned int),
         const void *frag, unsigned length, struct dest_route *rt,
         int msg_flags, unsigned int mtu, unsigned int prio)
 {
-    int             err, next_err;
+    int             err;
     struct rtskb    *skb;
-    struct rtskb    *next_skb;
+    struct rtskb_queue frags;
+    struct rtskb_queue batch;
     struct          iphdr *iph;
     struct          rtnet_device *rtdev = rt->rtdev;
     unsigned int    fragdatalen;
+    unsigned int    nfrags;
     unsigned int    offset = 0;
     u16             msg_rt_ip_id;
-    rtdm_lockctx_t  context;
     unsigned int    rtskb_size;
     int             hh_len = (rtdev->hard_header_len + 15) & ~15;
 
@@ -59,21 +66,18 @@ int rt_ip_build_xmit_slow(struct rtsocket *sk,
     #define FRAGHEADERLEN sizeof(struct iphdr)
 
     fragdatalen  = ((mtu - FRAGHEADERLEN) & ~7);
+    nfrags       = (length + fragdatalen - 1) / fragdatalen;
+    rtskb_size   = mtu + hh_len + 15;
 
-    /* Store id in local variable */
-    rtdm_lock_get_irqsave(&rt_ip_id_lock, context);
-    msg_rt_ip_id = rt_ip_id_count++;
-    rtdm_lock_put_irqrestore(&rt_ip_id_lock, context);
-
-    rtskb_size = mtu + hh_len + 15;
+    /* Reserve all rtskbs at once - or fail without sending anything */
+    rtskb_queue_init(&frags);
+    if (alloc_rtskbs(rtskb_size, nfrags, &sk->skb_pool, &frags) != 0)
+        return -ENOBUFS;
 
-    /* TODO: delay previous skb until ALL errors are catched which may occure
-             during next skb setup */
+    /* Store id in local variable */
+    msg_rt_ip_id = (u16)atomic_inc_return(&rt_ip_id_count);
 
-    /* Preallocate first rtskb */
-    skb = alloc_rtskb(rtskb_size, &sk->skb_pool);
-    if (skb == NULL)
-        return -ENOBUFS;
+    rtskb_queue_init(&batch);
 
     for (offset = 0; offset < length; offset += fragdatalen)
     {
@@ -82,25 +86,19 @@ int rt_ip_build_xmit_slow(struct rtsocket *sk,
         __u16 frag_off = offset >> 3 ;
 
 
-        next_err = 0;
         if (offset >= length - fragdatalen)
         {
             /* last fragment */
             fraglen  = FRAGHEADERLEN + length - offset ;
-            next_skb = NULL;
         }
         else
         {
             fraglen = FRAGHEADERLEN + fragdatalen;
             frag_off |= IP_MF;
-
-            next_skb = alloc_rtskb(rtskb_size, &sk->skb_pool);
-            if (next_skb == NULL) {
-                frag_off &= ~IP_MF; /* cut the chain */
-                next_err = -ENOBUFS;
-            }
         }
 
+        skb = __rtskb_dequeue(&frags);
+
         rtskb_reserve(skb, hh_len);
 
         skb->rtdev    = rtdev;
@@ -120,38 +118,38 @@ int rt_ip_build_xmit_slow(struct rtsocket *sk,
         iph->check    = 0; /* required! */
         iph->check    = ip_fast_csum((unsigned char *)iph, 5 /*iph->ihl*/);
 
+        /* queue first, so that the error path releases it as well */
+        __rtskb_queue_tail(&batch, skb);
+
         if ( (err=getfrag(frag, ((char *)iph) + 5 /*iph->ihl*/ * 4, offset,
                           fraglen - FRAGHEADERLEN)) )
             goto error;
 
-        if (rtdev->hard_header) {
+        if ((rt->pending_ip == 0) && rtdev->hard_header) {
             err = rtdev->hard_header(skb, rtdev, ETH_P_IP, rt->dev_addr,
                                      rtdev->dev_addr, skb->len);
             if (err < 0)
                 goto error;
         }
+    }
 
-        err = rtdev_xmit(skb);
-
-        skb = next_skb;
+    /* all fragments are complete, submit them in one go - the next hop
+       is still unresolved, hold them back as a unit or drop them all */
+    if (unlikely(rt->pending_ip != 0))
+        return rt_arp_queue_batch(&batch, nfrags, rt->pending_ip);
 
-        if (err != 0) {
-            err = -EAGAIN;
-            goto error;
-        }
+    /* a failure may leave the leading fragments sent, the datagram is lost
+       nevertheless and has to be repeated as a whole */
+    if (rtdev_xmit_batch(&batch) != 0)
+        return -EAGAIN;
 
-        if (next_err != 0)
-            return next_err;
-    }
     return 0;
 
   error:
-    if (skb != NULL) {
+    while ((skb = __rtskb_dequeue(&batch)) != NULL)
+        kfree_rtskb(skb);
+    while ((skb = __rtskb_dequeue(&frags)) != NULL)
         kfree_rtskb(skb);
-
-        if (next_skb != NULL)
-            kfree_rtskb(next_skb);
-    }
     return err;
 }
 
@@ -170,7 +168,6 @@ int rt_ip_build_xmit(struct rtsocket *sk,
     struct iphdr            *iph;
     int                     hh_len;
     u16                     msg_rt_ip_id;
-    rtdm_lockctx_t          context;
     struct  rtnet_device    *rtdev = rt->rtdev;
     unsigned int            prio;
     unsigned int            mtu;
@@ -193,10 +190,8 @@ int rt_ip_build_xmit(struct rtsocket *sk,
                                      length - sizeof(struct iphdr),
                                      rt, msg_flags, mtu, prio);
 
-    /* Store id in local variable */
-    rtdm_lock_get_irqsave(&rt_ip_id_lock, context);
-    msg_rt_ip_id = rt_ip_id_count++;
-    rtdm_lock_put_irqrestore(&rt_ip_id_lock, context);
+    /* Store id in local variable - a race on it is harmless with IP_DF */
+    msg_rt_ip_id = sk->prot.inet.ip_id++;
 
     hh_len = (rtdev->hard_header_len+15)&~15;
 
@@ -227,6 +222,10 @@ int rt_ip_build_xmit(struct rtsocket *sk,
                       length - 5 /*iph->ihl*/ * 4)) )
         goto error;
 
+    if (unlikely(rt->pending_ip != 0))
+        /* hold back until the next hop is resolved */
+        return rt_arp_queue(skb, rt->pending_ip);
+
     if (rtdev->hard_header) {
         err = rtdev->hard_header(skb, rtdev, ETH_P_IP, rt->dev_addr,
                                  rtdev->dev_addr, skb->len);
@@ -252,9 +251,19 @@ EXPORT_SYMBOL(rt_ip_build_xmit);
 /***
  *  IP protocol layer initialiser
  */
+#ifdef CONFIG_RTNET_RTIPV4_ROUTER
+static void rt_ip_flush(struct rtpacket_type *pt)
+{
+    rt_ip_route_forward_flush();
+}
+#endif /* CONFIG_RTNET_RTIPV4_ROUTER */
+
 static struct rtpacket_type ip_packet_type = {
     .type =     __constant_htons(ETH_P_IP),
-    .handler =  &rt_ip_rcv
+    .handler =  &rt_ip_rcv,
+#ifdef CONFIG_RTNET_RTIPV4_ROUTER
+    .flush_handler = &rt_ip_flush
+#endif /* CONFIG_RTNET_RTIPV4_ROUTER */
 };
 
 
@@ -262,10 +271,17 @@ static struct rtpacket_type ip_packet_type = {
 /***
  *  ip_init
  */
-void __init rt_ip_init(void)
+int __init rt_ip_init(void)
 {
+    int ret;
+
+
+    if ((ret = rt_ip_fragment_init()) < 0)
+        return ret;
+
     rtdev_add_pack(&ip_packet_type);
-    rt_ip_fragment_init();
+
+    return 0;
 }
 
 
@@ -275,6 +291,10 @@ void __init rt_ip_init(void)
  */
 void rt_ip_release(void)
 {
+    while (rtdev_remove_pack(&ip_packet_type) == -EAGAIN) {
+        printk("RTnet: waiting for IPv4 protocol unregistration\n");
+        set_current_state(TASK_UNINTERRUPTIBLE);
+        schedule_timeout(1*HZ); /* wait a second */
+    }
     rt_ip_fragment_cleanup();
-    rtdev_remove_pack(&ip_packet_type);
 }
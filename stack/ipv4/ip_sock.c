@@ -26,25 +26,99 @@
 #include <linux/in.h>
 
 #include <rtnet_socket.h>
+#include <ipv4/multicast.h>
+
+#ifndef SO_REUSEPORT
+#define SO_REUSEPORT    15
+#endif
+
+
+static int rt_ip_setsockopt_mc(struct rtsocket *s, int optname,
+                               const void *optval, socklen_t optlen)
+{
+    struct ip_mreqn mreq;
+
+
+    if (s->protocol != IPPROTO_UDP)
+        return -ENOPROTOOPT;
+
+    /* reprogramming the hardware filter requires Linux context */
+    if (rtdm_in_rt_context())
+        return -ENOSYS;
+
+    /* accept both struct ip_mreq and struct ip_mreqn */
+    if (optlen < sizeof(struct ip_mreq))
+        return -EINVAL;
+
+    memset(&mreq, 0, sizeof(mreq));
+    memcpy(&mreq, optval, min_t(socklen_t, optlen, sizeof(mreq)));
+
+    if (optname == IP_ADD_MEMBERSHIP)
+        return rt_ip_mc_join(s, mreq.imr_multiaddr.s_addr,
+                             mreq.imr_address.s_addr, mreq.imr_ifindex);
+    else
+        return rt_ip_mc_leave(s, mreq.imr_multiaddr.s_addr,
+                              mreq.imr_address.s_addr, mreq.imr_ifindex);
+}
+
+
+
+static int rt_ip_reuse_flag(int optname)
+{
+    switch (optname) {
+        case SO_REUSEADDR:
+            return RT_INET_REUSEADDR;
+
+        case SO_REUSEPORT:
+            return RT_INET_REUSEPORT;
+
+        default:
+            return 0;
+    }
+}
+
 
 
 int rt_ip_setsockopt(struct rtsocket *s, int level, int optname,
                      const void *optval, socklen_t optlen)
 {
     int err = 0;
+    int flag;
 
 
-    if (level != SOL_IP)
-        return -ENOPROTOOPT;
-
     if (optlen < sizeof(unsigned int))
         return -EINVAL;
 
+    /* address sharing only takes effect on the next bind */
+    if (level == SOL_SOCKET) {
+        if ((optname == SO_NO_CHECK) && (s->protocol == IPPROTO_UDP)) {
+            s->prot.inet.no_check = !!*(unsigned int *)optval;
+            return 0;
+        }
+
+        if ((flag = rt_ip_reuse_flag(optname)) == 0)
+            return rt_socket_common_setsockopt(s, optname, optval, optlen);
+
+        if (*(unsigned int *)optval)
+            s->prot.inet.reuse |= flag;
+        else
+            s->prot.inet.reuse &= ~flag;
+        return 0;
+    }
+
+    if (level != SOL_IP)
+        return -ENOPROTOOPT;
+
     switch (optname) {
         case IP_TOS:
             s->prot.inet.tos = *(unsigned int *)optval;
             break;
 
+        case IP_ADD_MEMBERSHIP:
+        case IP_DROP_MEMBERSHIP:
+            err = rt_ip_setsockopt_mc(s, optname, optval, optlen);
+            break;
+
         default:
             err = -ENOPROTOOPT;
             break;
@@ -61,9 +135,27 @@ int rt_ip_getsockopt(struct rtsocket *s, int level, int optname,
     int err = 0;
 
 
+    int flag;
+
+
     if (*optlen < sizeof(unsigned int))
         return -EINVAL;
 
+    if (level == SOL_SOCKET) {
+        if ((optname == SO_NO_CHECK) && (s->protocol == IPPROTO_UDP)) {
+            *(unsigned int *)optval = s->prot.inet.no_check;
+            *optlen = sizeof(unsigned int);
+            return 0;
+        }
+
+        if ((flag = rt_ip_reuse_flag(optname)) == 0)
+            return rt_socket_common_getsockopt(s, optname, optval, optlen);
+
+        *(unsigned int *)optval = !!(s->prot.inet.reuse & flag);
+        *optlen = sizeof(unsigned int);
+        return 0;
+    }
+
     switch (optname) {
         case IP_TOS:
             *(unsigned int *)optval = s->prot.inet.tos;
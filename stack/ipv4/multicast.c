@@ -0,0 +1,456 @@
+/***
+ *
+ *  ipv4/multicast.c - IPv4 multicast group membership
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <linux/hash.h>
+#include <linux/log2.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/mutex.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+
+#include <rtdev.h>
+#include <rtnet_internal.h>
+#include <rtnet_port.h>
+#include <rtnet_socket.h>
+#include <ipv4/af_inet.h>
+#include <ipv4/multicast.h>
+
+/*
+ * Every (socket, group, device) membership occupies one entry of a hash
+ * table keyed on the group. The receive path consults it to filter what the
+ * NIC let through, UDP uses it to find the subscribed socket. Joining and
+ * leaving is non-RT only, as it reprograms the hardware filter.
+ */
+static unsigned int mc_memberships = 32;
+module_param(mc_memberships, uint, 0444);
+MODULE_PARM_DESC(mc_memberships, "maximum number of multicast group "
+                 "memberships of all sockets (default: 32)");
+
+struct rt_ip_mc_membership {
+    struct hlist_node   link;       /* hash chain or free list */
+    u32                 group;
+    int                 ifindex;
+    struct rtsocket     *sock;
+};
+
+static struct rt_ip_mc_membership   *membership;
+static struct hlist_head            *mc_hash;
+static unsigned int                 mc_hash_bits;
+static HLIST_HEAD(mc_free_list);
+static unsigned int                 mc_in_use;
+static rtdm_lock_t                  mc_table_lock = RTDM_LOCK_UNLOCKED;
+static DEFINE_MUTEX(mc_nrt_lock);
+
+
+
+static inline struct hlist_head *rt_ip_mc_bucket(u32 group)
+{
+    return &mc_hash[hash_32(ntohl(group), mc_hash_bits)];
+}
+
+
+
+/***
+ *  __rt_ip_mc_find - look up a membership, caller holds mc_table_lock
+ *  @sock:    socket, NULL for any
+ *  @ifindex: device, 0 for any
+ */
+static struct rt_ip_mc_membership *__rt_ip_mc_find(u32 group, int ifindex,
+                                                   struct rtsocket *sock)
+{
+    struct rt_ip_mc_membership *mc;
+
+
+    hlist_for_each_entry(mc, rt_ip_mc_bucket(group), link)
+        if ((mc->group == group) &&
+            ((ifindex == 0) || (mc->ifindex == ifindex)) &&
+            ((sock == NULL) || (mc->sock == sock)))
+            return mc;
+
+    return NULL;
+}
+
+
+
+/***
+ *  rt_ip_mc_member - checks if any socket joined a group on a device
+ */
+int rt_ip_mc_member(u32 group, int ifindex)
+{
+    rtdm_lockctx_t  context;
+    int             ret;
+
+
+    rtdm_lock_get_irqsave(&mc_table_lock, context);
+    ret = (__rt_ip_mc_find(group, ifindex, NULL) != NULL);
+    rtdm_lock_put_irqrestore(&mc_table_lock, context);
+
+    return ret;
+}
+
+
+
+/***
+ *  rt_ip_mc_socket_member - checks if a socket joined a group on a device
+ */
+int rt_ip_mc_socket_member(struct rtsocket *sock, u32 group, int ifindex)
+{
+    rtdm_lockctx_t  context;
+    int             ret;
+
+
+    rtdm_lock_get_irqsave(&mc_table_lock, context);
+    ret = (__rt_ip_mc_find(group, ifindex, sock) != NULL);
+    rtdm_lock_put_irqrestore(&mc_table_lock, context);
+
+    return ret;
+}
+
+
+
+/***
+ *  rt_ip_mc_output_dev - selects the device for multicast traffic
+ *  @saddr: local address of the device, INADDR_ANY for the first
+ *          multicast-capable one
+ *
+ *  Note: increments refcount on returned rtdev
+ */
+struct rtnet_device *rt_ip_mc_output_dev(u32 saddr)
+{
+    struct rtnet_device *rtdev;
+    int                 i;
+
+
+    for (i = 1; i <= MAX_RT_DEVICES; i++) {
+        rtdev = rtdev_get_by_index(i);
+        if (rtdev == NULL)
+            continue;
+
+        if ((rtdev->flags & (IFF_UP | IFF_MULTICAST | IFF_LOOPBACK)) ==
+                (IFF_UP | IFF_MULTICAST) &&
+            ((saddr == INADDR_ANY) || (rtdev->local_ip == saddr)))
+            return rtdev;
+
+        rtdev_dereference(rtdev);
+    }
+
+    return NULL;
+}
+
+
+
+static struct rtnet_device *rt_ip_mc_get_dev(u32 ifaddr, int ifindex)
+{
+    if (ifindex > 0)
+        return rtdev_get_by_index(ifindex);
+
+    return rt_ip_mc_output_dev(ifaddr);
+}
+
+
+
+static void rt_ip_mc_remove(struct rt_ip_mc_membership *mc)
+{
+    rtdm_lockctx_t  context;
+
+
+    rtdm_lock_get_irqsave(&mc_table_lock, context);
+    hlist_del(&mc->link);
+    hlist_add_head(&mc->link, &mc_free_list);
+    mc_in_use--;
+    rtdm_lock_put_irqrestore(&mc_table_lock, context);
+}
+
+
+
+/***
+ *  rt_ip_mc_join - IP_ADD_MEMBERSHIP, non-RT only
+ */
+int rt_ip_mc_join(struct rtsocket *sock, u32 group, u32 ifaddr, int ifindex)
+{
+    struct rt_ip_mc_membership  *mc;
+    struct rtnet_device         *rtdev;
+    unsigned char               hw_addr[MAX_ADDR_LEN];
+    rtdm_lockctx_t              context;
+    int                         ret;
+
+
+    if (!rt_ip_is_multicast(group))
+        return -EINVAL;
+
+    rtdev = rt_ip_mc_get_dev(ifaddr, ifindex);
+    if (rtdev == NULL)
+        return -ENODEV;
+
+    if (!(rtdev->flags & IFF_MULTICAST)) {
+        ret = -EADDRNOTAVAIL;
+        goto out;
+    }
+
+    mutex_lock(&mc_nrt_lock);
+
+    rtdm_lock_get_irqsave(&mc_table_lock, context);
+    if (__rt_ip_mc_find(group, rtdev->ifindex, sock) != NULL) {
+        rtdm_lock_put_irqrestore(&mc_table_lock, context);
+        ret = -EADDRINUSE;
+        goto out_unlock;
+    }
+    if (hlist_empty(&mc_free_list)) {
+        rtdm_lock_put_irqrestore(&mc_table_lock, context);
+        ret = -ENOBUFS;
+        goto out_unlock;
+    }
+    mc = hlist_entry(mc_free_list.first, struct rt_ip_mc_membership, link);
+    hlist_del(&mc->link);
+    rtdm_lock_put_irqrestore(&mc_table_lock, context);
+
+    rt_ip_mc_map(group, hw_addr);
+    ret = rtdev_mc_add(rtdev, hw_addr);
+
+    rtdm_lock_get_irqsave(&mc_table_lock, context);
+    if (ret == 0) {
+        mc->group   = group;
+        mc->ifindex = rtdev->ifindex;
+        mc->sock    = sock;
+        hlist_add_head(&mc->link, rt_ip_mc_bucket(group));
+        mc_in_use++;
+    } else
+        hlist_add_head(&mc->link, &mc_free_list);
+    rtdm_lock_put_irqrestore(&mc_table_lock, context);
+
+  out_unlock:
+    mutex_unlock(&mc_nrt_lock);
+
+  out:
+    rtdev_dereference(rtdev);
+    return ret;
+}
+
+
+
+/***
+ *  rt_ip_mc_leave - IP_DROP_MEMBERSHIP, non-RT only
+ */
+int rt_ip_mc_leave(struct rtsocket *sock, u32 group, u32 ifaddr, int ifindex)
+{
+    struct rt_ip_mc_membership  *mc;
+    struct rtnet_device         *rtdev = NULL;
+    unsigned char               hw_addr[MAX_ADDR_LEN];
+    rtdm_lockctx_t              context;
+
+
+    /* without an explicit device, leave wherever the group was joined */
+    if ((ifindex > 0) || (ifaddr != INADDR_ANY)) {
+        rtdev = rt_ip_mc_get_dev(ifaddr, ifindex);
+        if (rtdev == NULL)
+            return -ENODEV;
+        ifindex = rtdev->ifindex;
+        rtdev_dereference(rtdev);
+    } else
+        ifindex = 0;
+
+    mutex_lock(&mc_nrt_lock);
+
+    rtdm_lock_get_irqsave(&mc_table_lock, context);
+    mc = __rt_ip_mc_find(group, ifindex, sock);
+    rtdm_lock_put_irqrestore(&mc_table_lock, context);
+
+    if (mc == NULL) {
+        mutex_unlock(&mc_nrt_lock);
+        return -EADDRNOTAVAIL;
+    }
+
+    ifindex = mc->ifindex;
+    rt_ip_mc_remove(mc);
+    mc->sock = NULL;
+
+    rtdev = rtdev_get_by_index(ifindex);
+    if (rtdev != NULL) {
+        rt_ip_mc_map(group, hw_addr);
+        rtdev_mc_del(rtdev, hw_addr);
+        rtdev_dereference(rtdev);
+    }
+
+    mutex_unlock(&mc_nrt_lock);
+
+    return 0;
+}
+
+
+
+/***
+ *  rt_ip_mc_drop_socket - leaves all groups of a closing socket
+ */
+void rt_ip_mc_drop_socket(struct rtsocket *sock)
+{
+    struct rt_ip_mc_membership  *mc;
+    struct rtnet_device         *rtdev;
+    unsigned char               hw_addr[MAX_ADDR_LEN];
+    unsigned int                i;
+
+
+    mutex_lock(&mc_nrt_lock);
+
+    for (i = 0; i < mc_memberships; i++) {
+        mc = &membership[i];
+        if (mc->sock != sock)
+            continue;
+
+        rt_ip_mc_remove(mc);
+        mc->sock = NULL;
+
+        rtdev = rtdev_get_by_index(mc->ifindex);
+        if (rtdev != NULL) {
+            rt_ip_mc_map(mc->group, hw_addr);
+            rtdev_mc_del(rtdev, hw_addr);
+            rtdev_dereference(rtdev);
+        }
+    }
+
+    mutex_unlock(&mc_nrt_lock);
+}
+
+
+
+/***
+ *  rt_ip_mc_release_device - forgets all memberships of a vanishing device
+ *
+ *  The hardware filter list itself is released along with the device.
+ */
+void rt_ip_mc_release_device(struct rtnet_device *rtdev)
+{
+    struct rt_ip_mc_membership  *mc;
+    unsigned int                i;
+
+
+    mutex_lock(&mc_nrt_lock);
+
+    for (i = 0; i < mc_memberships; i++) {
+        mc = &membership[i];
+        if ((mc->sock != NULL) && (mc->ifindex == rtdev->ifindex)) {
+            rt_ip_mc_remove(mc);
+            mc->sock = NULL;
+        }
+    }
+
+    mutex_unlock(&mc_nrt_lock);
+}
+
+
+
+#ifdef CONFIG_PROC_FS
+static int rtnet_ipv4_multicast_show(struct seq_file *p, void *data)
+{
+    struct rt_ip_mc_membership  *mc;
+    unsigned int                i;
+
+
+    mutex_lock(&mc_nrt_lock);
+
+    seq_printf(p, "Memberships used/total:\t%u/%u\n\n"
+               "Group\t\tDevice\tSocket\n", mc_in_use, mc_memberships);
+
+    for (i = 0; i < mc_memberships; i++) {
+        mc = &membership[i];
+        if (mc->sock == NULL)
+            continue;
+
+        seq_printf(p, "%u.%u.%u.%u\t%d\t%d\n", NIPQUAD(mc->group),
+                   mc->ifindex, rt_socket_context(mc->sock)->fd);
+    }
+
+    mutex_unlock(&mc_nrt_lock);
+
+    return 0;
+}
+
+static int rtnet_ipv4_multicast_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, rtnet_ipv4_multicast_show, NULL);
+}
+
+static const struct file_operations rtnet_ipv4_multicast_fops = {
+    .open = rtnet_ipv4_multicast_open,
+    .read = seq_read,
+    .llseek = seq_lseek,
+    .release = single_release,
+};
+#endif /* CONFIG_PROC_FS */
+
+
+
+int __init rt_ip_mc_init(void)
+{
+    unsigned int    hash_size;
+    unsigned int    i;
+
+
+    if (mc_memberships == 0)
+        mc_memberships = 1;
+
+    hash_size    = roundup_pow_of_two(mc_memberships);
+    mc_hash_bits = ilog2(hash_size);
+
+    membership = kzalloc(mc_memberships * sizeof(struct rt_ip_mc_membership),
+                         GFP_KERNEL);
+    mc_hash = kmalloc(hash_size * sizeof(struct hlist_head), GFP_KERNEL);
+    if (!membership || !mc_hash)
+        goto err;
+
+    for (i = 0; i < hash_size; i++)
+        INIT_HLIST_HEAD(&mc_hash[i]);
+    for (i = 0; i < mc_memberships; i++)
+        hlist_add_head(&membership[i].link, &mc_free_list);
+
+#ifdef CONFIG_PROC_FS
+    if (!proc_create("multicast", S_IFREG | S_IRUGO, ipv4_proc_root,
+                     &rtnet_ipv4_multicast_fops))
+        goto err;
+#endif /* CONFIG_PROC_FS */
+
+    return 0;
+
+  err:
+    /*ERRMSG*/printk("RTnet: unable to initialize IP multicast support\n");
+    kfree(mc_hash);
+    kfree(membership);
+    return -ENOMEM;
+}
+
+
+
+void rt_ip_mc_release(void)
+{
+#ifdef CONFIG_PROC_FS
+    remove_proc_entry("multicast", ipv4_proc_root);
+#endif /* CONFIG_PROC_FS */
+
+    kfree(mc_hash);
+    kfree(membership);
+}
+
+
+
+EXPORT_SYMBOL(rt_ip_mc_join);
+EXPORT_SYMBOL(rt_ip_mc_leave);
+EXPORT_SYMBOL(rt_ip_mc_drop_socket);
+EXPORT_SYMBOL(rt_ip_mc_member);
+EXPORT_SYMBOL(rt_ip_mc_socket_member);
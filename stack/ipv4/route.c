@@ -22,13 +22,19 @@
  *
  */
 
+#include <linux/hash.h>
+#include <linux/log2.h>
 #include <linux/moduleparam.h>
+#include <linux/seqlock.h>
+#include <linux/slab.h>
 #include <net/ip.h>
 
 #include <rtnet_internal.h>
 #include <rtnet_port.h>
 #include <rtnet_chrdev.h>
 #include <ipv4/af_inet.h>
+#include <ipv4/arp.h>
+#include <ipv4/multicast.h>
 #include <ipv4/route.h>
 
 
@@ -38,12 +44,37 @@
                      RTSKB_DEF_RT_CHANNEL)
 
 
-/* First-level routing: explicite host routes */
+/* First-level routing: explicite host routes
+ *
+ * The host routes are kept in an open-addressing hash table (linear probing).
+ * Keys are stored apart from the payload so that a probe sequence only walks
+ * over a few cache lines. Lookups run without taking any lock: they validate
+ * their snapshot against host_table_seq and simply retry if a writer moved
+ * entries around meanwhile. Writers are serialised via host_table_lock. */
+#define HOST_ROUTE_FREE     0   /* INADDR_ANY never names a host route */
+
+/* Lockless readers must not dereference the output device before their
+ * snapshot is validated, thus they work on copies of its attributes. */
 struct host_route {
-    struct host_route       *next;
-    struct dest_route       dest_host;
+    struct dest_route       dest;
+    u32                     local_ip;
+    int                     ifindex;
 };
 
+static unsigned int         host_routes = CONFIG_RTNET_RTIPV4_HOST_ROUTES;
+static unsigned int         host_hash_tbl_size;
+static unsigned int         host_hash_key_mask;
+static unsigned int         host_hash_bits;
+static u32                  *host_keys;
+static struct host_route    *host_entries;
+static int                  allocated_host_routes;
+static seqcount_t           host_table_seq;
+static rtdm_lock_t          host_table_lock = RTDM_LOCK_UNLOCKED;
+
+module_param(host_routes, uint, 0444);
+MODULE_PARM_DESC(host_routes, "maximum number of host routes (default: "
+                 __stringify(CONFIG_RTNET_RTIPV4_HOST_ROUTES) ")");
+
 /* Second-level routing: routes to other networks */
 struct net_route {
     struct net_route        *next;
@@ -52,22 +83,6 @@ struct net_route {
     u32                     gw_ip;
 };
 
-#if (CONFIG_RTNET_RTIPV4_HOST_ROUTES & (CONFIG_RTNET_RTIPV4_HOST_ROUTES - 1))
-# error CONFIG_RTNET_RTIPV4_HOST_ROUTES must be power of 2
-#endif
-#if CONFIG_RTNET_RTIPV4_HOST_ROUTES < 256
-# define HOST_HASH_TBL_SIZE 64
-#else
-# define HOST_HASH_TBL_SIZE ((CONFIG_RTNET_RTIPV4_HOST_ROUTES / 256) * 64)
-#endif
-#define HOST_HASH_KEY_MASK  (HOST_HASH_TBL_SIZE-1)
-
-static struct host_route    host_routes[CONFIG_RTNET_RTIPV4_HOST_ROUTES];
-static struct host_route    *free_host_route;
-static int                  allocated_host_routes;
-static struct host_route    *host_hash_tbl[HOST_HASH_TBL_SIZE];
-static rtdm_lock_t          host_table_lock = RTDM_LOCK_UNLOCKED;
-
 #ifdef CONFIG_RTNET_RTIPV4_NETROUTING
 #if (CONFIG_RTNET_RTIPV4_NET_ROUTES & (CONFIG_RTNET_RTIPV4_NET_ROUTES - 1))
 # error CONFIG_RTNET_RTIPV4_NET_ROUTES must be power of 2
@@ -92,6 +107,165 @@ MODULE_PARM_DESC(net_hash_key_shift, "destination right shift for "
                  "network hash key (default: 8)");
 #endif /* CONFIG_RTNET_RTIPV4_NETROUTING */
 
+#ifdef CONFIG_RTNET_RTIPV4_ROUTER
+/* Forwarding fast path
+ *
+ * Each ingress device owns a small direct-mapped cache of forwarding
+ * decisions, including the prepared link layer header, and a pool the
+ * forwarded rtskbs are charged to. Thus, a busy segment can neither evict the
+ * routes of another one nor drain its buffers. Cache entries are tagged with
+ * the routing generation they were filled under and simply miss once any
+ * route changed. Forwarded packets are collected per egress device and handed
+ * over as one batch when the stack manager finished its current burst or
+ * fwd_batch packets are pending. All of this is only touched by the stack
+ * manager, thus requires no locking. */
+#define FWD_CACHE_BITS      4
+#define FWD_CACHE_SIZE      (1 << FWD_CACHE_BITS)
+#define FWD_HH_LEN          16  /* enough for Ethernet */
+
+struct fwd_cache_entry {
+    u32                 daddr;
+    unsigned int        gen;
+    int                 ifindex;    /* 0 if unused, validated via gen */
+    unsigned int        hh_len;
+    unsigned char       hh[FWD_HH_LEN];
+};
+
+struct fwd_ingress {
+    struct rtskb_queue      pool;
+    struct fwd_cache_entry  cache[FWD_CACHE_SIZE];
+};
+
+struct fwd_egress {
+    struct rtskb_queue      batch;
+    unsigned int            len;
+    struct rtnet_device     *rtdev; /* referenced while len > 0 */
+};
+
+static struct fwd_ingress   fwd_ingress[MAX_RT_DEVICES];
+static struct fwd_egress    fwd_egress[MAX_RT_DEVICES];
+static unsigned long        fwd_egress_pending;
+static atomic_t             fwd_route_gen = ATOMIC_INIT(0);
+
+static struct {
+    unsigned long           forwarded;
+    unsigned long           cache_hits;
+    unsigned long           batches;
+    unsigned long           ttl_exceeded;
+    unsigned long           no_buffers;
+    unsigned long           no_route;
+} fwd_stats;
+
+static unsigned int         fwd_rtskbs = 16;
+static unsigned int         fwd_batch = 8;
+
+module_param(fwd_rtskbs, uint, 0444);
+MODULE_PARM_DESC(fwd_rtskbs, "rtskbs per ingress device for forwarded "
+                 "packets (default: 16)");
+module_param(fwd_batch, uint, 0444);
+MODULE_PARM_DESC(fwd_batch, "maximum number of forwarded packets collected "
+                 "per egress device before transmission (default: 8)");
+
+/* Note: to be called after the routing tables have been modified */
+static inline void rt_fwd_invalidate(void)
+{
+    smp_mb__before_atomic();
+    atomic_inc(&fwd_route_gen);
+}
+#else /* !CONFIG_RTNET_RTIPV4_ROUTER */
+static inline void rt_fwd_invalidate(void)
+{
+}
+#endif /* CONFIG_RTNET_RTIPV4_ROUTER */
+
+
+
+/***
+ *  rt_host_hash - home slot of a host route
+ */
+static inline unsigned int rt_host_hash(u32 addr)
+{
+    return hash_32(ntohl(addr), host_hash_bits);
+}
+
+
+
+/***
+ *  __rt_host_route_find - probes the host table for a destination
+ *  @addr:        destination IP
+ *  @local_ip:    local IP the output device must carry
+ *  @match_local: only consider entries matching @local_ip
+ *
+ *  Returns the slot or -1. Note: caller must either hold host_table_lock or
+ *  validate the result against host_table_seq.
+ */
+static inline int __rt_host_route_find(u32 addr, u32 local_ip,
+                                       int match_local)
+{
+    unsigned int    slot = rt_host_hash(addr);
+    unsigned int    n;
+    u32             key;
+
+
+    for (n = 0; n < host_hash_tbl_size; n++) {
+        key = ACCESS_ONCE(host_keys[slot]);
+        if (key == HOST_ROUTE_FREE)
+            break;
+        if (key == addr) {
+            smp_rmb();
+            if (!match_local ||
+                (ACCESS_ONCE(host_entries[slot].local_ip) == local_ip))
+                return slot;
+        }
+        slot = (slot + 1) & host_hash_key_mask;
+    }
+
+    return -1;
+}
+
+
+
+/***
+ *  __rt_host_route_remove - releases a host table slot
+ *
+ *  Closes the gap by shifting back successors of the probe sequence, thus the
+ *  table never accumulates tombstones.
+ *  Note: must be called with host_table_lock held
+ */
+static void __rt_host_route_remove(unsigned int slot)
+{
+    unsigned int    next = slot;
+    unsigned int    home;
+
+
+    write_seqcount_begin(&host_table_seq);
+
+    host_keys[slot] = HOST_ROUTE_FREE;
+
+    while (1) {
+        next = (next + 1) & host_hash_key_mask;
+        if (host_keys[next] == HOST_ROUTE_FREE)
+            break;
+
+        /* entries whose home lies cyclically in (slot, next] stay */
+        home = rt_host_hash(host_keys[next]);
+        if (((next - home) & host_hash_key_mask) <
+            ((next - slot) & host_hash_key_mask))
+            continue;
+
+        host_entries[slot] = host_entries[next];
+        host_keys[slot]    = host_keys[next];
+        host_keys[next]    = HOST_ROUTE_FREE;
+        slot = next;
+    }
+
+    write_seqcount_end(&host_table_seq);
+
+    allocated_host_routes--;
+
+    rt_fwd_invalidate();
+}
+
 
 
 /***
@@ -106,9 +280,7 @@ static int rtnet_ipv4_route_show(struct seq_file *p, void *data)
 
     seq_printf(p, "Host routes allocated/total:\t%d/%d\n"
 	       "Host hash table size:\t\t%d\n",
-	       allocated_host_routes,
-	       CONFIG_RTNET_RTIPV4_HOST_ROUTES,
-	       HOST_HASH_TBL_SIZE);
+	       allocated_host_routes, host_routes, host_hash_tbl_size);
 
 #ifdef CONFIG_RTNET_RTIPV4_NETROUTING
     mask = NET_HASH_KEY_MASK << net_hash_key_shift;
@@ -120,8 +292,22 @@ static int rtnet_ipv4_route_show(struct seq_file *p, void *data)
 	       net_hash_key_shift, mask);
 #endif /* CONFIG_RTNET_RTIPV4_NETROUTING */
 
+    seq_printf(p, "ARP pending destinations:\t%u\n"
+	       "ARP queued/resolved/timeouts:\t%lu/%lu/%lu\n"
+	       "ARP drops full/unresolved:\t%lu/%lu\n"
+	       "ARP pending overflows/recycled:\t%lu/%lu\n",
+	       rt_arp_stats.pending, rt_arp_stats.queued,
+	       rt_arp_stats.resolved, rt_arp_stats.timeouts,
+	       rt_arp_stats.dropped_full, rt_arp_stats.dropped_unresolved,
+	       rt_arp_stats.overflows, rt_arp_stats.recycled);
+
 #ifdef CONFIG_RTNET_RTIPV4_ROUTER
-    seq_printf(p, "IP Router:\t\t\tyes\n");
+    seq_printf(p, "IP Router:\t\t\tyes\n"
+	       "Forwarded/cache hits/batches:\t%lu/%lu/%lu\n"
+	       "Forward drops TTL/buffers/route:\t%lu/%lu/%lu\n",
+	       fwd_stats.forwarded, fwd_stats.cache_hits, fwd_stats.batches,
+	       fwd_stats.ttl_exceeded, fwd_stats.no_buffers,
+	       fwd_stats.no_route);
 #else
     seq_printf(p, "IP Router:\t\t\tno\n");
 #endif
@@ -143,46 +329,33 @@ static const struct file_operations rtnet_ipv4_route_fops = {
 
 static int  rtnet_ipv4_host__route_show(struct seq_file *p, void *data)
 {
-    struct host_route   *entry_ptr;
     struct dest_route   dest_host;
-    unsigned int        key;
-    unsigned int        index;
-    unsigned int        i;
+    unsigned int        slot;
     rtdm_lockctx_t      context;
 
     seq_printf(p, "Hash\tDestination\tHW Address\t\tDevice\n");
-    for (key = 0; key < HOST_HASH_TBL_SIZE; key++) {
-        index = 0;
-        while (1) {
-            rtdm_lock_get_irqsave(&host_table_lock, context);
-
-            entry_ptr = host_hash_tbl[key];
-
-            for (i = 0; (i < index) && (entry_ptr != NULL); i++)
-                entry_ptr = entry_ptr->next;
-
-            if (entry_ptr == NULL) {
-                rtdm_lock_put_irqrestore(&host_table_lock, context);
-                break;
-            }
-
-            memcpy(&dest_host, &entry_ptr->dest_host,
-                   sizeof(struct dest_route));
-            rtdev_reference(dest_host.rtdev);
+    for (slot = 0; slot < host_hash_tbl_size; slot++) {
+        rtdm_lock_get_irqsave(&host_table_lock, context);
 
+        if (host_keys[slot] == HOST_ROUTE_FREE) {
             rtdm_lock_put_irqrestore(&host_table_lock, context);
+            continue;
+        }
 
-            seq_printf(p, "%02X\t%u.%u.%u.%-3u\t"
-		      "%02X:%02X:%02X:%02X:%02X:%02X\t%s\n",
-		      key, NIPQUAD(dest_host.ip),
-		      dest_host.dev_addr[0], dest_host.dev_addr[1],
-		      dest_host.dev_addr[2], dest_host.dev_addr[3],
-		      dest_host.dev_addr[4], dest_host.dev_addr[5],
-		      dest_host.rtdev->name);
-            rtdev_dereference(dest_host.rtdev);
+        memcpy(&dest_host, &host_entries[slot].dest,
+               sizeof(struct dest_route));
+        rtdev_reference(dest_host.rtdev);
 
-            index++;
-        }
+        rtdm_lock_put_irqrestore(&host_table_lock, context);
+
+        seq_printf(p, "%02X\t%u.%u.%u.%-3u\t"
+		  "%02X:%02X:%02X:%02X:%02X:%02X\t%s\n",
+		  rt_host_hash(dest_host.ip), NIPQUAD(dest_host.ip),
+		  dest_host.dev_addr[0], dest_host.dev_addr[1],
+		  dest_host.dev_addr[2], dest_host.dev_addr[3],
+		  dest_host.dev_addr[4], dest_host.dev_addr[5],
+		  dest_host.rtdev->name);
+        rtdev_dereference(dest_host.rtdev);
     }
     return 0;
 }
@@ -327,43 +500,6 @@ static void rt_route_proc_unregister(void)
 
 
 
-/***
- *  rt_alloc_host_route - allocates new host route
- */
-static inline struct host_route *rt_alloc_host_route(void)
-{
-    rtdm_lockctx_t      context;
-    struct host_route   *rt;
-
-
-    rtdm_lock_get_irqsave(&host_table_lock, context);
-
-    if ((rt = free_host_route) != NULL) {
-        free_host_route = rt->next;
-        allocated_host_routes++;
-    }
-
-    rtdm_lock_put_irqrestore(&host_table_lock, context);
-
-    return rt;
-}
-
-
-
-/***
- *  rt_free_host_route - releases host route
- *
- *  Note: must be called with host_table_lock held
- */
-static inline void rt_free_host_route(struct host_route *rt)
-{
-    rt->next        = free_host_route;
-    free_host_route = rt;
-    allocated_host_routes--;
-}
-
-
-
 /***
  *  rt_ip_route_add_host: add or update host route
  */
@@ -371,12 +507,14 @@ int rt_ip_route_add_host(u32 addr, unsigned char *dev_addr,
                          struct rtnet_device *rtdev)
 {
     rtdm_lockctx_t      context;
-    struct host_route   *new_route;
     struct host_route   *rt;
-    unsigned int        key;
+    int                 slot;
     int                 ret = 0;
 
 
+    if (addr == HOST_ROUTE_FREE)
+        return -EINVAL;
+
     rtdm_lock_get_irqsave(&rtdev->rtdev_lock, context);
 
     if ((!test_bit(PRIV_FLAG_UP, &rtdev->priv_flags) ||
@@ -387,47 +525,56 @@ int rt_ip_route_add_host(u32 addr, unsigned char *dev_addr,
 
     rtdm_lock_put_irqrestore(&rtdev->rtdev_lock, context);
 
-    if ((new_route = rt_alloc_host_route()) != NULL) {
-        new_route->dest_host.ip    = addr;
-        new_route->dest_host.rtdev = rtdev;
-        memcpy(new_route->dest_host.dev_addr, dev_addr, rtdev->addr_len);
-    }
-
-    key = ntohl(addr) & HOST_HASH_KEY_MASK;
-
     rtdm_lock_get_irqsave(&host_table_lock, context);
 
-    rt = host_hash_tbl[key];
-    while (rt != NULL) {
-        if ((rt->dest_host.ip == addr) &&
-            (rt->dest_host.rtdev->local_ip == rtdev->local_ip)) {
-            rt->dest_host.rtdev = rtdev;
-            memcpy(rt->dest_host.dev_addr, dev_addr, rtdev->addr_len);
-
-            if (new_route)
-                rt_free_host_route(new_route);
-
-            rtdm_lock_put_irqrestore(&host_table_lock, context);
-
-            goto out;
+    slot = __rt_host_route_find(addr, rtdev->local_ip, 1);
+    if (slot >= 0) {
+        rt = &host_entries[slot];
+
+        /* refreshing an unchanged entry (e.g. via ARP) must not disturb
+         * concurrent readers */
+        if ((rt->dest.rtdev != rtdev) ||
+            (memcmp(rt->dest.dev_addr, dev_addr, rtdev->addr_len) != 0)) {
+            write_seqcount_begin(&host_table_seq);
+            rt->dest.rtdev = rtdev;
+            rt->local_ip   = rtdev->local_ip;
+            rt->ifindex    = rtdev->ifindex;
+            memcpy(rt->dest.dev_addr, dev_addr, rtdev->addr_len);
+            write_seqcount_end(&host_table_seq);
+
+            rt_fwd_invalidate();
         }
+    } else if (allocated_host_routes < host_routes) {
+        slot = rt_host_hash(addr);
+        while (host_keys[slot] != HOST_ROUTE_FREE)
+            slot = (slot + 1) & host_hash_key_mask;
+
+        /* A free slot is invisible to readers until its key is published,
+         * so inserting requires no sequence update. */
+        rt = &host_entries[slot];
+        rt->dest.ip    = addr;
+        rt->dest.rtdev = rtdev;
+        rt->local_ip   = rtdev->local_ip;
+        rt->ifindex    = rtdev->ifindex;
+        memcpy(rt->dest.dev_addr, dev_addr, rtdev->addr_len);
+        smp_wmb();
+        host_keys[slot] = addr;
 
-        rt = rt->next;
-    }
+        allocated_host_routes++;
 
-    if (new_route) {
-        new_route->next    = host_hash_tbl[key];
-        host_hash_tbl[key] = new_route;
+        /* may shadow a network route a cached decision is based on */
+        rt_fwd_invalidate();
+    } else
+        ret = -ENOBUFS;
 
-        rtdm_lock_put_irqrestore(&host_table_lock, context);
-    } else {
-        rtdm_lock_put_irqrestore(&host_table_lock, context);
+    rtdm_lock_put_irqrestore(&host_table_lock, context);
 
+    if (ret < 0)
         /*ERRMSG*/rtdm_printk("RTnet: no more host routes available\n");
-        ret = -ENOBUFS;
-    }
+    else
+        /* release packets waiting for this destination */
+        rt_arp_flush_pending(addr, rtdev, dev_addr);
 
-  out:
     clear_bit(PRIV_FLAG_ADDING_ROUTE, &rtdev->priv_flags);
 
     return ret;
@@ -441,36 +588,19 @@ int rt_ip_route_add_host(u32 addr, unsigned char *dev_addr,
 int rt_ip_route_del_host(u32 addr, struct rtnet_device *rtdev)
 {
     rtdm_lockctx_t      context;
-    struct host_route   *rt;
-    struct host_route   **last_ptr;
-    unsigned int        key;
+    int                 slot;
 
 
-    key = ntohl(addr) & HOST_HASH_KEY_MASK;
-    last_ptr = &host_hash_tbl[key];
-
     rtdm_lock_get_irqsave(&host_table_lock, context);
 
-    rt = host_hash_tbl[key];
-    while (rt != NULL) {
-        if ((rt->dest_host.ip == addr) &&
-            (!rtdev || (rt->dest_host.rtdev->local_ip == rtdev->local_ip))) {
-            *last_ptr = rt->next;
-
-            rt_free_host_route(rt);
-
-            rtdm_lock_put_irqrestore(&host_table_lock, context);
-
-            return 0;
-        }
-
-        last_ptr = &rt->next;
-        rt = rt->next;
-    }
+    slot = __rt_host_route_find(addr, rtdev ? rtdev->local_ip : 0,
+                                rtdev != NULL);
+    if (slot >= 0)
+        __rt_host_route_remove(slot);
 
     rtdm_lock_put_irqrestore(&host_table_lock, context);
 
-    return -ENOENT;
+    return (slot >= 0) ? 0 : -ENOENT;
 }
 
 
@@ -481,39 +611,33 @@ int rt_ip_route_del_host(u32 addr, struct rtnet_device *rtdev)
 void rt_ip_route_del_all(struct rtnet_device *rtdev)
 {
     rtdm_lockctx_t      context;
-    struct host_route   *host_rt;
-    struct host_route   **last_host_ptr;
-    unsigned int        key;
+    unsigned int        slot;
     u32                 ip;
 
 
-    for (key = 0; key < HOST_HASH_TBL_SIZE; key++) {
-      host_start_over:
-        last_host_ptr = &host_hash_tbl[key];
-
+    /* Removing an entry may shift a successor into the current slot, so
+     * only advance when the slot has been found clean. Only entries we
+     * already checked can wrap around to the table end. */
+    for (slot = 0; slot < host_hash_tbl_size; ) {
         rtdm_lock_get_irqsave(&host_table_lock, context);
 
-        host_rt = host_hash_tbl[key];
-        while (host_rt != NULL) {
-            if (host_rt->dest_host.rtdev == rtdev) {
-                *last_host_ptr = host_rt->next;
+        if ((host_keys[slot] != HOST_ROUTE_FREE) &&
+            (host_entries[slot].dest.rtdev == rtdev)) {
+            __rt_host_route_remove(slot);
 
-                rt_free_host_route(host_rt);
-
-                rtdm_lock_put_irqrestore(&host_table_lock, context);
-
-                goto host_start_over;
-            }
-
-            last_host_ptr = &host_rt->next;
-            host_rt = host_rt->next;
+            rtdm_lock_put_irqrestore(&host_table_lock, context);
+            continue;
         }
 
         rtdm_lock_put_irqrestore(&host_table_lock, context);
+
+        slot++;
     }
 
     if ((ip = rtdev->local_ip) != 0)
         rt_ip_route_del_host(ip, rtdev);
+
+    rt_arp_purge_pending(rtdev);
 }
 
 
@@ -524,32 +648,24 @@ int rt_ip_route_get_host(u32 addr, char *if_name, unsigned char *dev_addr,
                          struct rtnet_device *rtdev)
 {
     rtdm_lockctx_t      context;
-    struct host_route   *rt;
-    unsigned int        key;
-
+    struct dest_route   *rt;
+    int                 slot;
 
-    key = ntohl(addr) & HOST_HASH_KEY_MASK;
 
+    /* the device name is needed, so keep the entry from being removed */
     rtdm_lock_get_irqsave(&host_table_lock, context);
 
-    rt = host_hash_tbl[key];
-    while (rt != NULL) {
-        if ((rt->dest_host.ip == addr) &&
-            (!rtdev || rt->dest_host.rtdev->local_ip == rtdev->local_ip)) {
-            memcpy(dev_addr, rt->dest_host.dev_addr,
-                   rt->dest_host.rtdev->addr_len);
-            strncpy(if_name, rt->dest_host.rtdev->name, IFNAMSIZ);
-
-            rtdm_lock_put_irqrestore(&host_table_lock, context);
-            return 0;
-        }
-
-        rt = rt->next;
+    slot = __rt_host_route_find(addr, rtdev ? rtdev->local_ip : 0,
+                                rtdev != NULL);
+    if (slot >= 0) {
+        rt = &host_entries[slot].dest;
+        memcpy(dev_addr, rt->dev_addr, rt->rtdev->addr_len);
+        strncpy(if_name, rt->rtdev->name, IFNAMSIZ);
     }
 
     rtdm_lock_put_irqrestore(&host_table_lock, context);
 
-    return -ENOENT;
+    return (slot >= 0) ? 0 : -ENOENT;
 }
 
 
@@ -586,7 +702,7 @@ static inline void rt_free_net_route(struct net_route *rt)
 {
     rt->next       = free_net_route;
     free_net_route = rt;
-    allocated_host_routes--;
+    allocated_net_routes--;
 }
 
 
@@ -625,6 +741,7 @@ int rt_ip_route_add_net(u32 addr, u32 mask, u32 gw_addr)
     while (rt != NULL) {
         if ((rt->dest_net_ip == addr) && (rt->dest_net_mask == mask)) {
             rt->gw_ip = gw_addr;
+            rt_fwd_invalidate();
 
             if (new_route)
                 rt_free_net_route(new_route);
@@ -641,6 +758,7 @@ int rt_ip_route_add_net(u32 addr, u32 mask, u32 gw_addr)
     if (new_route) {
         new_route->next = *last_ptr;
         *last_ptr       = new_route;
+        rt_fwd_invalidate();
 
         rtdm_lock_put_irqrestore(&net_table_lock, context);
 
@@ -684,6 +802,7 @@ int rt_ip_route_del_net(u32 addr, u32 mask)
             *last_ptr = rt->next;
 
             rt_free_net_route(rt);
+            rt_fwd_invalidate();
 
             rtdm_lock_put_irqrestore(&net_table_lock, context);
 
@@ -703,21 +822,25 @@ int rt_ip_route_del_net(u32 addr, u32 mask)
 
 
 /***
- *  rt_ip_route_output - looks up output route
+ *  __rt_ip_route_output - looks up output route
+ *  @resolve: accept a route with pending address resolution
  *
  *  Note: increments refcount on returned rtdev in rt_buf
  */
-int rt_ip_route_output(struct dest_route *rt_buf, u32 daddr, u32 saddr)
+static int __rt_ip_route_output(struct dest_route *rt_buf, u32 daddr,
+                                u32 saddr, int resolve)
 {
-    rtdm_lockctx_t      context;
-    struct host_route   *host_rt;
-    unsigned int        key;
+    unsigned int        seq;
+    int                 slot;
+    int                 ifindex;
 
 #ifndef CONFIG_RTNET_RTIPV4_NETROUTING
     #define DADDR       daddr
 #else
     #define DADDR       real_daddr
 
+    rtdm_lockctx_t      context;
+    unsigned int        key;
     struct net_route    *net_rt;
     int                 lookup_gw  = 1;
     u32                 real_daddr = daddr;
@@ -726,37 +849,51 @@ int rt_ip_route_output(struct dest_route *rt_buf, u32 daddr, u32 saddr)
   restart:
 #endif /* !CONFIG_RTNET_RTIPV4_NETROUTING */
 
-    key = ntohl(daddr) & HOST_HASH_KEY_MASK;
+    /* multicast groups map directly onto link layer addresses */
+    if (rt_ip_is_multicast(daddr)) {
+        rt_buf->rtdev = rt_ip_mc_output_dev(saddr);
+        if (rt_buf->rtdev == NULL)
+            return -EHOSTUNREACH;
 
-    rtdm_lock_get_irqsave(&host_table_lock, context);
+        rt_ip_mc_map(daddr, rt_buf->dev_addr);
+        rt_buf->ip         = daddr;
+        rt_buf->pending_ip = 0;
 
-    host_rt = host_hash_tbl[key];
-    if (likely(saddr == INADDR_ANY))
-        while (host_rt != NULL) {
-            if (host_rt->dest_host.ip == daddr) {
-              host_route_found:
-                memcpy(rt_buf->dev_addr, &host_rt->dest_host.dev_addr,
-                       sizeof(rt_buf->dev_addr));
-                rt_buf->rtdev = host_rt->dest_host.rtdev;
-                rtdev_reference(rt_buf->rtdev);
+        return 0;
+    }
 
-                rtdm_lock_put_irqrestore(&host_table_lock, context);
+  host_retry:
+    seq = read_seqcount_begin(&host_table_seq);
+
+    slot = __rt_host_route_find(daddr, saddr, saddr != INADDR_ANY);
+    if (slot >= 0) {
+        memcpy(rt_buf->dev_addr, host_entries[slot].dest.dev_addr,
+               sizeof(rt_buf->dev_addr));
+        ifindex = ACCESS_ONCE(host_entries[slot].ifindex);
+
+        if (unlikely(read_seqcount_retry(&host_table_seq, seq)))
+            goto host_retry;
+
+        /* The device may be gone once the snapshot is stale, so only pick
+         * it up via its index and check the entry survived meanwhile. */
+        rt_buf->rtdev = rtdev_get_by_index(ifindex);
+        if (unlikely(read_seqcount_retry(&host_table_seq, seq))) {
+            if (rt_buf->rtdev != NULL)
+                rtdev_dereference(rt_buf->rtdev);
+            goto host_retry;
+        }
+        if (unlikely(rt_buf->rtdev == NULL))
+            return -EHOSTUNREACH;
 
-                rt_buf->ip = DADDR;
+        rt_buf->ip         = DADDR;
+        rt_buf->pending_ip = 0;
 
-                return 0;
-            }
-            host_rt = host_rt->next;
-        }
-    else
-        while (host_rt != NULL) {
-            if ((host_rt->dest_host.ip == daddr) &&
-                (host_rt->dest_host.rtdev->local_ip == saddr))
-                goto host_route_found;
-            host_rt = host_rt->next;
-        }
+        return 0;
+    }
 
-    rtdm_lock_put_irqrestore(&host_table_lock, context);
+    /* a miss is only valid if no entry was moved during the probe */
+    if (unlikely(read_seqcount_retry(&host_table_seq, seq)))
+        goto host_retry;
 
 #ifdef CONFIG_RTNET_RTIPV4_NETROUTING
     if (lookup_gw) {
@@ -802,50 +939,253 @@ int rt_ip_route_output(struct dest_route *rt_buf, u32 daddr, u32 saddr)
     }
 #endif /* CONFIG_RTNET_RTIPV4_NETROUTING */
 
+    /* Solicit the (next hop) address if it is on-link. Callers which cannot
+     * hold back their packets still fail, but will find the route once the
+     * reply arrived. */
+    if (rt_arp_resolve(rt_buf, daddr, saddr) == 0) {
+        if (resolve) {
+            rt_buf->ip = DADDR;
+            return 0;
+        }
+        rtdev_dereference(rt_buf->rtdev);
+    }
+
     /*ERRMSG*/rtdm_printk("RTnet: host %u.%u.%u.%u unreachable\n", NIPQUAD(daddr));
     return -EHOSTUNREACH;
 }
 
 
 
+/***
+ *  rt_ip_route_output - looks up resolved output route
+ *
+ *  Note: increments refcount on returned rtdev in rt_buf
+ */
+int rt_ip_route_output(struct dest_route *rt_buf, u32 daddr, u32 saddr)
+{
+    return __rt_ip_route_output(rt_buf, daddr, saddr, 0);
+}
+
+
+
+/***
+ *  rt_ip_route_resolve - looks up output route, starts address resolution
+ *
+ *  On a host route miss, the returned route may carry a pending_ip. Packets
+ *  sent via rt_ip_build_xmit over such a route are held back until the next
+ *  hop is resolved or given up.
+ *  Note: increments refcount on returned rtdev in rt_buf
+ */
+int rt_ip_route_resolve(struct dest_route *rt_buf, u32 daddr, u32 saddr)
+{
+    return __rt_ip_route_output(rt_buf, daddr, saddr, 1);
+}
+
+
+
 #ifdef CONFIG_RTNET_RTIPV4_ROUTER
+/***
+ *  rt_ip_fwd_xmit - hands the collected packets over to the egress device
+ */
+static void rt_ip_fwd_xmit(struct fwd_egress *out)
+{
+    struct rtnet_device *rtdev = out->rtdev;
+
+
+    fwd_egress_pending &= ~(1UL << (rtdev->ifindex - 1));
+    out->len = 0;
+
+    rtdev_xmit_batch(&out->batch);
+    fwd_stats.batches++;
+
+    rtdev_dereference(rtdev);
+}
+
+
+
+/***
+ *  rt_ip_route_forward_flush - transmits all pending forwarded packets
+ */
+void rt_ip_route_forward_flush(void)
+{
+    while (fwd_egress_pending != 0)
+        rt_ip_fwd_xmit(&fwd_egress[__ffs(fwd_egress_pending)]);
+}
+
+
+
+/***
+ *  rt_ip_fwd_cache_get - looks up a cached forwarding decision
+ *
+ *  Returns the referenced output device or NULL.
+ */
+static inline struct rtnet_device *
+rt_ip_fwd_cache_get(struct fwd_cache_entry *entry, u32 daddr)
+{
+    unsigned int        gen = (unsigned int)atomic_read(&fwd_route_gen);
+    struct rtnet_device *rtdev;
+
+
+    if ((entry->daddr != daddr) || (entry->gen != gen) ||
+        (entry->ifindex == 0))
+        return NULL;
+
+    /* The device may be unregistered once the route is dropped, so it is
+     * only picked up via its index. A new device may reuse the index, but
+     * dropping the old routes has advanced the generation then. */
+    rtdev = rtdev_get_by_index(entry->ifindex);
+    if (unlikely(rtdev == NULL))
+        return NULL;
+
+    smp_rmb();
+    if (unlikely((unsigned int)atomic_read(&fwd_route_gen) != gen)) {
+        rtdev_dereference(rtdev);
+        return NULL;
+    }
+
+    return rtdev;
+}
+
+
+
+/***
+ *  rt_ip_route_forward - forwards a packet not addressed to us
+ *
+ *  Returns 0 if the packet has to be delivered locally, otherwise it was
+ *  consumed (queued for transmission or dropped).
+ *  Note: must be called from the stack manager, see rt_ip_route_forward_flush
+ */
 int rt_ip_route_forward(struct rtskb *rtskb, u32 daddr)
 {
-    struct rtnet_device *rtdev = rtskb->rtdev;
-    struct dest_route   dest;
+    struct rtnet_device     *rtdev = rtskb->rtdev;
+    struct iphdr            *iph = rtskb->nh.iph;
+    struct fwd_ingress      *in;
+    struct fwd_cache_entry  *entry;
+    struct fwd_egress       *out;
+    struct dest_route       dest;
+    unsigned int            gen;
+    unsigned int            len;
 
 
     if (likely((daddr == rtdev->local_ip) || (daddr == rtdev->broadcast_ip) ||
         (rtdev->flags & IFF_LOOPBACK)))
         return 0;
 
-    if (rtskb_acquire(rtskb, &global_pool) != 0) {
-        /*ERRMSG*/rtdm_printk("RTnet: router overloaded, dropping packet\n");
-        goto error;
+    if (unlikely(iph->ttl <= 1)) {
+        fwd_stats.ttl_exceeded++;
+        goto drop;
     }
 
-    if (rt_ip_route_output(&dest, daddr, INADDR_ANY) < 0) {
-        /*ERRMSG*/rtdm_printk("RTnet: unable to forward packet from %u.%u.%u.%u\n",
-                              NIPQUAD(rtskb->nh.iph->saddr));
-        goto error;
+    in = &fwd_ingress[rtdev->ifindex - 1];
+
+    if (unlikely(rtskb_acquire(rtskb, &in->pool) != 0)) {
+        fwd_stats.no_buffers++;
+        goto drop;
     }
 
+    entry = &in->cache[hash_32(ntohl(daddr), FWD_CACHE_BITS)];
+
+    dest.rtdev = rt_ip_fwd_cache_get(entry, daddr);
+    if (likely(dest.rtdev != NULL) &&
+        likely(rtskb->data - rtskb->buf_start >= entry->hh_len)) {
+        memcpy(rtskb_push(rtskb, entry->hh_len), entry->hh, entry->hh_len);
+        fwd_stats.cache_hits++;
+    } else {
+        if (dest.rtdev != NULL)
+            rtdev_dereference(dest.rtdev);
+
+        gen = (unsigned int)atomic_read(&fwd_route_gen);
+        smp_rmb();
+
+        if (rt_ip_route_output(&dest, daddr, INADDR_ANY) < 0) {
+            fwd_stats.no_route++;
+            goto drop;
+        }
+
+        len = rtskb->len;
+        if ((dest.rtdev->hard_header) &&
+            (dest.rtdev->hard_header(rtskb, dest.rtdev, ETH_P_IP,
+                                     dest.dev_addr, dest.rtdev->dev_addr,
+                                     rtskb->len) < 0)) {
+            rtdev_dereference(dest.rtdev);
+            fwd_stats.no_route++;
+            goto drop;
+        }
+        len = rtskb->len - len;
+
+        /* remember the header as built for this destination */
+        if (len <= FWD_HH_LEN) {
+            entry->daddr   = daddr;
+            entry->gen     = gen;
+            entry->ifindex = dest.rtdev->ifindex;
+            entry->hh_len  = len;
+            memcpy(entry->hh, rtskb->data, len);
+        } else
+            entry->ifindex = 0;
+    }
+
+    ip_decrease_ttl(iph);
+
     rtskb->rtdev    = dest.rtdev;
     rtskb->priority = ROUTER_FORWARD_PRIO;
 
-    if ((dest.rtdev->hard_header) &&
-        (dest.rtdev->hard_header(rtskb, dest.rtdev, ETH_P_IP, dest.dev_addr,
-                                 dest.rtdev->dev_addr, rtskb->len) < 0))
-        goto error;
+    out = &fwd_egress[dest.rtdev->ifindex - 1];
+    if (out->len == 0) {
+        out->rtdev = dest.rtdev;
+        fwd_egress_pending |= 1UL << (dest.rtdev->ifindex - 1);
+    } else
+        rtdev_dereference(dest.rtdev);  /* the batch already holds one */
 
-    rtdev_xmit(rtskb);
+    __rtskb_queue_tail(&out->batch, rtskb);
+    fwd_stats.forwarded++;
+
+    if (++out->len >= fwd_batch)
+        rt_ip_fwd_xmit(out);
 
     return 1;
 
-  error:
+  drop:
     kfree_rtskb(rtskb);
     return 1;
 }
+
+
+
+static int __init rt_ip_fwd_init(void)
+{
+    int i;
+
+
+    if (fwd_batch == 0)
+        fwd_batch = 1;
+
+    for (i = 0; i < MAX_RT_DEVICES; i++) {
+        rtskb_queue_init(&fwd_egress[i].batch);
+
+        if (rtskb_pool_init(&fwd_ingress[i].pool, fwd_rtskbs) < fwd_rtskbs) {
+            /*ERRMSG*/printk("RTnet: unable to allocate forwarding buffers\n");
+            do {
+                rtskb_pool_release(&fwd_ingress[i].pool);
+            } while (i-- > 0);
+            return -ENOMEM;
+        }
+    }
+
+    return 0;
+}
+
+
+
+static void rt_ip_fwd_release(void)
+{
+    int i;
+
+
+    rt_ip_route_forward_flush();
+
+    for (i = 0; i < MAX_RT_DEVICES; i++)
+        rtskb_pool_release(&fwd_ingress[i].pool);
+}
 #endif /* CONFIG_RTNET_RTIPV4_ROUTER */
 
 
@@ -855,12 +1195,38 @@ int rt_ip_route_forward(struct rtskb *rtskb, u32 daddr)
  */
 int __init rt_ip_routing_init(void)
 {
+#ifdef CONFIG_RTNET_RTIPV4_NETROUTING
     int i;
+#endif /* CONFIG_RTNET_RTIPV4_NETROUTING */
+    int ret;
+
+
+    if (host_routes == 0)
+        host_routes = 1;
+
+    /* keep the load factor of the open-addressing table at or below 1/2 */
+    host_hash_tbl_size = roundup_pow_of_two(2 * host_routes);
+    if (host_hash_tbl_size < 64)
+        host_hash_tbl_size = 64;
+    host_hash_key_mask = host_hash_tbl_size - 1;
+    host_hash_bits     = ilog2(host_hash_tbl_size);
+
+    host_keys = kzalloc(host_hash_tbl_size * sizeof(u32), GFP_KERNEL);
+    host_entries = kzalloc(host_hash_tbl_size * sizeof(struct host_route),
+                           GFP_KERNEL);
+    if (!host_keys || !host_entries) {
+        /*ERRMSG*/printk("RTnet: unable to allocate host routing table\n");
+        ret = -ENOMEM;
+        goto err_free;
+    }
 
+    seqcount_init(&host_table_seq);
 
-    for (i = 0; i < CONFIG_RTNET_RTIPV4_HOST_ROUTES-2; i++)
-        host_routes[i].next = &host_routes[i+1];
-    free_host_route = &host_routes[0];
+#ifdef CONFIG_RTNET_RTIPV4_ROUTER
+    ret = rt_ip_fwd_init();
+    if (ret < 0)
+        goto err_free;
+#endif /* CONFIG_RTNET_RTIPV4_ROUTER */
 
 #ifdef CONFIG_RTNET_RTIPV4_NETROUTING
     for (i = 0; i < CONFIG_RTNET_RTIPV4_NET_ROUTES-2; i++)
@@ -869,10 +1235,24 @@ int __init rt_ip_routing_init(void)
 #endif /* CONFIG_RTNET_RTIPV4_NETROUTING */
 
 #ifdef CONFIG_PROC_FS
-    return rt_route_proc_register();
-#else /* !CONFIG_PROC_FS */
+    ret = rt_route_proc_register();
+    if (ret < 0)
+        goto err_fwd;
+#endif /* CONFIG_PROC_FS */
+
     return 0;
+
+#ifdef CONFIG_PROC_FS
+  err_fwd:
+#ifdef CONFIG_RTNET_RTIPV4_ROUTER
+    rt_ip_fwd_release();
+#endif /* CONFIG_RTNET_RTIPV4_ROUTER */
 #endif /* CONFIG_PROC_FS */
+
+  err_free:
+    kfree(host_entries);
+    kfree(host_keys);
+    return ret;
 }
 
 
@@ -885,6 +1265,13 @@ void rt_ip_routing_release(void)
 #ifdef CONFIG_PROC_FS
     rt_route_proc_unregister();
 #endif /* CONFIG_PROC_FS */
+
+#ifdef CONFIG_RTNET_RTIPV4_ROUTER
+    rt_ip_fwd_release();
+#endif /* CONFIG_RTNET_RTIPV4_ROUTER */
+
+    kfree(host_entries);
+    kfree(host_keys);
 }
 
 
@@ -892,3 +1279,4 @@ EXPORT_SYMBOL(rt_ip_route_add_host);
 EXPORT_SYMBOL(rt_ip_route_del_host);
 EXPORT_SYMBOL(rt_ip_route_del_all);
 EXPORT_SYMBOL(rt_ip_route_output);
+EXPORT_SYMBOL(rt_ip_route_resolve);
@@ -24,21 +24,28 @@
 #include <linux/skbuff.h>
 #include <linux/module.h>
 #include <linux/delay.h>
+#include <linux/slab.h>
+#include <linux/wait.h>
+#include <linux/jhash.h>
+#include <linux/seqlock.h>
 #include <net/tcp_states.h>
 #include <net/tcp.h>
+#include <asm/div64.h>
+#include <asm/unaligned.h>
 
 #include <rtdm/rtdm_driver.h>
 #include <rtnet_rtpc.h>
 #include <rtskb.h>
 #include <rtdev.h>
 #include <rtnet_port.h>
+#include <rtnet_iovec.h>
 #include <ipv4/tcp.h>
 #include <ipv4/ip_sock.h>
 #include <ipv4/ip_output.h>
 #include <ipv4/ip_fragment.h>
 #include <ipv4/route.h>
 #include <ipv4/af_inet.h>
-#include "timerwheel.h"
+#include <rtnet_timerwheel.h>
 
 #ifdef CONFIG_RTNET_RTIPV4_TCP_ERROR_INJECTION
 
@@ -57,14 +64,63 @@ MODULE_PARM_DESC(counter_start, "start value of per-socket packet counter "
 
 #endif /* CONFIG_RTNET_RTIPV4_TCP_ERROR_INJECTION */
 
+static unsigned int ofo_segments = 8;
+module_param(ofo_segments, uint, 0444);
+MODULE_PARM_DESC(ofo_segments, "maximum number of out-of-order segments "
+                 "held per socket (0: drop them), at most half of the "
+                 "socket pool (socket_rtskbs of rtnet) as they occupy its "
+                 "buffers");
+
+static unsigned int rto_initial_us = 50000;
+module_param(rto_initial_us, uint, 0644);
+MODULE_PARM_DESC(rto_initial_us, "retransmission timeout before the first "
+                 "RTT sample (us)");
+
+static unsigned int rto_min_us = 2000;
+module_param(rto_min_us, uint, 0644);
+MODULE_PARM_DESC(rto_min_us, "default lower bound of the retransmission "
+                 "timeout (us)");
+
+static unsigned int rto_max_us = 1000000;
+module_param(rto_max_us, uint, 0444);
+MODULE_PARM_DESC(rto_max_us, "upper bound of the retransmission timeout "
+                 "(us)");
+
+static unsigned int tcp_retries = 3;
+module_param(tcp_retries, uint, 0644);
+MODULE_PARM_DESC(tcp_retries, "default number of retransmissions before a "
+                 "connection is considered lost");
+
+static unsigned int tcp_window = RT_TCP_WINDOW;
+module_param(tcp_window, uint, 0644);
+MODULE_PARM_DESC(tcp_window, "default receive window of new sockets (bytes)");
+
+static unsigned int max_inflight = 8;
+module_param(max_inflight, uint, 0644);
+MODULE_PARM_DESC(max_inflight, "maximum number of unacknowledged segments "
+                 "per socket (up to 32)");
+
+static unsigned int delack_us = 1000;
+module_param(delack_us, uint, 0644);
+MODULE_PARM_DESC(delack_us, "delay of ACKs for received data, should stay "
+                 "below the peer's minimum RTO (us, 0: acknowledge at once)");
+
+/* largest payload of a large send, bounded by the IP datagram length */
+#define RT_TCP_TSO_MAX              (RTDEV_TSO_MAX_SIZE - 40)
+
+static unsigned int tso_max = RT_TCP_TSO_MAX;
+module_param(tso_max, uint, 0644);
+MODULE_PARM_DESC(tso_max, "maximum payload of a large send to devices with "
+                 "segmentation offload (bytes, 0: segment in software)");
+
 struct tcp_sync {
     u32 seq;
     u32 ack_seq;
 
-    /* Local window size sent to peer  */
-    u16 window;
-    /* Last received destination peer window size */
-    u16 dst_window;
+    /* Local window size sent to peer, in bytes */
+    u32 window;
+    /* Last received destination peer window size, scaled */
+    u32 dst_window;
 };
 
 /*
@@ -87,14 +143,46 @@ static const u8  rt_tcp_keepalive_probes  = 9;
 static const u64 rt_tcp_keepalive_timeout = 7200000000000ull;
 
 /*
-  retransmission timeout
+  resolution of all TCP timers, one tick of the stack timer wheel
+*/
+static const nanosecs_rel_t rt_tcp_timer_tick =
+    (nanosecs_rel_t)1 << TIMERWHEEL_GRANULARITY;
+/*
+  number of duplicate ACKs triggering a fast retransmission
+*/
+static const unsigned int rt_tcp_dupack_threshold = 3;
+/*
+  number of received segments acknowledged by one delayed ACK (RFC 1122)
+*/
+static const unsigned int rt_tcp_delack_segments = 2;
+/*
+  segments a connection may receive before it is accepted, they occupy
+  buffers of the listening socket until accept() takes them over
+*/
+static const unsigned int rt_tcp_early_segments = 4;
+/*
+  segments held out of order occupy the socket pool, at most half of it is
+  used for them so that in-order data still finds buffers
+*/
+#define RT_TCP_OFO_LIMIT(pool_size) ((pool_size) / 2)
+
+/*
+  largest window scale shift count (RFC 1323) and resulting window
+*/
+#define RT_TCP_MAX_WSCALE           14
+#define RT_TCP_MAX_WINDOW           (0xFFFF << RT_TCP_MAX_WSCALE)
+
+/*
+  segment size assumed for peers which send no MSS option (RFC 879)
 */
-/* 50 millisecond */
-static const nanosecs_rel_t rt_tcp_retransmission_timeout = 50000000ull;
+#define RT_TCP_DEFAULT_MSS          536
+
 /*
-  maximum allowed number of retransmissions
+  capacity of the retransmission queue, max_inflight is limited to it; the
+  segment flushed by close() and the FIN may exceed the limit
 */
-static const unsigned int max_retransmits = 3;
+#define RT_TCP_MAX_INFLIGHT         32
+#define RT_TCP_RTX_SLOTS            (RT_TCP_MAX_INFLIGHT + 2)
 
 struct tcp_keepalive {
     u8 enabled;
@@ -102,10 +190,48 @@ struct tcp_keepalive {
     rtdm_timer_t timer;
 };
 
+/***
+ *  Connection request of a listening socket, kept on one of the lists
+ *  req_free, req_syn (SYN received, SYN|ACK sent) or req_est (handshake
+ *  completed, waiting for accept()). Data of an established request is
+ *  held on the early queue and acknowledged on behalf of the connection.
+ *  While accept() sets up the connection, the request stays on req_est
+ *  marked accepting and is only released once the connection is published.
+ */
+struct tcp_request {
+    struct list_head entry;
+    u32             saddr;       /* local ip-addr the SYN was sent to */
+    u16             sport;       /* local port */
+    u32             daddr;       /* peer ip-addr */
+    u16             dport;       /* peer port */
+    u32             seq;         /* initial sequence number of SYN|ACK */
+    u32             ack_seq;
+    u32             rcv_window;  /* advertised receive window */
+    u32             dst_window;  /* scaled peer window of the final ACK */
+    u8              snd_wscale;
+    u8              rcv_wscale;
+    u8              wscale_ok;
+    u8              established;
+    u16             peer_mss;    /* MSS option of the SYN */
+    unsigned int    priority;    /* of the listening socket */
+    nanosecs_abs_t  stamp;       /* last SYN|ACK transmission */
+    struct rtskb_queue early;    /* in-order data received before accept() */
+    u32             early_len;
+    unsigned int    early_segs;
+    u8              accepting;   /* accept() is setting up the connection */
+    u8              reset;       /* peer reset the request meanwhile */
+};
+
 /***
  *  This structure is used to register a TCP socket for reception. All
  *  structures are kept in the port_registry array to increase the cache
  *  locality during the critical port lookup in rt_tcp_v4_lookup().
+ *
+ *  Lookups do not take tcp_socket_base_lock. Hash entries are published and
+ *  unlinked RCU-style, readers validate their result against tcp_hash_seq
+ *  and retry if needed. As socket structures are released on close,
+ *  rt_tcp_socket_destruct waits until no lookup is in progress
+ *  (tcp_lookups) after unlinking a socket.
  */
 
 /* if dport & daddr are zeroes, it means a listening socket */
@@ -125,7 +251,7 @@ struct tcp_socket {
     u8 is_bound;           /* if set, tcp socket is already port bound */
     u8 is_valid;           /* if set, read() and write() can process */
     u8 is_accepting;       /* if set, accept() is in progress */
-    u8 is_accepted;        /* if set, accept() is already called */
+    u8 is_accepted;        /* if set, socket was created by accept() */
     u8 is_closed;          /* close() call for resource deallocation follows */
 
     rtdm_event_t send_evt; /* write request is permissible */
@@ -136,16 +262,70 @@ struct tcp_socket {
     struct tcp_keepalive keepalive;
     rtdm_lock_t socket_lock;
 
-    struct hlist_node link;
+    struct hlist_node link;      /* port_hash, except accepted sockets */
+    struct hlist_node conn_link; /* conn_hash, sockets with a peer only */
 
     nanosecs_rel_t sk_sndtimeo;
 
-    /* retransmission routine data */
+    /* retransmission routine data, the queue holds references on the
+       transmitted segments (not linked via rtskb.next, drivers use it) */
     u32                nacked_first;
     unsigned int       timer_state;
-    struct rtskb_queue retransmit_queue;
+    struct rtskb       *rtx_queue[RT_TCP_RTX_SLOTS];
+    unsigned int       rtx_head;     /* oldest unacknowledged segment */
     struct timerwheel_timer timer;
 
+    /* retransmission timeout estimation (RFC 6298), in nanoseconds */
+    nanosecs_rel_t     srtt;         /* 0 until the first RTT sample */
+    nanosecs_rel_t     rttvar;
+    nanosecs_rel_t     rto;          /* current timeout incl. backoff */
+    nanosecs_rel_t     rto_min;
+    nanosecs_rel_t     rto_max;
+    unsigned int       retries;      /* allowed retransmissions */
+    u32                rtt_seq;      /* end of the segment being timed */
+    nanosecs_abs_t     rtt_stamp;    /* its transmission, 0 if none */
+
+    /* fast retransmission data */
+    u32                last_ack;     /* last ACK sequence received */
+    unsigned int       dup_acks;     /* duplicate ACKs of last_ack */
+
+    /* loss recovery, partial ACKs below recover trigger retransmissions */
+    u32                recover;      /* sequence sent when recovery began */
+    u8                 recovering;
+
+    /* segments received ahead of sync.ack_seq, sorted by sequence number */
+    struct rtskb_queue ofo_queue;
+    unsigned int       ofo_len;
+    unsigned int       ofo_limit;    /* ofo_segments, clamped to the pool */
+
+    /* window management */
+    u32                rcv_window;   /* configured receive window */
+    u32                adv_edge;     /* right edge of the last announcement */
+    u8                 snd_wscale;   /* shift applied to peer windows */
+    u8                 rcv_wscale;   /* shift applied to our window */
+    u8                 wscale_ok;    /* window scaling offered/agreed */
+    unsigned int       inflight;     /* segments in rtx_queue */
+
+    /* segment size, derived from the MTU of the transmission channel */
+    u32                mss;          /* payload limit of a frame */
+    u16                peer_mss;     /* MSS option of the peer's SYN */
+
+    /* write coalescing */
+    struct rtskb       *send_head;   /* segment being filled, not yet sent */
+    u8                 nodelay;      /* if set, don't hold small segments */
+    u8                 cork;         /* if set, hold all partial segments */
+
+    /* delayed acknowledgement */
+    struct timerwheel_timer ack_timer;
+    unsigned int       ack_pending;  /* segments received, not yet ACKed */
+    u8                 quickack;     /* if set, ACK every segment at once */
+
+    /* listen backlog, allocated by rt_tcp_listen() */
+    struct tcp_request *requests;
+    struct list_head   req_free;
+    struct list_head   req_syn;
+    struct list_head   req_est;
+
 #ifdef CONFIG_RTNET_RTIPV4_TCP_ERROR_INJECTION
     unsigned int packet_counter;
     unsigned int error_rate;
@@ -176,6 +356,12 @@ struct rt_tcp_dispatched_packet_send_cmd {
 MODULE_LICENSE("GPL");
 
 static struct tcp_socket rst_socket;
+/* accept() answers from non-RT context via rst_socket as well */
+static rtdm_lock_t       rst_lock = RTDM_LOCK_UNLOCKED;
+
+/* wakes up accept() callers in non-RT context */
+static rtdm_nrtsig_t        accept_signal;
+static DECLARE_WAIT_QUEUE_HEAD(accept_wq);
 
 static u32 tcp_auto_port_start = 1024;
 static u32 tcp_auto_port_mask  = ~(RT_TCP_SOCKETS-1);
@@ -186,10 +372,16 @@ static unsigned long      port_bitmap[RT_PORT_BITMAP_WORDS];
 
 static struct tcp_socket* port_registry[RT_TCP_SOCKETS];
 static rtdm_lock_t        tcp_socket_base_lock = RTDM_LOCK_UNLOCKED;
+static seqcount_t         tcp_hash_seq;   /* hashes and socket addresses */
+static atomic_t           tcp_lookups;    /* lookups in progress */
 
+/* bound and listening sockets, keyed by local port */
 static struct hlist_head port_hash[RT_TCP_SOCKETS * 2];
 #define port_hash_mask (RT_TCP_SOCKETS * 2 - 1)
 
+/* sockets with a peer, keyed by peer address, peer port and local port */
+static struct hlist_head conn_hash[RT_TCP_SOCKETS * 2];
+
 module_param(tcp_auto_port_start, uint, 0444);
 module_param(tcp_auto_port_mask, uint, 0444);
 MODULE_PARM_DESC(tcp_auto_port_start, "Start of automatically assigned "
@@ -222,41 +414,120 @@ static int port_hash_insert(struct tcp_socket *ts, u32 saddr, u16 sport)
     bucket = sport & port_hash_mask;
     ts->saddr = saddr;
     ts->sport = sport;
-    ts->daddr = 0;
-    ts->dport = 0;
 
-    hlist_add_head(&ts->link, &port_hash[bucket]);
+    hlist_add_head_rcu(&ts->link, &port_hash[bucket]);
 
     return 0;
 }
 
 static inline void port_hash_del(struct tcp_socket *ts)
 {
-    hlist_del(&ts->link);
+    hlist_del_init_rcu(&ts->link);
+}
+
+static inline u32 conn_hash_key(u32 daddr, u16 dport, u16 sport)
+{
+    return jhash_2words(daddr, ((u32)dport << 16) | sport, 0) &
+        port_hash_mask;
+}
+
+static inline void conn_hash_insert(struct tcp_socket *ts, u32 daddr,
+                                    u16 dport)
+{
+    ts->daddr = daddr;
+    ts->dport = dport;
+    hlist_add_head_rcu(&ts->conn_link,
+                       &conn_hash[conn_hash_key(daddr, dport, ts->sport)]);
+}
+
+static inline void conn_hash_del(struct tcp_socket *ts)
+{
+    hlist_del_init_rcu(&ts->conn_link);
 }
 
 /***
- *  rt_tcp_v4_lookup
+ *  tcp_v4_lookup - finds the receiving socket of a segment
+ *
+ *  A socket connected to the sender is preferred. Otherwise, the listening
+ *  or unconnected socket with the most specific local address is taken.
+ *  Note: result must be validated against tcp_hash_seq
  */
-static struct rtsocket *rt_tcp_v4_lookup(u32 daddr, u16 dport)
+static inline struct tcp_socket *tcp_v4_lookup(u32 daddr, u16 dport,
+                                               u32 saddr, u16 sport)
 {
-    rtdm_lockctx_t  context;
     struct tcp_socket *ts;
+    struct tcp_socket *found = NULL;
+    unsigned int steps = 0;
+
+    /* Chains reshuffled by concurrent writers may temporarily appear
+     * longer than the registry, the retry will sort that out. */
+    hlist_for_each_entry_rcu(ts, &conn_hash[conn_hash_key(saddr, sport,
+                                                          dport)],
+                             conn_link) {
+        if (unlikely(++steps > RT_TCP_SOCKETS))
+            return NULL;
+        if (ts->sport == dport && ts->dport == sport &&
+            ts->daddr == saddr &&
+            (ts->saddr == daddr || ts->saddr == INADDR_ANY))
+            return ts;
+    }
 
-    rtdm_lock_get_irqsave(&tcp_socket_base_lock, context);
-    ts = port_hash_search(daddr, dport);
+    steps = 0;
+    hlist_for_each_entry_rcu(ts, &port_hash[dport & port_hash_mask], link) {
+        if (unlikely(++steps > RT_TCP_SOCKETS))
+            return NULL;
+        if (ts->sport != dport || ts->dport != 0 ||
+            (ts->saddr != daddr && ts->saddr != INADDR_ANY))
+            continue;
+
+        if (!found || (found->saddr == INADDR_ANY &&
+                       ts->saddr != INADDR_ANY))
+            found = ts;
+    }
 
-    if (ts) {
-        rt_socket_reference(&ts->sock);
+    return found;
+}
 
-        rtdm_lock_put_irqrestore(&tcp_socket_base_lock, context);
+/***
+ *  tcp_wait_readers - waits for lookups which may still see unlinked entries
+ *
+ *  Note: must be called without tcp_socket_base_lock held
+ */
+static void tcp_wait_readers(void)
+{
+    /* pairs with the barriers in rt_tcp_v4_lookup */
+    smp_mb();
+    while (atomic_read(&tcp_lookups) != 0)
+        cpu_relax();
+}
 
-        return &ts->sock;
-    }
+/***
+ *  rt_tcp_v4_lookup
+ */
+static struct rtsocket *rt_tcp_v4_lookup(u32 daddr, u16 dport,
+                                         u32 saddr, u16 sport)
+{
+    struct tcp_socket *ts;
+    struct rtsocket *rtsock = NULL;
+    unsigned int seq;
+
+    atomic_inc(&tcp_lookups);
+    smp_mb__after_atomic();
+
+    do {
+        seq = read_seqcount_begin(&tcp_hash_seq);
+        ts  = tcp_v4_lookup(daddr, dport, saddr, sport);
+        if (ts && !read_seqcount_retry(&tcp_hash_seq, seq)) {
+            rtsock = &ts->sock;
+            rt_socket_reference(rtsock);
+            break;
+        }
+    } while (read_seqcount_retry(&tcp_hash_seq, seq));
 
-    rtdm_lock_put_irqrestore(&tcp_socket_base_lock, context);
+    smp_mb__before_atomic();
+    atomic_dec(&tcp_lookups);
 
-    return NULL;
+    return rtsock;
 }
 
 /* test seq1 <= seq2 */
@@ -414,6 +685,266 @@ static void rt_tcp_socket_validate(struct tcp_socket *ts)
     rtdm_event_init(&ts->send_evt, 0);
 }
 
+static inline unsigned int rt_tcp_ns_to_us(nanosecs_rel_t ns)
+{
+    u64 val = ns;
+
+    do_div(val, 1000);
+    return val;
+}
+
+/***
+ *  rt_tcp_rto_clamp - apply the socket bounds to a retransmission timeout
+ */
+static inline nanosecs_rel_t rt_tcp_rto_clamp(struct tcp_socket *ts,
+                                              nanosecs_rel_t rto)
+{
+    if (rto < ts->rto_min)
+        return ts->rto_min;
+    if (rto > ts->rto_max)
+        return ts->rto_max;
+    return rto;
+}
+
+/***
+ *  rt_tcp_rtt_sample - update the RTT estimation and the retransmission
+ *                      timeout according to RFC 6298 (locked)
+ *  @ts: rttcp socket
+ *  @rtt: measured round-trip time
+ */
+static void rt_tcp_rtt_sample(struct tcp_socket *ts, nanosecs_rel_t rtt)
+{
+    nanosecs_rel_t delta;
+
+    if (rtt <= 0)
+        rtt = 1;
+
+    if (ts->srtt == 0) {
+        ts->srtt   = rtt;
+        ts->rttvar = rtt >> 1;
+    } else {
+        delta = ts->srtt - rtt;
+        if (delta < 0)
+            delta = -delta;
+
+        /* RTTVAR = 3/4 RTTVAR + 1/4 |SRTT - R|, SRTT = 7/8 SRTT + 1/8 R */
+        ts->rttvar = ts->rttvar - (ts->rttvar >> 2) + (delta >> 2);
+        ts->srtt   = ts->srtt - (ts->srtt >> 3) + (rtt >> 3);
+    }
+
+    /* RTO = SRTT + max(G, 4 RTTVAR), this also ends a backoff */
+    ts->rto = rt_tcp_rto_clamp(ts, ts->srtt +
+                               max_t(nanosecs_rel_t, rt_tcp_timer_tick,
+                                     ts->rttvar << 2));
+}
+
+/* smallest shift count announcing the window within 16 bits */
+static inline u8 rt_tcp_wscale(u32 window)
+{
+    u8 wscale = 0;
+
+    while (wscale < RT_TCP_MAX_WSCALE && (window >> wscale) > 0xFFFF)
+        wscale++;
+
+    return wscale;
+}
+
+/***
+ *  rt_tcp_send_space - number of bytes the peer window still accepts
+ *                      (locked)
+ */
+static inline u32 rt_tcp_send_space(struct tcp_socket *ts)
+{
+    s32 space = ts->last_ack + ts->sync.dst_window - ts->sync.seq;
+
+    if (space <= 0 || ts->inflight >= max_inflight ||
+        ts->inflight >= RT_TCP_MAX_INFLIGHT)
+        return 0;
+
+    return space;
+}
+
+/***
+ *  rt_tcp_local_mss - payload which fits into a frame of the socket's
+ *                     transmission channel, e.g. a TDMA slot
+ *  @ts: rttcp socket with a route
+ */
+static inline u32 rt_tcp_local_mss(struct tcp_socket *ts)
+{
+    struct rtnet_device *rtdev = ts->rt.rtdev;
+
+    return rtdev->get_mtu(rtdev, ts->sock.priority) - 40;
+}
+
+/***
+ *  rt_tcp_mss_update - derive the segment size of a connection (locked)
+ *  @ts: rttcp socket with a route
+ *
+ *  Called when the connection is established, when the transmission
+ *  parameters change, and on retransmission timeouts, which may be caused by
+ *  a reconfigured TDMA slot.
+ */
+static void rt_tcp_mss_update(struct tcp_socket *ts)
+{
+    u32 mss = rt_tcp_local_mss(ts);
+
+    if (ts->peer_mss && ts->peer_mss < mss)
+        mss = ts->peer_mss;
+
+    ts->mss = mss;
+}
+
+/***
+ *  rt_tcp_seg_size - payload capacity of a data segment, limited by the MSS
+ *                    and by small peer windows (locked)
+ */
+static inline u32 rt_tcp_seg_size(struct tcp_socket *ts)
+{
+    u32 size = ts->mss;
+
+    if (ts->sync.dst_window && ts->sync.dst_window < size)
+        size = ts->sync.dst_window;
+
+    return size;
+}
+
+/***
+ *  rt_tcp_send_size - payload capacity of the segment being filled, a large
+ *                     send if the device segments it (locked)
+ */
+static inline u32 rt_tcp_send_size(struct tcp_socket *ts)
+{
+    u32 size = rt_tcp_seg_size(ts);
+    u32 max  = min_t(u32, tso_max, RT_TCP_TSO_MAX);
+
+    if (max > size && rtdev_can_tso(ts->rt.rtdev)) {
+        size = max;
+        if (ts->sync.dst_window && ts->sync.dst_window < size)
+            size = ts->sync.dst_window;
+    }
+
+    return size;
+}
+
+/* payload length of a data segment, which carries no TCP options, including
+   the chained buffers of a large send */
+static inline u32 rt_tcp_payload_len(struct rtskb *skb)
+{
+    return skb->tail - skb->h.raw - sizeof(struct tcphdr) +
+        rtskb_chain_data_len(skb) - skb->len;
+}
+
+/***
+ *  rt_tcp_copy_payload - copy data out of a (large) data segment
+ *  @skb: data segment
+ *  @offset: offset into the payload
+ *  @to: destination
+ *  @len: number of bytes, must not exceed the payload
+ */
+static void rt_tcp_copy_payload(struct rtskb *skb, u32 offset, u8 *to,
+                                u32 len)
+{
+    struct rtskb  *frag  = skb;
+    unsigned char *from  = skb->h.raw + sizeof(struct tcphdr);
+    u32           avail  = skb->tail - from;
+    u32           copy;
+
+    while (1) {
+        if (offset < avail) {
+            copy = min_t(u32, avail - offset, len);
+            memcpy(to, from + offset, copy);
+            to    += copy;
+            len   -= copy;
+            offset = 0;
+        } else
+            offset -= avail;
+
+        if (len == 0 || frag == skb->chain_end)
+            break;
+
+        frag  = frag->next;
+        from  = frag->data;
+        avail = frag->len;
+    }
+}
+
+/* oldest unacknowledged segment, NULL if none (locked) */
+static inline struct rtskb *rt_tcp_rtx_first(struct tcp_socket *ts)
+{
+    return ts->inflight ? ts->rtx_queue[ts->rtx_head] : NULL;
+}
+
+/* remove the oldest unacknowledged segment (locked) */
+static inline struct rtskb *rt_tcp_rtx_dequeue(struct tcp_socket *ts)
+{
+    struct rtskb *skb = rt_tcp_rtx_first(ts);
+
+    if (skb != NULL) {
+        ts->rtx_head = (ts->rtx_head + 1) % RT_TCP_RTX_SLOTS;
+        ts->inflight--;
+    }
+
+    return skb;
+}
+
+static struct rtskb *rt_tcp_rtx_copy(struct tcp_socket *ts,
+                                     struct rtskb *skb);
+
+/***
+ *  rt_tcp_rtx_resend - prepare the oldest unacknowledged segment for another
+ *                      transmission (locked)
+ *  @ts: rttcp socket
+ *
+ *  The queued rtskb itself is sent again once the driver released it,
+ *  otherwise a copy. Large sends, and segments exceeding an MSS which shrank
+ *  meanwhile, are resent in software, starting with the first
+ *  unacknowledged segment. Returns the rtskb to be passed to rtdev_xmit()
+ *  after releasing the lock, or NULL.
+ */
+static struct rtskb *rt_tcp_rtx_resend(struct tcp_socket *ts)
+{
+    struct rtskb *skb = rt_tcp_rtx_first(ts);
+
+    if (skb->gso_size || (ts->mss && rt_tcp_payload_len(skb) > ts->mss))
+        return rt_tcp_rtx_copy(ts, skb);
+
+    if (rtskb_shared(skb)) {
+        /* warning, rtskb_clone is under lock */
+        skb = rtskb_clone(skb, &ts->sock.skb_pool);
+        if (skb == NULL)
+            return NULL;
+    } else
+        rtskb_get(skb);
+
+    /* undo headers pushed in front of the frame by lower layers */
+    skb->data = skb->mac.raw;
+    skb->len  = skb->tail - skb->data;
+
+    /* the channel may have changed, the segment fits into its slot */
+    skb->priority = ts->sock.priority;
+
+    return skb;
+}
+
+/* sequence number following a segment of the retransmission queue */
+static inline u32 rt_tcp_end_seq(struct rtskb *skb)
+{
+    struct tcphdr *th = skb->h.th;
+    u32 end_seq = ntohl(th->seq) - (th->doff << 2);
+
+    /* the device rewrites the IP header of large sends */
+    if (skb->gso_size)
+        end_seq += skb->tail - skb->h.raw + rtskb_chain_data_len(skb) -
+            skb->len;
+    else
+        end_seq += ntohs(skb->nh.iph->tot_len) - (skb->nh.iph->ihl << 2);
+
+    if (th->syn || th->fin)
+        end_seq++;
+
+    return end_seq;
+}
+
 /***
  *  rt_tcp_retransmit_handler - timerwheel handler to process a retransmission
  *  @data: pointer to a rttcp socket structure
@@ -427,9 +958,9 @@ static void rt_tcp_retransmit_handler(void *data)
 
     rtdm_lock_get_irqsave(&ts->socket_lock, context);
 
-    if (unlikely(rtskb_queue_empty(&ts->retransmit_queue))) {
+    if (unlikely(ts->inflight == 0)) {
         /* handled, but retransmission queue is empty */
-        rtdm_lock_get_irqsave(&ts->socket_lock, context);
+        rtdm_lock_put_irqrestore(&ts->socket_lock, context);
         rtdm_printk("rttcp: bug in RT TCP retransmission routine\n");
         return;
     }
@@ -441,21 +972,30 @@ static void rt_tcp_retransmit_handler(void *data)
     }
 
     if (ts->timer_state) {
-        /* more tries */
+        /* more tries, with exponential backoff */
         ts->timer_state--;
-        timerwheel_add_timer(&ts->timer, rt_tcp_retransmission_timeout);
+        ts->rto = rt_tcp_rto_clamp(ts, ts->rto << 1);
+        timerwheel_add_timer(&ts->timer, ts->rto);
 
-        /* warning, rtskb_clone is under lock */
-        skb = rtskb_clone(ts->retransmit_queue.first, &ts->sock.skb_pool);
+        /* Karn's algorithm: no RTT sample from retransmitted segments */
+        ts->rtt_stamp = 0;
+
+        /* partial ACKs of the data sent so far continue the recovery */
+        ts->recover    = ts->sync.seq;
+        ts->recovering = 1;
+
+        /* the slot of the channel may have been reconfigured */
+        if (ts->tcp_state != TCP_SYN_SENT)
+            rt_tcp_mss_update(ts);
+
+        skb = rt_tcp_rtx_resend(ts);
         rtdm_lock_put_irqrestore(&ts->socket_lock, context);
 
         /* BUG, window changes are not respected */
-        if (unlikely(rtdev_xmit(skb)) != 0) {
-            kfree_rtskb(skb);
+        if (unlikely(skb == NULL || rtdev_xmit(skb) != 0))
             rtdm_printk("rttcp: packet retransmission from timer failed\n");
-        }
     } else {
-        ts->timer_state = max_retransmits;
+        ts->timer_state = ts->retries;
 
         /* report about connection lost */
         signal = rt_tcp_socket_invalidate(ts, TCP_CLOSE);
@@ -469,35 +1009,109 @@ static void rt_tcp_retransmit_handler(void *data)
     }
 }
 
+/***
+ *  rt_tcp_fast_retransmit - resend the first unacknowledged segment after
+ *                           duplicate ACKs (locked)
+ *  @ts: rttcp socket
+ *
+ *  Returns the segment to be passed to rtdev_xmit() after releasing the
+ *  lock, or NULL.
+ */
+static struct rtskb *rt_tcp_fast_retransmit(struct tcp_socket *ts)
+{
+    if (ts->tcp_state == TCP_CLOSE)
+        return NULL;
+
+    if (timerwheel_remove_timer(&ts->timer) != 0) {
+        /* already timed out, the handler retransmits */
+        return NULL;
+    }
+
+    /* restart the retransmission timeout, the copy below may get lost too */
+    timerwheel_add_timer(&ts->timer, ts->rto);
+
+    /* Karn's algorithm: no RTT sample from retransmitted segments */
+    ts->rtt_stamp = 0;
+
+    ts->recover    = ts->sync.seq;
+    ts->recovering = 1;
+
+    return rt_tcp_rtx_resend(ts);
+}
+
 /***
  *  rt_tcp_retransmit_ack - remove skbs from retransmission queue on ACK
  *  @ts: rttcp socket
  *  @ack_seq: received ACK sequence value
+ *  @dupack: segment qualifies as duplicate ACK (no data, no SYN or FIN)
+ *
+ *  Segments stay queued until they are acknowledged completely, this applies
+ *  to large sends in particular. During a loss recovery, an ACK which covers
+ *  only a part of the data sent before (partial ACK) retransmits the next
+ *  unacknowledged segment at once.
  */
-static void rt_tcp_retransmit_ack(struct tcp_socket *ts, u32 ack_seq)
+static void rt_tcp_retransmit_ack(struct tcp_socket *ts, u32 ack_seq,
+                                  int dupack)
 {
     struct rtskb* skb;
+    struct rtskb* xmit = NULL;
     rtdm_lockctx_t  context;
+    int advanced = 0;
 
     rtdm_lock_get_irqsave(&ts->socket_lock, context);
 
+    if (ack_seq != ts->last_ack && rt_tcp_after(ack_seq, ts->last_ack)) {
+        ts->last_ack = ack_seq;
+        ts->dup_acks = 0;
+        advanced = 1;
+
+        if (ts->rtt_stamp && rt_tcp_after(ack_seq, ts->rtt_seq)) {
+            rt_tcp_rtt_sample(ts, rtdm_clock_read() - ts->rtt_stamp);
+            ts->rtt_stamp = 0;
+        }
+
+        if (ts->recovering && rt_tcp_after(ack_seq, ts->recover))
+            ts->recovering = 0;
+    } else if (ack_seq != ts->last_ack) {
+        /* outdated ACK, overtaken by a later one */
+        rtdm_lock_put_irqrestore(&ts->socket_lock, context);
+        return;
+    } else if (dupack && ts->inflight &&
+               ++ts->dup_acks == rt_tcp_dupack_threshold) {
+        /* the peer reports a hole starting at ack_seq */
+        skb = rt_tcp_fast_retransmit(ts);
+        rtdm_lock_put_irqrestore(&ts->socket_lock, context);
+
+        if (skb != NULL && rtdev_xmit(skb) != 0)
+            rtdm_printk("rttcp: fast retransmission failed\n");
+        return;
+    }
+
     /*
       ACK, but retransmission queue is empty
       This could happen on repeated ACKs
     */
-    if (rtskb_queue_empty(&ts->retransmit_queue)) {
+    if (ts->inflight == 0) {
         rtdm_lock_put_irqrestore(&ts->socket_lock, context);
         return;
     }
 
     /*
-      Check ts->nacked_first value firstly to ensure that
-      skb for retransmission is present in the queue, otherwise
-      retransmission queue will be drained completely
+      Check ts->nacked_first value (end of the first queued segment)
+      firstly to ensure that at least this segment is acknowledged,
+      otherwise there is nothing to remove
     */
     if (!rt_tcp_before(ts->nacked_first, ack_seq)) {
-        rtdm_lock_put_irqrestore(&ts->socket_lock, context);
-        return;
+        /* a part of a large send, the peer still made progress */
+        if (advanced && ts->tcp_state != TCP_CLOSE &&
+            timerwheel_remove_timer(&ts->timer) == 0) {
+            ts->timer_state = ts->retries;
+            timerwheel_add_timer(&ts->timer, ts->rto);
+
+            if (ts->recovering)
+                xmit = rt_tcp_rtx_resend(ts);
+        }
+        goto out;
     }
 
     if (timerwheel_remove_timer(&ts->timer) != 0) {
@@ -514,48 +1128,54 @@ static void rt_tcp_retransmit_ack(struct tcp_socket *ts, u32 ack_seq)
         return;
     }
 
-    if ((skb = __rtskb_dequeue(&ts->retransmit_queue)) == NULL) {
-        ts->timer_state = max_retransmits;
+    if ((skb = rt_tcp_rtx_first(ts)) == NULL) {
+        ts->timer_state = ts->retries;
+        ts->recovering  = 0;
         rtdm_lock_put_irqrestore(&ts->socket_lock, context);
         return;
     }
 
-    if (rt_tcp_before(ts->nacked_first, ack_seq)) {
+    if (rt_tcp_before(rt_tcp_end_seq(skb), ack_seq)) {
+        rt_tcp_rtx_dequeue(ts);
         rtdm_lock_put_irqrestore(&ts->socket_lock, context);
+        /* the driver may still hold its own reference */
         kfree_rtskb(skb);
         rtdm_lock_get_irqsave(&ts->socket_lock, context);
         goto dequeue_loop;
     }
 
-    /* Put NACKed skb back to queue */
-    /* BUG, need to respect half-acknowledged packets */
-    ts->nacked_first = ntohl(skb->h.th->seq) + 1;
+    /* keep the NACKed skb in the queue, even if partially acknowledged */
+    ts->nacked_first = rt_tcp_end_seq(skb);
 
-    __rtskb_queue_head(&ts->retransmit_queue, skb);
+    /* Have more packages in retransmission queue, restart the timer
+       with a fresh number of tries, the peer made progress */
+    ts->timer_state = ts->retries;
+    timerwheel_add_timer(&ts->timer, ts->rto);
 
-    /* Have more packages in retransmission queue, restart the timer */
-    timerwheel_add_timer(&ts->timer, rt_tcp_retransmission_timeout);
+    if (ts->recovering)
+        xmit = rt_tcp_rtx_resend(ts);
 
+ out:
     rtdm_lock_put_irqrestore(&ts->socket_lock, context);
+
+    if (xmit != NULL && rtdev_xmit(xmit) != 0)
+        rtdm_printk("rttcp: retransmission on partial ACK failed\n");
 }
 
 /***
- *  rt_tcp_retransmit_send - enqueue a skb to retransmission queue (not locked)
+ *  rt_tcp_retransmit_send - enqueue a skb to retransmission queue (locked)
  *  @ts: rttcp socket
- *  @skb: a copied skb for enqueueing
+ *  @skb: a referenced skb for enqueueing
  */
 static void rt_tcp_retransmit_send(struct tcp_socket *ts, struct rtskb *skb)
 {
-    if (rtskb_queue_empty(&ts->retransmit_queue)) {
-        /* retransmission queue is empty */
-        ts->nacked_first = ntohl(skb->h.th->seq) + 1;
+    ts->rtx_queue[(ts->rtx_head + ts->inflight) % RT_TCP_RTX_SLOTS] = skb;
 
-        __rtskb_queue_tail(&ts->retransmit_queue, skb);
+    if (ts->inflight++ == 0) {
+        /* retransmission queue was empty */
+        ts->nacked_first = rt_tcp_end_seq(skb);
 
-        timerwheel_add_timer(&ts->timer, rt_tcp_retransmission_timeout);
-    } else {
-        /* retransmission queue is not empty */
-        __rtskb_queue_tail(&ts->retransmit_queue, skb);
+        timerwheel_add_timer(&ts->timer, ts->rto);
     }
 }
 
@@ -564,6 +1184,7 @@ static int rt_ip_build_frame(struct rtskb *skb, struct rtsocket *sk,
 {
     int             ret;
     struct          rtnet_device *rtdev = rt->rtdev;
+    u32             len = rtskb_chain_data_len(skb); /* large sends */
 
 
     RTNET_ASSERT(rtdev->hard_header, return -EBADF;);
@@ -574,7 +1195,7 @@ static int rt_ip_build_frame(struct rtskb *skb, struct rtsocket *sk,
 
     iph->version  = 4;
     iph->tos      = sk->prot.inet.tos;
-    iph->tot_len  = htons(skb->len); /* length of IP header and IP payload */
+    iph->tot_len  = htons(len); /* length of IP header and IP payload */
     iph->id       = htons(0x00); /* zero IP frame id */
     iph->frag_off = htons(IP_DF); /* and no more frames */
     iph->ttl      = 255;
@@ -586,7 +1207,7 @@ static int rt_ip_build_frame(struct rtskb *skb, struct rtsocket *sk,
 
     rtdev_reference(rt->rtdev);
     ret = rtdev->hard_header(skb, rtdev, ETH_P_IP, rt->dev_addr,
-                             rtdev->dev_addr, skb->len);
+                             rtdev->dev_addr, len);
     rtdev_dereference(rt->rtdev);
 
     if (ret != rtdev->hard_header_len) {
@@ -597,33 +1218,130 @@ static int rt_ip_build_frame(struct rtskb *skb, struct rtsocket *sk,
     return 0;
 }
 
+/* length of the TCP options, only SYN segments carry the MSS and window
+   scaling */
+static inline u8 rt_tcp_optlen(struct tcp_socket *ts, __be32 flags)
+{
+    if (!(flags & TCP_FLAG_SYN))
+        return 0;
+
+    return TCPOLEN_MSS + (ts->wscale_ok ? TCPOLEN_WINDOW + 1 : 0);
+}
+
+/***
+ *  rt_tcp_parse_options - look up the options of a SYN segment
+ *  @skb: received SYN segment
+ *  @mss: receives the MSS option, RT_TCP_DEFAULT_MSS if not present
+ *
+ *  Returns the window scale shift count or -1 if the option is not present.
+ */
+static int rt_tcp_parse_options(struct rtskb *skb, u16 *mss)
+{
+    struct tcphdr *th = skb->h.th;
+    u8 *ptr = (u8 *)(th + 1);
+    int length = min_t(int, th->doff << 2, skb->len) -
+        (int)sizeof(struct tcphdr);
+    int opcode, opsize;
+    int wscale = -1;
+
+    *mss = RT_TCP_DEFAULT_MSS;
+
+    while (length > 0) {
+        opcode = *ptr++;
+        if (opcode == TCPOPT_EOL)
+            break;
+        if (opcode == TCPOPT_NOP) {
+            length--;
+            continue;
+        }
+        if (length < 2)
+            break;
+        opsize = *ptr++;
+        if (opsize < 2 || opsize > length)
+            break;
+        if (opcode == TCPOPT_WINDOW && opsize == TCPOLEN_WINDOW)
+            wscale = min_t(int, *ptr, RT_TCP_MAX_WSCALE);
+        else if (opcode == TCPOPT_MSS && opsize == TCPOLEN_MSS &&
+                 get_unaligned_be16(ptr) != 0)
+            *mss = get_unaligned_be16(ptr);
+        ptr += opsize - 2;
+        length -= opsize;
+    }
+
+    return wscale;
+}
+
+/***
+ *  rt_tcp_build_header - fill in the TCP header of a segment (locked)
+ *  @ts: rttcp socket
+ *  @skb: segment from rt_tcp_alloc_segment() including its payload
+ *  @seq: sequence number of the segment
+ *  @flags: TCP flags
+ *
+ *  The device completes the checksum of large sends, their header only
+ *  carries the sum of the pseudo header without the length.
+ */
 static void rt_tcp_build_header(struct tcp_socket *ts, struct rtskb *skb,
-                                __be32 flags, u8 is_keepalive)
+                                u32 seq, __be32 flags)
 {
     u32 wcheck;
-    u8 tcphdrlen = 20;
+    u32 window;
+    u8 optlen    = rt_tcp_optlen(ts, flags);
+    u8 tcphdrlen = 20 + optlen;
     u8 iphdrlen  = 20;
+    u8 *opt;
     struct tcphdr *th;
 
     th = skb->h.th;
     th->source  = ts->sport;
     th->dest    = ts->dport;
 
-    th->seq = htonl(ts->sync.seq);
+    th->seq = htonl(seq);
+    th->ack_seq = htonl(ts->sync.ack_seq);
 
-    if (unlikely(is_keepalive))
-        th->seq--;
+    /* any segment carries the ACK of all data received so far */
+    if (ts->ack_pending) {
+        ts->ack_pending = 0;
+        timerwheel_remove_timer(&ts->ack_timer);
+    }
 
-    th->ack_seq = htonl(ts->sync.ack_seq);
-    th->window  = htons(ts->sync.window);
+    /* the window of SYN segments is never scaled */
+    window = ts->sync.window;
+    if (!(flags & TCP_FLAG_SYN))
+        window >>= ts->rcv_wscale;
+    window = min_t(u32, window, 0xFFFF);
+    th->window  = htons(window);
+
+    ts->adv_edge = ts->sync.ack_seq +
+        ((flags & TCP_FLAG_SYN) ? window : window << ts->rcv_wscale);
 
     rt_tcp_set_flags(th, flags);
 
-    th->doff = tcphdrlen >> 2; /* No options for now */
+    if (optlen) {
+        /* announce the payload which fits into the channel's frames */
+        opt = (u8 *)(th + 1);
+        opt[0] = TCPOPT_MSS;
+        opt[1] = TCPOLEN_MSS;
+        put_unaligned_be16(min_t(u32, rt_tcp_local_mss(ts), 0xFFFF), opt + 2);
+
+        if (ts->wscale_ok) {
+            opt[4] = TCPOPT_NOP;
+            opt[5] = TCPOPT_WINDOW;
+            opt[6] = TCPOLEN_WINDOW;
+            opt[7] = ts->rcv_wscale;
+        }
+    }
+
+    th->doff = tcphdrlen >> 2;
     th->res1 = 0;
     th->check   = 0;
     th->urg_ptr = 0;
 
+    if (skb->gso_size) {
+        th->check = ~tcp_v4_check(0, ts->saddr, ts->daddr, 0);
+        return;
+    }
+
     /* compute checksum */
     wcheck = csum_partial(th, tcphdrlen, 0);
 
@@ -635,81 +1353,142 @@ static void rt_tcp_build_header(struct tcp_socket *ts, struct rtskb *skb,
     th->check = tcp_v4_check(skb->len - iphdrlen, ts->saddr, ts->daddr, wcheck);
 }
 
-static int
-rt_tcp_segment(struct dest_route *rt, struct tcp_socket *ts, __be32 flags,
-               u32 data_len, u8 *data_ptr, u8 is_keepalive)
+/***
+ *  rt_tcp_alloc_segment - allocate a segment and reserve its IP and TCP
+ *                         headers
+ *  @rt: route of the segment
+ *  @ts: rttcp socket
+ *  @optlen: length of the TCP options
+ *
+ *  The payload is appended via rtskb_put(), the buffer holds up to one MTU.
+ */
+static struct rtskb *rt_tcp_alloc_segment(struct dest_route *rt,
+                                          struct tcp_socket *ts, u8 optlen)
 {
-    struct tcphdr       *th;
     struct rtsocket     *sk    = &ts->sock;
     struct rtnet_device *rtdev = rt->rtdev;
     struct rtskb        *skb;
-    struct iphdr        *iph;
-    struct rtskb* cloned_skb;
-    rtdm_lockctx_t  context;
-
-    int ret;
 
     u32 hh_len = (rtdev->hard_header_len + 15) & ~15;
     u32 prio = (volatile unsigned int)sk->priority;
     u32 mtu = rtdev->get_mtu(rtdev, prio);
 
-    u8 *data = NULL;
-
     if ((skb = alloc_rtskb(mtu + hh_len + 15, &sk->skb_pool)) == NULL) {
         rtdm_printk("rttcp: no more elements in skb_pool for allocation\n");
-        return -ENOBUFS;
+        return NULL;
     }
 
     /* rtskb_reserve(skb, hh_len + 20); */
     rtskb_reserve(skb, hh_len);
 
-    iph = (struct iphdr*)rtskb_put(skb, 20); /* length of IP header */
-    skb->nh.iph = iph;
+    /* length of IP header */
+    skb->nh.iph = (struct iphdr*)rtskb_put(skb, 20);
 
-    th = (struct tcphdr*)rtskb_put(skb, 20); /* length of TCP header */
-    skb->h.th = th;
+    /* length of TCP header */
+    skb->h.th = (struct tcphdr*)rtskb_put(skb, 20 + optlen);
 
-    if (data_len) { /* check for available place */
-        data = (u8*)rtskb_put(skb, data_len); /* length of TCP payload */
-        if (!memcpy(data, (void*)data_ptr, data_len)) {
-            ret = -EFAULT;
-            goto error;
-        }
+    skb->rtdev    = rtdev;
+    skb->priority = prio;
+
+    return skb;
+}
+
+/***
+ *  rt_tcp_rtx_copy - copy the first unacknowledged segment of a large send
+ *                    or of a segment exceeding the MSS (locked)
+ *  @ts: rttcp socket
+ *  @skb: queued segment
+ *
+ *  The copy is a regular segment of up to one MSS, segmented in software.
+ *  Returns the rtskb to be passed to rtdev_xmit() after releasing the lock,
+ *  or NULL.
+ */
+static struct rtskb *rt_tcp_rtx_copy(struct tcp_socket *ts,
+                                     struct rtskb *skb)
+{
+    struct rtskb *copy;
+    u32 seq    = ntohl(skb->h.th->seq);
+    u32 offset = 0;
+    u32 len;
+
+    if (ts->last_ack != seq && rt_tcp_after(ts->last_ack, seq))
+        offset = ts->last_ack - seq;
+
+    len = rt_tcp_payload_len(skb);
+    if (offset >= len)
+        return NULL;
+    len = min_t(u32, len - offset, rt_tcp_seg_size(ts));
+
+    /* warning, rt_tcp_alloc_segment is under lock */
+    copy = rt_tcp_alloc_segment(&ts->rt, ts, 0);
+    if (copy == NULL)
+        return NULL;
+
+    rt_tcp_copy_payload(skb, offset, rtskb_put(copy, len), len);
+
+    rt_tcp_build_header(ts, copy, seq + offset, TCP_FLAG_ACK);
+
+    if (rt_ip_build_frame(copy, &ts->sock, &ts->rt, copy->nh.iph) != 0) {
+        kfree_rtskb(copy);
+        return NULL;
     }
 
-    /* used local phy MTU value */
-    if (data_len > mtu)
-        data_len = mtu;
+    return copy;
+}
 
-    skb->rtdev    = rtdev;
-    skb->priority = prio;
+/***
+ *  rt_tcp_commit_segment - assign the next sequence numbers to a segment and
+ *                          build its headers (locked)
+ *  @rt: route of the segment
+ *  @ts: rttcp socket
+ *  @skb: segment from rt_tcp_alloc_segment() including its payload
+ *  @flags: TCP flags
+ *  @is_keepalive: send a keepalive probe
+ *
+ *  Segments occupying sequence space stay referenced by the retransmission
+ *  queue. On success, the caller passes skb to rtdev_xmit() after releasing
+ *  the lock and the payload length is returned. Otherwise, skb still
+ *  belongs to the caller.
+ */
+static int rt_tcp_commit_segment(struct dest_route *rt, struct tcp_socket *ts,
+                                 struct rtskb *skb, __be32 flags,
+                                 u8 is_keepalive)
+{
+    u32 data_len = skb->tail - skb->h.raw - 20 - rt_tcp_optlen(ts, flags) +
+        rtskb_chain_data_len(skb) - skb->len;
+    int queue;
+    int ret;
 
     /* do not validate socket connection on xmit
        this should be done at upper level */
 
-    rtdm_lock_get_irqsave(&ts->socket_lock, context);
-    rt_tcp_build_header(ts, skb, flags, is_keepalive);
-
-    if ((ret = rt_ip_build_frame(skb, sk, rt, iph)) != 0) {
-        rtdm_lock_put_irqrestore(&ts->socket_lock, context);
-        goto error;
+    queue = ts->tcp_state != TCP_CLOSE &&
+        ((flags & (TCP_FLAG_SYN|TCP_FLAG_FIN)) || data_len);
+    if (queue && ts->inflight == RT_TCP_RTX_SLOTS) {
+        rtdm_printk("rttcp: retransmission queue overflow\n");
+        return -ENOBUFS;
     }
 
-    /* add rtskb entry to the socket retransmission queue */
-    if (ts->tcp_state != TCP_CLOSE &&
-        ((flags & (TCP_FLAG_SYN|TCP_FLAG_FIN)) || data_len)) {
-        /* rtskb_clone below is called under lock, this is an admission,
-           because for now there is no rtskb copy by reference */
-        cloned_skb = rtskb_clone(skb, &ts->sock.skb_pool);
-        if (!cloned_skb) {
-            rtdm_lock_put_irqrestore(&ts->socket_lock, context);
-            rtdm_printk("rttcp: cann't clone skb\n");
-            ret = -ENOMEM;
-            goto error;
-        }
+    /* the device cuts chained segments into frames of one MSS */
+    if (skb->chain_end != skb)
+        skb->gso_size = rt_tcp_seg_size(ts);
 
-        rt_tcp_retransmit_send(ts, cloned_skb);
-    }
+    /* segments built before a change of the transmission parameters keep
+       the old channel unless they fit the new one */
+    if (skb->gso_size || data_len <= ts->mss)
+        skb->priority = ts->sock.priority;
+
+    rt_tcp_build_header(ts, skb,
+                        unlikely(is_keepalive) ? ts->sync.seq - 1 : ts->sync.seq,
+                        flags);
+
+    if ((ret = rt_ip_build_frame(skb, &ts->sock, rt, skb->nh.iph)) != 0)
+        return ret;
+
+    /* keep a reference in the socket retransmission queue instead of a
+       copy, rt_tcp_rtx_resend() takes care of the driver's reference */
+    if (queue)
+        rt_tcp_retransmit_send(ts, rtskb_get(skb));
 
     /* need to update sync here, because it is safe way in
        comparison with races on fast ACK response */
@@ -717,20 +1496,103 @@ rt_tcp_segment(struct dest_route *rt, struct tcp_socket *ts, __be32 flags,
         ts->sync.seq++;
 
     ts->sync.seq += data_len;
-    ts->sync.dst_window -= data_len;
+
+    /* time one segment per round trip, if none is in flight yet */
+    if (queue && !ts->rtt_stamp) {
+        ts->rtt_seq   = ts->sync.seq;
+        ts->rtt_stamp = rtdm_clock_read();
+    }
+
+    return data_len;
+}
+
+/***
+ *  rt_tcp_push - send the segment being filled if permitted (locked)
+ *  @ts: rttcp socket
+ *  @force: ignore the window and the coalescing rules (before the FIN)
+ *  @more: the writer announced more data (MSG_MORE)
+ *
+ *  A full segment leaves as soon as the peer window and the in-flight limit
+ *  permit it. A partly filled segment is held while the socket is corked,
+ *  or, unless nodelay is set, as long as sent data is unacknowledged
+ *  (Nagle's algorithm); the ACK path pushes it later. With segmentation
+ *  offload, a segment is full at rt_tcp_send_size() bytes and a large send
+ *  of at least one MSS is not subject to Nagle's algorithm.
+ *  Returns the segment to be passed to rtdev_xmit() after releasing the
+ *  lock, or NULL.
+ */
+static struct rtskb *rt_tcp_push(struct tcp_socket *ts, int force, int more)
+{
+    struct rtskb *skb = ts->send_head;
+    u32 len;
+    u32 size;
+
+    if (skb == NULL || ts->tcp_state == TCP_CLOSE)
+        return NULL;
+
+    len = rt_tcp_payload_len(skb);
+
+    if (!force) {
+        size = rt_tcp_send_size(ts);
+
+        /* a large send in progress need not wait for a full buffer */
+        if (len < size &&
+            (more || ts->cork ||
+             (!ts->nodelay && ts->inflight && len < rt_tcp_seg_size(ts))))
+            return NULL;
+
+        if (rt_tcp_send_space(ts) < len)
+            return NULL;
+    }
+
+    ts->send_head = NULL;
+
+    if (rt_tcp_commit_segment(&ts->rt, ts, skb, TCP_FLAG_ACK, 0) < 0) {
+        rtdm_printk("rttcp: cann't send a packet, %u bytes lost\n", len);
+        kfree_rtskb(skb);
+        return NULL;
+    }
+
+    return skb;
+}
+
+static int
+rt_tcp_segment(struct dest_route *rt, struct tcp_socket *ts, __be32 flags,
+               u8 is_keepalive)
+{
+    struct rtskb   *skb;
+    struct rtskb   *pending = NULL;
+    rtdm_lockctx_t context;
+    int ret;
+
+    skb = rt_tcp_alloc_segment(rt, ts, rt_tcp_optlen(ts, flags));
+    if (skb == NULL)
+        return -ENOBUFS;
+
+    rtdm_lock_get_irqsave(&ts->socket_lock, context);
+
+    /* data written before close() precedes the FIN */
+    if (flags & TCP_FLAG_FIN)
+        pending = rt_tcp_push(ts, 1, 0);
+
+    ret = rt_tcp_commit_segment(rt, ts, skb, flags, is_keepalive);
 
     rtdm_lock_put_irqrestore(&ts->socket_lock, context);
 
+    if (pending != NULL)
+        rtdev_xmit(pending);
+
+    if (ret < 0) {
+        kfree_rtskb(skb);
+        return ret;
+    }
+
     /* ignore return value from rtdev_xmit */
     /* the packet was enqueued and on error will be retransmitted later */
     /* on critical error after retransmission timeout the connection will
        be closed by connection lost */
     rtdev_xmit(skb);
 
-    return data_len;
-
- error:
-    kfree_rtskb(skb);
     return ret;
 }
 
@@ -744,11 +1606,11 @@ static int rt_tcp_send(struct tcp_socket *ts, __be32 flags)
      * until the socket died.
      */
     if (likely(ts->rt.rtdev)) {
-        ret = rt_tcp_segment(&ts->rt, ts, flags, 0, NULL, 0);
+        ret = rt_tcp_segment(&ts->rt, ts, flags, 0);
     } else {
         ret = rt_ip_route_output(&rt, ts->daddr, ts->saddr);
         if (ret == 0) {
-            ret = rt_tcp_segment(&rt, ts, flags, 0, NULL, 0);
+            ret = rt_tcp_segment(&rt, ts, flags, 0);
             rtdev_dereference(rt.rtdev);
         }
     }
@@ -757,6 +1619,47 @@ static int rt_tcp_send(struct tcp_socket *ts, __be32 flags)
     return ret;
 }
 
+/***
+ *  rt_tcp_delack_handler - timerwheel handler sending a delayed ACK
+ *  @data: pointer to a rttcp socket structure
+ */
+static void rt_tcp_delack_handler(void *data)
+{
+    struct tcp_socket *ts = (struct tcp_socket *)data;
+    rtdm_lockctx_t context;
+    int pending;
+
+    rtdm_lock_get_irqsave(&ts->socket_lock, context);
+    /* cleared if some segment took the ACK along meanwhile */
+    pending = ts->ack_pending && ts->tcp_state != TCP_CLOSE;
+    rtdm_lock_put_irqrestore(&ts->socket_lock, context);
+
+    if (pending)
+        rt_tcp_send(ts, TCP_FLAG_ACK);
+}
+
+/***
+ *  rt_tcp_delack - account for a received in-order data segment (locked)
+ *  @ts: rttcp socket
+ *  @urgent: the segment filled a hole in the received sequence space
+ *
+ *  Returns non-zero if the ACK has to be sent right away. Otherwise the
+ *  delayed ACK timer runs, and the ACK goes out with the next segment we
+ *  send or on expiry of the timer.
+ */
+static int rt_tcp_delack(struct tcp_socket *ts, int urgent)
+{
+    ts->ack_pending++;
+
+    if (urgent || ts->quickack || delack_us == 0 ||
+        ts->ack_pending >= rt_tcp_delack_segments)
+        return 1;
+
+    /* fails beyond the timer wheel horizon */
+    return timerwheel_add_timer(&ts->ack_timer,
+                                (nanosecs_rel_t)delack_us * 1000) != 0;
+}
+
 #ifdef YET_UNUSED
 static void rt_tcp_keepalive_timer(rtdm_timer_t *timer)
 {
@@ -771,105 +1674,471 @@ static void rt_tcp_keepalive_timer(rtdm_timer_t *timer)
 
     if (keepalive->probes) {
         /* Send a probe */
-        if (rt_tcp_segment(&ts->rt, ts, 0, 0, NULL, 1) < 0) {
+        if (rt_tcp_segment(&ts->rt, ts, 0, 1) < 0) {
             /* data receiving and sending is not possible anymore */
             signal = rt_tcp_socket_invalidate(ts, TCP_TIME_WAIT);
             rtdm_lock_put_irqrestore(&ts->socket_lock, context);
         }
 
-        keepalive->probes--;
-        rtdm_timer_start_in_handler(&keepalive->timer,
-                                    rt_tcp_keepalive_intvl,
-                                    0, RTDM_TIMERMODE_RELATIVE);
-        rtdm_lock_put_irqrestore(&ts->socket_lock, context);
-    } else {
-        /* data receiving and sending is not possible anymore */
+        keepalive->probes--;
+        rtdm_timer_start_in_handler(&keepalive->timer,
+                                    rt_tcp_keepalive_intvl,
+                                    0, RTDM_TIMERMODE_RELATIVE);
+        rtdm_lock_put_irqrestore(&ts->socket_lock, context);
+    } else {
+        /* data receiving and sending is not possible anymore */
+
+        signal = rt_tcp_socket_invalidate(ts, TCP_TIME_WAIT);
+        rtdm_lock_put_irqrestore(&ts->socket_lock, context);
+    }
+
+    if (signal)
+        rt_tcp_socket_invalidate_signal(ts);
+}
+#endif
+
+static inline u32 rt_tcp_initial_seq(void)
+{
+    uint64_t clock_val = rtdm_clock_read_monotonic();
+    return (u32)(clock_val ^ (clock_val >> 32));
+}
+
+/***
+ *  rt_tcp_send_rst - reply to a segment with RST|ACK via rst_socket
+ *  @skb: received segment
+ *  @seq: sequence number of the reply
+ */
+static void rt_tcp_send_rst(struct rtskb *skb, u32 seq)
+{
+    struct tcphdr *th = skb->h.th;
+    u32 data_len = skb->len - (th->doff << 2);
+    rtdm_lockctx_t context;
+
+    rtdm_lock_get_irqsave(&rst_lock, context);
+
+    rst_socket.saddr = skb->nh.iph->daddr;
+    rst_socket.daddr = skb->nh.iph->saddr;
+    rst_socket.sport = th->dest;
+    rst_socket.dport = th->source;
+
+    rst_socket.sync.seq = seq;
+    rst_socket.sync.ack_seq = rt_tcp_compute_ack_seq(th, data_len);
+    rst_socket.sync.window = 0;
+
+    if (rt_ip_route_output(&rst_socket.rt, rst_socket.daddr,
+                           rst_socket.saddr) == 0) {
+        rt_tcp_send(&rst_socket, TCP_FLAG_RST|TCP_FLAG_ACK);
+        rtdev_dereference(rst_socket.rt.rtdev);
+    }
+
+    rtdm_lock_put_irqrestore(&rst_lock, context);
+}
+
+/***
+ *  rt_tcp_send_request - answer a connection request via rst_socket
+ *  @req: request of a listening socket
+ *  @flags: TCP_FLAG_SYN|TCP_FLAG_ACK during the handshake, TCP_FLAG_ACK
+ *          for data received before accept(), TCP_FLAG_RST|TCP_FLAG_ACK if
+ *          accept() failed to set up the connection
+ *
+ *  rst_socket is in TCP_CLOSE state, so the segment is not queued for
+ *  retransmission, the peer repeats its SYN or data instead.
+ */
+static void rt_tcp_send_request(struct tcp_request *req, __be32 flags)
+{
+    rtdm_lockctx_t context;
+
+    rtdm_lock_get_irqsave(&rst_lock, context);
+
+    rst_socket.saddr = req->saddr;
+    rst_socket.daddr = req->daddr;
+    rst_socket.sport = req->sport;
+    rst_socket.dport = req->dport;
+
+    rst_socket.sync.seq     = (flags & TCP_FLAG_SYN) ? req->seq : req->seq + 1;
+    rst_socket.sync.ack_seq = req->ack_seq;
+    rst_socket.sync.window  = req->rcv_window - req->early_len;
+    rst_socket.wscale_ok    = req->wscale_ok;
+    rst_socket.rcv_wscale   = req->rcv_wscale;
+
+    /* the channel of the accepted socket determines the announced MSS */
+    rst_socket.sock.priority = req->priority;
+
+    if (rt_ip_route_output(&rst_socket.rt, rst_socket.daddr,
+                           rst_socket.saddr) == 0) {
+        rt_tcp_send(&rst_socket, flags);
+        rtdev_dereference(rst_socket.rt.rtdev);
+    }
+
+    rst_socket.wscale_ok     = 0;
+    rst_socket.rcv_wscale    = 0;
+    rst_socket.sock.priority = RT_TCP_RST_PRIO;
+
+    rtdm_lock_put_irqrestore(&rst_lock, context);
+}
+
+/***
+ *  rt_tcp_dest_socket
+ */
+static struct rtsocket *rt_tcp_dest_socket(struct rtskb *skb)
+{
+    struct tcphdr    *th = skb->h.th;
+
+    u32 saddr = skb->nh.iph->saddr;
+    u32 daddr = skb->nh.iph->daddr;
+    u32 sport = th->source;
+    u32 dport = th->dest;
+
+    if (tcp_v4_check(skb->len, saddr, daddr,
+                     csum_partial(skb->data, skb->len, 0))) {
+        rtdm_printk("rttcp: invalid TCP packet checksum, dropped\n");
+        return NULL; /* Invalid checksum, drop the packet */
+    }
+
+    /* find the destination socket */
+    if ((skb->sk = rt_tcp_v4_lookup(daddr, dport, saddr, sport)) == NULL) {
+        /*
+          rtdm_printk("Not found addr:0x%08x, port: 0x%04x\n", daddr, dport);
+        */
+        if (!th->rst) {
+            /* No listening socket found, send RST|ACK */
+            rt_tcp_send_rst(skb, 0);
+        }
+    }
+
+    return skb->sk;
+}
+
+/***
+ *  rt_tcp_window_update - take over the peer window of a segment
+ *  @ts: rttcp socket
+ *  @th: received TCP header
+ */
+static void rt_tcp_window_update(struct tcp_socket *ts, struct tcphdr *th)
+{
+    rtdm_lockctx_t context;
+    struct rtskb *skb;
+    int writable;
+
+    rtdm_lock_get_irqsave(&ts->socket_lock, context);
+
+    /* the window of SYN segments is never scaled */
+    ts->sync.dst_window = ntohs(th->window);
+    if (!th->syn)
+        ts->sync.dst_window <<= ts->snd_wscale;
+
+    /* the ACK may have opened the window or completed the data in flight */
+    skb = rt_tcp_push(ts, 0, 0);
+    writable = (ts->send_head == NULL);
+
+    rtdm_lock_put_irqrestore(&ts->socket_lock, context);
+
+    if (skb != NULL)
+        rtdev_xmit(skb);
+
+    /* writers wait for a full segment to leave, see rt_tcp_sendiov() */
+    if (writable)
+        rtdm_event_signal(&ts->send_evt);
+}
+
+/***
+ *  rt_tcp_ofo_queue - hold a segment received ahead of sync.ack_seq (locked)
+ *  @ts: rttcp socket
+ *  @skb: segment with data, skb->data still points to the TCP header
+ *
+ *  Returns 0 if the segment was queued, otherwise it has to be dropped.
+ */
+static int rt_tcp_ofo_queue(struct tcp_socket *ts, struct rtskb *skb)
+{
+    u32 seq = ntohl(skb->h.th->seq);
+    u32 cur_seq;
+    struct rtskb *prev = NULL;
+    struct rtskb *cur;
+
+    if (ts->ofo_len >= ts->ofo_limit)
+        return -ENOBUFS;
+
+    for (cur = ts->ofo_queue.first; cur != NULL; cur = cur->chain_end->next) {
+        cur_seq = ntohl(cur->h.th->seq);
+        if (cur_seq == seq)
+            return -EEXIST; /* already held */
+        if (rt_tcp_after(cur_seq, seq))
+            break;
+        prev = cur;
+    }
+
+    skb->chain_end->next = cur;
+    if (prev != NULL)
+        prev->chain_end->next = skb;
+    else
+        ts->ofo_queue.first = skb;
+    if (cur == NULL)
+        ts->ofo_queue.last = skb->chain_end;
+
+    ts->ofo_len++;
+
+    return 0;
+}
+
+/***
+ *  rt_tcp_ofo_collect - take held segments which became in-order (locked)
+ *  @ts: rttcp socket
+ *  @ready: receives segments to be delivered, in sequence order
+ *  @stale: receives segments overlapped by data received meanwhile
+ *
+ *  Both queues have to be processed by the caller after releasing the lock.
+ */
+static void rt_tcp_ofo_collect(struct tcp_socket *ts,
+                               struct rtskb_queue *ready,
+                               struct rtskb_queue *stale)
+{
+    struct rtskb *skb;
+    struct tcphdr *th;
+    unsigned int data_len;
+    u32 seq;
+
+    while ((skb = ts->ofo_queue.first) != NULL) {
+        th = skb->h.th;
+        seq = ntohl(th->seq);
+
+        if (seq != ts->sync.ack_seq && rt_tcp_after(seq, ts->sync.ack_seq))
+            break; /* still a hole in front of it */
+
+        __rtskb_dequeue_chain(&ts->ofo_queue);
+        ts->ofo_len--;
+
+        if (seq != ts->sync.ack_seq) {
+            __rtskb_queue_tail(stale, skb);
+            continue;
+        }
+
+        data_len = skb->len - (th->doff << 2);
+        ts->sync.ack_seq += data_len;
+        if (data_len < ts->sync.window)
+            ts->sync.window -= data_len;
+        else
+            ts->sync.window = 0;
 
-        signal = rt_tcp_socket_invalidate(ts, TCP_TIME_WAIT);
-        rtdm_lock_put_irqrestore(&ts->socket_lock, context);
+        __rtskb_queue_tail(ready, skb);
     }
-
-    if (signal)
-        rt_tcp_socket_invalidate_signal(ts);
 }
-#endif
 
-static inline u32 rt_tcp_initial_seq(void)
+/***
+ *  rt_tcp_request_find - look up the connection request of a peer (locked)
+ */
+static struct tcp_request *rt_tcp_request_find(struct tcp_socket *ts,
+                                               u32 daddr, u16 dport)
 {
-    uint64_t clock_val = rtdm_clock_read_monotonic();
-    return (u32)(clock_val ^ (clock_val >> 32));
+    struct tcp_request *req;
+
+    list_for_each_entry(req, &ts->req_syn, entry)
+        if (req->daddr == daddr && req->dport == dport)
+            return req;
+
+    list_for_each_entry(req, &ts->req_est, entry)
+        if (req->daddr == daddr && req->dport == dport)
+            return req;
+
+    return NULL;
 }
 
 /***
- *  rt_tcp_dest_socket
+ *  rt_tcp_request_alloc - get a free request entry (locked)
+ *
+ *  If the backlog is exhausted, the oldest request still waiting for the
+ *  final ACK is reused once its peer had time enough to repeat the SYN.
  */
-static struct rtsocket *rt_tcp_dest_socket(struct rtskb *skb)
+static struct tcp_request *rt_tcp_request_alloc(struct tcp_socket *ts)
 {
-    struct tcphdr    *th = skb->h.th;
+    struct tcp_request *req;
 
-    u32 saddr = skb->nh.iph->saddr;
-    u32 daddr = skb->nh.iph->daddr;
-    u32 sport = th->source;
-    u32 dport = th->dest;
+    if (!list_empty(&ts->req_free))
+        return list_first_entry(&ts->req_free, struct tcp_request, entry);
 
-    u32 data_len;
+    if (list_empty(&ts->req_syn))
+        return NULL;
 
-    if (tcp_v4_check(skb->len, saddr, daddr,
-                     csum_partial(skb->data, skb->len, 0))) {
-        rtdm_printk("rttcp: invalid TCP packet checksum, dropped\n");
-        return NULL; /* Invalid checksum, drop the packet */
-    }
+    req = list_first_entry(&ts->req_syn, struct tcp_request, entry);
+    if (rtdm_clock_read() - req->stamp < rt_tcp_connection_timeout)
+        return NULL;
 
-    /* find the destination socket */
-    if ((skb->sk = rt_tcp_v4_lookup(daddr, dport)) == NULL) {
-        /*
-          rtdm_printk("Not found addr:0x%08x, port: 0x%04x\n", daddr, dport);
-        */
-        if (!th->rst) {
-            /* No listening socket found, send RST|ACK */
-            rst_socket.saddr = daddr;
-            rst_socket.daddr = saddr;
-            rst_socket.sport = dport;
-            rst_socket.dport = sport;
+    return req;
+}
+
+static void rt_tcp_rcv(struct rtskb *skb);
+
+/***
+ *  rt_tcp_accepted_rcv - pass a segment on to a connection accept() published
+ *  @ts: listening rttcp socket the segment was looked up for
+ *  @skb: received segment without a matching request
+ *
+ *  The lookup of the segment may have raced with accept() publishing the
+ *  connection and releasing the request. Returns 1 if the segment was
+ *  consumed that way.
+ */
+static int rt_tcp_accepted_rcv(struct tcp_socket *ts, struct rtskb *skb)
+{
+    struct rtsocket *sock;
+    int err;
 
-            data_len = skb->len - (th->doff << 2);
+    sock = rt_tcp_v4_lookup(skb->nh.iph->daddr, skb->h.th->dest,
+                            skb->nh.iph->saddr, skb->h.th->source);
+    if (sock == NULL)
+        return 0;
+    if (sock == &ts->sock) {
+        rt_socket_dereference(sock);
+        return 0;
+    }
 
-            rst_socket.sync.seq = 0;
-            rst_socket.sync.ack_seq = rt_tcp_compute_ack_seq(th, data_len);
+    err = rtskb_acquire(skb, &sock->skb_pool);
+    if (err)
+        rt_socket_drop_nobuf(sock);
 
-            if (rt_ip_route_output(&rst_socket.rt, daddr, saddr) == 0) {
-                rt_tcp_send(&rst_socket, TCP_FLAG_ACK|TCP_FLAG_RST);
-                rtdev_dereference(rst_socket.rt.rtdev);
-            }
-        }
+    /* the socket is now implicitly locked by the rtskb */
+    rt_socket_dereference(sock);
+
+    if (err)
+        kfree_rtskb(skb);
+    else {
+        skb->sk = sock;
+        rt_tcp_rcv(skb);
     }
 
-    return skb->sk;
+    return 1;
 }
 
-static void rt_tcp_window_update(struct tcp_socket *ts, u16 window)
+/***
+ *  rt_tcp_listen_rcv - three-way handshake on behalf of a listening socket
+ *  @ts: rttcp socket in TCP_LISTEN state, socket_lock is held by the caller
+ *  @skb: received segment, consumed
+ *  @context: lock context of the caller, the lock is released
+ *
+ *  Completed handshakes are moved to the req_est list, accept() creates
+ *  the connected sockets from it. In-order data the peer sends meanwhile
+ *  is kept on the early queue of the request and acknowledged, so that the
+ *  peer does not run into its retransmission limit before accept().
+ */
+static void rt_tcp_listen_rcv(struct tcp_socket *ts, struct rtskb *skb,
+                              rtdm_lockctx_t context)
 {
-    rtdm_lockctx_t context;
+    struct tcphdr *th = skb->h.th;
+    u32 daddr = skb->nh.iph->saddr;
+    u32 seq = ntohl(th->seq);
+    unsigned int data_len = skb->len - (th->doff << 2);
+    struct tcp_request *req;
+    struct tcp_request answer;
+    int wscale;
+    enum { NO_REPLY, REPLY_SYNACK, REPLY_ACK, REPLY_RST } reply = NO_REPLY;
+    int signal = 0;
+    int queued = 0;
 
-    rtdm_lock_get_irqsave(&ts->socket_lock, context);
+    req = rt_tcp_request_find(ts, daddr, th->source);
 
-    if (ts->sync.dst_window) {
-        ts->sync.dst_window = window;
-        rtdm_lock_put_irqrestore(&ts->socket_lock, context);
-        if (!window) {
-            /* clear send event status */
-            rtdm_event_clear(&ts->send_evt);
+    if (th->rst) {
+        /* peer gave up, drop the request - accept() releases it itself */
+        if (req != NULL) {
+            rtskb_queue_purge(&req->early);
+            req->early_len  = 0;
+            req->early_segs = 0;
+            if (req->accepting)
+                req->reset = 1;
+            else
+                list_move_tail(&req->entry, &ts->req_free);
         }
-    } else {
-        if (window) {
-            ts->sync.dst_window = window;
-            rtdm_lock_put_irqrestore(&ts->socket_lock, context);
-            /* set send event status */
-            rtdm_event_signal(&ts->send_evt);
-        } else {
-            rtdm_lock_put_irqrestore(&ts->socket_lock, context);
+    } else if (th->syn && !th->ack) {
+        if (req == NULL) {
+            req = rt_tcp_request_alloc(ts);
+            if (req == NULL) {
+                /* backlog full, the peer will repeat its SYN */
+                rtdm_lock_put_irqrestore(&ts->socket_lock, context);
+                goto drop;
+            }
+
+            req->saddr       = skb->nh.iph->daddr;
+            req->sport       = th->dest;
+            req->daddr       = daddr;
+            req->dport       = th->source;
+            req->seq         = rt_tcp_initial_seq();
+            req->ack_seq     = ntohl(th->seq) + 1;
+            req->rcv_window  = ts->rcv_window;
+            req->priority    = ts->sock.priority;
+            req->established = 0;
+            req->accepting   = 0;
+            req->reset       = 0;
+            req->early_len   = 0;
+            req->early_segs  = 0;
+            rtskb_queue_init(&req->early);
+
+            wscale = rt_tcp_parse_options(skb, &req->peer_mss);
+            req->wscale_ok  = (wscale >= 0);
+            req->snd_wscale = req->wscale_ok ? wscale : 0;
+            req->rcv_wscale = req->wscale_ok ?
+                rt_tcp_wscale(req->rcv_window) : 0;
+
+            list_move_tail(&req->entry, &ts->req_syn);
+        }
+
+        /* a repeated SYN means our SYN|ACK got lost */
+        if (!req->established) {
+            req->stamp = rtdm_clock_read();
+            answer = *req;
+            reply = REPLY_SYNACK;
+        }
+    } else if (req == NULL) {
+        /* no connection request from this peer */
+        reply = REPLY_RST;
+    } else if (!req->established && th->ack) {
+        if (ntohl(th->ack_seq) == req->seq + 1 && seq == req->ack_seq) {
+            req->dst_window  = ntohs(th->window) << req->snd_wscale;
+            req->established = 1;
+            list_move_tail(&req->entry, &ts->req_est);
+            signal = 1;
+        } else
+            reply = REPLY_RST;
+    }
+
+    /* data for a connection not yet accepted, possibly carried by the
+       final ACK of the handshake */
+    if (reply == NO_REPLY && req != NULL && req->established &&
+        !req->reset && !th->rst && !th->syn && data_len > 0) {
+        /* fragmented segments cannot be handed over to another pool */
+        if (seq == req->ack_seq && !th->fin && skb->chain_end == skb &&
+            req->early_segs < rt_tcp_early_segments &&
+            req->early_len + data_len <= req->rcv_window) {
+            __rtskb_queue_tail(&req->early, skb);
+            req->early_len += data_len;
+            req->early_segs++;
+            req->ack_seq += data_len;
+            queued = 1;
         }
+        if (th->ack)
+            req->dst_window = ntohs(th->window) << req->snd_wscale;
+
+        /* acknowledge what is held, the peer retransmits the rest */
+        answer = *req;
+        reply = REPLY_ACK;
+    }
+
+    rtdm_lock_put_irqrestore(&ts->socket_lock, context);
+
+    if (signal)
+        rtdm_nrtsig_pend(&accept_signal);
+
+    if (reply == REPLY_SYNACK)
+        rt_tcp_send_request(&answer, TCP_FLAG_SYN|TCP_FLAG_ACK);
+    else if (reply == REPLY_ACK)
+        rt_tcp_send_request(&answer, TCP_FLAG_ACK);
+    else if (reply == REPLY_RST) {
+        if (req == NULL && rt_tcp_accepted_rcv(ts, skb))
+            return;
+        rt_tcp_send_rst(skb, th->ack ? ntohl(th->ack_seq) : 0);
     }
+
+    if (queued)
+        return;
+
+ drop:
+    kfree_rtskb(skb);
 }
 
 
@@ -883,6 +2152,10 @@ static void rt_tcp_rcv(struct rtskb *skb)
     struct tcphdr* th = skb->h.th;
     unsigned int data_len = skb->len - (th->doff << 2);
     u32 seq = ntohl(th->seq);
+    struct rtskb_queue ready, stale;
+    int held = 0;
+    int ack_now;
+    int wscale;
     int signal;
 
     ts = container_of(skb->sk, struct tcp_socket, sock);
@@ -906,6 +2179,11 @@ static void rt_tcp_rcv(struct rtskb *skb)
         goto drop;
     }
 
+    if (ts->tcp_state == TCP_LISTEN) {
+        rt_tcp_listen_rcv(ts, skb, context);
+        return;
+    }
+
     /* Check if it is a keepalive probe */
     if (ts->sync.ack_seq == (seq + 1) &&
         ts->tcp_state == TCP_ESTABLISHED) {
@@ -918,6 +2196,17 @@ static void rt_tcp_rcv(struct rtskb *skb)
         ts->sync.ack_seq = rt_tcp_compute_ack_seq(th, data_len);
 
         if (th->syn && th->ack) {
+            wscale = rt_tcp_parse_options(skb, &ts->peer_mss);
+            if (wscale < 0 || !ts->wscale_ok) {
+                /* no window scaling on either side */
+                ts->wscale_ok  = 0;
+                ts->snd_wscale = 0;
+                ts->rcv_wscale = 0;
+            } else
+                ts->snd_wscale = wscale;
+
+            rt_tcp_mss_update(ts);
+
             rt_tcp_socket_validate(ts);
             rtdm_lock_put_irqrestore(&ts->socket_lock, context);
             rtdm_event_signal(&ts->conn_evt);
@@ -942,8 +2231,7 @@ static void rt_tcp_rcv(struct rtskb *skb)
      *
      * th->ack && rt_tcp_after(ts->nacked_first, ntohl(th->ack_seq))
      * th->ack && th->rst && ...
-     * th->syn && (ts->tcp_state == TCP_LISTEN ||
-                   ts->tcp_state == TCP_SYN_SENT)
+     * th->syn && ts->tcp_state == TCP_SYN_SENT
      * rt_tcp_after(seq, ts->sync.ack_seq) &&
            rt_tcp_before(seq, ts->sync.ack_seq + ts->sync.window)
      */
@@ -951,14 +2239,19 @@ static void rt_tcp_rcv(struct rtskb *skb)
     if ((rt_tcp_after(seq, ts->sync.ack_seq) &&
          rt_tcp_before(seq, ts->sync.ack_seq + ts->sync.window)) ||
         th->rst ||
-        (th->syn && (ts->tcp_state == TCP_LISTEN ||
-                     ts->tcp_state == TCP_SYN_SENT))) {
+        (th->syn && ts->tcp_state == TCP_SYN_SENT)) {
         /* everything is ok */
     } else if (rt_tcp_after(seq, ts->sync.ack_seq - data_len)) {
         /* retransmission of data we already acked */
         rtdm_lock_put_irqrestore(&ts->socket_lock, context);
         rt_tcp_send(ts, TCP_FLAG_ACK);
         goto drop;
+    } else if (ts->tcp_state == TCP_ESTABLISHED &&
+               rt_tcp_after(seq, ts->sync.ack_seq)) {
+        /* beyond our window after losses, report the hole again */
+        rtdm_lock_put_irqrestore(&ts->socket_lock, context);
+        rt_tcp_send(ts, TCP_FLAG_ACK);
+        goto drop;
     } else {
         /* drop forward ack */
         if (th->ack &&
@@ -976,40 +2269,42 @@ static void rt_tcp_rcv(struct rtskb *skb)
                     ts->sync.ack_seq, seq, ts->sync.ack_seq + ts->sync.window);
 
         /* That's a forced RST for a lost connection */
-        rst_socket.saddr = skb->nh.iph->daddr;
-        rst_socket.daddr = skb->nh.iph->saddr;
-        rst_socket.sport = th->dest;
-        rst_socket.dport = th->source;
-
-        rst_socket.sync.seq = ntohl(th->ack_seq);
-        rst_socket.sync.ack_seq = rt_tcp_compute_ack_seq(th, data_len);
-
-        if (rt_ip_route_output(&rst_socket.rt, rst_socket.daddr,
-                               rst_socket.saddr) == 0) {
-            rt_tcp_send(&rst_socket, TCP_FLAG_RST|TCP_FLAG_ACK);
-            rtdev_dereference(rst_socket.rt.rtdev);
-        }
+        rt_tcp_send_rst(skb, ntohl(th->ack_seq));
         goto drop;
     }
 
     if (th->rst) {
-        if (ts->tcp_state == TCP_SYN_RECV) {
-            ts->tcp_state = TCP_LISTEN;
-            rtdm_lock_put_irqrestore(&ts->socket_lock, context);
-            goto drop;
-        } else {
-            /* Drop our half-open connection, peer obviously went away. */
-            signal = rt_tcp_socket_invalidate(ts, TCP_CLOSE);
-            rtdm_lock_put_irqrestore(&ts->socket_lock, context);
+        /* Drop our half-open connection, peer obviously went away. */
+        signal = rt_tcp_socket_invalidate(ts, TCP_CLOSE);
+        rtdm_lock_put_irqrestore(&ts->socket_lock, context);
 
-            if (signal)
-                rt_tcp_socket_invalidate_signal(ts);
+        if (signal)
+            rt_tcp_socket_invalidate_signal(ts);
 
-            goto drop;
-        }
+        goto drop;
     }
 
-    ts->sync.ack_seq = rt_tcp_compute_ack_seq(th, data_len);
+    if (ts->tcp_state == TCP_ESTABLISHED && seq != ts->sync.ack_seq &&
+        !th->syn) {
+        /* segment beyond a hole in the received sequence space */
+        if (th->fin || (data_len && rt_tcp_ofo_queue(ts, skb) != 0)) {
+            /* no room or FIN, the peer has to retransmit it */
+            rtdm_lock_put_irqrestore(&ts->socket_lock, context);
+            rt_tcp_send(ts, TCP_FLAG_ACK);
+            goto feed;
+        }
+
+        if (data_len) {
+            rtdm_lock_put_irqrestore(&ts->socket_lock, context);
+            /* duplicate ACK, triggers fast retransmission on the peer */
+            rt_tcp_send(ts, TCP_FLAG_ACK);
+            held = 1;
+            goto feed;
+        }
+
+        /* pure ACK, keep ack_seq until the missing data arrives */
+    } else
+        ts->sync.ack_seq = rt_tcp_compute_ack_seq(th, data_len);
 
     if (th->fin) {
         if (ts->tcp_state == TCP_ESTABLISHED) {
@@ -1047,29 +2342,7 @@ static void rt_tcp_rcv(struct rtskb *skb)
     }
 
     if (th->syn) {
-        /* Need to differentiate LISTEN socket from ESTABLISHED one */
-        /* Both of them have the same sport/saddr, but different dport/daddr */
-        /* dport is unknown if it is the first connection of n */
-
-        if (ts->tcp_state == TCP_LISTEN) {
-            /* Need to store ts->seq while sending SYN earlier */
-            /* The socket shall be in TCP_LISTEN state */
-
-            /* safe to update ts->saddr here due to a single task for
-               rt_tcp_rcv() and rt_tcp_dest_socket() callers */
-            ts->saddr = skb->nh.iph->daddr;
-
-            ts->daddr = skb->nh.iph->saddr;
-            ts->dport = th->source;
-            ts->sync.seq = rt_tcp_initial_seq();
-            ts->sync.window = 4096;
-            ts->tcp_state = TCP_SYN_RECV;
-            rtdm_lock_put_irqrestore(&ts->socket_lock, context);
-
-            /* Send SYN|ACK */
-            rt_tcp_send(ts, TCP_FLAG_SYN|TCP_FLAG_ACK);
-            goto drop;
-        }
+        /* connection requests are handled by rt_tcp_listen_rcv() */
 
         /* Send RST|ACK */
         rtdm_lock_put_irqrestore(&ts->socket_lock, context);
@@ -1099,11 +2372,6 @@ static void rt_tcp_rcv(struct rtskb *skb)
             ts->tcp_state = TCP_FIN_WAIT2;
             rtdm_lock_put_irqrestore(&ts->socket_lock, context);
             goto feed;
-        } else if (ts->tcp_state == TCP_SYN_RECV) {
-            rt_tcp_socket_validate(ts);
-            rtdm_lock_put_irqrestore(&ts->socket_lock, context);
-            rtdm_event_signal(&ts->conn_evt);
-            goto feed;
         } else if (ts->tcp_state == TCP_CLOSING) {
             ts->tcp_state = TCP_TIME_WAIT;
             rtdm_lock_put_irqrestore(&ts->socket_lock, context);
@@ -1122,32 +2390,56 @@ static void rt_tcp_rcv(struct rtskb *skb)
         goto feed;
     }
 
-    /* Send ACK */
     ts->sync.window -= data_len;
+
+    rtskb_queue_init(&ready);
+    rtskb_queue_init(&stale);
+    if (!rtskb_queue_empty(&ts->ofo_queue)) {
+        rt_tcp_ofo_collect(ts, &ready, &stale);
+        /* let the peer's recovery proceed without delay */
+        ack_now = rt_tcp_delack(ts, 1);
+    } else
+        ack_now = rt_tcp_delack(ts, 0);
+
     rtdm_lock_put_irqrestore(&ts->socket_lock, context);
-    rt_tcp_send(ts, TCP_FLAG_ACK);
 
-    rtskb_queue_tail(&skb->sk->incoming, skb);
-    rtdm_sem_up(&ts->sock.pending_sem);
+    /* Send ACK, covering held segments which are in-order now */
+    if (ack_now)
+        rt_tcp_send(ts, TCP_FLAG_ACK);
 
     /* inform retransmission subsystem about arrived ack */
     if (th->ack) {
-        rt_tcp_retransmit_ack(ts, ntohl(th->ack_seq));
+        rt_tcp_retransmit_ack(ts, ntohl(th->ack_seq), 0);
     }
 
     rt_tcp_keepalive_feed(ts);
-    rt_tcp_window_update(ts, ntohs(th->window));
+    rt_tcp_window_update(ts, th);
+
+    rtskb_queue_tail(&ts->sock.incoming, skb);
+    rtdm_sem_up(&ts->sock.pending_sem);
+
+    while ((skb = __rtskb_dequeue_chain(&ready)) != NULL) {
+        rtskb_queue_tail(&ts->sock.incoming, skb);
+        rtdm_sem_up(&ts->sock.pending_sem);
+    }
+
+    while ((skb = __rtskb_dequeue_chain(&stale)) != NULL)
+        kfree_rtskb(skb);
 
     return;
 
  feed:
     /* inform retransmission subsystem about arrived ack */
     if (th->ack) {
-        rt_tcp_retransmit_ack(ts, ntohl(th->ack_seq));
+        rt_tcp_retransmit_ack(ts, ntohl(th->ack_seq),
+                              !data_len && !th->syn && !th->fin);
     }
 
     rt_tcp_keepalive_feed(ts);
-    rt_tcp_window_update(ts, ntohs(th->window));
+    rt_tcp_window_update(ts, th);
+
+    if (held)
+        return;
 
  drop:
     kfree_rtskb(skb);
@@ -1163,25 +2455,6 @@ static void rt_tcp_rcv_err(struct rtskb *skb)
     rtdm_printk("rttcp: rt_tcp_rcv err\n");
 }
 
-static int rt_tcp_window_send(struct tcp_socket *ts, u32 data_len,
-                              u8 *data_ptr)
-{
-    u32 dst_window = ts->sync.dst_window;
-    int ret;
-
-    if (data_len > dst_window)
-        data_len = dst_window;
-
-    if ((ret = rt_tcp_segment(&ts->rt, ts, TCP_FLAG_ACK,
-                              data_len, data_ptr, 0)) < 0) {
-        rtdm_printk("rttcp: cann't send a packet: err %d\n", -ret);
-        return ret;
-    }
-
-    return ret;
-}
-
-
 static int rt_tcp_socket_create(struct tcp_socket* ts)
 {
     rtdm_lockctx_t  context;
@@ -1192,6 +2465,10 @@ static int rt_tcp_socket_create(struct tcp_socket* ts)
     sock->prot.inet.saddr = INADDR_ANY;
     sock->prot.inet.state = TCP_CLOSE;
     sock->prot.inet.tos   = 0;
+    sock->prot.inet.ip_id = 0;
+    sock->prot.inet.reuse = 0;
+    sock->prot.inet.no_check = 0;
+    sock->prot.inet.frag_collectors = 0;
     /*
       rtdm_printk("rttcp: rt_tcp_socket_create 0x%p\n", ts);
     */
@@ -1199,6 +2476,10 @@ static int rt_tcp_socket_create(struct tcp_socket* ts)
 
     ts->rt.rtdev = NULL;
 
+    ts->daddr = 0;
+    ts->dport = 0;
+    INIT_HLIST_NODE(&ts->conn_link);
+
     ts->tcp_state = TCP_CLOSE;
 
     ts->is_accepting = 0;
@@ -1214,9 +2495,50 @@ static int rt_tcp_socket_create(struct tcp_socket* ts)
 
     ts->keepalive.enabled = 0;
 
-    ts->timer_state = max_retransmits;
+    ts->srtt      = 0;
+    ts->rttvar    = 0;
+    ts->rto_min   = (nanosecs_rel_t)rto_min_us * 1000;
+    ts->rto_max   = (nanosecs_rel_t)rto_max_us * 1000;
+    ts->rto       = rt_tcp_rto_clamp(ts, (nanosecs_rel_t)rto_initial_us * 1000);
+    ts->retries   = tcp_retries;
+    ts->rtt_stamp = 0;
+
+    ts->timer_state = ts->retries;
     timerwheel_init_timer(&ts->timer, rt_tcp_retransmit_handler, ts);
-    rtskb_queue_init(&ts->retransmit_queue);
+    ts->rtx_head = 0;
+
+    timerwheel_init_timer(&ts->ack_timer, rt_tcp_delack_handler, ts);
+    ts->ack_pending = 0;
+    ts->quickack    = 0;
+
+    ts->last_ack = 0;
+    ts->dup_acks = 0;
+    ts->recovering = 0;
+    ts->mss        = 0;
+    ts->adv_edge   = 0;
+    ts->peer_mss   = 0;
+
+    rtskb_queue_init(&ts->ofo_queue);
+    ts->ofo_len   = 0;
+    ts->ofo_limit = min_t(unsigned int, ofo_segments,
+                          RT_TCP_OFO_LIMIT(sock->pool_size));
+
+    ts->rcv_window = tcp_window;
+    if (ts->rcv_window == 0 || ts->rcv_window > RT_TCP_MAX_WINDOW)
+        ts->rcv_window = RT_TCP_WINDOW;
+    ts->snd_wscale = 0;
+    ts->rcv_wscale = 0;
+    ts->wscale_ok  = 0;
+    ts->inflight   = 0;
+
+    ts->send_head = NULL;
+    ts->nodelay   = 0;
+    ts->cork      = 0;
+
+    ts->requests = NULL;
+    INIT_LIST_HEAD(&ts->req_free);
+    INIT_LIST_HEAD(&ts->req_syn);
+    INIT_LIST_HEAD(&ts->req_est);
 
 #ifdef CONFIG_RTNET_RTIPV4_TCP_ERROR_INJECTION
     ts->packet_counter = counter_start;
@@ -1239,13 +2561,15 @@ static int rt_tcp_socket_create(struct tcp_socket* ts)
             break;
     index = ffz(port_bitmap[i]);
     set_bit(index, &port_bitmap[i]);
-    index += i*32;
+    index += i*BITS_PER_LONG;
     sock->prot.inet.reg_index = index;
     sock->prot.inet.sport     = index + tcp_auto_port_start;
 
     /* register TCP socket */
     port_registry[index] = ts;
+    write_seqcount_begin(&tcp_hash_seq);
     port_hash_insert(ts, INADDR_ANY, sock->prot.inet.sport);
+    write_seqcount_end(&tcp_hash_seq);
 
     rtdm_lock_put_irqrestore(&tcp_socket_base_lock, context);
 
@@ -1291,6 +2615,7 @@ static void rt_tcp_socket_destruct(struct tcp_socket* ts)
 {
     rtdm_lockctx_t  context;
     struct rtskb    *skb;
+    struct tcp_request *requests, *req;
     int             index;
     int             signal;
     struct rtsocket *sock = &ts->sock;
@@ -1304,16 +2629,32 @@ static void rt_tcp_socket_destruct(struct tcp_socket* ts)
         index = sock->prot.inet.reg_index;
 
         clear_bit(index % BITS_PER_LONG, &port_bitmap[index / BITS_PER_LONG]);
+        write_seqcount_begin(&tcp_hash_seq);
         port_hash_del(port_registry[index]);
+        conn_hash_del(port_registry[index]);
+        write_seqcount_end(&tcp_hash_seq);
         free_ports++;
         sock->prot.inet.reg_index = -1;
     }
     rtdm_lock_put_irqrestore(&tcp_socket_base_lock, context);
 
+    /* lookups still walking over the socket may reference it now */
+    tcp_wait_readers();
+
     rtdm_lock_get_irqsave(&ts->socket_lock, context);
 
     signal = rt_tcp_socket_invalidate(ts, TCP_CLOSE);
 
+    /* drop the listen backlog, the peers of pending requests receive
+       an RST with their next segment */
+    list_for_each_entry(req, &ts->req_est, entry)
+        rtskb_queue_purge(&req->early);
+    requests = ts->requests;
+    ts->requests = NULL;
+    INIT_LIST_HEAD(&ts->req_free);
+    INIT_LIST_HEAD(&ts->req_syn);
+    INIT_LIST_HEAD(&ts->req_est);
+
     rt_tcp_keepalive_disable(ts);
 
     sock->prot.inet.state = TCP_CLOSE;
@@ -1331,6 +2672,12 @@ static void rt_tcp_socket_destruct(struct tcp_socket* ts)
 
     rtdm_event_destroy(&ts->conn_evt);
 
+    if (requests != NULL) {
+        kfree(requests);
+        /* let accept() callers notice the closed socket */
+        wake_up_interruptible(&accept_wq);
+    }
+
     /* cleanup already collected fragments */
     rt_ip_frag_invalidate_socket(sock);
 
@@ -1338,12 +2685,25 @@ static void rt_tcp_socket_destruct(struct tcp_socket* ts)
     while ((skb = rtskb_dequeue(&sock->incoming)) != NULL)
         kfree_rtskb(skb);
 
-    /* ensure that the timer is no longer running */
+    /* ensure that the timers are no longer running */
     timerwheel_remove_timer_sync(&ts->timer);
+    timerwheel_remove_timer_sync(&ts->ack_timer);
+    ts->ack_pending = 0;
+
+    /* drop the references of the retransmission queue */
+    while ((skb = rt_tcp_rtx_dequeue(ts)) != NULL)
+        kfree_rtskb(skb);
+
+    /* data not sent before the connection ended */
+    if (ts->send_head != NULL) {
+        kfree_rtskb(ts->send_head);
+        ts->send_head = NULL;
+    }
 
-    /* free packets in retransmission queue */
-    while ((skb = __rtskb_dequeue(&ts->retransmit_queue)) != NULL)
+    /* free segments held out of order */
+    while ((skb = __rtskb_dequeue_chain(&ts->ofo_queue)) != NULL)
         kfree_rtskb(skb);
+    ts->ofo_len = 0;
 }
 
 /***
@@ -1445,16 +2805,22 @@ static int rt_tcp_bind(struct tcp_socket *ts, const struct sockaddr *addr,
         goto unlock_out;
     }
 
+    write_seqcount_begin(&tcp_hash_seq);
+
+    /* forget the peer of a failed connect() */
+    conn_hash_del(ts);
+    ts->daddr = 0;
+    ts->dport = 0;
+
     port_hash_del(ts);
     if (port_hash_insert(ts, usin->sin_addr.s_addr,
                          usin->sin_port ?: index + tcp_auto_port_start)) {
         port_hash_insert(ts, ts->saddr, ts->sport);
-
         ret = -EADDRINUSE;
-        goto unlock_out;
-    }
+    } else
+        bound = 1;
 
-    bound = 1;
+    write_seqcount_end(&tcp_hash_seq);
 
  unlock_out:
     rtdm_lock_put_irqrestore(&tcp_socket_base_lock, context);
@@ -1510,20 +2876,32 @@ static int rt_tcp_connect(struct tcp_socket *ts, const struct sockaddr *serv_add
     else
         rtdev_dereference(rt.rtdev);
 
-    ts->saddr = rt.rtdev->local_ip;
-
-    ts->daddr = usin->sin_addr.s_addr;
-    ts->dport = usin->sin_port;
-
     ts->sync.seq = rt_tcp_initial_seq();
     ts->sync.ack_seq = 0;
-    ts->sync.window = 4096;
+    ts->sync.window = ts->rcv_window;
     ts->sync.dst_window = 0;
+    ts->last_ack = ts->sync.seq;
+
+    /* offer window scaling, the SYN|ACK tells if the peer agrees */
+    ts->wscale_ok  = 1;
+    ts->snd_wscale = 0;
+    ts->rcv_wscale = rt_tcp_wscale(ts->rcv_window);
 
     ts->tcp_state = TCP_SYN_SENT;
 
     rtdm_lock_put_irqrestore(&ts->socket_lock, context);
 
+    /* let replies of the peer find the socket via the connection hash */
+    rtdm_lock_get_irqsave(&tcp_socket_base_lock, context);
+    write_seqcount_begin(&tcp_hash_seq);
+
+    conn_hash_del(ts);
+    ts->saddr = ts->rt.rtdev->local_ip;
+    conn_hash_insert(ts, usin->sin_addr.s_addr, usin->sin_port);
+
+    write_seqcount_end(&tcp_hash_seq);
+    rtdm_lock_put_irqrestore(&tcp_socket_base_lock, context);
+
     /* Complete three-way handshake */
     ret = rt_tcp_send(ts, TCP_FLAG_SYN);
     if (ret < 0) {
@@ -1559,13 +2937,24 @@ static int rt_tcp_connect(struct tcp_socket *ts, const struct sockaddr *serv_add
 
 /***
  *  rt_tcp_listen
+ *  this function requires non realtime context
  */
 static int rt_tcp_listen(struct tcp_socket *ts, unsigned long backlog)
 {
-    int ret;
+    struct tcp_request  *requests;
     rtdm_lockctx_t      context;
+    unsigned int        i;
+    int ret;
+
+    /* every accepted connection occupies a socket */
+    if (backlog == 0)
+        backlog = 1;
+    else if (backlog > RT_TCP_SOCKETS)
+        backlog = RT_TCP_SOCKETS;
 
-    /* Ignore backlog value, maximum number of queued connections is 1 */
+    requests = kmalloc(backlog * sizeof(struct tcp_request), GFP_KERNEL);
+    if (requests == NULL)
+        return -ENOMEM;
 
     rtdm_lock_get_irqsave(&ts->socket_lock, context);
     if (ts->is_closed) {
@@ -1578,33 +2967,224 @@ static int rt_tcp_listen(struct tcp_socket *ts, unsigned long backlog)
         goto unlock_out;
     }
 
+    ts->requests = requests;
+    for (i = 0; i < backlog; i++)
+        list_add_tail(&requests[i].entry, &ts->req_free);
+    requests = NULL;
+
     ts->tcp_state = TCP_LISTEN;
     ret = 0;
 
  unlock_out:
     rtdm_lock_put_irqrestore(&ts->socket_lock, context);
 
+    kfree(requests);
+
     return ret;
 }
 
 /***
- *  rt_tcp_accept
+ *  rt_tcp_accept_signal_handler - wake up accept() on completed handshakes
+ */
+static void rt_tcp_accept_signal_handler(rtdm_nrtsig_t nrtsig, void *arg)
+{
+    wake_up_interruptible(&accept_wq);
+}
+
+static int rt_tcp_accept_ready(struct tcp_socket *ts)
+{
+    rtdm_lockctx_t context;
+    int ready;
+
+    rtdm_lock_get_irqsave(&ts->socket_lock, context);
+    ready = ts->tcp_state != TCP_LISTEN || !list_empty(&ts->req_est);
+    rtdm_lock_put_irqrestore(&ts->socket_lock, context);
+
+    return ready;
+}
+
+/***
+ *  rt_tcp_accept_child - turn a fresh socket into the connection of an
+ *                        accepted request
+ *  @ts: listening rttcp socket
+ *  @child: new rttcp socket
+ *  @req: completed connection request, marked accepting, released here
+ *  @rt: route to the peer, taken over by the child
+ */
+static void rt_tcp_accept_child(struct tcp_socket *ts, struct tcp_socket *child,
+                                struct tcp_request *req, struct dest_route *rt)
+{
+    rtdm_lockctx_t  context;
+    struct rtskb    *skb;
+    nanosecs_rel_t  sk_sndtimeo, timeout, rto_min, rto_max;
+    unsigned int    retries, priority;
+    unsigned int    queued = 0, lost = 0;
+    u8              quickack, nodelay, cork;
+    int             signal = 0;
+
+    rtdm_lock_get_irqsave(&ts->socket_lock, context);
+    sk_sndtimeo = ts->sk_sndtimeo;
+    timeout     = ts->sock.timeout;
+    priority    = ts->sock.priority;
+    rto_min     = ts->rto_min;
+    rto_max     = ts->rto_max;
+    retries     = ts->retries;
+    quickack    = ts->quickack;
+    nodelay     = ts->nodelay;
+    cork        = ts->cork;
+    rtdm_lock_put_irqrestore(&ts->socket_lock, context);
+
+    /* the connection shares the local port of the listening socket, which
+       keeps it reserved, so it is only found via the connection hash */
+    rtdm_lock_get_irqsave(&tcp_socket_base_lock, context);
+    write_seqcount_begin(&tcp_hash_seq);
+    port_hash_del(child);
+    child->saddr = req->saddr;
+    child->sport = req->sport;
+    child->daddr = req->daddr;
+    child->dport = req->dport;
+    write_seqcount_end(&tcp_hash_seq);
+    rtdm_lock_put_irqrestore(&tcp_socket_base_lock, context);
+
+    rtdm_lock_get_irqsave(&child->socket_lock, context);
+
+    memcpy(&child->rt, rt, sizeof(*rt));
+
+    child->sk_sndtimeo   = sk_sndtimeo;
+    child->sock.timeout  = timeout;
+    child->sock.priority = priority;
+    child->rto_min       = rto_min;
+    child->rto_max       = rto_max;
+    child->rto           = rt_tcp_rto_clamp(child, child->rto);
+    child->retries       = retries;
+    child->timer_state   = retries;
+    child->quickack      = quickack;
+    child->nodelay       = nodelay;
+    child->cork          = cork;
+
+    /* the handshake part of the request does not change anymore */
+    child->sync.seq        = req->seq + 1;
+    child->rcv_window      = req->rcv_window;
+    child->last_ack        = child->sync.seq;
+    child->snd_wscale      = req->snd_wscale;
+    child->rcv_wscale      = req->rcv_wscale;
+    child->wscale_ok       = req->wscale_ok;
+    child->peer_mss        = req->peer_mss;
+    rt_tcp_mss_update(child);
+
+    child->is_bound    = 1;
+    child->is_accepted = 1;
+    rt_tcp_socket_validate(child);
+
+    rtdm_lock_put_irqrestore(&child->socket_lock, context);
+
+    /* Publish the connection and release the request in one go: until then
+       rt_tcp_listen_rcv keeps collecting data of the peer, afterwards the
+       connection receives it. Lock order: base lock, listening socket,
+       connection. */
+    rtdm_lock_get_irqsave(&tcp_socket_base_lock, context);
+    rtdm_lock_get(&ts->socket_lock);
+    rtdm_lock_get(&child->socket_lock);
+
+    if (!req->reset) {
+        child->sync.ack_seq    = req->ack_seq;
+        child->sync.window     = req->rcv_window - req->early_len;
+        child->sync.dst_window = req->dst_window;
+        child->adv_edge        = req->ack_seq + child->sync.window;
+
+        /* data received before, the peer considers it delivered */
+        while ((skb = __rtskb_dequeue(&req->early)) != NULL) {
+            if (rtskb_acquire(skb, &child->sock.skb_pool) != 0) {
+                kfree_rtskb(skb);
+                lost++;
+                continue;
+            }
+            skb->sk = &child->sock;
+            rtskb_queue_tail(&child->sock.incoming, skb);
+            queued++;
+        }
+
+        write_seqcount_begin(&tcp_hash_seq);
+        conn_hash_insert(child, req->daddr, req->dport);
+        write_seqcount_end(&tcp_hash_seq);
+    } else
+        signal = rt_tcp_socket_invalidate(child, TCP_CLOSE);
+
+    req->accepting = 0;
+    req->reset     = 0;
+    list_move_tail(&req->entry, &ts->req_free);
+
+    rtdm_lock_put(&child->socket_lock);
+    rtdm_lock_put(&ts->socket_lock);
+    rtdm_lock_put_irqrestore(&tcp_socket_base_lock, context);
+
+    if (lost)
+        rtdm_printk("rttcp: no buffer for data received before "
+                    "accept(), connection data lost\n");
+
+    while (queued-- > 0)
+        rtdm_sem_up(&child->sock.pending_sem);
+
+    if (signal) {
+        /* the peer reset the connection while it was set up */
+        rt_tcp_socket_invalidate_signal(child);
+        return;
+    }
+
+    /* nothing is pending yet, writers may proceed */
+    rtdm_event_signal(&child->send_evt);
+}
+
+/***
+ *  rt_tcp_accept_abort - give up a request accept() failed to set up
+ *  @ts: listening rttcp socket
+ *  @req: connection request, marked accepting
+ *
+ *  The peer considers the connection established, so it is reset.
  */
-static int rt_tcp_accept(struct tcp_socket *ts, struct sockaddr *addr,
-                         socklen_t *addrlen)
+static void rt_tcp_accept_abort(struct tcp_socket *ts, struct tcp_request *req)
 {
-    /* Return sockaddr, but bind it with rt_socket_init, so it would be
-       possible to read/write from it in future, return valid file descriptor */
+    rtdm_lockctx_t     context;
+    struct tcp_request answer;
+    int                send_rst;
+
+    rtdm_lock_get_irqsave(&ts->socket_lock, context);
+
+    send_rst = !req->reset;
+    answer = *req;
+
+    rtskb_queue_purge(&req->early);
+    req->accepting = 0;
+    req->reset     = 0;
+    list_move_tail(&req->entry, &ts->req_free);
+
+    rtdm_lock_put_irqrestore(&ts->socket_lock, context);
+
+    if (send_rst)
+        rt_tcp_send_request(&answer, TCP_FLAG_RST|TCP_FLAG_ACK);
+}
 
+/***
+ *  rt_tcp_accept
+ *  this function requires non realtime context
+ */
+static int rt_tcp_accept(struct tcp_socket *ts, rtdm_user_info_t *user_info,
+                         struct sockaddr *addr, socklen_t *addrlen)
+{
     int ret;
-    struct sockaddr_in  *sin = (struct sockaddr_in*)addr;
-    nanosecs_rel_t      timeout = ts->sock.timeout;
-    rtdm_lockctx_t      context;
-    struct dest_route   rt;
+    struct sockaddr_in      *sin = (struct sockaddr_in*)addr;
+    nanosecs_rel_t          timeout = ts->sock.timeout;
+    rtdm_lockctx_t          context;
+    struct dest_route       rt;
+    struct tcp_request      *req;
+    struct rtdm_dev_context *child_ctx;
+    u32                     saddr, daddr;
+    u16                     dport;
+    int                     fd;
 
     rtdm_lock_get_irqsave(&ts->socket_lock, context);
-    if (ts->is_accepting || ts->is_accepted) {
-        /* socket is already accepted or is accepting a connection right now */
+    if (ts->is_accepting) {
+        /* socket is accepting a connection right now */
         rtdm_lock_put_irqrestore(&ts->socket_lock, context);
         return -EALREADY;
     }
@@ -1614,55 +3194,84 @@ static int rt_tcp_accept(struct tcp_socket *ts, struct sockaddr *addr,
         return -EINVAL;
     }
 
-    ts->is_accepting = 1;
-    rtdm_lock_put_irqrestore(&ts->socket_lock, context);
+    ts->is_accepting = 1;
+    rtdm_lock_put_irqrestore(&ts->socket_lock, context);
+
+    /* wait for a completed handshake, see rt_tcp_listen_rcv() */
+    if (timeout < 0)
+        ret = rt_tcp_accept_ready(ts) ? 0 : -EWOULDBLOCK;
+    else if (timeout == 0)
+        ret = wait_event_interruptible(accept_wq, rt_tcp_accept_ready(ts));
+    else {
+        ret = wait_event_interruptible_timeout(accept_wq,
+            rt_tcp_accept_ready(ts),
+            usecs_to_jiffies(rt_tcp_ns_to_us(timeout)) ? : 1);
+        if (ret == 0)
+            ret = -ETIMEDOUT;
+    }
+    if (ret < 0) {
+        if (ret == -ERESTARTSYS)
+            ret = -EINTR;
+        goto out;
+    }
+
+    rtdm_lock_get_irqsave(&ts->socket_lock, context);
 
-    ret = rtdm_event_timedwait(&ts->conn_evt, timeout, NULL);
+    if (ts->tcp_state != TCP_LISTEN || list_empty(&ts->req_est)) {
+        /* socket is closed */
+        rtdm_lock_put_irqrestore(&ts->socket_lock, context);
+        ret = -EBADF;
+        goto out;
+    }
 
-    if (unlikely(ret < 0))
-        switch (ret) {
-            case -ETIMEDOUT:
-            case -EINTR:
-                goto err;
+    /* the request stays listed, so that data of the peer is still collected
+       until the connection is published, see rt_tcp_accept_child() */
+    req = list_first_entry(&ts->req_est, struct tcp_request, entry);
+    req->accepting = 1;
+    saddr = req->saddr;
+    daddr = req->daddr;
+    dport = req->dport;
 
-            default:
-                ret = -EBADF;
-                goto err;
-        }
+    rtdm_lock_put_irqrestore(&ts->socket_lock, context);
 
-    /* accept() reported about connection establishment */
-    ret = rt_ip_route_output(&rt, ts->daddr, ts->saddr);
+    ret = rt_ip_route_output(&rt, daddr, saddr);
     if (ret < 0) {
-        /* strange, no route to host, keep status quo */
+        /* strange, no route to host */
         ret = -EPROTO;
-        goto err;
+        goto err_abort;
     }
 
-    rtdm_lock_get_irqsave(&ts->socket_lock, context);
-
-    if (ts->tcp_state != TCP_ESTABLISHED) {
-        /* protocol error */
-        rtdm_lock_put_irqrestore(&ts->socket_lock, context);
+    fd = __rt_dev_socket(user_info, PF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (fd < 0) {
         rtdev_dereference(rt.rtdev);
-        ret = -EPROTO;
-        goto err;
+        ret = fd;
+        goto err_abort;
     }
 
-    if (ts->rt.rtdev == NULL)
-        memcpy(&ts->rt, &rt, sizeof(rt));
-    else
+    child_ctx = rtdm_context_get(fd);
+    if (child_ctx == NULL) {
+        /* already closed again by another thread */
         rtdev_dereference(rt.rtdev);
+        ret = -EBADF;
+        goto err_abort;
+    }
+
+    rt_tcp_accept_child(ts, (struct tcp_socket *)&child_ctx->dev_private,
+                        req, &rt);
+
+    rtdm_context_unlock(child_ctx);
 
     sin->sin_family      = AF_INET;
-    sin->sin_port        = ts->dport;
-    sin->sin_addr.s_addr = ts->daddr;
+    sin->sin_port        = dport;
+    sin->sin_addr.s_addr = daddr;
 
-    ts->is_accepted = 1;
-    rtdm_lock_put_irqrestore(&ts->socket_lock, context);
+    ret = fd;
+    goto out;
 
-    ret = rt_socket_context(&ts->sock)->fd;
+ err_abort:
+    rt_tcp_accept_abort(ts, req);
 
- err:
+ out:
     /* it is not critical to leave this unlocked
        due to single entry nature of accept() */
     ts->is_accepting = 0;
@@ -1678,6 +3287,83 @@ static int rt_tcp_shutdown(struct tcp_socket *ts, unsigned long how)
     return -EOPNOTSUPP;
 }
 
+/***
+ *  rt_tcp_set_option - set IPPROTO_TCP level options
+ */
+static int rt_tcp_set_option(struct tcp_socket *ts, int optname,
+                             unsigned int val)
+{
+    nanosecs_rel_t  ns = (nanosecs_rel_t)val * 1000;
+    struct rtskb    *skb = NULL;
+    rtdm_lockctx_t  context;
+    int             ret = 0;
+
+    rtdm_lock_get_irqsave(&ts->socket_lock, context);
+
+    switch (optname) {
+        case RTNET_TCP_RTO_MIN:
+            if (ns > ts->rto_max)
+                ret = -EINVAL;
+            else
+                ts->rto_min = ns;
+            break;
+
+        case RTNET_TCP_RTO_MAX:
+            /* bounded by the timer wheel horizon */
+            if (ns < ts->rto_min || val > rto_max_us)
+                ret = -EINVAL;
+            else
+                ts->rto_max = ns;
+            break;
+
+        case RTNET_TCP_RETRIES:
+            ts->retries = val;
+            if (ts->inflight == 0)
+                ts->timer_state = val;
+            break;
+
+        case RTNET_TCP_WINDOW:
+            /* announced on connection setup, fixed afterwards */
+            if (ts->tcp_state != TCP_CLOSE)
+                ret = -EISCONN;
+            else if (val == 0 || val > RT_TCP_MAX_WINDOW)
+                ret = -EINVAL;
+            else
+                ts->rcv_window = val;
+            break;
+
+        case RTNET_TCP_QUICKACK:
+            /* an ACK already delayed goes out on expiry of its timer */
+            ts->quickack = (val != 0);
+            break;
+
+        case TCP_NODELAY:
+            ts->nodelay = (val != 0);
+            skb = rt_tcp_push(ts, 0, 0);
+            break;
+
+        case TCP_CORK:
+            /* uncorking sends a held partial segment */
+            ts->cork = (val != 0);
+            skb = rt_tcp_push(ts, 0, 0);
+            break;
+
+        default:
+            ret = -ENOPROTOOPT;
+            break;
+    }
+
+    if (ret == 0)
+        ts->rto = rt_tcp_rto_clamp(ts, ts->rto);
+
+    rtdm_lock_put_irqrestore(&ts->socket_lock, context);
+
+    if (skb != NULL)
+        rtdev_xmit(skb);
+
+    return ret;
+}
+
 /***
  *  rt_tcp_setsockopt
  */
@@ -1686,9 +3372,19 @@ static int rt_tcp_setsockopt(rtdm_user_info_t *user_info, struct tcp_socket *ts,
                              socklen_t optlen)
 {
     /* uint64_t val; */
+    unsigned int val;
     struct timeval tv;
     rtdm_lockctx_t  context;
 
+    if (level == IPPROTO_TCP) {
+        if (optlen < sizeof(unsigned int))
+            return -EINVAL;
+        if (rtdm_copy_from_user(user_info, &val, optval, sizeof(val)))
+            return -EFAULT;
+
+        return rt_tcp_set_option(ts, optname, val);
+    }
+
     switch (optname) {
         case SO_KEEPALIVE:
             if (optlen < sizeof(unsigned int))
@@ -1740,7 +3436,7 @@ static int rt_tcp_setsockopt(rtdm_user_info_t *user_info, struct tcp_socket *ts,
             return -EOPNOTSUPP;
     }
 
-    return -ENOPROTOOPT;
+    return rt_socket_common_setsockopt(&ts->sock, optname, optval, optlen);
 }
 
 /***
@@ -1749,18 +3445,64 @@ static int rt_tcp_setsockopt(rtdm_user_info_t *user_info, struct tcp_socket *ts,
 static int rt_tcp_getsockopt(rtdm_user_info_t *user_info, struct tcp_socket *ts,
                              int level, int optname, void *optval, socklen_t *optlen)
 {
+    rtdm_lockctx_t context;
     int ret = 0;
 
     if (*optlen < sizeof(unsigned int))
         return -EINVAL;
 
+    if (level == IPPROTO_TCP) {
+        rtdm_lock_get_irqsave(&ts->socket_lock, context);
+
+        switch (optname) {
+            case RTNET_TCP_RTO_MIN:
+                *(unsigned int *)optval = rt_tcp_ns_to_us(ts->rto_min);
+                break;
+
+            case RTNET_TCP_RTO_MAX:
+                *(unsigned int *)optval = rt_tcp_ns_to_us(ts->rto_max);
+                break;
+
+            case RTNET_TCP_RETRIES:
+                *(unsigned int *)optval = ts->retries;
+                break;
+
+            case RTNET_TCP_WINDOW:
+                *(unsigned int *)optval = ts->rcv_window;
+                break;
+
+            case RTNET_TCP_QUICKACK:
+                *(unsigned int *)optval = ts->quickack;
+                break;
+
+            case TCP_NODELAY:
+                *(unsigned int *)optval = ts->nodelay;
+                break;
+
+            case TCP_CORK:
+                *(unsigned int *)optval = ts->cork;
+                break;
+
+            default:
+                ret = -ENOPROTOOPT;
+                break;
+        }
+
+        rtdm_lock_put_irqrestore(&ts->socket_lock, context);
+
+        if (ret == 0)
+            *optlen = sizeof(unsigned int);
+        return ret;
+    }
+
     switch (optname) {
         case SO_ERROR:
             ret = 0; /* used in nonblocking connect(), extend later */
             break;
 
         default:
-            ret = -ENOPROTOOPT;
+            ret = rt_socket_common_getsockopt(&ts->sock, optname, optval,
+                                              optlen);
             break;
     }
 
@@ -1770,6 +3512,31 @@ static int rt_tcp_getsockopt(rtdm_user_info_t *user_info, struct tcp_socket *ts,
 /***
  *  rt_tcp_ioctl
  */
+/***
+ *  rt_tcp_set_xmitparams - change priority and channel of a socket
+ *  @ts: rttcp socket
+ *  @priority: RTSKB_PRIO_VALUE() of priority and channel
+ *
+ *  The segment size of a connection follows the MTU of the new channel.
+ */
+static int rt_tcp_set_xmitparams(struct tcp_socket *ts, unsigned int priority)
+{
+    rtdm_lockctx_t context;
+
+    rtdm_lock_get_irqsave(&ts->socket_lock, context);
+
+    ts->sock.priority = priority;
+
+    /* the peer's SYN|ACK derives it during connection setup */
+    if (ts->rt.rtdev != NULL && ts->tcp_state != TCP_SYN_SENT &&
+        ts->tcp_state != TCP_LISTEN)
+        rt_tcp_mss_update(ts);
+
+    rtdm_lock_put_irqrestore(&ts->socket_lock, context);
+
+    return 0;
+}
+
 static int rt_tcp_ioctl(struct rtdm_dev_context *sockctx,
                         rtdm_user_info_t *user_info,
                         unsigned int request, void __user *arg)
@@ -1779,11 +3546,28 @@ static int rt_tcp_ioctl(struct rtdm_dev_context *sockctx,
     struct _rtdm_getsockaddr_args *getaddr = arg;
     struct _rtdm_getsockopt_args  *getopt  = arg;
     struct _rtdm_setsockopt_args  *setopt  = arg;
+    rtdm_lockctx_t context;
     int in_rt;
+    int ret;
 
     /* fast path for common socket IOCTLs */
-    if (_IOC_TYPE(request) == RTIOC_TYPE_NETWORK)
-        return rt_socket_common_ioctl(sockctx, user_info, request, arg);
+    if (_IOC_TYPE(request) == RTIOC_TYPE_NETWORK) {
+        if (request == RTNET_RTIOC_XMITPARAMS)
+            return rt_tcp_set_xmitparams(ts, *(unsigned int *)arg);
+
+        ret = rt_socket_common_ioctl(sockctx, user_info, request, arg);
+
+        /* keep the reordering queue within the resized pool; segments
+           already held beyond a shrunk limit drain as the gap fills */
+        if (request == RTNET_RTIOC_EXTPOOL || request == RTNET_RTIOC_SHRPOOL) {
+            rtdm_lock_get_irqsave(&ts->socket_lock, context);
+            ts->ofo_limit = min_t(unsigned int, ofo_segments,
+                                  RT_TCP_OFO_LIMIT(ts->sock.pool_size));
+            rtdm_lock_put_irqrestore(&ts->socket_lock, context);
+        }
+
+        return ret;
+    }
 
     in_rt = rtdm_in_rt_context();
 
@@ -1797,18 +3581,22 @@ static int rt_tcp_ioctl(struct rtdm_dev_context *sockctx,
             return rt_tcp_connect(ts, setaddr->addr, setaddr->addrlen);
 
         case _RTIOC_LISTEN:
+            if (in_rt)
+                return -ENOSYS;
             return rt_tcp_listen(ts, (unsigned long)arg);
 
         case _RTIOC_ACCEPT:
-            if (!in_rt)
+            /* creates a socket, non-RT only */
+            if (in_rt)
                 return -ENOSYS;
-            return rt_tcp_accept(ts, getaddr->addr, getaddr->addrlen);
+            return rt_tcp_accept(ts, user_info, getaddr->addr,
+                                 getaddr->addrlen);
 
         case _RTIOC_SHUTDOWN:
             return rt_tcp_shutdown(ts, (unsigned long)arg);
 
         case _RTIOC_SETSOCKOPT:
-            if (setopt->level != SOL_SOCKET)
+            if (setopt->level != SOL_SOCKET && setopt->level != IPPROTO_TCP)
                 break;
 
             return rt_tcp_setsockopt(user_info, ts, setopt->level,
@@ -1816,7 +3604,7 @@ static int rt_tcp_ioctl(struct rtdm_dev_context *sockctx,
                                      setopt->optlen);
 
         case _RTIOC_GETSOCKOPT:
-            if (setopt->level != SOL_SOCKET)
+            if (getopt->level != SOL_SOCKET && getopt->level != IPPROTO_TCP)
                 break;
             return rt_tcp_getsockopt(user_info, ts, getopt->level,
                                      getopt->optname, getopt->optval,
@@ -1830,11 +3618,48 @@ static int rt_tcp_ioctl(struct rtdm_dev_context *sockctx,
 
 
 /***
- *  rt_tcp_read
+ *  rt_tcp_window_open - return buffer space the reader consumed to the
+ *                       receive window
+ *  @ts: rttcp socket
+ *  @len: bytes handed to the reader
+ *
+ *  Receiver side silly window avoidance (RFC 1122, 4.2.3.3): a window update
+ *  is only sent once the window offered to the peer grows by one MSS or half
+ *  the receive window. The comparison is done in units of the window scale,
+ *  the granularity the peer sees, so small windows announced as zero are
+ *  reopened as well - there is no persist timer to recover them.
  */
-static ssize_t rt_tcp_read(struct rtdm_dev_context *sockctx,
-                           rtdm_user_info_t *user_info, void *buf,
-                           size_t nbyte)
+static void rt_tcp_window_open(struct tcp_socket *ts, u32 len)
+{
+    rtdm_lockctx_t context;
+    u32 offered = 0;
+    u32 avail;
+    u32 thresh;
+    int update;
+
+    rtdm_lock_get_irqsave(&ts->socket_lock, context);
+
+    ts->sync.window += len;
+
+    if (rt_tcp_after(ts->adv_edge, ts->sync.ack_seq))
+        offered = (ts->adv_edge - ts->sync.ack_seq) >> ts->rcv_wscale;
+    avail  = min_t(u32, ts->sync.window >> ts->rcv_wscale, 0xFFFF);
+    thresh = min_t(u32, ts->mss, ts->rcv_window / 2) >> ts->rcv_wscale;
+    update = avail >= offered + max_t(u32, thresh, 1);
+
+    rtdm_lock_put_irqrestore(&ts->socket_lock, context);
+
+    if (update)
+        rt_tcp_send(ts, TCP_FLAG_ACK); /* window update */
+}
+
+/***
+ *  __rt_tcp_read - receives stream data, reporting the arrival time of the
+ *                  last segment consumed via stamp (optional)
+ */
+static ssize_t __rt_tcp_read(struct rtdm_dev_context *sockctx,
+                             rtdm_user_info_t *user_info, void *buf,
+                             size_t nbyte, nanosecs_abs_t *stamp)
 {
     struct tcp_socket *ts = (struct tcp_socket *)&sockctx->dev_private;
     struct rtsocket   *sock = &ts->sock;
@@ -1898,6 +3723,9 @@ static ssize_t rt_tcp_read(struct rtdm_dev_context *sockctx,
         skb = rtskb_dequeue_chain(&sock->incoming);
         RTNET_ASSERT(skb != NULL, return -EFAULT;);
 
+        if (stamp)
+            *stamp = skb->time_stamp;
+
         th_len = (skb->h.th->doff) << 2;
 
         data_len = skb->len - th_len;
@@ -1920,15 +3748,7 @@ static ssize_t rt_tcp_read(struct rtdm_dev_context *sockctx,
                 kfree_rtskb(first_skb); /* or store the data? */
                 return -EFAULT;
             }
-            rtdm_lock_get_irqsave(&ts->socket_lock, context);
-            if (ts->sync.window) {
-                ts->sync.window += block_size;
-                rtdm_lock_put_irqrestore(&ts->socket_lock, context);
-            } else {
-                ts->sync.window = block_size;
-                rtdm_lock_put_irqrestore(&ts->socket_lock, context);
-                rt_tcp_send(ts, TCP_FLAG_ACK); /* window update */
-            }
+            rt_tcp_window_open(ts, block_size);
 
             __rtskb_pull(skb, block_size);
             __rtskb_push(first_skb, sizeof(struct tcphdr));
@@ -1943,15 +3763,7 @@ static ssize_t rt_tcp_read(struct rtdm_dev_context *sockctx,
             kfree_rtskb(first_skb); /* or store the data? */
             return -EFAULT;
         }
-        rtdm_lock_get_irqsave(&ts->socket_lock, context);
-        if (ts->sync.window) {
-            ts->sync.window += block_size;
-            rtdm_lock_put_irqrestore(&ts->socket_lock, context);
-        } else {
-            ts->sync.window = block_size;
-            rtdm_lock_put_irqrestore(&ts->socket_lock, context);
-            rt_tcp_send(ts, TCP_FLAG_ACK); /* window update */
-        }
+        rt_tcp_window_open(ts, block_size);
 
         if ((skb = skb->next) != NULL) {
             user_buf += data_len;
@@ -1965,21 +3777,40 @@ static ssize_t rt_tcp_read(struct rtdm_dev_context *sockctx,
 }
 
 /***
- *  rt_tcp_write
+ *  rt_tcp_read
  */
-static ssize_t rt_tcp_write(struct rtdm_dev_context *sockctx,
-                            rtdm_user_info_t *user_info,
-                            const void *buf, size_t nbyte)
+static ssize_t rt_tcp_read(struct rtdm_dev_context *sockctx,
+                           rtdm_user_info_t *user_info, void *buf,
+                           size_t nbyte)
 {
-    struct tcp_socket *ts = (struct tcp_socket *)&sockctx->dev_private;
-    uint32_t sent_len = 0;
-    rtdm_lockctx_t      context;
-    int ret = 0;
-    nanosecs_rel_t sk_sndtimeo;
+    return __rt_tcp_read(sockctx, user_info, buf, nbyte, NULL);
+}
 
-    if (!user_info) {
-        return -EFAULT;
-    }
+/***
+ *  rt_tcp_sendiov - gather user data into segments and send them
+ *  @ts: rttcp socket
+ *  @iov: user data vectors, consumed
+ *  @len: total length of the vectors
+ *  @more: more data follows (MSG_MORE), hold the last partial segment
+ *
+ *  Data is copied straight into the segment being filled (ts->send_head),
+ *  which leaves according to rt_tcp_push() once it is full or the writer is
+ *  done. Small writes are thus coalesced. A writer only blocks while a full
+ *  segment waits for the peer window.
+ *  Returns the number of bytes taken over or a negative error code.
+ */
+static ssize_t rt_tcp_sendiov(struct tcp_socket *ts, struct iovec *iov,
+                              size_t len, int more)
+{
+    struct rtskb *skb;
+    struct rtskb *frag;
+    struct rtskb *xmit;
+    size_t sent_len = 0;
+    rtdm_lockctx_t context;
+    nanosecs_rel_t sk_sndtimeo;
+    u32 size;
+    u32 copy;
+    int ret;
 
     rtdm_lock_get_irqsave(&ts->socket_lock, context);
 
@@ -1995,41 +3826,133 @@ static ssize_t rt_tcp_write(struct rtdm_dev_context *sockctx,
         return -EINVAL;
     }
 
-    rtdm_lock_put_irqrestore(&ts->socket_lock, context);
+    while (sent_len < len) {
+        if (!ts->is_valid) {
+            rtdm_lock_put_irqrestore(&ts->socket_lock, context);
+            return sent_len ? : -EPIPE;
+        }
+
+        size = rt_tcp_send_size(ts);
+        skb  = ts->send_head;
 
-    while (sent_len < nbyte) {
+        if (skb != NULL && rt_tcp_payload_len(skb) >= size) {
+            /* a full segment waits for the window, rt_tcp_window_update()
+               signals when it left */
+            rtdm_event_clear(&ts->send_evt);
+            rtdm_lock_put_irqrestore(&ts->socket_lock, context);
 
-        ret = rtdm_event_timedwait(&ts->send_evt, sk_sndtimeo, NULL);
+            ret = rtdm_event_timedwait(&ts->send_evt, sk_sndtimeo, NULL);
 
-        if (unlikely(ret < 0))
-            switch (ret) {
-                case -EWOULDBLOCK:
-                case -ETIMEDOUT:
-                case -EINTR:
-                    return sent_len ? : ret;
+            if (unlikely(ret < 0))
+                switch (ret) {
+                    case -EWOULDBLOCK:
+                    case -ETIMEDOUT:
+                    case -EINTR:
+                        return sent_len ? : ret;
+
+                    case -EIDRM: /* event is destroyed */
+                    default:
+                        if (ts->is_closed)
+                            return -EBADF;
+
+                        return sent_len ? : ret;
+                }
+
+            rtdm_lock_get_irqsave(&ts->socket_lock, context);
+            continue;
+        }
+
+        if (skb == NULL) {
+            rtdm_lock_put_irqrestore(&ts->socket_lock, context);
 
-                case -EIDRM: /* event is destroyed */
-                default:
-                    if (ts->is_closed)
-                        return -EBADF;
+            skb = rt_tcp_alloc_segment(&ts->rt, ts, 0);
+            if (skb == NULL)
+                return sent_len ? : -ENOBUFS;
 
-                    return sent_len ? : ret;
+            rtdm_lock_get_irqsave(&ts->socket_lock, context);
+
+            if (ts->send_head != NULL) {
+                /* a concurrent writer was faster */
+                rtdm_lock_put_irqrestore(&ts->socket_lock, context);
+                kfree_rtskb(skb);
+                rtdm_lock_get_irqsave(&ts->socket_lock, context);
+                continue;
             }
+            ts->send_head = skb;
+        } else if (skb->chain_end->tail == skb->chain_end->end) {
+            /* a large send continues in another buffer of the chain */
+            rtdm_lock_put_irqrestore(&ts->socket_lock, context);
 
-        ret = rt_tcp_window_send(ts, nbyte - sent_len,
-                                 ((u8*)buf) + sent_len);
+            frag = alloc_rtskb(RTSKB_SIZE, &ts->sock.skb_pool);
 
-        if (ret < 0) { /* check this branch correctness */
-            rtdm_event_signal(&ts->send_evt);
-            break;
+            rtdm_lock_get_irqsave(&ts->socket_lock, context);
+
+            if (frag == NULL) {
+                /* send what is there, the pool is exhausted */
+                xmit = rt_tcp_push(ts, 1, 0);
+                rtdm_lock_put_irqrestore(&ts->socket_lock, context);
+
+                if (xmit != NULL)
+                    rtdev_xmit(xmit);
+                return sent_len ? : -ENOBUFS;
+            }
+
+            if (ts->send_head != skb ||
+                skb->chain_end->tail != skb->chain_end->end) {
+                /* the segment left or a concurrent writer extended it */
+                rtdm_lock_put_irqrestore(&ts->socket_lock, context);
+                kfree_rtskb(frag);
+                rtdm_lock_get_irqsave(&ts->socket_lock, context);
+                continue;
+            }
+
+            frag->rtdev = skb->rtdev;
+            rtskb_chain_append(skb, frag);
+        }
+
+        copy = min_t(u32, size - rt_tcp_payload_len(skb),
+                     skb->chain_end->end - skb->chain_end->tail);
+        if (copy > len - sent_len)
+            copy = len - sent_len;
+
+        /* copying under the lock keeps concurrent writers and the ACK path
+           off the segment, this is an admission like the former cloning */
+        rt_memcpy_fromkerneliovec(rtskb_put(skb->chain_end, copy), iov, copy);
+        sent_len += copy;
+
+        /* a partly filled buffer of a large send is held until the write
+           is complete */
+        xmit = rt_tcp_push(ts, 0, more || sent_len < len);
+        if (xmit != NULL) {
+            rtdm_lock_put_irqrestore(&ts->socket_lock, context);
+            rtdev_xmit(xmit);
+            rtdm_lock_get_irqsave(&ts->socket_lock, context);
         }
+    }
+
+    rtdm_lock_put_irqrestore(&ts->socket_lock, context);
+
+    return sent_len;
+}
+
+/***
+ *  rt_tcp_write
+ */
+static ssize_t rt_tcp_write(struct rtdm_dev_context *sockctx,
+                            rtdm_user_info_t *user_info,
+                            const void *buf, size_t nbyte)
+{
+    struct tcp_socket *ts = (struct tcp_socket *)&sockctx->dev_private;
+    struct iovec iov;
 
-        sent_len += ret;
-        if (ts->sync.dst_window)
-            rtdm_event_signal(&ts->send_evt);
+    if (!user_info) {
+        return -EFAULT;
     }
 
-    return (ret < 0 ? ret : sent_len);
+    iov.iov_base = (void *)buf;
+    iov.iov_len  = nbyte;
+
+    return rt_tcp_sendiov(ts, &iov, nbyte, 0);
 }
 
 /***
@@ -2039,8 +3962,11 @@ static ssize_t rt_tcp_recvmsg(struct rtdm_dev_context *sockctx,
                               rtdm_user_info_t *user_info,
                               struct msghdr *msg, int msg_flags)
 {
+    struct tcp_socket *ts = (struct tcp_socket *)&sockctx->dev_private;
+    nanosecs_abs_t stamp = 0;
     size_t len;
     void *buf;
+    ssize_t ret;
 
     if (msg_flags)
         return -EOPNOTSUPP;
@@ -2052,7 +3978,11 @@ static ssize_t rt_tcp_recvmsg(struct rtdm_dev_context *sockctx,
     len = msg->msg_iov[0].iov_len;
     buf = msg->msg_iov[0].iov_base;
 
-    return rt_tcp_read(sockctx, user_info, buf, len);
+    ret = __rt_tcp_read(sockctx, user_info, buf, len, &stamp);
+    if (ret > 0)
+        rt_socket_recv_timestamp(&ts->sock, user_info, msg, stamp);
+
+    return ret;
 }
 
 /***
@@ -2062,20 +3992,18 @@ static ssize_t rt_tcp_sendmsg(struct rtdm_dev_context *sockctx,
                               rtdm_user_info_t *user_info,
                               const struct msghdr *msg, int msg_flags)
 {
-    size_t len;
-    void *buf;
+    struct tcp_socket *ts = (struct tcp_socket *)&sockctx->dev_private;
 
-    if (msg_flags)
-        return -EOPNOTSUPP;
+    if (!user_info)
+        return -EFAULT;
 
-    /* loop over all vectors to be implemented */
-    if (msg->msg_iovlen != 1)
+    if (msg_flags & ~MSG_MORE)
         return -EOPNOTSUPP;
 
-    len = msg->msg_iov[0].iov_len;
-    buf = msg->msg_iov[0].iov_base;
-
-    return rt_tcp_write(sockctx, user_info, (const void*)buf, len);
+    /* all vectors are gathered into the same segments */
+    return rt_tcp_sendiov(ts, msg->msg_iov,
+                          rt_iovec_len(msg->msg_iov, msg->msg_iovlen),
+                          msg_flags & MSG_MORE);
 }
 
 #ifdef CONFIG_RTNET_SELECT_SUPPORT
@@ -2180,25 +4108,39 @@ static int rtnet_ipv4_tcp_show(struct seq_file *p, void *data)
     struct tcp_socket *ts;
     u32 saddr, daddr;
     u16 sport = 0, dport = 0; /* set to 0 to silence compiler */
+    nanosecs_rel_t srtt = 0, rttvar = 0, rto = 0;
     char sbuffer[24];
     char dbuffer[24];
     int state;
     int index;
 
     seq_printf(p, "Hash    Local Address           "
-	          "Foreign Address         State\n");
+	          "Foreign Address         State       "
+	          "SRTT[us]  RTTVAR[us]  RTO[us]\n");
 
     for (index = 0; index < RT_TCP_SOCKETS; index++) {
         rtdm_lock_get_irqsave(&tcp_socket_base_lock, context);
 
         ts = port_registry[index];
-        state = ts ? ts->tcp_state : TCP_CLOSE;
+        state = TCP_CLOSE;
+
+        if (ts) {
+            /* the registry keeps the socket alive, the RTT estimates are
+               updated under its socket_lock (nested, IRQs are off) */
+            rtdm_lock_get(&ts->socket_lock);
+
+            state = ts->tcp_state;
+            if (state != TCP_CLOSE) {
+                saddr = ts->saddr;
+                sport = ts->sport;
+                daddr = ts->daddr;
+                dport = ts->dport;
+                srtt = ts->srtt;
+                rttvar = ts->rttvar;
+                rto = ts->rto;
+            }
 
-        if (ts && ts->tcp_state != TCP_CLOSE) {
-            saddr = ts->saddr;
-            sport = ts->sport;
-            daddr = ts->daddr;
-            dport = ts->dport;
+            rtdm_lock_put(&ts->socket_lock);
         }
 
         rtdm_lock_put_irqrestore(&tcp_socket_base_lock, context);
@@ -2209,9 +4151,10 @@ static int rtnet_ipv4_tcp_show(struct seq_file *p, void *data)
             snprintf(dbuffer, sizeof(dbuffer), "%u.%u.%u.%u:%u",
                      NIPQUAD(daddr), ntohs(dport));
 
-            seq_printf(p, "%04X    %-23s %-23s %s\n",
+            seq_printf(p, "%04X    %-23s %-23s %-11s %-9u %-11u %u\n",
 		       sport & port_hash_mask, sbuffer, dbuffer,
-		       rt_tcp_string_of_state(state));
+		       rt_tcp_string_of_state(state), rt_tcp_ns_to_us(srtt),
+		       rt_tcp_ns_to_us(rttvar), rt_tcp_ns_to_us(rto));
         }
     }
     return 0;
@@ -2274,8 +4217,13 @@ int __init rt_tcp_init(void)
                                 (tcp_auto_port_mask & 0xFFFF));
     tcp_auto_port_mask  = htons(tcp_auto_port_mask | 0xFFFF0000);
 
-    for (i = 0; i < ARRAY_SIZE(port_hash); i++)
+    seqcount_init(&tcp_hash_seq);
+    atomic_set(&tcp_lookups, 0);
+
+    for (i = 0; i < ARRAY_SIZE(port_hash); i++) {
         INIT_HLIST_HEAD(&port_hash[i]);
+        INIT_HLIST_HEAD(&conn_hash[i]);
+    }
 
     /* Perform essential initialization of the RST|ACK socket */
     skbs = rt_bare_socket_init(&rst_socket.sock, IPPROTO_TCP, RT_TCP_RST_PRIO,
@@ -2284,16 +4232,24 @@ int __init rt_tcp_init(void)
         printk("rttcp: allocated only %d RST|ACK rtskbs\n", skbs);
     rst_socket.sock.prot.inet.tos = 0;
     rtdm_lock_init(&rst_socket.socket_lock);
+    /* replies are never queued for retransmission */
+    rst_socket.tcp_state = TCP_CLOSE;
 
-    /*
-     * 100 ms forwarding timer with 8.38 ms slots
-     */
-    ret = timerwheel_init(100000000ull, 23);
-    if (ret < 0) {
-        rtdm_printk("rttcp: cann't initialize timerwheel task: %d\n", -ret);
-        goto out_1;
+    if (ofo_segments > RT_TCP_OFO_LIMIT(socket_rtskbs)) {
+        ofo_segments = RT_TCP_OFO_LIMIT(socket_rtskbs);
+        printk("rttcp: ofo_segments limited to %u by socket_rtskbs\n",
+               ofo_segments);
     }
 
+    /* the RTO must span at least two timer wheel ticks */
+    if (rto_max_us < 2 * ((1 << TIMERWHEEL_GRANULARITY) / 1000))
+        rto_max_us = 2 * ((1 << TIMERWHEEL_GRANULARITY) / 1000);
+
+    ret = rtdm_nrtsig_init(&accept_signal, rt_tcp_accept_signal_handler,
+                           NULL);
+    if (ret < 0)
+        goto out_1;
+
 #ifdef CONFIG_PROC_FS
     if ((ret = rt_tcp_proc_register()) < 0) {
         rtdm_printk("rttcp: cann't initialize proc entry: %d\n", -ret);
@@ -2318,7 +4274,7 @@ int __init rt_tcp_init(void)
 #endif /* CONFIG_PROC_FS */
 
  out_2:
-    timerwheel_cleanup();
+    rtdm_nrtsig_destroy(&accept_signal);
 
  out_1:
     rt_bare_socket_cleanup(&rst_socket.sock);
@@ -2338,11 +4294,11 @@ void __exit rt_tcp_release(void)
     rt_tcp_proc_unregister();
 #endif /* CONFIG_PROC_FS */
 
-    timerwheel_cleanup();
-
     rt_bare_socket_cleanup(&rst_socket.sock);
 
     rtdm_dev_unregister(&tcp_device, 1000);
+
+    rtdm_nrtsig_destroy(&accept_signal);
 }
 
 module_init(rt_tcp_init);
@@ -26,6 +26,11 @@
 #include <linux/socket.h>
 #include <linux/in.h>
 #include <linux/ip.h>
+#include <linux/jhash.h>
+#include <linux/proc_fs.h>
+#include <linux/rculist.h>
+#include <linux/seq_file.h>
+#include <linux/seqlock.h>
 #include <linux/udp.h>
 #include <linux/tcp.h>
 #include <net/checksum.h>
@@ -36,9 +41,11 @@
 #include <rtnet_port.h>
 #include <rtnet_iovec.h>
 #include <rtnet_socket.h>
+#include <ipv4/af_inet.h>
 #include <ipv4/ip_fragment.h>
 #include <ipv4/ip_output.h>
 #include <ipv4/ip_sock.h>
+#include <ipv4/multicast.h>
 #include <ipv4/protocol.h>
 #include <ipv4/route.h>
 #include <ipv4/udp.h>
@@ -48,12 +55,23 @@
  *  This structure is used to register a UDP socket for reception. All
  +  structures are kept in the port_registry array to increase the cache
  *  locality during the critical port lookup in rt_udp_v4_lookup().
+ *
+ *  Lookups do not take udp_socket_base_lock. Entries are published and
+ *  unlinked RCU-style, and as the registry is static, a reader walking a
+ *  chain that is modified meanwhile never leaves it. Readers validate their
+ *  result against udp_hash_seq and retry if needed. Before a socket may go
+ *  away, rt_udp_close waits until no reader holds its entry (users).
  */
 struct udp_socket {
     u16             sport;      /* local port */
     u32             saddr;      /* local ip-addr */
+    u16             dport;      /* peer port, 0 if not connected */
+    u32             daddr;      /* peer ip-addr */
+    u8              reuse;      /* RT_INET_REUSE* at bind time */
     struct rtsocket *sock;
-    struct hlist_node link;
+    atomic_t        users;      /* readers about to reference sock */
+    struct hlist_node link;     /* port_hash, all sockets */
+    struct hlist_node conn_link; /* conn_hash, connected sockets only */
 };
 
 /***
@@ -78,10 +96,14 @@ static int                  free_ports      = RT_UDP_SOCKETS;
 static unsigned long        port_bitmap[RT_PORT_BITMAP_WORDS];
 static struct udp_socket    port_registry[RT_UDP_SOCKETS];
 static rtdm_lock_t          udp_socket_base_lock = RTDM_LOCK_UNLOCKED;
+static seqcount_t           udp_hash_seq;   /* hashes and socket addresses */
 
 static struct hlist_head port_hash[RT_UDP_SOCKETS * 2];
 #define port_hash_mask (RT_UDP_SOCKETS * 2 - 1)
 
+/* connected sockets, keyed by peer address, peer port and local port */
+static struct hlist_head conn_hash[RT_UDP_SOCKETS * 2];
+
 MODULE_LICENSE("GPL");
 
 module_param(auto_port_start, uint, 0444);
@@ -90,60 +112,235 @@ MODULE_PARM_DESC(auto_port_start, "Start of automatically assigned port range");
 MODULE_PARM_DESC(auto_port_mask,
                  "Mask that defines port range for automatic assignment");
 
-static inline struct udp_socket *port_hash_search(u32 saddr, u16 sport)
+static inline struct udp_socket *port_hash_search(u32 saddr, u16 sport,
+						  u8 reuse)
 {
 	unsigned bucket = sport & port_hash_mask;
 	struct udp_socket *sock;
 
+	/* sharing requires all sockets to agree on the same option */
 	hlist_for_each_entry(sock, &port_hash[bucket], link)
 		if (sock->sport == sport &&
 		    (saddr == INADDR_ANY
 		     || sock->saddr == saddr
-		     || sock->saddr == INADDR_ANY))
+		     || sock->saddr == INADDR_ANY) &&
+		    !(sock->reuse & reuse))
 			return sock;
 
 	return NULL;
 }
 
-static inline int port_hash_insert(struct udp_socket *sock, u32 saddr, u16 sport)
+static inline int port_hash_insert(struct udp_socket *sock, u32 saddr, u16 sport,
+				   u8 reuse)
 {
 	unsigned bucket;
 
-	if (port_hash_search(saddr, sport))
+	if (port_hash_search(saddr, sport, reuse))
 		return -EADDRINUSE;
 
 	bucket = sport & port_hash_mask;
 	sock->saddr = saddr;
 	sock->sport = sport;
-	hlist_add_head(&sock->link, &port_hash[bucket]);
+	sock->reuse = reuse;
+	hlist_add_head_rcu(&sock->link, &port_hash[bucket]);
 	return 0;
 }
 
 static inline void port_hash_del(struct udp_socket *sock)
 {
-	hlist_del(&sock->link);
+	hlist_del_init_rcu(&sock->link);
+}
+
+static inline unsigned conn_hash_key(u32 daddr, u16 dport, u16 sport)
+{
+	return jhash_2words(daddr, ((u32)dport << 16) | sport, 0) &
+		port_hash_mask;
+}
+
+static inline void conn_hash_insert(struct udp_socket *sock, u32 daddr,
+				    u16 dport)
+{
+	sock->daddr = daddr;
+	sock->dport = dport;
+	hlist_add_head_rcu(&sock->conn_link,
+			   &conn_hash[conn_hash_key(daddr, dport, sock->sport)]);
+}
+
+static inline void conn_hash_del(struct udp_socket *sock)
+{
+	if (sock->dport != 0) {
+		hlist_del_init_rcu(&sock->conn_link);
+		sock->daddr = INADDR_ANY;
+		sock->dport = 0;
+	}
+}
+
+/***
+ *  udp_v4_lookup - finds the receiving socket of a datagram
+ *
+ *  A connected socket matching the full 4-tuple is preferred. Otherwise, the
+ *  unconnected socket with the most specific local address is taken. If that
+ *  one belongs to a SO_REUSEPORT group, the group member is chosen based on a
+ *  flow hash so that all datagrams of a peer reach the same socket.
+ *  Note: result must be validated against udp_hash_seq, see udp_pin_socket
+ */
+static inline struct udp_socket *udp_v4_lookup(u32 daddr, u16 dport,
+					       u32 saddr, u16 sport)
+{
+	struct hlist_head *bucket = &port_hash[dport & port_hash_mask];
+	struct udp_socket *sock;
+	struct udp_socket *found = NULL;
+	unsigned members = 0;
+	unsigned steps = 0;
+	unsigned n;
+
+	/* Chains reshuffled by concurrent writers may temporarily appear
+	 * longer than the registry, the retry will sort that out. */
+	hlist_for_each_entry_rcu(sock, &conn_hash[conn_hash_key(saddr, sport,
+								dport)],
+				 conn_link) {
+		if (unlikely(++steps > RT_UDP_SOCKETS))
+			return NULL;
+		if (sock->sport == dport && sock->dport == sport &&
+		    sock->daddr == saddr &&
+		    (sock->saddr == daddr || sock->saddr == INADDR_ANY))
+			return sock;
+	}
+
+	steps = 0;
+	hlist_for_each_entry_rcu(sock, bucket, link) {
+		if (unlikely(++steps > RT_UDP_SOCKETS))
+			return NULL;
+		if (sock->sport != dport || sock->dport != 0 ||
+		    (sock->saddr != daddr && sock->saddr != INADDR_ANY))
+			continue;
+
+		if (!found || (found->saddr == INADDR_ANY &&
+			       sock->saddr != INADDR_ANY)) {
+			found = sock;
+			members = 1;
+		} else if (sock->saddr == found->saddr &&
+			   (sock->reuse & found->reuse & RT_INET_REUSEPORT))
+			members++;
+	}
+
+	if (members <= 1)
+		return found;
+
+	n = jhash_3words(saddr, ((u32)sport << 16) | dport, daddr, 0) % members;
+
+	steps = 0;
+	hlist_for_each_entry_rcu(sock, bucket, link) {
+		if (unlikely(++steps > RT_UDP_SOCKETS))
+			return NULL;
+		if (sock->sport == dport && sock->dport == 0 &&
+		    sock->saddr == found->saddr &&
+		    (sock->reuse & RT_INET_REUSEPORT) && n-- == 0)
+			return sock;
+	}
+
+	return found;
+}
+
+/***
+ *  udp_pin_socket - references the socket of a lookup result
+ *  @seq: udp_hash_seq as read before the lookup
+ *
+ *  Returns the referenced socket or NULL if the lookup has to be repeated.
+ */
+static inline struct rtsocket *udp_pin_socket(struct udp_socket *sock,
+					      unsigned seq)
+{
+	struct rtsocket *rtsock;
+
+	/* pairs with the barrier in udp_wait_readers */
+	atomic_inc(&sock->users);
+	smp_mb__after_atomic();
+
+	if (read_seqcount_retry(&udp_hash_seq, seq)) {
+		atomic_dec(&sock->users);
+		return NULL;
+	}
+
+	rtsock = sock->sock;
+	rt_socket_reference(rtsock);
+
+	smp_mb__before_atomic();
+	atomic_dec(&sock->users);
+
+	return rtsock;
+}
+
+/***
+ *  udp_wait_readers - waits for lookups which may still see an entry
+ *
+ *  Note: the entry must have been unlinked already, must be called without
+ *  udp_socket_base_lock held
+ */
+static void udp_wait_readers(struct udp_socket *sock)
+{
+	smp_mb();
+	while (atomic_read(&sock->users) != 0)
+		cpu_relax();
 }
 
 /***
  *  rt_udp_v4_lookup
  */
-static inline struct rtsocket *rt_udp_v4_lookup(u32 daddr, u16 dport)
+static inline struct rtsocket *rt_udp_v4_lookup(u32 daddr, u16 dport,
+                                                u32 saddr, u16 sport)
 {
-    rtdm_lockctx_t  context;
-    struct udp_socket *sock;
+    struct udp_socket   *sock;
+    struct rtsocket     *rtsock;
+    unsigned            seq;
 
-    rtdm_lock_get_irqsave(&udp_socket_base_lock, context);
-    sock = port_hash_search(daddr, dport);
-    if (sock) {
-	    rt_socket_reference(sock->sock);
 
-	    rtdm_lock_put_irqrestore(&udp_socket_base_lock, context);
+    do {
+        seq  = read_seqcount_begin(&udp_hash_seq);
+        sock = udp_v4_lookup(daddr, dport, saddr, sport);
+        if (sock) {
+            rtsock = udp_pin_socket(sock, seq);
+            if (rtsock)
+                return rtsock;
+        }
+    } while (read_seqcount_retry(&udp_hash_seq, seq));
 
-	    return sock->sock;
-    }
+    return NULL;
+}
+
+
+
+/***
+ *  rt_udp_v4_mc_lookup - find the socket which joined a group on a port
+ */
+static inline struct rtsocket *rt_udp_v4_mc_lookup(u32 group, u16 dport,
+                                                   int ifindex)
+{
+    struct udp_socket   *sock;
+    struct rtsocket     *rtsock;
+    unsigned            seq;
+    unsigned            steps;
+
+
+    do {
+        seq   = read_seqcount_begin(&udp_hash_seq);
+        steps = 0;
+
+        hlist_for_each_entry_rcu(sock, &port_hash[dport & port_hash_mask],
+                                 link) {
+            if (unlikely(++steps > RT_UDP_SOCKETS))
+                break;
+            if ((sock->sport == dport) &&
+                ((sock->saddr == INADDR_ANY) || (sock->saddr == group)) &&
+                rt_ip_mc_socket_member(sock->sock, group, ifindex)) {
+                rtsock = udp_pin_socket(sock, seq);
+                if (rtsock)
+                    return rtsock;
+                break;
+            }
+        }
+    } while (read_seqcount_retry(&udp_hash_seq, seq));
 
-    rtdm_lock_put_irqrestore(&udp_socket_base_lock, context);
-	    
     return NULL;
 }
 
@@ -179,22 +376,27 @@ int rt_udp_bind(struct rtsocket *sock, const struct sockaddr *addr,
         goto unlock_out;
     }
 
+    write_seqcount_begin(&udp_hash_seq);
+
     port_hash_del(&port_registry[index]);
     if (port_hash_insert(&port_registry[index],
 			 usin->sin_addr.s_addr,
-			 usin->sin_port ?: index + auto_port_start)) {
+			 usin->sin_port ?: index + auto_port_start,
+			 sock->prot.inet.reuse)) {
 	    port_hash_insert(&port_registry[index],
 			     port_registry[index].saddr,
-			     port_registry[index].sport);
-	    rtdm_lock_put_irqrestore(&udp_socket_base_lock, context);
-	    return -EADDRINUSE;
-    }
+			     port_registry[index].sport,
+			     port_registry[index].reuse);
+	    err = -EADDRINUSE;
+    } else {
+	    /* set the source-addr */
+	    sock->prot.inet.saddr = port_registry[index].saddr;
 
-    /* set the source-addr */
-    sock->prot.inet.saddr = port_registry[index].saddr;
+	    /* set source port, if not set by user */
+	    sock->prot.inet.sport = port_registry[index].sport;
+    }
 
-    /* set source port, if not set by user */
-    sock->prot.inet.sport = port_registry[index].sport;
+    write_seqcount_end(&udp_hash_seq);
 
  unlock_out:
     rtdm_lock_put_irqrestore(&udp_socket_base_lock, context);
@@ -221,6 +423,9 @@ int rt_udp_connect(struct rtsocket *sock, const struct sockaddr *serv_addr,
             return -EBADF;
 
         rtdm_lock_get_irqsave(&udp_socket_base_lock, context);
+        write_seqcount_begin(&udp_hash_seq);
+
+        conn_hash_del(&port_registry[index]);
 
         sock->prot.inet.saddr = INADDR_ANY;
         /* Note: The following line differs from standard stacks, and we also
@@ -231,6 +436,7 @@ int rt_udp_connect(struct rtsocket *sock, const struct sockaddr *serv_addr,
         sock->prot.inet.dport = 0;
         sock->prot.inet.state = TCP_CLOSE;
 
+        write_seqcount_end(&udp_hash_seq);
         rtdm_lock_put_irqrestore(&udp_socket_base_lock, context);
     } else {
         if ((addrlen < (int)sizeof(struct sockaddr_in)) ||
@@ -239,15 +445,29 @@ int rt_udp_connect(struct rtsocket *sock, const struct sockaddr *serv_addr,
 
         rtdm_lock_get_irqsave(&udp_socket_base_lock, context);
 
+        if ((index = sock->prot.inet.reg_index) < 0) {
+            /* socket is being closed */
+            rtdm_lock_put_irqrestore(&udp_socket_base_lock, context);
+            return -EBADF;
+        }
         if (sock->prot.inet.state != TCP_CLOSE) {
             rtdm_lock_put_irqrestore(&udp_socket_base_lock, context);
             return -EINVAL;
         }
 
+        write_seqcount_begin(&udp_hash_seq);
+
         sock->prot.inet.state = TCP_ESTABLISHED;
         sock->prot.inet.daddr = usin->sin_addr.s_addr;
         sock->prot.inet.dport = usin->sin_port;
 
+        /* only peers with a port can be matched exactly */
+        if (usin->sin_port != 0)
+            conn_hash_insert(&port_registry[index], usin->sin_addr.s_addr,
+                             usin->sin_port);
+
+        write_seqcount_end(&udp_hash_seq);
+
         rtdm_lock_put_irqrestore(&udp_socket_base_lock, context);
     }
 
@@ -276,6 +496,10 @@ int rt_udp_socket(struct rtdm_dev_context *sockctx,
     sock->prot.inet.saddr = INADDR_ANY;
     sock->prot.inet.state = TCP_CLOSE;
     sock->prot.inet.tos   = 0;
+    sock->prot.inet.ip_id = 0;
+    sock->prot.inet.reuse = 0;
+    sock->prot.inet.no_check = 0;
+    sock->prot.inet.frag_collectors = 0;
 
     rtdm_lock_get_irqsave(&udp_socket_base_lock, context);
 
@@ -295,11 +519,17 @@ int rt_udp_socket(struct rtdm_dev_context *sockctx,
     set_bit(index, &port_bitmap[i]);
     index += i*32;
     sock->prot.inet.reg_index = index;
-    sock->prot.inet.sport     = index + auto_port_start;
 
-    /* register UDP socket */
-    port_hash_insert(&port_registry[index], INADDR_ANY, sock->prot.inet.sport);
+    /* register UDP socket, the entry must be complete when published */
     port_registry[index].sock  = sock;
+    port_registry[index].daddr = INADDR_ANY;
+    port_registry[index].dport = 0;
+
+    write_seqcount_begin(&udp_hash_seq);
+    sock->prot.inet.sport = index + auto_port_start;
+    port_hash_insert(&port_registry[index], INADDR_ANY, sock->prot.inet.sport,
+                     0);
+    write_seqcount_end(&udp_hash_seq);
 
     rtdm_lock_put_irqrestore(&udp_socket_base_lock, context);
 
@@ -322,19 +552,31 @@ int rt_udp_close(struct rtdm_dev_context *sockctx,
 
     rtdm_lock_get_irqsave(&udp_socket_base_lock, context);
 
-    sock->prot.inet.state = TCP_CLOSE;
+    port = sock->prot.inet.reg_index;
+    sock->prot.inet.reg_index = -1;
 
-    if (sock->prot.inet.reg_index >= 0) {
-        port = sock->prot.inet.reg_index;
-        clear_bit(port % BITS_PER_LONG, &port_bitmap[port / BITS_PER_LONG]);
+    write_seqcount_begin(&udp_hash_seq);
+    sock->prot.inet.state = TCP_CLOSE;
+    if (port >= 0) {
 	port_hash_del(&port_registry[port]);
+	conn_hash_del(&port_registry[port]);
+    }
+    write_seqcount_end(&udp_hash_seq);
 
-        free_ports++;
+    rtdm_lock_put_irqrestore(&udp_socket_base_lock, context);
 
-        sock->prot.inet.reg_index = -1;
+    if (port >= 0) {
+        /* the entry may only be reused once no lookup can return it */
+        udp_wait_readers(&port_registry[port]);
+
+        rtdm_lock_get_irqsave(&udp_socket_base_lock, context);
+        clear_bit(port % BITS_PER_LONG, &port_bitmap[port / BITS_PER_LONG]);
+        free_ports++;
+        rtdm_lock_put_irqrestore(&udp_socket_base_lock, context);
     }
 
-    rtdm_lock_put_irqrestore(&udp_socket_base_lock, context);
+    /* leave all multicast groups */
+    rt_ip_mc_drop_socket(sock);
 
     /* cleanup already collected fragments */
     rt_ip_frag_invalidate_socket(sock);
@@ -348,6 +590,13 @@ int rt_udp_close(struct rtdm_dev_context *sockctx,
 
 
 
+static int rt_udp_recvmmsg(struct rtdm_dev_context *sockctx,
+                           rtdm_user_info_t *user_info,
+                           struct rtnet_mmsg_args *uargs);
+static int rt_udp_sendmmsg(struct rtdm_dev_context *sockctx,
+                           rtdm_user_info_t *user_info,
+                           struct rtnet_mmsg_args *uargs);
+
 int rt_udp_ioctl(struct rtdm_dev_context *sockctx,
                  rtdm_user_info_t *user_info,
                  unsigned int request, void *arg)
@@ -358,7 +607,29 @@ int rt_udp_ioctl(struct rtdm_dev_context *sockctx,
 
     /* fast path for common socket IOCTLs */
     if (_IOC_TYPE(request) == RTIOC_TYPE_NETWORK)
-        return rt_socket_common_ioctl(sockctx, user_info, request, arg);
+        switch (request) {
+            case RTNET_RTIOC_RECVMMSG:
+                if (!rtdm_in_rt_context())
+                    return -ENOSYS;
+                return rt_udp_recvmmsg(sockctx, user_info, arg);
+
+            case RTNET_RTIOC_SENDMMSG:
+                if (!rtdm_in_rt_context())
+                    return -ENOSYS;
+                return rt_udp_sendmmsg(sockctx, user_info, arg);
+
+            case RTNET_RTIOC_RXRING:
+                return rt_socket_rxring_setup(sockctx, user_info, arg);
+
+            case RTNET_RTIOC_RXRING_WAIT:
+                if (!rtdm_in_rt_context())
+                    return -ENOSYS;
+                return rt_socket_rxring_wait(sock, *(unsigned int *)arg);
+
+            default:
+                return rt_socket_common_ioctl(sockctx, user_info, request,
+                                              arg);
+        }
 
     switch (request) {
         case _RTIOC_BIND:
@@ -375,13 +646,13 @@ int rt_udp_ioctl(struct rtdm_dev_context *sockctx,
 
 
 /***
- *  rt_udp_recvmsg
+ *  __rt_udp_recvmsg - receives a single datagram
  */
-ssize_t rt_udp_recvmsg(struct rtdm_dev_context *sockctx,
-                       rtdm_user_info_t *user_info, struct msghdr *msg,
-                       int msg_flags)
+static ssize_t __rt_udp_recvmsg(struct rtsocket *sock,
+                                rtdm_user_info_t *user_info,
+                                struct msghdr *msg, int msg_flags,
+                                nanosecs_rel_t timeout)
 {
-    struct rtsocket     *sock = (struct rtsocket *)&sockctx->dev_private;
     size_t              len   = rt_iovec_len(msg->msg_iov, msg->msg_iovlen);
     struct rtskb        *skb;
     struct rtskb        *first_skb;
@@ -390,14 +661,9 @@ ssize_t rt_udp_recvmsg(struct rtdm_dev_context *sockctx,
     size_t              data_len;
     struct udphdr       *uh;
     struct sockaddr_in  *sin;
-    nanosecs_rel_t      timeout = sock->timeout;
     int                 ret;
 
 
-    /* non-blocking receive? */
-    if (testbits(msg_flags, MSG_DONTWAIT))
-        timeout = -1;
-
     ret = rtdm_sem_timeddown(&sock->pending_sem, timeout, NULL);
     if (unlikely(ret < 0))
         switch (ret) {
@@ -412,6 +678,7 @@ ssize_t rt_udp_recvmsg(struct rtdm_dev_context *sockctx,
 
     skb = rtskb_dequeue_chain(&sock->incoming);
     RTNET_ASSERT(skb != NULL, return -EFAULT;);
+    atomic_dec(&sock->rx_queued);
 
     uh = skb->h.uh;
     data_len = ntohs(uh->len) - sizeof(struct udphdr);
@@ -461,11 +728,14 @@ ssize_t rt_udp_recvmsg(struct rtdm_dev_context *sockctx,
     if (data_len > 0)
         msg->msg_flags |= MSG_TRUNC;
 
+    rt_socket_recv_timestamp(sock, user_info, msg, first_skb->time_stamp);
+
     if ((msg_flags & MSG_PEEK) == 0)
         kfree_rtskb(first_skb);
     else {
         __rtskb_push(first_skb, sizeof(struct udphdr));
         rtskb_queue_head(&sock->incoming, first_skb);
+        atomic_inc(&sock->rx_queued);
         rtdm_sem_up(&sock->pending_sem);
     }
 
@@ -474,6 +744,26 @@ ssize_t rt_udp_recvmsg(struct rtdm_dev_context *sockctx,
 
 
 
+/***
+ *  rt_udp_recvmsg
+ */
+ssize_t rt_udp_recvmsg(struct rtdm_dev_context *sockctx,
+                       rtdm_user_info_t *user_info, struct msghdr *msg,
+                       int msg_flags)
+{
+    struct rtsocket     *sock = (struct rtsocket *)&sockctx->dev_private;
+    nanosecs_rel_t      timeout = sock->timeout;
+
+
+    /* non-blocking receive? */
+    if (testbits(msg_flags, MSG_DONTWAIT))
+        timeout = -1;
+
+    return __rt_udp_recvmsg(sock, user_info, msg, msg_flags, timeout);
+}
+
+
+
 /***
  *  struct udpfakehdr
  */
@@ -485,6 +775,7 @@ struct udpfakehdr
     struct iovec *iov;
     int iovlen;
     u32 wcheck;
+    int no_check;   /* send a zero checksum */
 };
 
 
@@ -499,6 +790,14 @@ static int rt_udp_getfrag(const void *p, unsigned char *to,
     int i;
 
 
+    if (offset==0 && ufh->no_check) {
+        /* trusted segment: checksum field stays 0 ("not computed") */
+        rt_memcpy_fromkerneliovec(to + sizeof(struct udphdr), ufh->iov,
+                                  fraglen - sizeof(struct udphdr));
+        memcpy(to, ufh, sizeof(struct udphdr));
+        return 0;
+    }
+
     // We should optimize this function a bit (copy+csum...)!
     if (offset==0) {
         /* Checksum of the complete data part of the UDP message: */
@@ -532,23 +831,44 @@ static int rt_udp_getfrag(const void *p, unsigned char *to,
 
 
 /***
- *  rt_udp_sendmsg
+ *  Output route of the previous datagram, reused by batched sends as long as
+ *  the destination does not change
  */
-ssize_t rt_udp_sendmsg(struct rtdm_dev_context *sockctx,
-                       rtdm_user_info_t *user_info,
-                       const struct msghdr *msg, int msg_flags)
+struct udp_route_cache {
+    struct dest_route   rt;
+    u32                 daddr;
+    u32                 saddr;
+    int                 valid;
+};
+
+static inline void udp_route_cache_release(struct udp_route_cache *rc)
+{
+    if (rc->valid) {
+        rtdev_dereference(rc->rt.rtdev);
+        rc->valid = 0;
+    }
+}
+
+
+
+/***
+ *  __rt_udp_sendmsg - sends a single datagram
+ *  @rc: route cache, must be released by the caller
+ */
+static ssize_t __rt_udp_sendmsg(struct rtsocket *sock,
+                                const struct msghdr *msg, int msg_flags,
+                                struct udp_route_cache *rc)
 {
-    struct rtsocket     *sock = (struct rtsocket *)&sockctx->dev_private;
     size_t              len   = rt_iovec_len(msg->msg_iov, msg->msg_iovlen);
     int                 ulen  = len + sizeof(struct udphdr);
-    struct sockaddr_in  *usin;
+    struct sockaddr_in  *usin = NULL;
     struct udpfakehdr   ufh;
-    struct dest_route   rt;
     u32                 saddr;
-    u32                 daddr;
-    u16                 dport;
+    u32                 daddr = INADDR_ANY;
+    u16                 dport = 0;
+    int                 connected = 1;
+    unsigned            seq;
     int                 err;
-    rtdm_lockctx_t      context;
 
 
     if ((len < 0) || (len > 0xFFFF-sizeof(struct iphdr)-sizeof(struct udphdr)))
@@ -568,32 +888,43 @@ ssize_t rt_udp_sendmsg(struct rtdm_dev_context *sockctx,
 
         daddr = usin->sin_addr.s_addr;
         dport = usin->sin_port;
+    }
 
-        rtdm_lock_get_irqsave(&udp_socket_base_lock, context);
-    } else {
-        rtdm_lock_get_irqsave(&udp_socket_base_lock, context);
-
-        if (sock->prot.inet.state != TCP_ESTABLISHED)
-            return -ENOTCONN;
+    /* consistent snapshot of the socket addresses */
+    do {
+        seq = read_seqcount_begin(&udp_hash_seq);
 
-        daddr = sock->prot.inet.daddr;
-        dport = sock->prot.inet.dport;
-    }
-    saddr         = sock->prot.inet.saddr;
-    ufh.uh.source = sock->prot.inet.sport;
+        if (usin == NULL) {
+            connected = (sock->prot.inet.state == TCP_ESTABLISHED);
+            daddr     = sock->prot.inet.daddr;
+            dport     = sock->prot.inet.dport;
+        }
+        saddr         = sock->prot.inet.saddr;
+        ufh.uh.source = sock->prot.inet.sport;
+    } while (read_seqcount_retry(&udp_hash_seq, seq));
 
-    rtdm_lock_put_irqrestore(&udp_socket_base_lock, context);
+    if (!connected)
+        return -ENOTCONN;
 
     if ((daddr | dport) == 0)
         return -EINVAL;
 
-    /* get output route */
-    err = rt_ip_route_output(&rt, daddr, saddr);
-    if (err)
-        return err;
+    if (rc->valid && ((rc->daddr != daddr) || (rc->saddr != saddr)))
+        udp_route_cache_release(rc);
+
+    /* get output route, hold back the datagram if the peer is unresolved */
+    if (!rc->valid) {
+        err = rt_ip_route_resolve(&rc->rt, daddr, saddr);
+        if (err)
+            return err;
+
+        rc->daddr = daddr;
+        rc->saddr = saddr;
+        rc->valid = 1;
+    }
 
     /* we found a route, remember the routing dest-addr could be the netmask */
-    ufh.saddr     = saddr != INADDR_ANY ? saddr : rt.rtdev->local_ip;
+    ufh.saddr     = saddr != INADDR_ANY ? saddr : rc->rt.rtdev->local_ip;
     ufh.daddr     = daddr;
     ufh.uh.dest   = dport;
     ufh.uh.len    = htons(ulen);
@@ -601,10 +932,11 @@ ssize_t rt_udp_sendmsg(struct rtdm_dev_context *sockctx,
     ufh.iov       = msg->msg_iov;
     ufh.iovlen    = msg->msg_iovlen;
     ufh.wcheck    = 0;
+    ufh.no_check  = sock->prot.inet.no_check &&
+                    (rc->rt.rtdev->flags & IFF_RT_NOCSUM);
 
-    err = rt_ip_build_xmit(sock, rt_udp_getfrag, &ufh, ulen, &rt, msg_flags);
-
-    rtdev_dereference(rt.rtdev);
+    err = rt_ip_build_xmit(sock, rt_udp_getfrag, &ufh, ulen, &rc->rt,
+                           msg_flags);
 
     if (!err)
         return len;
@@ -614,6 +946,210 @@ ssize_t rt_udp_sendmsg(struct rtdm_dev_context *sockctx,
 
 
 
+/***
+ *  rt_udp_sendmsg
+ */
+ssize_t rt_udp_sendmsg(struct rtdm_dev_context *sockctx,
+                       rtdm_user_info_t *user_info,
+                       const struct msghdr *msg, int msg_flags)
+{
+    struct rtsocket         *sock = (struct rtsocket *)&sockctx->dev_private;
+    struct udp_route_cache  rc = { .valid = 0 };
+    ssize_t                 ret;
+
+
+    ret = __rt_udp_sendmsg(sock, msg, msg_flags, &rc);
+    udp_route_cache_release(&rc);
+
+    return ret;
+}
+
+
+
+/***
+ *  rt_udp_mmsg_get - fetches a message header and its iovec
+ *  @iov: kernel copy of the iovec, at least RTNET_MMSG_IOV_MAX entries
+ *
+ *  Working on copies leaves the caller's descriptors untouched.
+ */
+static int rt_udp_mmsg_get(rtdm_user_info_t *user_info, struct msghdr *msg,
+                           struct iovec *iov, const struct msghdr *umsg)
+{
+    if (user_info) {
+        if (rtdm_copy_from_user(user_info, msg, umsg, sizeof(*msg)))
+            return -EFAULT;
+    } else
+        memcpy(msg, umsg, sizeof(*msg));
+
+    if (msg->msg_iovlen > RTNET_MMSG_IOV_MAX)
+        return -EMSGSIZE;
+
+    if (user_info) {
+        if (rtdm_copy_from_user(user_info, iov, msg->msg_iov,
+                                msg->msg_iovlen * sizeof(struct iovec)))
+            return -EFAULT;
+    } else
+        memcpy(iov, msg->msg_iov, msg->msg_iovlen * sizeof(struct iovec));
+
+    msg->msg_iov = iov;
+
+    return 0;
+}
+
+
+
+/***
+ *  rt_udp_mmsg_put - reports the result of a message back
+ */
+static int rt_udp_mmsg_put(rtdm_user_info_t *user_info,
+                           struct rtnet_mmsghdr *umsg,
+                           const struct msghdr *msg, unsigned int len)
+{
+    struct rtnet_mmsghdr    *kmsg = umsg;
+    struct rtnet_mmsghdr    tmp;
+
+
+    if (user_info)
+        kmsg = &tmp;
+
+    kmsg->msg_hdr.msg_namelen    = msg->msg_namelen;
+    kmsg->msg_hdr.msg_controllen = msg->msg_controllen;
+    kmsg->msg_hdr.msg_flags      = msg->msg_flags;
+    kmsg->msg_len                = len;
+
+    if (user_info &&
+        (rtdm_copy_to_user(user_info, &umsg->msg_hdr.msg_namelen,
+                           &tmp.msg_hdr.msg_namelen,
+                           sizeof(tmp.msg_hdr.msg_namelen)) ||
+         rtdm_copy_to_user(user_info, &umsg->msg_hdr.msg_controllen,
+                           &tmp.msg_hdr.msg_controllen,
+                           sizeof(tmp.msg_hdr.msg_controllen)) ||
+         rtdm_copy_to_user(user_info, &umsg->msg_hdr.msg_flags,
+                           &tmp.msg_hdr.msg_flags,
+                           sizeof(tmp.msg_hdr.msg_flags)) ||
+         rtdm_copy_to_user(user_info, &umsg->msg_len, &tmp.msg_len,
+                           sizeof(tmp.msg_len))))
+        return -EFAULT;
+
+    return 0;
+}
+
+
+
+/***
+ *  rt_udp_recvmmsg - receives a batch of datagrams
+ *
+ *  Only waits for the first datagram, then collects whatever else is already
+ *  queued, up to args->vlen datagrams. Returns the number of datagrams
+ *  received or, if there was none, the error.
+ */
+static int rt_udp_recvmmsg(struct rtdm_dev_context *sockctx,
+                           rtdm_user_info_t *user_info,
+                           struct rtnet_mmsg_args *uargs)
+{
+    struct rtsocket         *sock = (struct rtsocket *)&sockctx->dev_private;
+    struct rtnet_mmsg_args  args;
+    struct msghdr           msg;
+    struct iovec            iov[RTNET_MMSG_IOV_MAX];
+    nanosecs_rel_t          timeout = sock->timeout;
+    unsigned int            i;
+    ssize_t                 ret = 0;
+
+
+    if (user_info) {
+        if (rtdm_copy_from_user(user_info, &args, uargs, sizeof(args)))
+            return -EFAULT;
+    } else
+        args = *uargs;
+
+    /* peeking would return the same datagram over and over */
+    if (args.flags & ~MSG_DONTWAIT)
+        return -EINVAL;
+    if (testbits(args.flags, MSG_DONTWAIT))
+        timeout = -1;
+
+    for (i = 0; i < args.vlen; i++) {
+        ret = rt_udp_mmsg_get(user_info, &msg, iov, &args.msgvec[i].msg_hdr);
+        if (ret < 0)
+            break;
+        msg.msg_flags = 0;
+
+        ret = __rt_udp_recvmsg(sock, user_info, &msg, args.flags,
+                               timeout);
+        if (ret < 0)
+            break;
+
+        ret = rt_udp_mmsg_put(user_info, &args.msgvec[i], &msg, ret);
+        if (ret < 0)
+            break;
+
+        /* don't wait for further datagrams */
+        timeout = -1;
+    }
+
+    return (i > 0) ? (int)i : (int)ret;
+}
+
+
+
+/***
+ *  rt_udp_sendmmsg - sends a batch of datagrams
+ *
+ *  Consecutive datagrams to the same destination share one route lookup.
+ *  Returns the number of datagrams sent or, if there was none, the error.
+ */
+static int rt_udp_sendmmsg(struct rtdm_dev_context *sockctx,
+                           rtdm_user_info_t *user_info,
+                           struct rtnet_mmsg_args *uargs)
+{
+    struct rtsocket         *sock = (struct rtsocket *)&sockctx->dev_private;
+    struct rtnet_mmsg_args  args;
+    struct msghdr           msg;
+    struct iovec            iov[RTNET_MMSG_IOV_MAX];
+    struct sockaddr_in      sin;
+    struct udp_route_cache  rc = { .valid = 0 };
+    unsigned int            i;
+    ssize_t                 ret = 0;
+
+
+    if (user_info) {
+        if (rtdm_copy_from_user(user_info, &args, uargs, sizeof(args)))
+            return -EFAULT;
+    } else
+        args = *uargs;
+
+    for (i = 0; i < args.vlen; i++) {
+        ret = rt_udp_mmsg_get(user_info, &msg, iov, &args.msgvec[i].msg_hdr);
+        if (ret < 0)
+            break;
+
+        if (msg.msg_name && (msg.msg_namelen == sizeof(sin))) {
+            if (user_info) {
+                if (rtdm_copy_from_user(user_info, &sin, msg.msg_name,
+                                        sizeof(sin))) {
+                    ret = -EFAULT;
+                    break;
+                }
+                msg.msg_name = &sin;
+            }
+        }
+
+        ret = __rt_udp_sendmsg(sock, &msg, args.flags, &rc);
+        if (ret < 0)
+            break;
+
+        ret = rt_udp_mmsg_put(user_info, &args.msgvec[i], &msg, ret);
+        if (ret < 0)
+            break;
+    }
+
+    udp_route_cache_release(&rc);
+
+    return (i > 0) ? (int)i : (int)ret;
+}
+
+
+
 /***
  *  rt_udp_check
  */
@@ -634,6 +1170,7 @@ struct rtsocket *rt_udp_dest_socket(struct rtskb *skb)
     u32                     saddr = skb->nh.iph->saddr;
     u32                     daddr = skb->nh.iph->daddr;
     struct rtnet_device*    rtdev = skb->rtdev;
+    struct rtsocket         *sock;
 
 
     if (uh->check == 0)
@@ -649,17 +1186,26 @@ struct rtsocket *rt_udp_dest_socket(struct rtskb *skb)
             skb->ip_summed = CHECKSUM_NONE;
         }*/
 
-    if (skb->ip_summed != CHECKSUM_UNNECESSARY)
-        skb->csum = csum_tcpudp_nofold(saddr, daddr, ulen, IPPROTO_UDP, 0);
-
     /* patch broadcast daddr */
     if (daddr == rtdev->broadcast_ip)
         daddr = rtdev->local_ip;
 
     /* find the destination socket */
-    skb->sk = rt_udp_v4_lookup(daddr, uh->dest);
+    if (rt_ip_is_multicast(daddr))
+        sock = rt_udp_v4_mc_lookup(daddr, uh->dest, rtdev->ifindex);
+    else
+        sock = rt_udp_v4_lookup(daddr, uh->dest, saddr, uh->source);
 
-    return skb->sk;
+    /* sockets on trusted segments may waive the checksum */
+    if (sock && sock->prot.inet.no_check && (rtdev->flags & IFF_RT_NOCSUM))
+        skb->ip_summed = CHECKSUM_UNNECESSARY;
+
+    if (skb->ip_summed != CHECKSUM_UNNECESSARY)
+        skb->csum = csum_tcpudp_nofold(saddr, skb->nh.iph->daddr, ulen,
+                                       IPPROTO_UDP, 0);
+
+    skb->sk = sock;
+    return sock;
 }
 
 
@@ -669,22 +1215,52 @@ struct rtsocket *rt_udp_dest_socket(struct rtskb *skb)
  */
 void rt_udp_rcv (struct rtskb *skb)
 {
-    struct rtsocket *sock = skb->sk;
-    void            (*callback_func)(struct rtdm_dev_context *, void *);
-    void            *callback_arg;
-    rtdm_lockctx_t  context;
+    struct rtsocket     *sock = skb->sk;
+    void                (*callback_func)(struct rtdm_dev_context *, void *);
+    void                *callback_arg;
+    struct rtsocket_ring *ring;
+    struct sockaddr_in  sin;
+    struct rtskb        *release;
+    int                 queued, lost;
+    rtdm_lockctx_t      context;
 
 
-    rtskb_queue_tail(&sock->incoming, skb);
-    rtdm_sem_up(&sock->pending_sem);
+    ring = rt_socket_ring_get(sock, &sock->rx_ring);
+    if (ring) {
+        /* store payload and source in the mapped ring, drop on overflow */
+        sin.sin_family      = AF_INET;
+        sin.sin_port        = skb->h.uh->source;
+        sin.sin_addr.s_addr = skb->nh.iph->saddr;
+        memset(sin.sin_zero, 0, sizeof(sin.sin_zero));
+
+        __rtskb_pull(skb, sizeof(struct udphdr));
+        queued = (rt_socket_rxring_put(ring, skb,
+                                       ntohs(skb->h.uh->len) -
+                                           sizeof(struct udphdr),
+                                       &sin, sizeof(sin)) == 0);
+        lost    = !queued;
+        release = skb;
+
+        rt_socket_ring_put(ring);
+    } else {
+        release = rt_socket_queue_rx(sock, skb);
+        queued  = (release != skb);
+        lost    = (release != NULL);
+    }
 
     rtdm_lock_get_irqsave(&sock->param_lock, context);
+    sock->stats.received     += queued;
+    sock->stats.dropped_full += lost;
     callback_func = sock->callback_func;
     callback_arg  = sock->callback_arg;
     rtdm_lock_put_irqrestore(&sock->param_lock, context);
 
     if (callback_func)
         callback_func(rt_socket_context(sock), callback_arg);
+
+    /* the rtskb keeps the socket alive up to here */
+    if (release)
+        kfree_rtskb(release);
 }
 
 
@@ -743,12 +1319,80 @@ static struct rtdm_device udp_device = {
     .proc_name =        "INET_DGRAM"
 };
 
+#ifdef CONFIG_PROC_FS
+static int rtnet_ipv4_udp_show(struct seq_file *p, void *data)
+{
+    struct udp_socket   entry;
+    struct rtsocket     *sock;
+    unsigned long       received, dropped_full, dropped_nobuf;
+    unsigned int        queued, limit, policy;
+    int                 fd;
+    unsigned int        i;
+    rtdm_lockctx_t      context;
+
+
+    seq_printf(p, "FD\tLocal Address\t\tQueued\tLimit\tReceived\t"
+               "Dropped (full/no buffer)\n");
+
+    for (i = 0; i < RT_UDP_SOCKETS; i++) {
+        /* the socket cannot go away while its registry bit is set */
+        rtdm_lock_get_irqsave(&udp_socket_base_lock, context);
+
+        if (!test_bit(i % BITS_PER_LONG, &port_bitmap[i / BITS_PER_LONG])) {
+            rtdm_lock_put_irqrestore(&udp_socket_base_lock, context);
+            continue;
+        }
+
+        entry = port_registry[i];
+        sock  = entry.sock;
+        fd    = rt_socket_context(sock)->fd;
+
+        queued        = atomic_read(&sock->rx_queued);
+        limit         = sock->rx_limit;
+        policy        = sock->rx_policy;
+        received      = sock->stats.received;
+        dropped_full  = sock->stats.dropped_full;
+        dropped_nobuf = sock->stats.dropped_nobuf;
+
+        rtdm_lock_put_irqrestore(&udp_socket_base_lock, context);
+
+        seq_printf(p, "%d\t%u.%u.%u.%u:%-5u\t\t%u\t", fd,
+                   NIPQUAD(entry.saddr), ntohs(entry.sport), queued);
+        if (limit > 0)
+            seq_printf(p, "%u%s\t", limit,
+                       (policy == RTNET_RXQ_DROP_OLDEST) ? "/o" : "/n");
+        else
+            seq_printf(p, "-\t");
+        seq_printf(p, "%lu\t\t%lu/%lu\n", received, dropped_full,
+                   dropped_nobuf);
+    }
+
+    return 0;
+}
+
+static int rtnet_ipv4_udp_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, rtnet_ipv4_udp_show, NULL);
+}
+
+static const struct file_operations rtnet_ipv4_udp_fops = {
+    .open = rtnet_ipv4_udp_open,
+    .read = seq_read,
+    .llseek = seq_lseek,
+    .release = single_release,
+};
+#endif /* CONFIG_PROC_FS */
+
+
+
 /***
  *  rt_udp_init
  */
 static int __init rt_udp_init(void)
 {
     int i;
+    int ret;
+
     if ((auto_port_start < 0) || (auto_port_start >= 0x10000 - RT_UDP_SOCKETS))
         auto_port_start = 1024;
     auto_port_start = htons(auto_port_start & (auto_port_mask & 0xFFFF));
@@ -756,10 +1400,33 @@ static int __init rt_udp_init(void)
 
     rt_inet_add_protocol(&udp_protocol);
 
-    for (i = 0; i < ARRAY_SIZE(port_hash); i++)
+    seqcount_init(&udp_hash_seq);
+
+    for (i = 0; i < ARRAY_SIZE(port_hash); i++) {
 	    INIT_HLIST_HEAD(&port_hash[i]);
+	    INIT_HLIST_HEAD(&conn_hash[i]);
+    }
+    for (i = 0; i < RT_UDP_SOCKETS; i++)
+	    INIT_HLIST_NODE(&port_registry[i].conn_link);
+
+#ifdef CONFIG_PROC_FS
+    if (!proc_create("udp", S_IFREG | S_IRUGO, ipv4_proc_root,
+                     &rtnet_ipv4_udp_fops)) {
+        /*ERRMSG*/printk("RTnet: unable to initialize /proc entry (udp)\n");
+        rt_inet_del_protocol(&udp_protocol);
+        return -ENOMEM;
+    }
+#endif /* CONFIG_PROC_FS */
+
+    ret = rtdm_dev_register(&udp_device);
+    if (ret < 0) {
+#ifdef CONFIG_PROC_FS
+        remove_proc_entry("udp", ipv4_proc_root);
+#endif /* CONFIG_PROC_FS */
+        rt_inet_del_protocol(&udp_protocol);
+    }
 
-    return rtdm_dev_register(&udp_device);
+    return ret;
 }
 
 
@@ -770,6 +1437,9 @@ static int __init rt_udp_init(void)
 static void __exit rt_udp_release(void)
 {
     rtdm_dev_unregister(&udp_device, 1000);
+#ifdef CONFIG_PROC_FS
+    remove_proc_entry("udp", ipv4_proc_root);
+#endif /* CONFIG_PROC_FS */
     rt_inet_del_protocol(&udp_protocol);
 }
 
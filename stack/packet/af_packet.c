@@ -32,6 +32,73 @@
 MODULE_LICENSE("GPL");
 
 
+/***
+ *  rt_packet_rcv_ring - stores a packet in the receive ring of the socket
+ *
+ *  The packet is copied straight out of the device buffer, the socket pool
+ *  is not involved.
+ */
+static int rt_packet_rcv_ring(struct rtsocket *sock,
+                              struct rtsocket_ring *ring, struct rtskb *skb,
+                              struct rtpacket_type *pt)
+{
+    struct rtdm_dev_context *sockctx = rt_socket_context(sock);
+    struct rtnet_device     *rtdev = skb->rtdev;
+    void                    (*callback_func)(struct rtdm_dev_context *,
+                                             void *);
+    void                    *callback_arg;
+    struct sockaddr_ll      sll;
+    unsigned int            hdr_len = 0;
+    int                     queued;
+    rtdm_lockctx_t          context;
+
+
+    memset(&sll, 0, sizeof(sll));
+    sll.sll_family   = AF_PACKET;
+    sll.sll_hatype   = rtdev->type;
+    sll.sll_protocol = skb->protocol;
+    sll.sll_pkttype  = skb->pkt_type;
+    sll.sll_ifindex  = rtdev->ifindex;
+
+    /* Ethernet specific, see rt_packet_recvmsg */
+    memcpy(sll.sll_addr, skb->mac.ethernet->h_source, ETH_ALEN);
+    sll.sll_halen = ETH_ALEN;
+
+    /* Include the header in raw delivery. The buffer may be passed on to
+       further listeners, so restore it afterwards. */
+    if (sockctx->device->socket_type != SOCK_DGRAM) {
+        hdr_len = skb->data - skb->mac.raw;
+        rtskb_push(skb, hdr_len);
+    }
+
+    queued = (rt_socket_rxring_put(ring, skb, skb->len, &sll,
+                                   sizeof(sll)) == 0);
+
+    if (hdr_len)
+        __rtskb_pull(skb, hdr_len);
+
+    rtdm_lock_get_irqsave(&sock->param_lock, context);
+    sock->stats.received     += queued;
+    sock->stats.dropped_full += !queued;
+    callback_func = sock->callback_func;
+    callback_arg  = sock->callback_arg;
+    rtdm_lock_put_irqrestore(&sock->param_lock, context);
+
+    if (callback_func)
+        callback_func(sockctx, callback_arg);
+
+#ifdef CONFIG_RTNET_ETH_P_ALL
+    /* the stack manager keeps ETH_P_ALL buffers */
+    if (pt->type == htons(ETH_P_ALL))
+        return 0;
+#endif /* CONFIG_RTNET_ETH_P_ALL */
+
+    kfree_rtskb(skb);
+    return 0;
+}
+
+
+
 /***
  *  rt_packet_rcv
  */
@@ -42,30 +109,46 @@ static int rt_packet_rcv(struct rtskb *skb, struct rtpacket_type *pt)
     int             ifindex = sock->prot.packet.ifindex;
     void            (*callback_func)(struct rtdm_dev_context *, void *);
     void            *callback_arg;
+    struct rtskb    *dropped;
+    struct rtsocket_ring *ring;
     rtdm_lockctx_t  context;
+    int             ret;
 
 
     if (unlikely((ifindex != 0) && (ifindex != skb->rtdev->ifindex)))
         return -EUNATCH;
 
+    ring = rt_socket_ring_get(sock, &sock->rx_ring);
+    if (ring) {
+        ret = rt_packet_rcv_ring(sock, ring, skb, pt);
+        rt_socket_ring_put(ring);
+        return ret;
+    }
+
 #ifdef CONFIG_RTNET_ETH_P_ALL
     if (pt->type == htons(ETH_P_ALL)) {
         struct rtskb *clone_skb = rtskb_clone(skb, &sock->skb_pool);
-        if (clone_skb == NULL)
+        if (clone_skb == NULL) {
+            rt_socket_drop_nobuf(sock);
             return 0;
+        }
         skb = clone_skb;
     } else
 #endif /* CONFIG_RTNET_ETH_P_ALL */
         if (unlikely(rtskb_acquire(skb, &sock->skb_pool) < 0)) {
+            rt_socket_drop_nobuf(sock);
             kfree_rtskb(skb);
             return 0;
         }
 
     rtdev_reference(skb->rtdev);
-    rtskb_queue_tail(&sock->incoming, skb);
-    rtdm_sem_up(&sock->pending_sem);
+    dropped = rt_socket_queue_rx(sock, skb);
 
     rtdm_lock_get_irqsave(&sock->param_lock, context);
+    if (dropped != skb)
+        sock->stats.received++;
+    if (dropped != NULL)
+        sock->stats.dropped_full++;
     callback_func = sock->callback_func;
     callback_arg  = sock->callback_arg;
     rtdm_lock_put_irqrestore(&sock->param_lock, context);
@@ -73,6 +156,11 @@ static int rt_packet_rcv(struct rtskb *skb, struct rtpacket_type *pt)
     if (callback_func)
         callback_func(rt_socket_context(sock), callback_arg);
 
+    if (dropped) {
+        rtdev_dereference(dropped->rtdev);
+        kfree_rtskb(dropped);
+    }
+
     return 0;
 }
 
@@ -232,6 +320,8 @@ static int rt_packet_close(struct rtdm_dev_context *sockctx,
 
 
 
+static int rt_packet_txring_kick(struct rtdm_dev_context *sockctx);
+
 /***
  *  rt_packet_ioctl
  */
@@ -242,11 +332,33 @@ static int rt_packet_ioctl(struct rtdm_dev_context *sockctx,
     struct rtsocket *sock = (struct rtsocket *)&sockctx->dev_private;
     struct _rtdm_setsockaddr_args *setaddr = arg;
     struct _rtdm_getsockaddr_args *getaddr = arg;
+    struct _rtdm_setsockopt_args  *setopt  = arg;
+    struct _rtdm_getsockopt_args  *getopt  = arg;
 
 
     /* fast path for common socket IOCTLs */
     if (_IOC_TYPE(request) == RTIOC_TYPE_NETWORK)
-        return rt_socket_common_ioctl(sockctx, user_info, request, arg);
+        switch (request) {
+            case RTNET_RTIOC_RXRING:
+                return rt_socket_rxring_setup(sockctx, user_info, arg);
+
+            case RTNET_RTIOC_RXRING_WAIT:
+                if (!rtdm_in_rt_context())
+                    return -ENOSYS;
+                return rt_socket_rxring_wait(sock, *(unsigned int *)arg);
+
+            case RTNET_RTIOC_TXRING:
+                return rt_socket_txring_setup(sockctx, user_info, arg);
+
+            case RTNET_RTIOC_TXRING_KICK:
+                if (!rtdm_in_rt_context())
+                    return -ENOSYS;
+                return rt_packet_txring_kick(sockctx);
+
+            default:
+                return rt_socket_common_ioctl(sockctx, user_info, request,
+                                              arg);
+        }
 
     switch (request) {
         case _RTIOC_BIND:
@@ -256,6 +368,20 @@ static int rt_packet_ioctl(struct rtdm_dev_context *sockctx,
             return rt_packet_getsockname(sock, getaddr->addr,
                                          getaddr->addrlen);
 
+        case _RTIOC_SETSOCKOPT:
+            if (setopt->level != SOL_SOCKET)
+                return -ENOPROTOOPT;
+            return rt_socket_common_setsockopt(sock, setopt->optname,
+                                               setopt->optval,
+                                               setopt->optlen);
+
+        case _RTIOC_GETSOCKOPT:
+            if (getopt->level != SOL_SOCKET)
+                return -ENOPROTOOPT;
+            return rt_socket_common_getsockopt(sock, getopt->optname,
+                                               getopt->optval,
+                                               getopt->optlen);
+
         default:
             return rt_socket_if_ioctl(sockctx, user_info, request, arg);
     }
@@ -298,6 +424,7 @@ static ssize_t rt_packet_recvmsg(struct rtdm_dev_context *sockctx,
 
     rtskb = rtskb_dequeue_chain(&sock->incoming);
     RTNET_ASSERT(rtskb != NULL, return -EFAULT;);
+    atomic_dec(&sock->rx_queued);
 
     sll = msg->msg_name;
 
@@ -331,11 +458,14 @@ static ssize_t rt_packet_recvmsg(struct rtdm_dev_context *sockctx,
 
     rt_memcpy_tokerneliovec(msg->msg_iov, rtskb->data, copy_len);
 
+    rt_socket_recv_timestamp(sock, user_info, msg, rtskb->time_stamp);
+
     if ((msg_flags & MSG_PEEK) == 0) {
         rtdev_dereference(rtskb->rtdev);
         kfree_rtskb(rtskb);
     } else {
         rtskb_queue_head(&sock->incoming, rtskb);
+        atomic_inc(&sock->rx_queued);
         rtdm_sem_up(&sock->pending_sem);
     }
 
@@ -345,54 +475,61 @@ static ssize_t rt_packet_recvmsg(struct rtdm_dev_context *sockctx,
 
 
 /***
- *  rt_packet_sendmsg
+ *  rt_packet_dest - resolves the destination of an outgoing packet
+ *  @sll:        destination address, NULL for the bound one
+ *  @namelen:    length of the address
  */
-static ssize_t rt_packet_sendmsg(struct rtdm_dev_context *sockctx,
-                                 rtdm_user_info_t *user_info,
-                                 const struct msghdr *msg, int msg_flags)
+static int rt_packet_dest(struct rtsocket *sock, const struct sockaddr_ll *sll,
+                          socklen_t namelen, int *ifindex,
+                          unsigned short *proto)
 {
-    struct rtsocket     *sock = (struct rtsocket *)&sockctx->dev_private;
-    size_t              len   = rt_iovec_len(msg->msg_iov, msg->msg_iovlen);
-    struct sockaddr_ll  *sll  = (struct sockaddr_ll*)msg->msg_name;
-    struct rtnet_device *rtdev;
-    struct rtskb        *rtskb;
-    unsigned short      proto;
-    unsigned char       *addr;
-    int                 ifindex;
-    int                 ret = 0;
-
-
-    if (msg_flags & MSG_OOB)    /* Mirror BSD error message compatibility */
-        return -EOPNOTSUPP;
-    if (msg_flags & ~MSG_DONTWAIT)
-        return -EINVAL;
-
     if (sll == NULL) {
         /* Note: We do not care about races with rt_packet_bind here -
            the user has to do so. */
-        ifindex = sock->prot.packet.ifindex;
-        proto   = sock->prot.packet.packet_type.type;
-        addr    = NULL;
-    } else {
-        if ((msg->msg_namelen < sizeof(struct sockaddr_ll)) ||
-            (msg->msg_namelen <
-                (sll->sll_halen + offsetof(struct sockaddr_ll, sll_addr))) ||
-            ((sll->sll_family != AF_PACKET) &&
-            (sll->sll_family != AF_UNSPEC)))
+        *ifindex = sock->prot.packet.ifindex;
+        *proto   = sock->prot.packet.packet_type.type;
+        return 0;
+    }
+
+    if ((namelen < sizeof(struct sockaddr_ll)) ||
+        (namelen < (sll->sll_halen + offsetof(struct sockaddr_ll, sll_addr))) ||
+        ((sll->sll_family != AF_PACKET) && (sll->sll_family != AF_UNSPEC)))
         return -EINVAL;
 
-        ifindex = sll->sll_ifindex;
-        proto   = sll->sll_protocol;
-        addr    = sll->sll_addr;
-    }
+    *ifindex = sll->sll_ifindex;
+    *proto   = sll->sll_protocol;
+
+    return 0;
+}
+
 
-    if ((rtdev = rtdev_get_by_index(ifindex)) == NULL)
-        return -ENODEV;
+
+/***
+ *  rt_packet_alloc_xmit - prepares an outgoing packet
+ *
+ *  Returns an rtskb with the link layer header set up (SOCK_DGRAM) and room
+ *  for len bytes of data, or NULL with the error code in *err.
+ */
+static struct rtskb *rt_packet_alloc_xmit(struct rtdm_dev_context *sockctx,
+                                          struct rtnet_device *rtdev,
+                                          const struct sockaddr_ll *sll,
+                                          unsigned short proto, size_t len,
+                                          int *err)
+{
+    struct rtsocket *sock = (struct rtsocket *)&sockctx->dev_private;
+    struct rtskb    *rtskb;
+    int             ret;
+
+
+    if ((rtdev->flags & IFF_UP) == 0) {
+        *err = -ENETDOWN;
+        return NULL;
+    }
 
     rtskb = alloc_rtskb(rtdev->hard_header_len + len, &sock->skb_pool);
     if (rtskb == NULL) {
-        ret = -ENOBUFS;
-        goto out;
+        *err = -ENOBUFS;
+        return NULL;
     }
 
     /* If an RTmac discipline is active, this becomes a pure sanity check to
@@ -419,7 +556,8 @@ static ssize_t rt_packet_sendmsg(struct rtdm_dev_context *sockctx,
 
         ret = -EINVAL;
         hdr_len = rtdev->hard_header(rtskb, rtdev, ntohs(proto),
-                                     addr, NULL, len);
+                                     (sll != NULL) ? sll->sll_addr : NULL,
+                                     NULL, len);
         if (sockctx->device->socket_type != SOCK_DGRAM) {
             rtskb->tail = rtskb->data;
             rtskb->len = 0;
@@ -427,23 +565,153 @@ static ssize_t rt_packet_sendmsg(struct rtdm_dev_context *sockctx,
             goto err;
     }
 
-    rt_memcpy_fromkerneliovec(rtskb_put(rtskb, len), msg->msg_iov, len);
+    return rtskb;
+
+ err:
+    kfree_rtskb(rtskb);
+    *err = ret;
+    return NULL;
+}
+
+
+
+/***
+ *  rt_packet_sendmsg
+ */
+static ssize_t rt_packet_sendmsg(struct rtdm_dev_context *sockctx,
+                                 rtdm_user_info_t *user_info,
+                                 const struct msghdr *msg, int msg_flags)
+{
+    struct rtsocket     *sock = (struct rtsocket *)&sockctx->dev_private;
+    size_t              len   = rt_iovec_len(msg->msg_iov, msg->msg_iovlen);
+    struct sockaddr_ll  *sll  = (struct sockaddr_ll*)msg->msg_name;
+    struct rtnet_device *rtdev;
+    struct rtskb        *rtskb;
+    unsigned short      proto;
+    int                 ifindex;
+    int                 ret = 0;
+
+
+    if (msg_flags & MSG_OOB)    /* Mirror BSD error message compatibility */
+        return -EOPNOTSUPP;
+    if (msg_flags & ~MSG_DONTWAIT)
+        return -EINVAL;
+
+    ret = rt_packet_dest(sock, sll, msg->msg_namelen, &ifindex, &proto);
+    if (ret < 0)
+        return ret;
+
+    if ((rtdev = rtdev_get_by_index(ifindex)) == NULL)
+        return -ENODEV;
+
+    rtskb = rt_packet_alloc_xmit(sockctx, rtdev, sll, proto, len, &ret);
+    if (rtskb != NULL) {
+        rt_memcpy_fromkerneliovec(rtskb_put(rtskb, len), msg->msg_iov, len);
 
-    if ((rtdev->flags & IFF_UP) != 0) {
         if ((ret = rtdev_xmit(rtskb)) == 0)
             ret = len;
-    } else {
-        ret = -ENETDOWN;
-        goto err;
     }
 
- out:
     rtdev_dereference(rtdev);
     return ret;
+}
 
- err:
-    kfree_rtskb(rtskb);
-    goto out;
+
+
+/***
+ *  rt_packet_txring_kick - sends the frames marked in the transmit ring
+ *
+ *  Frames are processed in ring order until the first one that is not
+ *  marked for transmission. Returns the number of frames passed to the
+ *  devices, or the error of the first frame if none was sent.
+ */
+static int rt_packet_txring_kick(struct rtdm_dev_context *sockctx)
+{
+    struct rtsocket         *sock = (struct rtsocket *)&sockctx->dev_private;
+    struct rtsocket_ring    *ring;
+    struct rtnet_ring_frame *frame;
+    struct rtnet_device     *rtdev = NULL;
+    struct rtskb            *rtskb;
+    struct sockaddr_ll      sll;
+    unsigned int            len, data, addr_len;
+    unsigned short          proto;
+    int                     ifindex;
+    int                     sent = 0;
+    int                     err = 0;
+    int                     ret;
+
+
+    ring = rt_socket_ring_get(sock, &sock->tx_ring);
+    if (!ring)
+        return -EINVAL;
+
+    while ((frame = rt_socket_txring_claim(ring)) != NULL) {
+        /* the frame remains writable for the application, so work on a
+           private copy of its header - each field is read exactly once */
+        len      = ACCESS_ONCE(frame->len);
+        data     = ACCESS_ONCE(frame->data);
+        addr_len = ACCESS_ONCE(frame->addr_len);
+
+        /* bound the address before using it in any computation */
+        if ((addr_len > ring->frame_size - RTNET_RING_HDRLEN) ||
+            ((addr_len > 0) && (addr_len < sizeof(struct sockaddr_ll)))) {
+            ret = -EINVAL;
+            goto complete;
+        }
+
+        if ((data < RTNET_RING_HDRLEN + addr_len) ||
+            (data > ring->frame_size) || (len > ring->frame_size - data)) {
+            ret = -EINVAL;
+            goto complete;
+        }
+
+        /* anything beyond struct sockaddr_ll is ignored */
+        addr_len = min_t(unsigned int, addr_len, sizeof(sll));
+        if (addr_len > 0)
+            memcpy(&sll, frame + 1, addr_len);
+
+        ret = rt_packet_dest(sock, (addr_len > 0) ? &sll : NULL, addr_len,
+                             &ifindex, &proto);
+        if (ret < 0)
+            goto complete;
+
+        /* consecutive frames usually leave via the same device */
+        if ((rtdev == NULL) || (rtdev->ifindex != ifindex)) {
+            if (rtdev != NULL)
+                rtdev_dereference(rtdev);
+            if ((rtdev = rtdev_get_by_index(ifindex)) == NULL) {
+                ret = -ENODEV;
+                goto complete;
+            }
+        }
+
+        rtskb = rt_packet_alloc_xmit(sockctx, rtdev,
+                                     (addr_len > 0) ? &sll : NULL, proto,
+                                     len, &ret);
+        if (rtskb != NULL) {
+            memcpy(rtskb_put(rtskb, len), (char *)frame + data, len);
+            ret = rtdev_xmit(rtskb);
+        }
+
+     complete:
+        rt_socket_txring_complete(frame, ret);
+
+        if (ret == 0)
+            sent++;
+        else {
+            if (err == 0)
+                err = ret;
+            /* leave the remaining frames until buffers are available */
+            if (ret == -ENOBUFS)
+                break;
+        }
+    }
+
+    if (rtdev != NULL)
+        rtdev_dereference(rtdev);
+    rt_socket_ring_put(ring);
+
+    return (sent > 0) ? sent : err;
 }
 
 
@@ -48,6 +48,91 @@ LIST_HEAD(event_hook_list);
 LIST_HEAD(rtskb_list);
 DEFINE_MUTEX(rtnet_devices_nrt_lock);
 
+/***
+ *  rtdev_mc_add - add a link layer multicast address to the device filter
+ *  @rtdev: device
+ *  @addr:  multicast address (rtdev->addr_len bytes)
+ *
+ *  Addresses are reference counted, the hardware is only reprogrammed when
+ *  the list changes. Must be called from non-RT context.
+ */
+int rtdev_mc_add(struct rtnet_device *rtdev, const unsigned char *addr)
+{
+    struct rtdev_mc_list *mc;
+    int                 ret = 0;
+
+
+    mutex_lock(&rtdev->nrt_lock);
+
+    for (mc = rtdev->mc_list; mc != NULL; mc = mc->next)
+        if (memcmp(mc->dmi_addr, addr, rtdev->addr_len) == 0) {
+            mc->dmi_users++;
+            goto out;
+        }
+
+    mc = kmalloc(sizeof(struct rtdev_mc_list), GFP_KERNEL);
+    if (mc == NULL) {
+        ret = -ENOMEM;
+        goto out;
+    }
+
+    memcpy(mc->dmi_addr, addr, rtdev->addr_len);
+    mc->dmi_addrlen = rtdev->addr_len;
+    mc->dmi_users   = 1;
+    mc->next        = rtdev->mc_list;
+
+    rtdev->mc_list = mc;
+    rtdev->mc_count++;
+
+    if ((rtdev->flags & IFF_UP) && (rtdev->set_multicast_list != NULL))
+        rtdev->set_multicast_list(rtdev);
+
+  out:
+    mutex_unlock(&rtdev->nrt_lock);
+
+    return ret;
+}
+
+
+
+/***
+ *  rtdev_mc_del - drop a reference on a link layer multicast address
+ *  @rtdev: device
+ *  @addr:  multicast address (rtdev->addr_len bytes)
+ *
+ *  Must be called from non-RT context.
+ */
+int rtdev_mc_del(struct rtnet_device *rtdev, const unsigned char *addr)
+{
+    struct rtdev_mc_list **prev;
+    struct rtdev_mc_list *mc;
+    int                 ret = -ENOENT;
+
+
+    mutex_lock(&rtdev->nrt_lock);
+
+    for (prev = &rtdev->mc_list; (mc = *prev) != NULL; prev = &mc->next)
+        if (memcmp(mc->dmi_addr, addr, rtdev->addr_len) == 0) {
+            ret = 0;
+            if (--mc->dmi_users > 0)
+                break;
+
+            *prev = mc->next;
+            rtdev->mc_count--;
+            kfree(mc);
+
+            if ((rtdev->flags & IFF_UP) && (rtdev->set_multicast_list != NULL))
+                rtdev->set_multicast_list(rtdev);
+            break;
+        }
+
+    mutex_unlock(&rtdev->nrt_lock);
+
+    return ret;
+}
+
+
+
 static int rtdev_locked_xmit(struct rtskb *skb, struct rtnet_device *rtdev);
 
 
@@ -262,7 +347,14 @@ struct rtnet_device *rtdev_alloc(int sizeof_priv)
  */
 void rtdev_free (struct rtnet_device *rtdev)
 {
+    struct rtdev_mc_list *mc;
+
+
     if (rtdev != NULL) {
+        while ((mc = rtdev->mc_list) != NULL) {
+            rtdev->mc_list = mc->next;
+            kfree(mc);
+        }
         rtskb_pool_shrink(&global_pool, rtdev->add_rtskbs);
         rtdev->stack_event = NULL;
         rtdm_mutex_destroy(&rtdev->xmit_mutex);
@@ -296,7 +388,7 @@ struct rtnet_device *rt_alloc_etherdev(int sizeof_priv)
     rtdev->hard_header_len = ETH_HLEN;
     rtdev->mtu             = 1500; /* eth_mtu */
     rtdev->addr_len        = ETH_ALEN;
-    rtdev->flags           = IFF_BROADCAST; /* TODO: IFF_MULTICAST; */
+    rtdev->flags           = IFF_BROADCAST;
     rtdev->get_mtu         = rt_hard_mtu;
 
     memset(rtdev->broadcast, 0xFF, ETH_ALEN);
@@ -450,6 +542,10 @@ int rt_register_rtnetdev(struct rtnet_device *rtdev)
     if (rtdev->vers < RTDEV_VERS_2_0)
         return -EINVAL;
 
+    /* only drivers which can program a filter receive multicast */
+    if (rtdev->set_multicast_list != NULL)
+        rtdev->flags |= IFF_MULTICAST;
+
     if (rtdev->features & NETIF_F_LLTX)
         rtdev->start_xmit = rtdev->hard_start_xmit;
     else
@@ -671,6 +767,13 @@ int rtdev_xmit(struct rtskb *rtskb)
 
     RTNET_ASSERT(rtdev != NULL, return -EINVAL;);
 
+    /* the device lost the offload feature after the large send was built,
+       the protocol's retransmissions are segmented in software */
+    if (unlikely(rtskb->gso_size != 0) && !rtdev_can_tso(rtdev)) {
+        kfree_rtskb(rtskb);
+        return -EOPNOTSUPP;
+    }
+
     err = rtdev->start_xmit(rtskb, rtdev);
     if (err) {
         /* on error we must free the rtskb here */
@@ -684,6 +787,36 @@ int rtdev_xmit(struct rtskb *rtskb)
 
 
 
+/***
+ *  rtdev_xmit_batch - send a batch of real-time packets back-to-back
+ *  @batch: complete packets, each carrying its output device (not locked)
+ *
+ *  The batch is consumed in any case. Transmission stops at the first packet
+ *  the driver rejects: it and all following packets are dropped, and the
+ *  error is returned. Packets handed over before cannot be recalled, thus a
+ *  fragmented datagram may leave incompletely - its receiver discards the
+ *  partial datagram on reassembly timeout. Drivers do not reserve descriptors
+ *  in advance, a full TX ring therefore shows up as such a mid-batch error.
+ */
+int rtdev_xmit_batch(struct rtskb_queue *batch)
+{
+    struct rtskb    *skb;
+    int             err = 0;
+
+
+    while ((skb = __rtskb_dequeue(batch)) != NULL) {
+        if (unlikely(err != 0)) {
+            kfree_rtskb(skb);
+            continue;
+        }
+        err = rtdev_xmit(skb);
+    }
+
+    return err;
+}
+
+
+
 #ifdef CONFIG_RTNET_ADDON_PROXY
 /***
  *      rtdev_xmit_proxy - send rtproxy packet
@@ -744,6 +877,10 @@ EXPORT_SYMBOL(rtdev_get_by_hwaddr);
 EXPORT_SYMBOL(rtdev_get_loopback);
 
 EXPORT_SYMBOL(rtdev_xmit);
+EXPORT_SYMBOL(rtdev_xmit_batch);
+
+EXPORT_SYMBOL(rtdev_mc_add);
+EXPORT_SYMBOL(rtdev_mc_del);
 
 #ifdef CONFIG_RTNET_ADDON_PROXY
 EXPORT_SYMBOL(rtdev_xmit_proxy);
@@ -32,6 +32,7 @@
 #include <rtnet_internal.h>
 #include <rtnet_socket.h>
 #include <rtnet_rtpc.h>
+#include <rtnet_timerwheel.h>
 #include <stack_mgr.h>
 #include <rtwlan.h>
 
@@ -316,9 +317,15 @@ int __init rtnet_init(void)
     if ((err = rtpc_init()) != 0)
         goto err_out6;
 
+    if ((err = timerwheel_init()) != 0)
+        goto err_out7;
+
     return 0;
 
 
+err_out7:
+    rtpc_cleanup();
+
 err_out6:
     rtwlan_exit();
 
@@ -347,6 +354,8 @@ err_out1:
  */
 void __exit rtnet_release(void)
 {
+    timerwheel_cleanup();
+
     rtpc_cleanup();
 
     rtwlan_exit();
@@ -23,19 +23,30 @@
  */
 
 #include <asm/atomic.h>
+#include <asm/div64.h>
 #include <asm/uaccess.h>
+#include <linux/err.h>
 #include <linux/kernel.h>
 #include <linux/list.h>
+#include <linux/moduleparam.h>
+#include <linux/proc_fs.h>
 #include <linux/sched.h>
+#include <linux/seq_file.h>
 #include <linux/slab.h>
 #include <linux/wait.h>
 
+#include <rtnet_internal.h>
 #include <rtnet_rtpc.h>
 #include <rtnet_sys.h>
 
 
+static unsigned int rtpc_calls = 32;
+module_param(rtpc_calls, uint, 0444);
+MODULE_PARM_DESC(rtpc_calls, "number of preallocated RT procedure calls");
+
 static rtdm_lock_t      pending_calls_lock   = RTDM_LOCK_UNLOCKED;
 static rtdm_lock_t      processed_calls_lock = RTDM_LOCK_UNLOCKED;
+static rtdm_lock_t      free_calls_lock      = RTDM_LOCK_UNLOCKED;
 static rtdm_event_t     dispatch_event;
 static rtdm_task_t      dispatch_task;
 static rtdm_nrtsig_t    rtpc_nrt_signal;
@@ -43,6 +54,27 @@ static rtdm_nrtsig_t    rtpc_nrt_signal;
 LIST_HEAD(pending_calls);
 LIST_HEAD(processed_calls);
 
+/* preallocated calls, callers wait on free_calls_wq if all are in use */
+static LIST_HEAD(free_calls);
+static DECLARE_WAIT_QUEUE_HEAD(free_calls_wq);
+static void             *call_pool;
+static unsigned int     free_count;
+
+#define RTPC_POOL_CALL_SIZE \
+    (sizeof(struct rt_proc_call) + RTPC_POOL_PRIV_SIZE)
+
+/* calls submitted at once by rtnet_rtpc_dispatch_calls() */
+#define RTPC_BATCH_CALLS    16
+
+/* statistics, the dispatch latency is only written by the dispatcher */
+static atomic_t         pool_waits = ATOMIC_INIT(0);
+static atomic_t         oversized_calls = ATOMIC_INIT(0);
+static unsigned long    dispatched_calls;
+static unsigned long    dispatcher_wakeups;
+static nanosecs_rel_t   latency_min;
+static nanosecs_rel_t   latency_max;
+static u64              latency_sum;
+
 
 #ifndef __wait_event_interruptible_timeout
 #define __wait_event_interruptible_timeout(wq, condition, ret)              \
@@ -81,77 +113,252 @@ do {                                                                        \
 
 
 
-int rtnet_rtpc_dispatch_call(rtpc_proc proc, unsigned int timeout,
-                             void* priv_data, size_t priv_data_size,
-                             rtpc_copy_back_proc copy_back_handler,
-                             rtpc_cleanup_proc cleanup_handler)
+/***
+ *  rtpc_take_free_call - take a call from the pool, NULL if exhausted
+ */
+static inline struct rt_proc_call *rtpc_take_free_call(void)
 {
-    struct rt_proc_call *call;
     rtdm_lockctx_t      context;
-    int                 ret;
+    struct rt_proc_call *call = NULL;
 
 
-    call = kmalloc(sizeof(struct rt_proc_call) + priv_data_size, GFP_KERNEL);
-    if (call == NULL) {
-        if (call->cleanup_handler != NULL)
-            call->cleanup_handler(priv_data);
-        return -ENOMEM;
+    rtdm_lock_get_irqsave(&free_calls_lock, context);
+    if (!list_empty(&free_calls)) {
+        call = list_entry(free_calls.next, struct rt_proc_call, list_entry);
+        list_del(&call->list_entry);
+        free_count--;
     }
+    rtdm_lock_put_irqrestore(&free_calls_lock, context);
 
-    memcpy(call->priv_data, priv_data, priv_data_size);
+    return call;
+}
 
-    call->processed       = 0;
-    call->proc            = proc;
-    call->result          = 0;
-    call->cleanup_handler = cleanup_handler;
-    atomic_set(&call->ref_count, 2);    /* dispatcher + rt-procedure */
-    init_waitqueue_head(&call->call_wq);
 
-    rtdm_lock_get_irqsave(&pending_calls_lock, context);
-    list_add_tail(&call->list_entry, &pending_calls);
-    rtdm_lock_put_irqrestore(&pending_calls_lock, context);
 
-    rtdm_event_signal(&dispatch_event);
+/***
+ *  rtpc_alloc_call - get a call object (non-RT)
+ *  @priv_data_size: size of the private data
+ *  @wait: wait for a call of the pool if it is exhausted
+ *
+ *  Calls with more than RTPC_POOL_PRIV_SIZE bytes of private data are
+ *  allocated on demand. Returns NULL if the pool is exhausted and wait is
+ *  not set, or an ERR_PTR() on failure.
+ */
+static struct rt_proc_call *rtpc_alloc_call(size_t priv_data_size, int wait)
+{
+    struct rt_proc_call *call;
+
+
+    if (priv_data_size > RTPC_POOL_PRIV_SIZE) {
+        atomic_inc(&oversized_calls);
+
+        call = kmalloc(sizeof(struct rt_proc_call) + priv_data_size,
+                       GFP_KERNEL);
+        if (call == NULL)
+            return ERR_PTR(-ENOMEM);
 
-    if (timeout > 0) {
-        ret = wait_event_interruptible_timeout(call->call_wq,
-            call->processed, (timeout * HZ) / 1000);
-        if (ret == 0)
-            ret = -ETIME;
-    } else
-        ret = wait_event_interruptible(call->call_wq, call->processed);
-
-    if (ret >= 0) {
-        if (copy_back_handler != NULL)
-            copy_back_handler(call, priv_data);
-        ret = call->result;
+        call->pooled = 0;
+        return call;
     }
 
+    call = rtpc_take_free_call();
+    if ((call == NULL) && wait) {
+        atomic_inc(&pool_waits);
+
+        if (wait_event_interruptible(free_calls_wq,
+                (call = rtpc_take_free_call()) != NULL))
+            return ERR_PTR(-ERESTARTSYS);
+    }
+
+    return call;
+}
+
+
+
+static void rtpc_free_call(struct rt_proc_call *call)
+{
+    rtdm_lockctx_t  context;
+
+
+    if (!call->pooled) {
+        kfree(call);
+        return;
+    }
+
+    rtdm_lock_get_irqsave(&free_calls_lock, context);
+    list_add(&call->list_entry, &free_calls);
+    free_count++;
+    rtdm_lock_put_irqrestore(&free_calls_lock, context);
+
+    wake_up(&free_calls_wq);
+}
+
+
+
+/* drops a reference of the caller or the dispatcher (non-RT) */
+static void rtpc_put_call(struct rt_proc_call *call)
+{
     if (atomic_dec_and_test(&call->ref_count)) {
         if (call->cleanup_handler != NULL)
             call->cleanup_handler(&call->priv_data);
-        kfree(call);
+        rtpc_free_call(call);
+    }
+}
+
+
+
+static void rtpc_queue_pending_calls(struct rt_proc_call **calls,
+                                     unsigned int count)
+{
+    rtdm_lockctx_t  context;
+    nanosecs_abs_t  now = rtdm_clock_read();
+    unsigned int    i;
+
+
+    rtdm_lock_get_irqsave(&pending_calls_lock, context);
+    for (i = 0; i < count; i++) {
+        calls[i]->queued = now;
+        list_add_tail(&calls[i]->list_entry, &pending_calls);
     }
+    rtdm_lock_put_irqrestore(&pending_calls_lock, context);
+
+    rtdm_event_signal(&dispatch_event);
+}
+
+
+
+/* waits for a call being processed, returns a negative value on timeout or
+   signal */
+static long rtpc_wait_call(struct rt_proc_call *call, unsigned int timeout,
+                           unsigned long deadline)
+{
+    long ret;
+
+
+    if (timeout == 0)
+        return wait_event_interruptible(call->call_wq, call->processed);
+
+    ret = (long)(deadline - jiffies);
+    if (ret < 0)
+        ret = 0;
+
+    ret = wait_event_interruptible_timeout(call->call_wq, call->processed,
+                                           ret);
+    if (ret == 0)
+        ret = call->processed ? 1 : -ETIME;
 
     return ret;
 }
 
 
 
-static inline struct rt_proc_call *rtpc_dequeue_pending_call(void)
+/***
+ *  rtnet_rtpc_dispatch_calls - execute a procedure for an array of private
+ *                              data in the real-time dispatcher (non-RT)
+ *  @proc: procedure
+ *  @timeout: overall timeout in ms, 0 for infinite
+ *  @priv_data: array of count elements
+ *  @priv_data_size: size of one element
+ *  @count: number of calls
+ *  @copy_back_handler: called per element on completion
+ *  @cleanup_handler: called per element when the call is released
+ *
+ *  Calls are submitted in batches of up to RTPC_BATCH_CALLS, the dispatcher
+ *  processes each batch in one go. Submission stops at the first error.
+ *  Returns the result of the last call or the first error.
+ */
+int rtnet_rtpc_dispatch_calls(rtpc_proc proc, unsigned int timeout,
+                              void *priv_data, size_t priv_data_size,
+                              unsigned int count,
+                              rtpc_copy_back_proc copy_back_handler,
+                              rtpc_cleanup_proc cleanup_handler)
 {
-    rtdm_lockctx_t      context;
+    struct rt_proc_call *calls[RTPC_BATCH_CALLS];
     struct rt_proc_call *call = NULL;
+    char                *data = priv_data;
+    unsigned long       deadline = jiffies + (timeout * HZ) / 1000;
+    unsigned int        done = 0;
+    unsigned int        n, i;
+    long                wait;
+    int                 ret = 0;
+
+
+    while ((done < count) && (ret >= 0)) {
+        /* never wait for the pool while holding calls of this batch */
+        for (n = 0; (n < RTPC_BATCH_CALLS) && (done + n < count); n++) {
+            call = rtpc_alloc_call(priv_data_size, n == 0);
+            if ((call == NULL) || IS_ERR(call))
+                break;
+
+            memcpy(call->priv_data, data + (done + n) * priv_data_size,
+                   priv_data_size);
+
+            call->processed       = 0;
+            call->proc            = proc;
+            call->result          = 0;
+            call->cleanup_handler = cleanup_handler;
+            atomic_set(&call->ref_count, 2);    /* dispatcher + rt-procedure */
+            init_waitqueue_head(&call->call_wq);
+
+            calls[n] = call;
+        }
 
+        if (n == 0) {
+            ret = PTR_ERR(call);
+            break;
+        }
 
-    rtdm_lock_get_irqsave(&pending_calls_lock, context);
-    if (!list_empty(&pending_calls)) {
-        call = (struct rt_proc_call *)pending_calls.next;
-        list_del(&call->list_entry);
+        rtpc_queue_pending_calls(calls, n);
+
+        for (i = 0; i < n; i++) {
+            call = calls[i];
+
+            wait = rtpc_wait_call(call, timeout, deadline);
+            if (wait >= 0) {
+                if (copy_back_handler != NULL)
+                    copy_back_handler(call,
+                        data + (done + i) * priv_data_size);
+                if (ret >= 0)
+                    ret = call->result;
+            } else if (ret >= 0)
+                ret = wait;
+
+            rtpc_put_call(call);
+        }
+
+        done += n;
     }
-    rtdm_lock_put_irqrestore(&pending_calls_lock, context);
 
-    return call;
+    /* release the private data of calls not submitted */
+    if (cleanup_handler != NULL)
+        for (; done < count; done++)
+            cleanup_handler(data + done * priv_data_size);
+
+    return ret;
+}
+
+
+
+int rtnet_rtpc_dispatch_call(rtpc_proc proc, unsigned int timeout,
+                             void* priv_data, size_t priv_data_size,
+                             rtpc_copy_back_proc copy_back_handler,
+                             rtpc_cleanup_proc cleanup_handler)
+{
+    return rtnet_rtpc_dispatch_calls(proc, timeout, priv_data,
+                                     priv_data_size, 1, copy_back_handler,
+                                     cleanup_handler);
+}
+
+
+
+static inline void rtpc_dequeue_pending_calls(struct list_head *batch)
+{
+    rtdm_lockctx_t  context;
+
+
+    rtdm_lock_get_irqsave(&pending_calls_lock, context);
+    list_splice_init(&pending_calls, batch);
+    rtdm_lock_put_irqrestore(&pending_calls_lock, context);
 }
 
 
@@ -188,18 +395,48 @@ static inline struct rt_proc_call *rtpc_dequeue_processed_call(void)
 
 
 
+static inline void rtpc_account_latency(nanosecs_rel_t latency)
+{
+    if ((dispatched_calls == 0) || (latency < latency_min))
+        latency_min = latency;
+    if (latency > latency_max)
+        latency_max = latency;
+    latency_sum += latency;
+    dispatched_calls++;
+}
+
+
+
 static void rtpc_dispatch_handler(void *arg)
 {
     struct rt_proc_call *call;
+    struct list_head    batch;
+    nanosecs_abs_t      now;
     int                 ret;
 
 
-    while (rtdm_event_wait(&dispatch_event) == 0)
-        while ((call = rtpc_dequeue_pending_call())) {
+    INIT_LIST_HEAD(&batch);
+
+    while (rtdm_event_wait(&dispatch_event) == 0) {
+        /* take over all pending calls at once */
+        rtpc_dequeue_pending_calls(&batch);
+        if (list_empty(&batch))
+            continue;
+
+        dispatcher_wakeups++;
+        now = rtdm_clock_read();
+
+        while (!list_empty(&batch)) {
+            call = list_entry(batch.next, struct rt_proc_call, list_entry);
+            list_del(&call->list_entry);
+
+            rtpc_account_latency(now - call->queued);
+
             ret = call->proc(call);
             if (ret != -CALL_PENDING)
                 rtpc_complete_call(call, ret);
         }
+    }
 }
 
 
@@ -213,11 +450,7 @@ static void rtpc_signal_handler(rtdm_nrtsig_t nrt_sig, void *arg)
         call->processed = 1;
         wake_up(&call->call_wq);
 
-        if (atomic_dec_and_test(&call->ref_count)) {
-            if (call->cleanup_handler != NULL)
-                call->cleanup_handler(&call->priv_data);
-            kfree(call);
-        }
+        rtpc_put_call(call);
     }
 }
 
@@ -239,23 +472,75 @@ void rtnet_rtpc_complete_call_nrt(struct rt_proc_call *call, int result)
     call->processed = 1;
     wake_up(&call->call_wq);
 
-    if (atomic_dec_and_test(&call->ref_count)) {
-        if (call->cleanup_handler != NULL)
-            call->cleanup_handler(&call->priv_data);
-        kfree(call);
-    }
+    rtpc_put_call(call);
+}
+
+
+
+#ifdef CONFIG_PROC_FS
+static int rtpc_proc_show(struct seq_file *p, void *data)
+{
+    u64 latency_avg = latency_sum;
+
+
+    if (dispatched_calls > 0)
+        do_div(latency_avg, dispatched_calls);
+
+    seq_printf(p, "call pool\t\t%u of %u free\n"
+               "pool exhausted\t\t%d\n"
+               "oversized calls\t\t%d\n"
+               "dispatched calls\t%lu\n"
+               "dispatcher wakeups\t%lu\n"
+               "latency (ns)\t\tmin %lld avg %llu max %lld\n",
+               free_count, rtpc_calls,
+               atomic_read(&pool_waits), atomic_read(&oversized_calls),
+               dispatched_calls, dispatcher_wakeups,
+               (long long)latency_min, (unsigned long long)latency_avg,
+               (long long)latency_max);
+
+    return 0;
+}
+
+static int rtpc_proc_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, rtpc_proc_show, NULL);
 }
 
+static const struct file_operations rtpc_proc_fops = {
+    .open       = rtpc_proc_open,
+    .read       = seq_read,
+    .llseek     = seq_lseek,
+    .release    = single_release,
+};
+#endif /* CONFIG_PROC_FS */
+
 
 
 int __init rtpc_init(void)
 {
-    int ret;
+    struct rt_proc_call *call;
+    unsigned int        i;
+    int                 ret;
 
 
+    if (rtpc_calls == 0)
+        rtpc_calls = 1;
+
+    call_pool = kmalloc(rtpc_calls * RTPC_POOL_CALL_SIZE, GFP_KERNEL);
+    if (call_pool == NULL)
+        return -ENOMEM;
+
+    for (i = 0; i < rtpc_calls; i++) {
+        call = (struct rt_proc_call *)
+            ((char *)call_pool + i * RTPC_POOL_CALL_SIZE);
+        call->pooled = 1;
+        list_add_tail(&call->list_entry, &free_calls);
+    }
+    free_count = rtpc_calls;
+
     ret = rtdm_nrtsig_init(&rtpc_nrt_signal, rtpc_signal_handler, NULL);
     if (ret < 0)
-        return ret;
+        goto err_free_pool;
 
     rtdm_event_init(&dispatch_event, 0);
 
@@ -264,8 +549,18 @@ int __init rtpc_init(void)
     if (ret < 0) {
         rtdm_event_destroy(&dispatch_event);
         rtdm_nrtsig_destroy(&rtpc_nrt_signal);
+        goto err_free_pool;
     }
 
+#ifdef CONFIG_PROC_FS
+    if (proc_create("rtpc", S_IRUGO, rtnet_proc_root, &rtpc_proc_fops) == NULL)
+        printk("RTnet: unable to initialize /proc/rtnet/rtpc\n");
+#endif
+
+    return 0;
+
+  err_free_pool:
+    kfree(call_pool);
     return ret;
 }
 
@@ -273,12 +568,19 @@ int __init rtpc_init(void)
 
 void rtpc_cleanup(void)
 {
+#ifdef CONFIG_PROC_FS
+    remove_proc_entry("rtpc", rtnet_proc_root);
+#endif
+
     rtdm_event_destroy(&dispatch_event);
     rtdm_task_join_nrt(&dispatch_task, 100);
     rtdm_nrtsig_destroy(&rtpc_nrt_signal);
+
+    kfree(call_pool);
 }
 
 
 EXPORT_SYMBOL(rtnet_rtpc_dispatch_call);
+EXPORT_SYMBOL(rtnet_rtpc_dispatch_calls);
 EXPORT_SYMBOL(rtnet_rtpc_complete_call);
 EXPORT_SYMBOL(rtnet_rtpc_complete_call_nrt);
@@ -153,22 +153,11 @@ EXPORT_SYMBOL(rtskb_under_panic);
 
 
 /***
- *  alloc_rtskb - allocate an rtskb from a pool
- *  @size: required buffer size (to check against maximum boundary)
- *  @pool: pool to take the rtskb from
+ *  rtskb_setup - prepare a freshly allocated rtskb
  */
-struct rtskb *alloc_rtskb(unsigned int size, struct rtskb_queue *pool)
+static inline void rtskb_setup(struct rtskb *skb, unsigned int size)
 {
-    struct rtskb *skb;
-
-
-    RTNET_ASSERT(size <= SKB_DATA_ALIGN(RTSKB_SIZE), return NULL;);
-
-    skb = rtskb_dequeue(pool);
-    if (!skb)
-        return NULL;
 #ifdef CONFIG_RTNET_CHECKED
-    pool->pool_balance--;
     skb->chain_len = 1;
 #endif
 
@@ -181,11 +170,36 @@ struct rtskb *alloc_rtskb(unsigned int size, struct rtskb_queue *pool)
     skb->chain_end = skb;
     skb->len = 0;
     skb->pkt_type = PACKET_HOST;
+    skb->gso_size = 0;
+    atomic_set(&skb->users, 1);
     skb->xmit_stamp = NULL;
 
 #ifdef CONFIG_RTNET_ADDON_RTCAP
     skb->cap_flags = 0;
 #endif
+}
+
+
+/***
+ *  alloc_rtskb - allocate an rtskb from a pool
+ *  @size: required buffer size (to check against maximum boundary)
+ *  @pool: pool to take the rtskb from
+ */
+struct rtskb *alloc_rtskb(unsigned int size, struct rtskb_queue *pool)
+{
+    struct rtskb *skb;
+
+
+    RTNET_ASSERT(size <= SKB_DATA_ALIGN(RTSKB_SIZE), return NULL;);
+
+    skb = rtskb_dequeue(pool);
+    if (!skb)
+        return NULL;
+#ifdef CONFIG_RTNET_CHECKED
+    pool->pool_balance--;
+#endif
+
+    rtskb_setup(skb, size);
 
     return skb;
 }
@@ -193,6 +207,64 @@ struct rtskb *alloc_rtskb(unsigned int size, struct rtskb_queue *pool)
 EXPORT_SYMBOL(alloc_rtskb);
 
 
+/***
+ *  alloc_rtskbs - allocate a batch of rtskbs from a pool
+ *  @size:  required buffer size of each rtskb
+ *  @count: number of rtskbs
+ *  @pool:  pool to take the rtskbs from
+ *  @batch: queue to append the rtskbs to (not locked)
+ *
+ *  Either all or none of the requested rtskbs are taken from the pool.
+ *  Returns 0 or -ENOBUFS.
+ */
+int alloc_rtskbs(unsigned int size, unsigned int count,
+                 struct rtskb_queue *pool, struct rtskb_queue *batch)
+{
+    struct rtskb    *first;
+    struct rtskb    *last;
+    struct rtskb    *skb;
+    unsigned int    i;
+    rtdm_lockctx_t  context;
+
+
+    RTNET_ASSERT(size <= SKB_DATA_ALIGN(RTSKB_SIZE), return -EINVAL;);
+
+    if (count == 0)
+        return 0;
+
+    rtdm_lock_get_irqsave(&pool->lock, context);
+
+    first = last = pool->first;
+    for (i = 1; (i < count) && (last != NULL); i++)
+        last = last->next;
+
+    if (last == NULL) {
+        rtdm_lock_put_irqrestore(&pool->lock, context);
+        return -ENOBUFS;
+    }
+
+    pool->first = last->next;
+    last->next  = NULL;
+#ifdef CONFIG_RTNET_CHECKED
+    pool->pool_balance -= count;
+#endif
+
+    rtdm_lock_put_irqrestore(&pool->lock, context);
+
+    while (first != NULL) {
+        skb   = first;
+        first = skb->next;
+
+        rtskb_setup(skb, size);
+        __rtskb_queue_tail(batch, skb);
+    }
+
+    return 0;
+}
+
+EXPORT_SYMBOL(alloc_rtskbs);
+
+
 /***
  *  kfree_rtskb
  *  @skb    rtskb
@@ -210,6 +282,11 @@ void kfree_rtskb(struct rtskb *skb)
     RTNET_ASSERT(skb != NULL, return;);
     RTNET_ASSERT(skb->pool != NULL, return;);
 
+    /* someone else still holds a reference */
+    if (atomic_read(&skb->users) != 1 &&
+        !atomic_dec_and_test(&skb->users))
+        return;
+
 #ifdef CONFIG_RTNET_ADDON_RTCAP
     next_skb  = skb;
     chain_end = skb->chain_end;
@@ -327,6 +404,7 @@ unsigned int rtskb_pool_extend(struct rtskb_queue *pool,
 
         skb->chain_end = skb;
         skb->pool = pool;
+        atomic_set(&skb->users, 1);
         skb->buf_start = ((unsigned char *)skb) + ALIGN_RTSKB_STRUCT_LEN;
 #ifdef CONFIG_RTNET_CHECKED
         skb->buf_end = skb->buf_start + SKB_DATA_ALIGN(RTSKB_SIZE) - 1;
@@ -23,13 +23,17 @@
  *
  */
 
+#include <linux/mman.h>
 #include <linux/moduleparam.h>
+#include <linux/slab.h>
 #include <linux/spinlock.h>
+#include <linux/vmalloc.h>
 #include <linux/socket.h>
 #include <linux/in.h>
 #include <linux/ip.h>
 #include <linux/tcp.h>
 #include <asm/bitops.h>
+#include <asm/div64.h>
 
 #include <rtnet.h>
 #include <rtnet_internal.h>
@@ -40,7 +44,12 @@
 
 #define SKB_POOL_CLOSED     RTDM_USER_CONTEXT_FLAG + 0
 
-static unsigned int socket_rtskbs = DEFAULT_SOCKET_RTSKBS;
+#ifndef SO_TIMESTAMPNS
+#define SO_TIMESTAMPNS      35
+#define SCM_TIMESTAMPNS     SO_TIMESTAMPNS
+#endif
+
+unsigned int socket_rtskbs = DEFAULT_SOCKET_RTSKBS;
 module_param(socket_rtskbs, uint, 0444);
 MODULE_PARM_DESC(socket_rtskbs, "Default number of realtime socket buffers in socket pools");
 
@@ -71,10 +80,17 @@ int rt_socket_init(struct rtdm_dev_context *sockctx, unsigned short protocol)
 
 
     sock->callback_func = NULL;
+    sock->rx_ring       = NULL;
+    sock->tx_ring       = NULL;
 
     rtskb_queue_init(&sock->incoming);
+    atomic_set(&sock->rx_queued, 0);
+    sock->rx_limit  = 0;
+    sock->rx_policy = RTNET_RXQ_DROP_NEWEST;
+    memset(&sock->stats, 0, sizeof(sock->stats));
 
     sock->timeout = 0;
+    sock->options = 0;
 
     rtdm_lock_init(&sock->param_lock);
     rtdm_sem_init(&sock->pending_sem, 0);
@@ -100,6 +116,9 @@ int rt_socket_init(struct rtdm_dev_context *sockctx, unsigned short protocol)
 
 
 
+static void rt_socket_ring_release(struct rtsocket *sock,
+                                   struct rtsocket_ring **slot);
+
 /***
  *  rt_socket_cleanup - releases resources allocated for the socket
  */
@@ -124,6 +143,15 @@ int rt_socket_cleanup(struct rtdm_dev_context *sockctx)
             rtskb_pool_release(&sock->skb_pool);
     }
 
+    /* Received datagrams hold buffers of the socket pool while they are
+       stored in a ring. Only a drained pool guarantees that no receiver
+       still uses the rings, so the real-time side never drops the last
+       reference of a ring. */
+    if (ret == 0) {
+        rt_socket_ring_release(sock, &sock->rx_ring);
+        rt_socket_ring_release(sock, &sock->tx_ring);
+    }
+
     mutex_unlock(&sock->pool_nrt_lock);
 
     return ret;
@@ -141,6 +169,8 @@ int rt_socket_common_ioctl(struct rtdm_dev_context *sockctx,
     struct rtsocket         *sock = (struct rtsocket *)&sockctx->dev_private;
     int                     ret = 0;
     struct rtnet_callback   *callback = arg;
+    struct rtnet_rx_limit   *limit = arg;
+    struct rtnet_sock_stats *stats = arg;
     unsigned int            rtskbs;
     rtdm_lockctx_t          context;
 
@@ -206,6 +236,30 @@ int rt_socket_common_ioctl(struct rtdm_dev_context *sockctx,
 
             break;
 
+        case RTNET_RTIOC_RXLIMIT:
+            if (limit->policy > RTNET_RXQ_DROP_OLDEST)
+                return -EINVAL;
+
+            rtdm_lock_get_irqsave(&sock->param_lock, context);
+
+            sock->rx_limit  = limit->depth;
+            sock->rx_policy = limit->policy;
+
+            rtdm_lock_put_irqrestore(&sock->param_lock, context);
+            break;
+
+        case RTNET_RTIOC_SOCKSTATS:
+            rtdm_lock_get_irqsave(&sock->param_lock, context);
+
+            stats->received      = sock->stats.received;
+            stats->dropped_full  = sock->stats.dropped_full;
+            stats->dropped_nobuf = sock->stats.dropped_nobuf;
+
+            rtdm_lock_put_irqrestore(&sock->param_lock, context);
+
+            stats->queued = atomic_read(&sock->rx_queued);
+            break;
+
         default:
             ret = -EOPNOTSUPP;
             break;
@@ -305,6 +359,530 @@ int rt_socket_if_ioctl(struct rtdm_dev_context *sockctx,
 }
 
 
+/***
+ *  rt_socket_queue_rx - queues a received packet, applying the queue limit
+ *
+ *  Returns NULL if the packet was queued without loss. Otherwise, the
+ *  returned packet was dropped - either skb itself or, with
+ *  RTNET_RXQ_DROP_OLDEST, the longest waiting one - and has to be released
+ *  by the caller.
+ */
+struct rtskb *rt_socket_queue_rx(struct rtsocket *sock, struct rtskb *skb)
+{
+    unsigned int    limit = sock->rx_limit;
+
+
+    if ((limit > 0) && (atomic_read(&sock->rx_queued) >= limit)) {
+        if (sock->rx_policy != RTNET_RXQ_DROP_OLDEST)
+            return skb;
+
+        /* A successful non-blocking down leaves us with an entry no reader
+         * has claimed yet, so the dequeue cannot come up empty. If all
+         * entries are already claimed, they are about to leave the queue
+         * anyway. The oldest entry leaves before the new one is signalled,
+         * so the queue never exceeds the limit and the semaphore never
+         * counts more entries than the queue holds. */
+        if (rtdm_sem_timeddown(&sock->pending_sem, RTDM_TIMEOUT_NONE,
+                               NULL) == 0) {
+            struct rtskb *oldest = rtskb_dequeue_chain(&sock->incoming);
+
+            rtskb_queue_tail(&sock->incoming, skb);
+            rtdm_sem_up(&sock->pending_sem);
+
+            return oldest;
+        }
+    }
+
+    rtskb_queue_tail(&sock->incoming, skb);
+    atomic_inc(&sock->rx_queued);
+    rtdm_sem_up(&sock->pending_sem);
+
+    return NULL;
+}
+
+
+
+/***
+ *  rt_socket_common_setsockopt - SOL_SOCKET options shared by all sockets
+ */
+int rt_socket_common_setsockopt(struct rtsocket *sock, int optname,
+                                const void *optval, socklen_t optlen)
+{
+    rtdm_lockctx_t  context;
+
+
+    if (optlen < sizeof(unsigned int))
+        return -EINVAL;
+
+    switch (optname) {
+        case SO_TIMESTAMPNS:
+            rtdm_lock_get_irqsave(&sock->param_lock, context);
+            if (*(unsigned int *)optval)
+                sock->options |= RT_SOCK_TIMESTAMPNS;
+            else
+                sock->options &= ~RT_SOCK_TIMESTAMPNS;
+            rtdm_lock_put_irqrestore(&sock->param_lock, context);
+            return 0;
+
+        default:
+            return -ENOPROTOOPT;
+    }
+}
+
+
+
+/***
+ *  rt_socket_common_getsockopt
+ */
+int rt_socket_common_getsockopt(struct rtsocket *sock, int optname,
+                                void *optval, socklen_t *optlen)
+{
+    if (*optlen < sizeof(unsigned int))
+        return -EINVAL;
+
+    switch (optname) {
+        case SO_TIMESTAMPNS:
+            *(unsigned int *)optval = !!(sock->options & RT_SOCK_TIMESTAMPNS);
+            *optlen = sizeof(unsigned int);
+            return 0;
+
+        default:
+            return -ENOPROTOOPT;
+    }
+}
+
+
+
+/***
+ *  rt_socket_recv_timestamp - attaches the reception time to a message
+ *  @sock:       receiving socket
+ *  @user_info:  caller, NULL for kernel users
+ *  @msg:        message to be returned
+ *  @stamp:      arrival time of the data (rtskb time_stamp)
+ *
+ *  Delivers an SCM_TIMESTAMPNS control message if the socket requested it
+ *  via SO_TIMESTAMPNS and updates msg_controllen, setting MSG_CTRUNC if the
+ *  control buffer is too small or cannot be written. The data has already
+ *  been consumed at this point, thus a faulty control buffer must not fail
+ *  the reception.
+ */
+void rt_socket_recv_timestamp(struct rtsocket *sock,
+                             rtdm_user_info_t *user_info,
+                             struct msghdr *msg, nanosecs_abs_t stamp)
+{
+    union {
+        struct cmsghdr  hdr;
+        char            buf[CMSG_SPACE(sizeof(struct timespec))];
+    } cmsg;
+    struct timespec     *ts = (struct timespec *)CMSG_DATA(&cmsg.hdr);
+    size_t              len = CMSG_SPACE(sizeof(struct timespec));
+
+
+    if (!(sock->options & RT_SOCK_TIMESTAMPNS)) {
+        msg->msg_controllen = 0;
+        return;
+    }
+
+    if (!msg->msg_control || (msg->msg_controllen < len))
+        goto truncated;
+
+    memset(&cmsg, 0, sizeof(cmsg));
+    cmsg.hdr.cmsg_len   = CMSG_LEN(sizeof(struct timespec));
+    cmsg.hdr.cmsg_level = SOL_SOCKET;
+    cmsg.hdr.cmsg_type  = SCM_TIMESTAMPNS;
+    ts->tv_nsec = do_div(stamp, 1000000000);
+    ts->tv_sec  = stamp;
+
+    if (user_info) {
+        if (!rtdm_rw_user_ok(user_info, msg->msg_control, len) ||
+            rtdm_copy_to_user(user_info, msg->msg_control, &cmsg, len))
+            goto truncated;
+    } else
+        memcpy(msg->msg_control, &cmsg, len);
+
+    msg->msg_controllen = len;
+    return;
+
+  truncated:
+    msg->msg_flags     |= MSG_CTRUNC;
+    msg->msg_controllen = 0;
+}
+
+
+
+/************************************************************************
+ *  memory-mapped receive and transmit rings                            *
+ ************************************************************************/
+
+static inline struct rtnet_ring_frame *
+rt_socket_ring_frame(struct rtsocket_ring *ring, unsigned int index)
+{
+    return (struct rtnet_ring_frame *)
+        ((char *)ring->buf + index * ring->frame_size);
+}
+
+
+
+void rt_socket_ring_put(struct rtsocket_ring *ring)
+{
+    if (atomic_dec_and_test(&ring->refs)) {
+        vfree(ring->buf);
+        kfree(ring);
+    }
+}
+
+
+
+static void rt_socket_ring_vm_open(struct vm_area_struct *vma)
+{
+    struct rtsocket_ring *ring = vma->vm_private_data;
+
+    atomic_inc(&ring->refs);
+}
+
+
+
+static void rt_socket_ring_vm_close(struct vm_area_struct *vma)
+{
+    rt_socket_ring_put(vma->vm_private_data);
+}
+
+
+
+static struct vm_operations_struct rt_socket_ring_vm_ops = {
+    .open   = rt_socket_ring_vm_open,
+    .close  = rt_socket_ring_vm_close,
+};
+
+
+
+/***
+ *  rt_socket_ring_setup - attaches a ring and maps it to user space
+ *
+ *  The ring stays valid until the socket is closed and the last mapping of
+ *  it is gone.
+ */
+static int rt_socket_ring_setup(struct rtdm_dev_context *sockctx,
+                                rtdm_user_info_t *user_info,
+                                struct rtnet_ring_req *ureq,
+                                struct rtsocket_ring **slot)
+{
+    struct rtsocket         *sock = (struct rtsocket *)&sockctx->dev_private;
+    struct rtsocket_ring    *ring;
+    struct rtnet_ring_req   req;
+    rtdm_lockctx_t          context;
+    int                     ret;
+
+
+    if (rtdm_in_rt_context())
+        return -ENOSYS;
+
+    /* the ring can only be mapped into a user process */
+    if (!user_info)
+        return -EINVAL;
+
+    if (!rtdm_rw_user_ok(user_info, ureq, sizeof(req)) ||
+        rtdm_copy_from_user(user_info, &req, ureq, sizeof(req)))
+        return -EFAULT;
+
+    if ((req.frame_size <= RTNET_RING_HDRLEN) ||
+        (req.frame_size > 0xFFFF) ||
+        (req.frame_size % RTNET_RING_ALIGN) ||
+        (req.frame_nr == 0) || (req.frame_nr > INT_MAX / req.frame_size))
+        return -EINVAL;
+
+    ring = kmalloc(sizeof(struct rtsocket_ring), GFP_KERNEL);
+    if (!ring)
+        return -ENOMEM;
+
+    ring->size = PAGE_ALIGN(req.frame_size * req.frame_nr);
+    ring->buf  = vmalloc(ring->size);
+    if (!ring->buf) {
+        kfree(ring);
+        return -ENOMEM;
+    }
+    /* frames start owned by the stack (rx) or by the application (tx) */
+    memset(ring->buf, 0, ring->size);
+
+    ring->frame_size = req.frame_size;
+    ring->frame_nr   = req.frame_nr;
+    ring->head       = 0;
+    rtdm_lock_init(&ring->lock);
+    rtdm_event_init(&ring->event, 0);
+    atomic_set(&ring->refs, 2);     /* socket + initial mapping */
+
+    mutex_lock(&sock->pool_nrt_lock);
+
+    if (test_bit(SKB_POOL_CLOSED, &sockctx->context_flags)) {
+        ret = -EBADF;
+        goto err_unlock;
+    }
+    if (*slot) {
+        ret = -EBUSY;
+        goto err_unlock;
+    }
+
+    ret = rtdm_mmap_to_user(user_info, ring->buf, ring->size,
+                            PROT_READ | PROT_WRITE, &req.addr,
+                            &rt_socket_ring_vm_ops, ring);
+    if (ret < 0)
+        goto err_unlock;
+
+    rtdm_lock_get_irqsave(&sock->param_lock, context);
+    *slot = ring;
+    rtdm_lock_put_irqrestore(&sock->param_lock, context);
+
+    mutex_unlock(&sock->pool_nrt_lock);
+
+    if (rtdm_copy_to_user(user_info, &ureq->addr, &req.addr,
+                          sizeof(req.addr)))
+        return -EFAULT;
+
+    return 0;
+
+ err_unlock:
+    mutex_unlock(&sock->pool_nrt_lock);
+
+    rtdm_event_destroy(&ring->event);
+    vfree(ring->buf);
+    kfree(ring);
+
+    return ret;
+}
+
+
+
+/***
+ *  rt_socket_rxring_setup - attaches a receive ring to the socket
+ *
+ *  Datagrams that are already queued remain available to recvmsg.
+ */
+int rt_socket_rxring_setup(struct rtdm_dev_context *sockctx,
+                           rtdm_user_info_t *user_info,
+                           struct rtnet_ring_req *ureq)
+{
+    struct rtsocket *sock = (struct rtsocket *)&sockctx->dev_private;
+
+    return rt_socket_ring_setup(sockctx, user_info, ureq, &sock->rx_ring);
+}
+
+
+
+/***
+ *  rt_socket_txring_setup - attaches a transmit ring to the socket
+ */
+int rt_socket_txring_setup(struct rtdm_dev_context *sockctx,
+                           rtdm_user_info_t *user_info,
+                           struct rtnet_ring_req *ureq)
+{
+    struct rtsocket *sock = (struct rtsocket *)&sockctx->dev_private;
+
+    return rt_socket_ring_setup(sockctx, user_info, ureq, &sock->tx_ring);
+}
+
+
+
+/***
+ *  rt_socket_ring_release - detaches a ring from a closing socket
+ *
+ *  Called with pool_nrt_lock held.
+ */
+static void rt_socket_ring_release(struct rtsocket *sock,
+                                   struct rtsocket_ring **slot)
+{
+    struct rtsocket_ring    *ring;
+    rtdm_lockctx_t          context;
+
+
+    rtdm_lock_get_irqsave(&sock->param_lock, context);
+    ring = *slot;
+    *slot = NULL;
+    rtdm_lock_put_irqrestore(&sock->param_lock, context);
+
+    if (ring) {
+        /* wakes up all waiters with -EIDRM */
+        rtdm_event_destroy(&ring->event);
+        rt_socket_ring_put(ring);
+    }
+}
+
+
+
+/***
+ *  rt_socket_ring_get - references a ring of the socket, NULL if unset
+ */
+struct rtsocket_ring *rt_socket_ring_get(struct rtsocket *sock,
+                                         struct rtsocket_ring **slot)
+{
+    struct rtsocket_ring    *ring;
+    rtdm_lockctx_t          context;
+
+
+    rtdm_lock_get_irqsave(&sock->param_lock, context);
+    ring = *slot;
+    if (ring)
+        atomic_inc(&ring->refs);
+    rtdm_lock_put_irqrestore(&sock->param_lock, context);
+
+    return ring;
+}
+
+
+
+/***
+ *  rt_socket_rxring_wait - waits until a ring frame holds a datagram
+ */
+int rt_socket_rxring_wait(struct rtsocket *sock, unsigned int index)
+{
+    struct rtsocket_ring    *ring;
+    struct rtnet_ring_frame *frame;
+    int                     ret = 0;
+
+
+    ring = rt_socket_ring_get(sock, &sock->rx_ring);
+    if (!ring)
+        return -EINVAL;
+
+    if (index >= ring->frame_nr) {
+        ret = -EINVAL;
+        goto out;
+    }
+
+    frame = rt_socket_ring_frame(ring, index);
+
+    /* the event may carry stale signals, so re-check after each wakeup */
+    while (!(frame->status & RTNET_RING_USER)) {
+        ret = rtdm_event_timedwait(&ring->event, sock->timeout, NULL);
+        if (ret < 0) {
+            if (ret == -EIDRM)
+                ret = -EBADF;   /* socket has been closed */
+            break;
+        }
+    }
+
+ out:
+    rt_socket_ring_put(ring);
+    return ret;
+}
+
+
+
+/***
+ *  rt_socket_rxring_put - stores a received datagram in the ring
+ *  @ring:       receive ring, referenced by the caller
+ *  @skb:        datagram (chain), data pointing to the payload
+ *  @len:        payload length across the chain
+ *  @addr:       source address to report
+ *  @addr_len:   length of the source address
+ *
+ *  The rtskb is not consumed. Returns -ENOBUFS if the next frame is still
+ *  owned by the application, i.e. the ring is full.
+ */
+int rt_socket_rxring_put(struct rtsocket_ring *ring, struct rtskb *skb,
+                         unsigned int len, const void *addr,
+                         unsigned int addr_len)
+{
+    struct rtnet_ring_frame *frame;
+    unsigned char           *dest;
+    unsigned int            data, snaplen, copied, block_size;
+    rtdm_lockctx_t          context;
+
+
+    data = RTNET_RING_HDRLEN + RTNET_RING_ALIGN_LEN(addr_len);
+    if (data > ring->frame_size)
+        return -EINVAL;
+
+    /* concurrent senders may deliver via the loopback device */
+    rtdm_lock_get_irqsave(&ring->lock, context);
+
+    frame = rt_socket_ring_frame(ring, ring->head);
+    if (frame->status != RTNET_RING_KERNEL) {
+        rtdm_lock_put_irqrestore(&ring->lock, context);
+        return -ENOBUFS;
+    }
+
+    snaplen = min(len, ring->frame_size - data);
+    frame->stamp = skb->time_stamp;
+
+    dest = (unsigned char *)frame + data;
+    for (copied = 0; (copied < snaplen) && skb; skb = skb->next) {
+        block_size = min(skb->len, snaplen - copied);
+        memcpy(dest + copied, skb->data, block_size);
+        copied += block_size;
+    }
+
+    memcpy(frame + 1, addr, addr_len);
+    frame->len      = len;
+    frame->snaplen  = copied;
+    frame->data     = data;
+    frame->addr_len = addr_len;
+
+    if (++ring->head == ring->frame_nr)
+        ring->head = 0;
+
+    /* publish the frame contents before handing it over */
+    smp_wmb();
+    frame->status = (copied < len) ?
+        RTNET_RING_USER | RTNET_RING_TRUNC : RTNET_RING_USER;
+
+    rtdm_lock_put_irqrestore(&ring->lock, context);
+
+    rtdm_event_signal(&ring->event);
+
+    return 0;
+}
+
+
+
+/***
+ *  rt_socket_txring_claim - takes the next frame marked for transmission
+ *
+ *  Returns NULL if the next frame in line is not marked RTNET_RING_SEND.
+ *  The frame is owned by the caller until rt_socket_txring_complete().
+ */
+struct rtnet_ring_frame *rt_socket_txring_claim(struct rtsocket_ring *ring)
+{
+    struct rtnet_ring_frame *frame;
+    rtdm_lockctx_t          context;
+
+
+    rtdm_lock_get_irqsave(&ring->lock, context);
+
+    frame = rt_socket_ring_frame(ring, ring->head);
+    if (frame->status != RTNET_RING_SEND) {
+        rtdm_lock_put_irqrestore(&ring->lock, context);
+        return NULL;
+    }
+
+    frame->status = RTNET_RING_SENDING;
+    if (++ring->head == ring->frame_nr)
+        ring->head = 0;
+
+    rtdm_lock_put_irqrestore(&ring->lock, context);
+
+    /* read the frame contents only after having seen its status */
+    smp_rmb();
+
+    return frame;
+}
+
+
+
+/***
+ *  rt_socket_txring_complete - hands a claimed frame back to the application
+ *  @frame:      frame returned by rt_socket_txring_claim()
+ *  @err:        0 if the frame was passed to the device, negative otherwise
+ */
+void rt_socket_txring_complete(struct rtnet_ring_frame *frame, int err)
+{
+    frame->stamp = rtdm_clock_read();
+
+    smp_wmb();
+    frame->status = (err < 0) ? RTNET_RING_ERROR : RTNET_RING_AVAILABLE;
+}
+
+
+
 #ifdef CONFIG_RTNET_SELECT_SUPPORT
 int rt_socket_select_bind(struct rtdm_dev_context *context,
                           rtdm_selector_t *selector,
@@ -329,7 +907,20 @@ EXPORT_SYMBOL(rt_socket_select_bind);
 
 
 
+EXPORT_SYMBOL(socket_rtskbs);
 EXPORT_SYMBOL(rt_socket_init);
 EXPORT_SYMBOL(rt_socket_cleanup);
 EXPORT_SYMBOL(rt_socket_common_ioctl);
 EXPORT_SYMBOL(rt_socket_if_ioctl);
+EXPORT_SYMBOL(rt_socket_queue_rx);
+EXPORT_SYMBOL(rt_socket_common_setsockopt);
+EXPORT_SYMBOL(rt_socket_common_getsockopt);
+EXPORT_SYMBOL(rt_socket_recv_timestamp);
+EXPORT_SYMBOL(rt_socket_rxring_setup);
+EXPORT_SYMBOL(rt_socket_rxring_wait);
+EXPORT_SYMBOL(rt_socket_rxring_put);
+EXPORT_SYMBOL(rt_socket_txring_setup);
+EXPORT_SYMBOL(rt_socket_txring_claim);
+EXPORT_SYMBOL(rt_socket_txring_complete);
+EXPORT_SYMBOL(rt_socket_ring_get);
+EXPORT_SYMBOL(rt_socket_ring_put);
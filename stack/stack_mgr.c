@@ -46,6 +46,9 @@ struct list_head    rt_packets_all;
 #endif /* CONFIG_RTNET_ETH_P_ALL */
 rtdm_lock_t         rt_packets_lock = RTDM_LOCK_UNLOCKED;
 
+/* handlers waiting for the end of the current burst, manager task only */
+static struct rtpacket_type *rt_flush_list;
+
 
 /***
  *  rtdev_add_pack:         add protocol (Layer 3)
@@ -57,7 +60,8 @@ int rtdev_add_pack(struct rtpacket_type *pt)
     rtdm_lockctx_t          context;
 
     INIT_LIST_HEAD(&pt->list_entry);
-    pt->refcount = 0;
+    pt->refcount      = 0;
+    pt->flush_pending = 0;
 
     rtdm_lock_get_irqsave(&rt_packets_lock, context);
 
@@ -206,6 +210,57 @@ EXPORT_SYMBOL_GPL(rt_stack_deliver);
 #endif /* CONFIG_RTNET_DRV_LOOPBACK */
 
 
+/***
+ *  rt_stack_request_flush - schedule the flush_handler of a packet type
+ *  @pt: packet type, must provide a flush_handler
+ *
+ *  The handler is invoked once the stack manager has drained its receive
+ *  queue, e.g. to pass packets collected during the burst on as one batch.
+ *  Note: may only be called from a handler running in the stack manager
+ *  context, i.e. not for packets delivered directly by the loopback driver.
+ */
+void rt_stack_request_flush(struct rtpacket_type *pt)
+{
+    rtdm_lockctx_t          context;
+
+
+    if (pt->flush_pending)
+        return;
+
+    /* keep the packet type registered until it is flushed */
+    rtdm_lock_get_irqsave(&rt_packets_lock, context);
+    pt->refcount++;
+    rtdm_lock_put_irqrestore(&rt_packets_lock, context);
+
+    pt->flush_pending = 1;
+    pt->flush_next    = rt_flush_list;
+    rt_flush_list     = pt;
+}
+
+EXPORT_SYMBOL(rt_stack_request_flush);
+
+
+
+static void rt_stack_flush(void)
+{
+    struct rtpacket_type    *pt;
+    rtdm_lockctx_t          context;
+
+
+    while ((pt = rt_flush_list) != NULL) {
+        rt_flush_list     = pt->flush_next;
+        pt->flush_pending = 0;
+
+        pt->flush_handler(pt);
+
+        rtdm_lock_get_irqsave(&rt_packets_lock, context);
+        pt->refcount--;
+        rtdm_lock_put_irqrestore(&rt_packets_lock, context);
+    }
+}
+
+
+
 static void rt_stack_mgr_task(void *arg)
 {
     rtdm_event_t            *mgr_event = &((struct rtnet_mgr *)arg)->event;
@@ -216,6 +271,9 @@ static void rt_stack_mgr_task(void *arg)
         /* we are the only reader => no locking required */
         while ((rtskb = __rtskb_fifo_remove(&rx.fifo)))
             rt_stack_deliver(rtskb);
+
+        if (rt_flush_list != NULL)
+            rt_stack_flush();
     }
 }
 
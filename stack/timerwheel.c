@@ -0,0 +1,432 @@
+/***
+ *
+ *  stack/timerwheel.c - timerwheel implementation for RTnet
+ *
+ *  Copyright (C) 2009 Vladimir Zapolskiy <vladimir.zapolskiy@siemens.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License, version 2, as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <linux/bitops.h>
+#include <linux/delay.h>
+#include <linux/module.h>
+
+#include <rtnet_timerwheel.h>
+
+/*
+  The wheel consists of TIMERWHEEL_LEVELS levels with 64 slots each. Level 0
+  holds timers expiring within the next 64 ticks, one slot per tick, every
+  slot of level n covers 64^n ticks. When the wheel reaches the first tick
+  covered by a higher level slot, its timers are cascaded down.
+
+  The wheel is tickless: instead of advancing tick by tick, the pivot task
+  sleeps until the absolute time of the next tick requiring work - the
+  expiry of a level 0 slot or a cascade - and skips all ticks in between.
+  Without armed timers it does not wake up at all.
+*/
+
+#define WHEEL_SLOTS         (1 << TIMERWHEEL_LEVEL_BITS)
+#define WHEEL_SLOT_MASK     (WHEEL_SLOTS - 1)
+#define WHEEL_TICK          ((nanosecs_rel_t)1 << TIMERWHEEL_GRANULARITY)
+
+/* slot value of expired timers waiting for their handler */
+#define WHEEL_EXPIRED       (TIMERWHEEL_LEVELS * WHEEL_SLOTS)
+
+static struct {
+    /* timer pivot task */
+    rtdm_task_t pivot_task;
+
+    /* wakes up the pivot task at the next event */
+    rtdm_timer_t timer;
+    rtdm_event_t wakeup;
+
+    /* time of tick 0 */
+    nanosecs_abs_t epoch;
+
+    /* next tick to be processed */
+    u64 now;
+
+    /* tick the timer is programmed for, if programmed */
+    u64 next;
+    int programmed;
+
+    /* non-empty slots per level */
+    u64 pending[TIMERWHEEL_LEVELS];
+
+    /* timerwheel slots, level after level */
+    struct list_head vec[TIMERWHEEL_LEVELS * WHEEL_SLOTS];
+
+    /* expired timers, handlers run in batches */
+    struct list_head expired;
+
+    /* protects all of the above */
+    rtdm_lock_t lock;
+} wheel;
+
+static inline nanosecs_abs_t timerwheel_time(u64 tick)
+{
+    return wheel.epoch + (tick << TIMERWHEEL_GRANULARITY);
+}
+
+static inline u64 timerwheel_current_tick(void)
+{
+    return (rtdm_clock_read() - wheel.epoch) >> TIMERWHEEL_GRANULARITY;
+}
+
+static inline unsigned int timerwheel_ffs(u64 bits)
+{
+    if ((u32)bits)
+        return __ffs((u32)bits);
+    return 32 + __ffs((u32)(bits >> 32));
+}
+
+/* (locked) */
+static void timerwheel_enqueue(struct timerwheel_timer *timer)
+{
+    u64 delta = timer->expires - wheel.now;
+    unsigned int level;
+    unsigned int index;
+
+    for (level = 0; level < TIMERWHEEL_LEVELS - 1; level++)
+        if (delta < (1ULL << ((level + 1) * TIMERWHEEL_LEVEL_BITS)))
+            break;
+
+    index = (timer->expires >> (level * TIMERWHEEL_LEVEL_BITS)) &
+        WHEEL_SLOT_MASK;
+
+    timer->slot = level * WHEEL_SLOTS + index;
+    list_add_tail(&timer->link, &wheel.vec[timer->slot]);
+    wheel.pending[level] |= 1ULL << index;
+}
+
+/* (locked) */
+static void timerwheel_unlink(struct timerwheel_timer *timer)
+{
+    list_del(&timer->link);
+
+    if (timer->slot != WHEEL_EXPIRED &&
+        list_empty(&wheel.vec[timer->slot]))
+        wheel.pending[timer->slot / WHEEL_SLOTS] &=
+            ~(1ULL << (timer->slot & WHEEL_SLOT_MASK));
+
+    timer->slot = TIMERWHEEL_TIMER_UNUSED;
+}
+
+/***
+ *  timerwheel_next_event - find the next tick requiring work (locked)
+ *  @tick: receives the tick
+ *
+ *  Returns 0 if no timer is armed.
+ */
+static int timerwheel_next_event(u64 *tick)
+{
+    unsigned int level;
+    unsigned int shift;
+    unsigned int cur;
+    u64 unit;
+    u64 base;
+    u64 ahead;
+    u64 event;
+    int found = 0;
+
+    for (level = 0; level < TIMERWHEEL_LEVELS; level++) {
+        if (!wheel.pending[level])
+            continue;
+
+        shift = level * TIMERWHEEL_LEVEL_BITS;
+        unit  = 1ULL << shift;
+        cur   = (wheel.now >> shift) & WHEEL_SLOT_MASK;
+        base  = wheel.now & ~((unit << TIMERWHEEL_LEVEL_BITS) - 1);
+
+        /* slots still ahead in the current rotation, the current one only
+           if the wheel stands exactly at its beginning */
+        ahead = wheel.pending[level] & (~0ULL << cur);
+        if (wheel.now & (unit - 1))
+            ahead &= ~(1ULL << cur);
+
+        if (ahead)
+            event = base + ((u64)timerwheel_ffs(ahead) << shift);
+        else
+            event = base + (unit << TIMERWHEEL_LEVEL_BITS) +
+                ((u64)timerwheel_ffs(wheel.pending[level]) << shift);
+
+        if (!found || event < *tick)
+            *tick = event;
+        found = 1;
+    }
+
+    return found;
+}
+
+/***
+ *  timerwheel_program - set up the timer for the next event (locked)
+ *  @lazy: keep an earlier programming, the pivot task corrects it then
+ *
+ *  Returns non-zero if the event is already due and the pivot task has
+ *  to be woken up by the caller.
+ */
+static int timerwheel_program(int lazy)
+{
+    u64 tick;
+    int ret;
+
+    if (!timerwheel_next_event(&tick)) {
+        /* nothing to do, no need to wake up */
+        if (wheel.programmed && !lazy) {
+            rtdm_timer_stop(&wheel.timer);
+            wheel.programmed = 0;
+        }
+        return 0;
+    }
+
+    if (wheel.programmed && (tick == wheel.next ||
+                             (lazy && wheel.next < tick)))
+        return 0;
+
+    wheel.next = tick;
+    ret = rtdm_timer_start(&wheel.timer, timerwheel_time(tick), 0,
+                           RTDM_TIMERMODE_ABSOLUTE);
+    wheel.programmed = (ret == 0);
+
+    return ret == -ETIMEDOUT;
+}
+
+/* (locked) */
+static void timerwheel_cascade(unsigned int level, unsigned int index)
+{
+    struct timerwheel_timer *timer, *n;
+    LIST_HEAD(list);
+
+    list_splice_init(&wheel.vec[level * WHEEL_SLOTS + index], &list);
+    wheel.pending[level] &= ~(1ULL << index);
+
+    /* all of them expire within the next 64^level ticks */
+    list_for_each_entry_safe(timer, n, &list, link)
+        timerwheel_enqueue(timer);
+}
+
+/* (locked) */
+static void timerwheel_process_tick(void)
+{
+    struct timerwheel_timer *timer;
+    unsigned int index;
+    unsigned int level;
+
+    for (level = 1; level < TIMERWHEEL_LEVELS; level++) {
+        if (wheel.now & ((1ULL << (level * TIMERWHEEL_LEVEL_BITS)) - 1))
+            break;
+        index = (wheel.now >> (level * TIMERWHEEL_LEVEL_BITS)) &
+            WHEEL_SLOT_MASK;
+        if (wheel.pending[level] & (1ULL << index))
+            timerwheel_cascade(level, index);
+    }
+
+    index = wheel.now & WHEEL_SLOT_MASK;
+    if (!(wheel.pending[0] & (1ULL << index)))
+        return;
+
+    list_for_each_entry(timer, &wheel.vec[index], link)
+        timer->slot = WHEEL_EXPIRED;
+    list_splice_tail_init(&wheel.vec[index], &wheel.expired);
+    wheel.pending[0] &= ~(1ULL << index);
+}
+
+/***
+ *  timerwheel_advance - process all ticks up to the given one (locked)
+ */
+static void timerwheel_advance(u64 target)
+{
+    u64 tick;
+
+    while (timerwheel_next_event(&tick) && tick <= target) {
+        wheel.now = tick;
+        timerwheel_process_tick();
+        wheel.now = tick + 1;
+    }
+
+    if (wheel.now <= target)
+        wheel.now = target + 1;
+
+    /* the timer fired or is about to fire */
+    if (wheel.programmed && wheel.next < wheel.now)
+        wheel.programmed = 0;
+}
+
+static struct timerwheel_timer *timerwheel_get_expired(void)
+{
+    struct timerwheel_timer *timer = NULL;
+    rtdm_lockctx_t context;
+
+    rtdm_lock_get_irqsave(&wheel.lock, context);
+
+    if (!list_empty(&wheel.expired)) {
+        timer = list_first_entry(&wheel.expired, struct timerwheel_timer,
+                                 link);
+        list_del(&timer->link);
+        timer->slot = TIMERWHEEL_TIMER_UNUSED;
+        timer->refcount++;
+    }
+
+    rtdm_lock_put_irqrestore(&wheel.lock, context);
+
+    return timer;
+}
+
+int timerwheel_add_timer(struct timerwheel_timer *timer,
+                         nanosecs_rel_t expires)
+{
+    rtdm_lockctx_t context;
+    u64 tick;
+    int due;
+
+    if (expires < 0)
+        expires = 0;
+
+    /* first tick at or after the expiry date */
+    tick = (rtdm_clock_read() - wheel.epoch + expires + WHEEL_TICK - 1) >>
+        TIMERWHEEL_GRANULARITY;
+
+    rtdm_lock_get_irqsave(&wheel.lock, context);
+
+    /* the wheel may lag behind the clock, but never runs ahead */
+    if (tick < wheel.now)
+        tick = wheel.now;
+
+    if (tick - wheel.now >= TIMERWHEEL_HORIZON) {
+        rtdm_lock_put_irqrestore(&wheel.lock, context);
+        return -EINVAL;
+    }
+
+    /* cancel timer if it's still running */
+    if (timer->slot >= 0)
+        timerwheel_unlink(timer);
+
+    timer->expires = tick;
+    timerwheel_enqueue(timer);
+
+    due = timerwheel_program(1);
+
+    rtdm_lock_put_irqrestore(&wheel.lock, context);
+
+    if (due)
+        rtdm_event_signal(&wheel.wakeup);
+
+    return 0;
+}
+
+static void timerwheel_timer_handler(rtdm_timer_t *timer)
+{
+    rtdm_event_signal(&wheel.wakeup);
+}
+
+static void timerwheel_pivot(void *arg)
+{
+    struct timerwheel_timer *timer;
+    rtdm_lockctx_t context;
+
+    while (rtdm_event_wait(&wheel.wakeup) == 0) {
+        rtdm_lock_get_irqsave(&wheel.lock, context);
+
+        /* repeat if the next event passed meanwhile */
+        do
+            timerwheel_advance(timerwheel_current_tick());
+        while (timerwheel_program(0));
+
+        rtdm_lock_put_irqrestore(&wheel.lock, context);
+
+        while ((timer = timerwheel_get_expired())) {
+            timer->handler(timer->data);
+
+            smp_mb();
+            timer->refcount--;
+        }
+    }
+}
+
+int timerwheel_remove_timer(struct timerwheel_timer *timer)
+{
+    rtdm_lockctx_t context;
+    int ret;
+
+    rtdm_lock_get_irqsave(&wheel.lock, context);
+
+    /* the timer is left programmed, a needless wakeup corrects it */
+    if (timer->slot >= 0) {
+        timerwheel_unlink(timer);
+        ret = 0;
+    } else
+        ret = -ENOENT;
+
+    rtdm_lock_put_irqrestore(&wheel.lock, context);
+
+    return ret;
+}
+
+void timerwheel_remove_timer_sync(struct timerwheel_timer *timer)
+{
+    u64 interval_ms = WHEEL_TICK;
+
+    do_div(interval_ms, 1000000);
+
+    timerwheel_remove_timer(timer);
+
+    while (timer->refcount > 0)
+        msleep(interval_ms);
+}
+
+int __init timerwheel_init(void)
+{
+    int i;
+    int err;
+
+    for (i = 0; i < ARRAY_SIZE(wheel.vec); i++)
+        INIT_LIST_HEAD(&wheel.vec[i]);
+    INIT_LIST_HEAD(&wheel.expired);
+
+    rtdm_lock_init(&wheel.lock);
+    rtdm_event_init(&wheel.wakeup, 0);
+
+    wheel.epoch      = rtdm_clock_read();
+    wheel.now        = 0;
+    wheel.programmed = 0;
+
+    err = rtdm_timer_init(&wheel.timer, timerwheel_timer_handler,
+                          "rtnet-timerwheel");
+    if (err) {
+        rtdm_event_destroy(&wheel.wakeup);
+        return err;
+    }
+
+    err = rtdm_task_init(&wheel.pivot_task, "rtnet-timerwheel",
+                         timerwheel_pivot, NULL, 1, 0);
+    if (err) {
+        printk("timerwheel: error on pivot task initialization: %d\n", err);
+        rtdm_timer_destroy(&wheel.timer);
+        rtdm_event_destroy(&wheel.wakeup);
+    }
+
+    return err;
+}
+
+void timerwheel_cleanup(void)
+{
+    rtdm_timer_destroy(&wheel.timer);
+    rtdm_event_destroy(&wheel.wakeup);
+    rtdm_task_join_nrt(&wheel.pivot_task, 100);
+}
+
+EXPORT_SYMBOL(timerwheel_add_timer);
+EXPORT_SYMBOL(timerwheel_remove_timer);
+EXPORT_SYMBOL(timerwheel_remove_timer_sync);
@@ -166,7 +166,7 @@ void help(void)
     fprintf(stderr, "Usage:\n"
         "\trtifconfig [-a] [<dev>]\n"
         "\trtifconfig <dev> up [<addr> [netmask <mask>]] "
-            "[hw <HW> <address>] [[-]promisc]\n"
+            "[hw <HW> <address>] [[-]promisc] [[-]nocsum]\n"
         "\trtifconfig <dev> down\n"
         );
 
@@ -216,13 +216,15 @@ void print_dev(void)
     }
 
     flags = cmd.args.info.flags &
-        (IFF_UP | IFF_BROADCAST | IFF_LOOPBACK | IFF_RUNNING | IFF_PROMISC);
-    printf("          %s%s%s%s%s%s MTU: %d\n",
+        (IFF_UP | IFF_BROADCAST | IFF_LOOPBACK | IFF_RUNNING | IFF_PROMISC |
+         IFF_RT_NOCSUM);
+    printf("          %s%s%s%s%s%s%s MTU: %d\n",
            ((flags & IFF_UP) != 0) ? "UP " : "",
            ((flags & IFF_BROADCAST) != 0) ? "BROADCAST " : "",
            ((flags & IFF_LOOPBACK) != 0) ? "LOOPBACK " : "",
            ((flags & IFF_RUNNING) != 0) ? "RUNNING " : "",
            ((flags & IFF_PROMISC) != 0) ? "PROMISC " : "",
+           ((flags & IFF_RT_NOCSUM) != 0) ? "NOCSUM " : "",
            (flags == 0) ? "[NO FLAGS] " : "", cmd.args.info.mtu);
 
     if ((itf = find_stats(cmd.head.if_name))) {
@@ -369,6 +371,12 @@ void do_up(int argc, char *argv[])
         } else if (strcmp(argv[i], "-promisc") == 0) {
             cmd.args.up.set_dev_flags   &= ~IFF_PROMISC;
             cmd.args.up.clear_dev_flags |= IFF_PROMISC;
+        } else if (strcmp(argv[i], "nocsum") == 0) {
+            cmd.args.up.set_dev_flags   |= IFF_RT_NOCSUM;
+            cmd.args.up.clear_dev_flags &= ~IFF_RT_NOCSUM;
+        } else if (strcmp(argv[i], "-nocsum") == 0) {
+            cmd.args.up.set_dev_flags   &= ~IFF_RT_NOCSUM;
+            cmd.args.up.clear_dev_flags |= IFF_RT_NOCSUM;
         } else
             help();
     }
@@ -49,7 +49,7 @@ void help(void)
 {
     fprintf(stderr, "Usage:\n"
         "\trtroute\n"
-        "\trtroute solicit <addr> dev <dev>\n"
+        "\trtroute solicit <addr> [<addr> ...] dev <dev>\n"
         "\trtroute add <addr> <hwaddr> dev <dev>\n"
         "\trtroute add <addr> netmask <mask> gw <gw-addr>\n"
         "\trtroute del <addr> [dev <dev>]\n"
@@ -105,16 +105,43 @@ void print_routes(void)
 
 void route_solicit(int argc, char *argv[])
 {
-    int ret;
+    __u32   *ip_addrs;
+    int     count = argc - 4;
+    int     i;
+    int     ret;
 
 
-    if ((argc != 5) || (strcmp(argv[3], "dev") != 0))
+    if ((argc < 5) || (strcmp(argv[argc - 2], "dev") != 0))
         help();
 
-    strncpy(cmd.head.if_name, argv[4], IFNAMSIZ);
-    cmd.args.solicit.ip_addr = addr.s_addr;
+    strncpy(cmd.head.if_name, argv[argc - 1], IFNAMSIZ);
+
+    if (count == 1) {
+        cmd.args.solicit.ip_addr = addr.s_addr;
+
+        ret = ioctl(f, IOC_RT_HOST_ROUTE_SOLICIT, &cmd);
+    } else {
+        /*** solicit all addresses in one batch ***/
+        ip_addrs = malloc(count * sizeof(__u32));
+        if (ip_addrs == NULL) {
+            perror("malloc");
+            exit(1);
+        }
+
+        ip_addrs[0] = addr.s_addr;
+        for (i = 1; i < count; i++) {
+            if (!inet_aton(argv[2 + i], &addr))
+                help();
+            ip_addrs[i] = addr.s_addr;
+        }
+
+        cmd.args.solicit_list.count    = count;
+        cmd.args.solicit_list.ip_addrs = (unsigned long)ip_addrs;
+
+        ret = ioctl(f, IOC_RT_HOST_ROUTE_SOLICIT_LIST, &cmd);
+        free(ip_addrs);
+    }
 
-    ret = ioctl(f, IOC_RT_HOST_ROUTE_SOLICIT, &cmd);
     if (ret < 0) {
         perror("ioctl");
         exit(1);